@@ -27,27 +27,23 @@
 #ifndef INCLUDED_balloc_h
 #define INCLUDED_balloc_h
 
+struct BlockHeap;
+
 /* 
- * Block contains status information for an allocated block in our
- * heap.
+ * Block is the header at the front of each slab of elements, which is
+ * aligned to the slab size so an element can find it.
  */
 struct Block
 {
-	size_t alloc_size;
-	struct Block *next;	/* Next in our chain of blocks */
-	void *elems;		/* Points to allocated memory */
-	dlink_list free_list;
-	dlink_list used_list;
+	struct BlockHeap *heap;
+	struct Block *next;	/* in the heaps avail list */
+	struct Block *prev;
+	void *free_list;	/* free elements, chained through their first word */
+	unsigned long freeCount;
+	void *raw;		/* what to hand back to the OS */
 };
 typedef struct Block Block;
 
-struct MemBlock
-{
-	dlink_node self;
-	Block *block;		/* Which block we belong to */
-};
-typedef struct MemBlock MemBlock;
-
 /* 
  * BlockHeap contains the information for the root node of the
  * memory heap.
@@ -57,10 +53,12 @@ struct BlockHeap
 	char *name;
 	dlink_node hlist;
 	size_t elemSize;	/* Size of each element to be stored */
+	size_t blockSize;	/* Size of each slab, a power of two */
 	unsigned long elemsPerBlock;	/* Number of elements per block */
 	unsigned long blocksAllocated;	/* Number of blocks allocated */
 	unsigned long freeElems;		/* Number of free elements */
-	Block *base;		/* Pointer to first block */
+	unsigned long highWater;	/* Most elements in use at once */
+	Block *avail;		/* slabs with free elements */
 };
 typedef struct BlockHeap BlockHeap;
 
@@ -75,5 +73,7 @@ extern BlockHeap *BlockHeapCreate(const char *name, size_t elemsize, int elemspe
 extern int BlockHeapDestroy(BlockHeap * bh);
 
 extern void BlockHeapUsage(BlockHeap * bh, size_t * bused, size_t * bfree, size_t * bmemusage, size_t *bfreemem);
+extern void BlockHeapStats(BlockHeap * bh, unsigned long *slabs, unsigned long *highwater,
+				unsigned int *fragmentation);
 
 #endif /* INCLUDED_blalloc_h */
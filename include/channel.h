@@ -7,7 +7,12 @@
 
 #define MAX_MODES	10
 
-#define MAX_CHANNEL_TABLE	16384
+#define CHANNEL_HASH_MIN	1024
+
+/* channels with at least this many users get a hash of their members,
+ * which is dropped again once they fall under half of it
+ */
+#define CHMEMBER_HASH_MIN	64
 
 extern dlink_list channel_list;
 
@@ -40,8 +45,11 @@ struct channel
 
 	struct chmode mode;
 
+	struct chmember **members;	/* open addressed on client, or NULL */
+	unsigned int members_size;	/* slots, a power of two */
+
 	dlink_node listptr;		/* node in channel_list */
-	dlink_node nameptr;		/* node in channel hash */
+	dlink_node splitptr;		/* node in a netsplits channels */
 };
 
 struct chmember
@@ -74,8 +82,6 @@ struct chmember
 
 extern void init_channel(void);
 
-unsigned int hash_channel(const char *p);
-
 int valid_chname(const char *name);
 
 extern void add_channel(struct channel *chptr);
@@ -91,12 +97,15 @@ extern const char *chmode_to_string_simple(struct chmode *mode);
 
 extern struct chmember *add_chmember(struct channel *chptr, struct client *target_p, int flags);
 extern void del_chmember(struct chmember *mptr);
+extern void del_chmember_split(struct chmember *mptr, dlink_list *channels);
+extern void finish_chmember_split(dlink_list *channels);
 extern struct chmember *find_chmember(struct channel *chptr, struct client *target_p);
 #define is_member(chptr, target_p) ((find_chmember(chptr, target_p)) ? 1 : 0)
 
 int find_exempt(struct channel *chptr, struct client *target_p);
 
 extern unsigned long count_topics(void);
+extern void count_chmember_hashes(size_t *count, size_t *sz_mem);
 
 extern void join_service(struct client *service_p, const char *chname,
 			time_t tsinfo, struct chmode *mode, int override);
@@ -8,8 +8,17 @@
 #define USERHOSTLEN (USERLEN + HOSTLEN + 1)
 #define NICKUSERHOSTLEN	(NICKLEN + USERLEN + HOSTLEN + 2)
 
-#define MAX_NAME_HASH 65536
-#define MAX_HOST_HASH 65536
+/* smallest sizes of the name and host tables, see htable.h */
+#define NAME_HASH_MIN 1024
+#define HOST_HASH_MIN 1024
+
+/* TS6 ids are looked up directly: the SID picks one of UID_SID_MAX
+ * servers, and the rest of a UID, read as base 36, indexes that servers
+ * users in pages of UID_PAGE_SIZE.  Anything else with an id goes in a
+ * hash.
+ */
+#define UID_SID_MAX	(10 * 36 * 36)
+#define UID_PAGE_SIZE	1024
 
 extern dlink_list user_list;
 extern dlink_list oper_list;
@@ -33,8 +42,6 @@ struct client
 	struct service *service;
 	struct client *uplink;		/* server this is connected to */
 
-	dlink_node nameptr;		/* dlink_node in name_table */
-	dlink_node uidptr;
 	dlink_node listnode;		/* in client/server/exited_list */
 	dlink_node upnode;		/* in uplinks servers/clients list */
 };
@@ -53,12 +60,18 @@ struct user
 	unsigned int flood_count;
 	time_t flood_time;
 
+	unsigned int ignore_serial;	/* ignore list serial ignored is for */
+	int ignored;
+
 	struct user_reg *user_reg;
 	struct conf_oper *oper;
 	int watchflags;
 
 	dlink_list channels;
 
+	dlink_node regptr;		/* node in user_reg->users */
+	dlink_node operptr;		/* node in oper_list */
+
 	dlink_node servptr;
 	dlink_node hostptr;
 	dlink_node uhostptr;
@@ -123,7 +136,6 @@ struct host_entry
 	time_t cregister_expire;
 	int uregister;
 	time_t uregister_expire;
-	dlink_node node;
 };
 
 #define UID(x) (EmptyString((x)->uid) ? (x)->name : (x)->uid)
@@ -183,8 +195,6 @@ struct host_entry
 
 extern void init_client(void);
 
-unsigned int hash_name(const char *p);
-
 char *generate_uid(void);
 
 extern void add_client(struct client *target_p);
@@ -193,6 +203,7 @@ extern struct client *find_client(const char *name);
 extern struct client *find_named_client(const char *name);
 extern struct client *find_user(const char *name, int search_uid);
 extern struct client *find_uid(const char *name);
+extern void count_uid_pages(size_t *count, size_t *sz_mem);
 extern struct client *find_server(const char *name);
 extern struct client *find_service(const char *name);
 struct host_entry *find_host(const char *name);
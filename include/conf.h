@@ -26,6 +26,10 @@ struct _config_file
 
 	int reconnect_time;
 	int ping_time;
+	int cork_size;
+	int crypt_threads;
+	int crypt_scheme;
+	int crypt_rounds;
 	int ratbox;
 	int allow_stats_o;
 	int allow_sslonly;
@@ -44,6 +48,7 @@ struct _config_file
 	char *db_name;
 	char *db_username;
 	char *db_password;
+	int db_async_writes;
 
 	int disable_email;
 	char *email_program[MAX_EMAIL_PROGRAM_ARGS+1];
@@ -10,6 +10,8 @@
 #define LOG_PATH	LOGDIR "/ratbox-services.log"
 #define HELP_PATH       HELPDIR
 #define DB_PATH		SYSCONFDIR "/ratbox-services.db"
+#define USER_SNAPSHOT_PATH	SYSCONFDIR "/ratbox-services.users.snap"
+#define CHAN_SNAPSHOT_PATH	SYSCONFDIR "/ratbox-services.channels.snap"
 
 /* SMALL_NETWORK
  * If your network is fairly small, enable this to save some memory.
@@ -52,6 +54,7 @@
 #define HEAP_MEMBER_REG	256
 #define HEAP_BAN_REG	512
 #define HEAP_NICK_REG	256
+#define HEAP_SENDQ	8
 
 #endif
 /* $Id: config.h 27023 2010-04-22 18:27:28Z leeh $ */
@@ -2,7 +2,10 @@
 #ifndef INCLUDED_event_h
 #define INCLUDED_event_h
 
-#define	MAX_EVENTS	50
+#define MAX_TASKS	16
+
+/* how long a task may run before the io loop gets a turn */
+#define TASK_SLICE_MSEC	20
 
 struct lconn;
 
@@ -17,20 +20,42 @@ struct ev_entry
 
 	/* frequency == -1 means disabled event */
 	/* frequency == 0 means 'oneshot' event */
-	time_t frequency;
-	time_t when;
+	long frequency;			/* milliseconds */
+	struct timeval when;
+
+	int index;			/* in the event heap, -1 if not */
+	dlink_node node;
+};
+
+/* a task does a long job, such as walking every registration, a slice
+ * at a time.  It should check eventTaskYield() as it goes, and return
+ * non-zero if it stopped before finishing.
+ */
+typedef int ETH(void *);
+
+struct ev_task
+{
+	ETH *func;
+	void *arg;
+	const char *name;
 	int active;
 };
 
 extern void eventAdd(const char *name, EVH * func, void *arg, time_t when);
 extern void eventAddOnce(const char *name, EVH * func, void *arg, time_t when);
+extern void eventAddOnceMsec(const char *name, EVH * func, void *arg, long msec);
 extern void eventRun(void);
-extern time_t eventNextTime(void);
+extern long eventNextTimeout(void);
 extern void init_events(void);
 extern void eventDelete(EVH * func, void *);
-extern int eventFind(EVH * func, void *);
+extern struct ev_entry *eventFind(EVH * func, void *);
 void eventUpdate(const char *name, time_t when);
 
+extern void eventTaskAdd(const char *name, ETH * func, void *arg);
+extern void eventTaskRun(void);
+extern int eventTaskPending(void);
+extern int eventTaskYield(void);
+
 extern void event_show(struct lconn *conn_p);
 
 #endif /* INCLUDED_event_h */
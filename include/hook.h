@@ -17,18 +17,32 @@
 #define HOOK_NICKCHANGE		10	/* client changing nick */
 #define HOOK_SERVER_EOB		11	/* specific server sent EOB */
 #define HOOK_DBSYNC		12
-#define HOOK_NEW_CLIENT_BURST	13	/* new client during burst */
+#define HOOK_NEW_CLIENT_BURST	13	/* new client during burst, batched */
 #define HOOK_DCC_AUTH		14	/* dcc client auths */
 #define HOOK_DCC_EXIT		15	/* dcc client exits */
-#define HOOK_USER_EXIT		16	/* user exits the network */
-#define HOOK_SERVER_EXIT	17	/* server exits the network */
+#define HOOK_USER_EXIT		16	/* user exits the network, but not
+					 * in a netsplit
+					 */
+#define HOOK_SERVER_EXIT	17	/* server exits the network, once per
+					 * split, with a dlink_list of every
+					 * user lost in it
+					 */
 #define HOOK_MODE_BAN		18	/* mode +b done by a user only */
 #define HOOK_CHANNEL_TOPIC	19	/* TOPIC/TB on a channel */
-#define HOOK_LAST_HOOK		20
+#define HOOK_DBSNAPSHOT		20	/* write registry snapshots */
+#define HOOK_LAST_HOOK		21
+
+/* most clients a batch hook is handed at once */
+#define HOOK_BATCH_SIZE		512
 
 typedef int (*hook_func)(void *, void *);
+typedef void (*hook_batch_func)(void **, int);
 
 extern void hook_add(hook_func func, int hook);
 extern int hook_call(int hook, void *arg, void *arg2);
 
+extern void hook_add_batch(hook_batch_func func, int hook);
+extern int hook_call_batch(int hook, void *arg);
+extern void hook_flush_batches(void);
+
 #endif
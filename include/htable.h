@@ -0,0 +1,74 @@
+/* $Id$ */
+#ifndef INCLUDED_htable_h
+#define INCLUDED_htable_h
+
+/* An htable is an open addressed hash of objects keyed on a name held in
+ * the object, found through the tables key function.  Names are hashed
+ * case folded, and every slot caches its entries hash, so a probe only
+ * compares names when the full hash matches.
+ *
+ * Deleted entries leave a tombstone rather than moving anything, and
+ * tables are only ever resized when adding -- so a walk may delete the
+ * entry its on (or any other), but a walk that adds entries, or a slice
+ * walk paused while others do, may miss or revisit some.
+ */
+
+struct htable_slot
+{
+	unsigned int hashv;
+	void *data;
+};
+
+struct htable
+{
+	const char *name;
+	const char *(*key)(void *);
+	int (*cmp)(const char *, const char *);
+
+	struct htable_slot *slots;
+	unsigned int size;		/* slots, a power of two */
+	unsigned int count;		/* live entries */
+	unsigned int used;		/* live entries and tombstones */
+	unsigned int min_size;
+
+	dlink_node node;		/* in htable_list */
+};
+
+extern dlink_list htable_list;
+extern char htable_tombstone;
+
+#define HTABLE_DELETED		((void *) &htable_tombstone)
+#define HTABLE_LIVE(slot)	((slot)->data != NULL && (slot)->data != HTABLE_DELETED)
+
+/* how many slots a slice walk covers between checks of its time slice */
+#define HTABLE_SLICE_CHECK	64
+
+#define HTABLE_WALK(i, ptr, table) for (i = 0; i < (table)->size; i++) { \
+		if(!HTABLE_LIVE(&(table)->slots[i])) continue; \
+		ptr = (table)->slots[i].data;
+#define HTABLE_WALK_END }
+
+/* walks a table from inside an event task, stopping once eventTaskYield()
+ * says so.  start is left at the next slot to walk, which is the tables
+ * size once the whole table has been walked.
+ */
+#define HTABLE_WALK_SLICE(start, ptr, table) for (; (start) < (table)->size && \
+		(((start) & (HTABLE_SLICE_CHECK - 1)) || !eventTaskYield()); (start)++) { \
+		if(!HTABLE_LIVE(&(table)->slots[start])) continue; \
+		ptr = (table)->slots[start].data;
+#define HTABLE_WALK_SLICE_END }
+
+#define htable_count(table)	((table)->count)
+
+extern unsigned int htable_hash(const char *name);
+
+extern void htable_init(struct htable *table, const char *name, unsigned int min_size,
+			const char *(*key)(void *), int (*cmp)(const char *, const char *));
+extern void htable_add(struct htable *table, void *data);
+extern void htable_del(struct htable *table, void *data);
+extern void *htable_find(struct htable *table, const char *name);
+
+extern void htable_usage(struct htable *table, size_t *count, size_t *size,
+			size_t *sz_mem);
+
+#endif
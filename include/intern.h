@@ -0,0 +1,18 @@
+/* $Id$ */
+#ifndef INCLUDED_intern_h
+#define INCLUDED_intern_h
+
+/* Interned strings are shared, refcounted copies of strings that tend to
+ * be repeated across the registries -- who last modified an access
+ * entry, who set a ban or suspension and why.  They must never be
+ * modified, and are released rather than freed.
+ */
+
+extern const char *intern_string(const char *str);
+extern const char *intern_stringn(const char *str, size_t len);
+extern void intern_release(const char *str);
+
+extern void intern_countmem(size_t *count, size_t *refs, size_t *sz_used,
+				size_t *sz_arena, size_t *sz_saved);
+
+#endif
@@ -5,11 +5,19 @@
 struct client;
 struct conf_oper;
 
-struct send_queue
+#define READBUF_SIZE	16384
+
+#define SENDQ_CHUNK_SIZE	16384
+
+/* sendqs are built from a list of these, lines are appended to the
+ * tail chunk and may span more than one.
+ */
+struct sendq_chunk
 {
-	const char *buf;
-	int len;
-	int pos;
+	dlink_node node;
+	int pos;			/* start of unsent data */
+	int len;			/* end of data */
+	char buf[SENDQ_CHUNK_SIZE];
 };
 
 struct lconn
@@ -33,10 +41,20 @@ struct lconn
 	int (*io_write)(struct lconn *);
 	void (*io_close)(struct lconn *);
 
-	char recvbuf[BUFSIZE+1];
-	size_t recvbuf_offset;
+	int io_flags;			/* events registered with io backend */
+
+	char recvbuf[READBUF_SIZE];
+	size_t recvbuf_len;		/* amount of data in recvbuf */
+	size_t recvbuf_pos;		/* start of unparsed data */
+
+	unsigned long recv_count;	/* number of read()s */
+	unsigned long recv_lines;	/* number of lines parsed */
+
+	unsigned long cork_lines;	/* lines buffered whilst corked */
+	unsigned long cork_flushes;	/* flushes of those lines */
 
-	dlink_list sendq;
+	dlink_list sendq;		/* list of struct sendq_chunk */
+	unsigned long sendq_len;	/* bytes in sendq */
 };
 
 extern struct lconn *server_p;
@@ -84,6 +102,7 @@ extern dlink_list connection_list;
 #define CONN_FLAGS_UNTERMINATED	0x01000
 #define CONN_FLAGS_EOB		0x02000
 #define CONN_FLAGS_SENTBURST	0x04000
+#define CONN_FLAGS_CORKED	0x08000
 /* CONTINUES ... */
 
 #define SetConnSentBurst(x)	((x)->flags |= CONN_FLAGS_SENTBURST)
@@ -103,6 +122,7 @@ extern dlink_list connection_list;
 #define ClearUserChat(x)	((x)->flags &= ~CONN_FLAGS_CHAT)
 
 extern void read_io(void);
+extern void io_loop(int block);
 
 extern void connect_to_server(void *unused);
 extern void connect_to_client(struct client *client_p, struct conf_oper *oper_p,
@@ -119,7 +139,39 @@ extern int sock_create(int);
 extern int sock_open(const char *host, int port, const char *vhost, int type);
 extern void sock_close(struct lconn *conn_p);
 extern int sock_write(struct lconn *conn_p, const char *buf, size_t len);
+extern void flush_server(void);
 
 extern unsigned long get_sendq(struct lconn *conn_p);
 
+/* io backends, io_epoll.c and io_select.c */
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE)
+#define USE_EPOLL
+#endif
+
+#define IO_READ		0x0001
+#define IO_WRITE	0x0002
+
+struct io_backend
+{
+	const char *name;
+	int (*init)(void);
+	int (*update)(struct lconn *, int flags);	/* 0 flags == delete */
+	int (*wait)(long timeout);			/* milliseconds */
+};
+
+extern struct io_backend io_select_backend;
+#ifdef USE_EPOLL
+extern struct io_backend io_epoll_backend;
+#endif
+
+extern struct io_backend *io_backend;
+
+extern void init_io(void);
+extern void io_dispatch(struct lconn *conn_p, int flags);
+
+#ifdef RSERV_BENCH
+extern void bench_connect_server(const char *name, const char *pass, int fd);
+extern void bench_parse_server(char *buf, int len);
+#endif
+
 #endif
@@ -19,6 +19,14 @@ struct rsdb_table
 	void *arg;
 };
 
+struct rsdb_cursor
+{
+	int col_count;
+	unsigned int row_count;	/* rows stepped through so far */
+	void *arg;
+	void *row;
+};
+
 void rsdb_init(void);
 void rsdb_shutdown(void);
 
@@ -32,6 +40,23 @@ void rsdb_exec_insert(unsigned int *insert_id, const char *table_name,
 void rsdb_exec_fetch(struct rsdb_table *data, const char *format, ...);
 void rsdb_exec_fetch_end(struct rsdb_table *data);
 
+void rsdb_cursor_open(struct rsdb_cursor *cursor, const char *format, ...);
+int rsdb_cursor_step(struct rsdb_cursor *cursor);
+const char *rsdb_cursor_column(struct rsdb_cursor *cursor, int col);
+void rsdb_cursor_close(struct rsdb_cursor *cursor);
+
+/* parameter types for rsdb_exec_prepared(), one character per '?':
+ *   'd' - int
+ *   'u' - unsigned long (timestamps)
+ *   's' - const char *, NULL binds an SQL NULL
+ */
+void rsdb_exec_prepared(rsdb_callback cb, const char *sql, const char *types, ...);
+
 void rsdb_transaction(rsdb_transtype type);
 
+void rsdb_sync(void);
+
+/* returns 0 if the backend can't tell whether it has been written to */
+int rsdb_change_counter(unsigned long *counter);
+
 #endif
@@ -8,6 +8,7 @@
 #define MAX_DATE_STRING	32
 
 #define PASSWDLEN	35
+#define CRYPTLEN	128	/* stored password hashes */
 #define EMAILLEN	100
 #define OPERNAMELEN	30
 #define URLLEN		100
@@ -21,13 +22,30 @@ extern struct timeval system_time;
 #define CURRENT_TIME system_time.tv_sec
 
 extern void set_time(void);
+extern void init_main(void);
 
 extern void PRINTFLIKE(2, 3) die(int graceful, const char *format, ...);
 
-extern int have_md5_crypt;
+struct client;
+
+/* crypt.c */
+#define CRYPT_DES	0
+#define CRYPT_MD5	1
+#define CRYPT_SHA256	2
+#define CRYPT_SHA512	3
+
+typedef void (*crypt_callback)(struct client *, const char *result, void *arg);
 
 void init_crypt_seed(void);
+void init_crypt_schemes(void);
+int crypt_supported(int scheme);
+void init_crypt_pool(void);
 const char *get_crypt(const char *password, const char *csalt);
+void crypt_async(struct client *, const char *password, const char *salt,
+		crypt_callback, void *arg);
+void crypt_cancel(struct client *);
+void crypt_cancel_dead(void);
+int crypt_pending_count(void);
 const char *get_password(void);
 
 char *rebuild_params(const char **, int, int);
@@ -35,12 +53,13 @@ char *rebuild_params(const char **, int, int);
 int valid_servername(const char *);
 int valid_sid(const char *);
 
-struct client;
 void count_memory(struct client *);
 
 /* cidr.c */
 int match_ips(const char *s1, const char *s2);
 int match_cidr(const char *s1, const char *s2);
+int parse_ip(const char *ip, unsigned char *addr);
+int parse_cidr(const char *mask, unsigned char *addr, int *bits);
 
 /* snprintf.c */
 int rs_snprintf(char *, const size_t, const char *, ...);
@@ -21,6 +21,14 @@ struct regexp_ban
 	struct regexp_ban *parent;
 
 	pcre *regexp;
+	pcre_extra *regexp_extra;
+
+	char *literal;			/* text any match must contain */
+	int literal_node;		/* where the literal ends in the prefilter */
 };
 
+#ifdef RSERV_BENCH
+extern const char *bench_regexp_literal(void);
+#endif
+
 #endif
@@ -31,13 +31,15 @@ struct chmode;
 /* used to validate flags on db load.. */
 #define CS_MEMBER_ALL		(CS_MEMBER_AUTOOP|CS_MEMBER_AUTOVOICE)
 
+struct ban_index;
+
 struct chan_reg
 {
 	char *name;
 	char *topic;
 	char *url;
-	char *suspender;
-	char *suspend_reason;
+	const char *suspender;		/* interned */
+	const char *suspend_reason;	/* interned */
 	time_t suspend_time;
 	struct chmode cmode;
 	struct chmode emode;
@@ -49,36 +51,40 @@ struct chan_reg
 	time_t last_time;
 	unsigned long bants;
 
-	dlink_node node;
+	dlink_node update_node;		/* chan_reg_update_list, when NEEDUPDATE */
 
-	dlink_list users;
+	struct member_list users;
 	dlink_list bans;
+
+	struct ban_index *ban_index;	/* built on demand from bans */
 };
 
 struct member_reg
 {
 	struct user_reg *user_reg;
 	struct chan_reg *channel_reg;
+	struct member_reg *hnext;	/* member_reg_table chain */
+
+	const char *lastmod;		/* last user to modify this membership, interned */
+	unsigned long bants;
 
 	int level;
 	int flags;
 	int suspend;
-	unsigned long bants;
-
-	char *lastmod;			/* last user to modify this membership */
 
-	dlink_node usernode;
-	dlink_node channode;
+	unsigned int userpos;		/* index in user_reg->channels */
+	unsigned int chanpos;		/* index in chan_reg->users */
 };
 
 struct ban_reg
 {
-	char *mask;
-	char *reason;
-	char *username;
+	const char *mask;		/* interned, as are reason and username */
+	const char *reason;
+	const char *username;
 	int level;
 	time_t hold;
 	int marked;
+	int position;		/* in chan_reg bans, set by the ban index */
 
 	dlink_node channode;
 };
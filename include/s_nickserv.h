@@ -2,7 +2,7 @@
 #ifndef INCLUDED_nickserv_h
 #define INCLUDED_nickserv_h
 
-#define MAX_NICK_REG_HASH	65536
+#define NICK_REG_HASH_MIN	1024
 
 struct client;
 struct user_reg;
@@ -14,7 +14,6 @@ struct nick_reg
 	time_t reg_time;
 	time_t last_time;
 	int flags;
-	dlink_node node;
 	dlink_node usernode;
 };
 
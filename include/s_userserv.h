@@ -2,9 +2,18 @@
 #ifndef INCLUDED_s_userserv_h
 #define INCLUDED_s_userserv_h
 
-#define MAX_USER_REG_HASH	65536
+#define USER_REG_HASH_MIN	1024
 
 struct client;
+struct member_reg;
+
+/* access list entries for a user or channel, see s_chanserv.c */
+struct member_list
+{
+	struct member_reg **entry;
+	unsigned int count;
+	unsigned int size;
+};
 
 struct user_reg
 {
@@ -12,9 +21,9 @@ struct user_reg
 
 	char name[USERREGNAME_LEN+1];
 	char *password;
-	char *email;
-	char *suspender;
-	char *suspend_reason;
+	const char *email;		/* interned */
+	const char *suspender;		/* interned */
+	const char *suspend_reason;	/* interned */
 	time_t suspend_time;
 
 	time_t reg_time;
@@ -24,8 +33,8 @@ struct user_reg
 
 	unsigned int language;
 
-	dlink_node node;
-	dlink_list channels;
+	dlink_node update_node;		/* user_reg_update_list, when NEEDUPDATE */
+	struct member_list channels;
 	dlink_list users;
 	dlink_list nicks;
 };
@@ -45,6 +54,8 @@ struct user_reg
 extern struct user_reg *find_user_reg(struct client *, const char *name);
 extern struct user_reg *find_user_reg_nick(struct client *, const char *name);
 
+extern void mark_user_reg_update(struct user_reg *);
+
 void s_userserv_countmem(size_t *, size_t *, size_t *, size_t *);
 
 #endif
@@ -2,7 +2,9 @@
 #ifndef INCLUDED_scommand_h
 #define INCLUDED_scommand_h
 
-#define MAX_SCOMMAND_HASH 100
+/* must be a power of two */
+#define MAX_SCOMMAND_HASH 256
+#define MAX_SCOMMAND_HOOKS 4
 
 struct client;
 
@@ -13,7 +15,8 @@ struct scommand_handler
 	const char *cmd;
 	scommand_func func;
 	int flags;
-	dlink_list hooks;
+	int hook_count;
+	scommand_func hooks[MAX_SCOMMAND_HOOKS];
 };
 
 #define FLAGS_UNKNOWN	0x0001
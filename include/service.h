@@ -7,6 +7,8 @@ struct lconn;
 struct ucommand_handler;
 struct cachefile;
 
+#define IGNORE_HOST_HASH_MIN	64
+
 #define SCMD_WALK(i, svc) do { int m = svc->service->command_size / sizeof(struct service_command); \
 				for(i = 0; i < m; i++)
 #define SCMD_END		} while(0)
@@ -49,12 +51,19 @@ struct service_ignore
 	char *reason;
 	char *oper;
 
+	const char *host;		/* key in the ignore host hash, or NULL */
+	struct service_ignore *next;	/* next in its bucket of the index */
+
 	dlink_node ptr;
 };
 
 extern dlink_list service_list;
 extern dlink_list ignore_list;
 
+extern struct service_ignore *add_ignore(const char *mask, const char *oper,
+					const char *reason);
+extern void del_ignore(struct service_ignore *ignore_p);
+
 #define OPER_NAME(client_p, conn_p) ((conn_p) ? (conn_p)->name : \
 		((client_p)->user->oper ? (client_p)->user->oper->name : "-"))
 #define OPER_MASK(client_p, conn_p) ((conn_p) ? "-" : (client_p)->user->mask)
@@ -0,0 +1,177 @@
+/* include/setup.h.  Generated from setup.h.in by configure.  */
+/* include/setup.h.in.  Generated from autoconf/configure.in by autoheader.  */
+
+/* List Service */
+#define ENABLE_ALIS 1
+
+/* Ban Service */
+#define ENABLE_BANSERV 1
+
+/* Channel Service */
+#define ENABLE_CHANSERV 1
+
+/* Global Messaging Service */
+#define ENABLE_GLOBAL 1
+
+/* Jupe Service */
+#define ENABLE_JUPESERV 1
+
+/* Memo Service */
+#define ENABLE_MEMOSERV 1
+
+/* Nickname Service */
+#define ENABLE_NICKSERV 1
+
+/* Operbot Service */
+#define ENABLE_OPERBOT 1
+
+/* Oper Service */
+#define ENABLE_OPERSERV 1
+
+/* User Service */
+#define ENABLE_USERSERV 1
+
+/* Command Watching Service */
+#define ENABLE_WATCHSERV 1
+
+/* Define to 1 if you have the <crypt.h> header file. */
+#define HAVE_CRYPT_H 1
+
+/* Define to 1 if you have the `crypt_r' function. */
+#define HAVE_CRYPT_R 1
+
+/* Define to 1 if you have the <dirent.h> header file. */
+#define HAVE_DIRENT_H 1
+
+/* Define to 1 if you have the `epoll_create' function. */
+#define HAVE_EPOLL_CREATE 1
+
+/* Define to 1 if you have the <errno.h> header file. */
+#define HAVE_ERRNO_H 1
+
+/* Define to 1 if you have the `getaddrinfo' function. */
+#define HAVE_GETADDRINFO 1
+
+/* Define to 1 if you have the `gethostbyname' function. */
+#define HAVE_GETHOSTBYNAME 1
+
+/* Define to 1 if you have the <getopt.h> header file. */
+#define HAVE_GETOPT_H 1
+
+/* Define to 1 if you have the <inttypes.h> header file. */
+#define HAVE_INTTYPES_H 1
+
+/* Define to 1 if you have the `crypt' library (-lcrypt). */
+#define HAVE_LIBCRYPT 1
+
+/* Define to 1 if you have the `pthread' library (-lpthread). */
+#define HAVE_LIBPTHREAD 1
+
+/* Define to 1 if you have the `nsl' library (-lnsl). */
+/* #undef HAVE_LIBNSL */
+
+/* Define to 1 if you have the `socket' library (-lsocket). */
+/* #undef HAVE_LIBSOCKET */
+
+/* Define to 1 if you have the <memory.h> header file. */
+#define HAVE_MEMORY_H 1
+
+/* Define to 1 if you have the `mmap' function. */
+#define HAVE_MMAP 1
+
+/* Define to 1 if MySQL libraries are available */
+/* #undef HAVE_MYSQL */
+
+/* Define if you have nanosleep */
+#define HAVE_NANOSLEEP 1
+
+/* Define to 1 if PostgreSQL libraries are available */
+/* #undef HAVE_POSTGRESQL */
+
+/* Define to 1 if you have the <pthread.h> header file. */
+#define HAVE_PTHREAD_H 1
+
+/* Define to 1 if you have the `select' function. */
+#define HAVE_SELECT 1
+
+/* Define to 1 if you have the <stdarg.h> header file. */
+#define HAVE_STDARG_H 1
+
+/* Define to 1 if you have the <stdint.h> header file. */
+#define HAVE_STDINT_H 1
+
+/* Define to 1 if you have the <stdlib.h> header file. */
+#define HAVE_STDLIB_H 1
+
+/* Define to 1 if you have the `strftime' function. */
+#define HAVE_STRFTIME 1
+
+/* Define to 1 if you have the <strings.h> header file. */
+#define HAVE_STRINGS_H 1
+
+/* Define to 1 if you have the <string.h> header file. */
+#define HAVE_STRING_H 1
+
+/* Define to 1 if you have the `strlcat' function. */
+/* #undef HAVE_STRLCAT */
+
+/* Define to 1 if you have the `strlcpy' function. */
+/* #undef HAVE_STRLCPY */
+
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#define HAVE_SYS_EPOLL_H 1
+
+/* Define to 1 if you have the <sys/stat.h> header file. */
+#define HAVE_SYS_STAT_H 1
+
+/* Define to 1 if you have the <sys/time.h> header file. */
+#define HAVE_SYS_TIME_H 1
+
+/* Define to 1 if you have the <sys/types.h> header file. */
+#define HAVE_SYS_TYPES_H 1
+
+/* Define to 1 if you have the <unistd.h> header file. */
+#define HAVE_UNISTD_H 1
+
+/* Nick Length */
+#define NICKLEN (9+1)
+
+/* Define to the address where bug reports for this package should be sent. */
+#define PACKAGE_BUGREPORT ""
+
+/* Define to the full name of this package. */
+#define PACKAGE_NAME "ratbox-services"
+
+/* Define to the full name and version of this package. */
+#define PACKAGE_STRING "ratbox-services stable"
+
+/* Define to the one symbol short name of this package. */
+#define PACKAGE_TARNAME "ratbox-services"
+
+/* Define to the home page for this package. */
+#define PACKAGE_URL ""
+
+/* Define to the version of this package. */
+#define PACKAGE_VERSION "stable"
+
+/* Build packaged PCRE */
+#define PCRE_BUILD 1
+
+/* Define as the return type of signal handlers (`int' or `void'). */
+#define RETSIGTYPE void
+
+/* Build packaged sqlite3 */
+/* #undef SQLITE_BUILD */
+
+/* Define to 1 if you have the ANSI C header files. */
+#define STDC_HEADERS 1
+
+/* Topic Length */
+#define TOPICLEN (160+1)
+
+/* Registered Username Length */
+#define USERREGNAME_LEN (10)
+
+/* Define to 1 if `lex' declares `yytext' as a `char *' by default, not a
+   `char[]'. */
+/* #undef YYTEXT_POINTER */
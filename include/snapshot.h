@@ -0,0 +1,81 @@
+/* $Id$ */
+#ifndef INCLUDED_snapshot_h
+#define INCLUDED_snapshot_h
+
+/* A snapshot is a binary dump of one of the registries, written out at
+ * dbsync and shutdown, and mapped back in at startup instead of walking
+ * the tables through SQL.  It is only trusted when the database has not
+ * been written to since it was taken, so the database always remains
+ * the authoritative copy.
+ *
+ * Records are plain structs in the layout of the binary that wrote
+ * them, strings live in a table at the end of the file and are referred
+ * to by offset, with 0 meaning NULL.
+ */
+
+#define SNAPSHOT_MAX_SECTIONS	4
+
+struct snapshot_section
+{
+	unsigned int record_size;
+	unsigned int count;
+	unsigned long offset;
+};
+
+struct snapshot_header
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int byteorder;
+	unsigned long counter;		/* database change counter */
+	unsigned long strings;		/* offset of the string table */
+	unsigned long strings_len;
+	struct snapshot_section section[SNAPSHOT_MAX_SECTIONS];
+};
+
+struct snapshot_buf
+{
+	char *data;
+	unsigned long len;
+	unsigned long size;
+};
+
+/* a snapshot being built */
+struct snapshot
+{
+	char *path;
+	unsigned int version;
+	unsigned long counter;
+	unsigned int record_size[SNAPSHOT_MAX_SECTIONS];
+	unsigned int count[SNAPSHOT_MAX_SECTIONS];
+	struct snapshot_buf section[SNAPSHOT_MAX_SECTIONS];
+	struct snapshot_buf strings;
+};
+
+/* a snapshot mapped in for loading */
+struct snapshot_map
+{
+	char *base;
+	unsigned long len;
+	int mapped;
+	const struct snapshot_header *header;
+};
+
+extern void snapshot_sync(void);
+
+extern struct snapshot *snapshot_create(const char *path, unsigned int version,
+					unsigned long counter);
+extern unsigned int snapshot_string(struct snapshot *, const char *);
+extern void snapshot_add(struct snapshot *, int section, const void *record,
+				unsigned int record_size);
+extern int snapshot_commit(struct snapshot *);
+
+extern int snapshot_open(struct snapshot_map *, const char *path, unsigned int version);
+extern const void *snapshot_records(struct snapshot_map *, int section,
+				unsigned int record_size, unsigned int *count);
+extern const char *snapshot_get_string(struct snapshot_map *, unsigned int offset);
+extern char *snapshot_strdup(struct snapshot_map *, unsigned int offset);
+extern const char *snapshot_intern(struct snapshot_map *, unsigned int offset);
+extern void snapshot_close(struct snapshot_map *);
+
+#endif
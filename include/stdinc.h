@@ -47,6 +47,11 @@ extern int errno;
 
 #include <assert.h>
 
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_LIBPTHREAD)
+#define USE_THREADS
+#include <pthread.h>
+#endif
+
 #include "config.h"
 #include "tools.h"
 
@@ -11,12 +11,22 @@ extern void init_tools(void);
 
 void my_sleep(unsigned int seconds, unsigned int microseconds);
 
+#ifdef USE_THREADS
+extern int create_thread(pthread_t *, void *(*)(void *), void *);
+#endif
+
 #define my_malloc(x) (my_calloc(1, x))
 extern void *my_calloc(size_t, size_t);
+extern void *my_realloc(void *, size_t);
 extern void my_free(void *);
 extern char *my_strdup(const char *s);
 extern char *my_strndup(const char *, size_t);
 
+#ifdef RSERV_BENCH
+/* calls to the allocators above and BlockHeapAlloc() */
+extern unsigned long bench_allocs;
+#endif
+
 extern const char *get_duration(time_t seconds);
 extern const char *get_short_duration(time_t seconds);
 extern const char *get_time(time_t when, int show_tz);
@@ -142,6 +152,7 @@ dlink_node *dlink_find_string(const char *data, dlink_list *list);
 				}				\
 				while(0)
 
+
 #ifndef HARD_ASSERT
 #ifdef __GNUC__
 #define s_assert(expr)	do						\
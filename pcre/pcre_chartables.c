@@ -0,0 +1 @@
+./pcre_chartables.c.dist
\ No newline at end of file
@@ -52,16 +52,16 @@
  * return the pages back to the operating system, thus reducing the size 
  * of the process as the memory is unused.  malloc() on many systems just keeps
  * a heap of memory to itself, which never gets given back to the OS, except on
- * exit.  This of course is bad, if say we have an event that causes us to 
- * allocate say, 200MB of memory, while our normal memory consumption would be 
- * 15MB.  In the malloc() case, the amount of memory allocated to our process 
- * never goes down, as malloc() has it locked up in its heap.  With the mmap() 
- * method, we can munmap() the block and return it back to the OS, thus causing
- * our memory consumption to go down after we no longer need it.
- * 
- * Of course it is up to the caller to make sure BlockHeapGarbageCollect() gets
- * called periodically to do this cleanup, otherwise you'll keep the memory in 
- * the process.
+ * exit.
+ *
+ * Memory is handed out in slabs, each aligned to its own (power of two)
+ * size, with the Block header at the front.  The slab an element belongs
+ * to is found by masking its address, so elements carry no header of
+ * their own, and free elements are chained through their first word.
+ * Slabs with free elements sit on the heaps avail list, and a slab is
+ * given back as soon as it's empty, as long as the heap has another
+ * slabs worth of free elements -- so there's no need for a periodic
+ * garbage collection pass.
  */
 
 #include "stdinc.h"
@@ -85,9 +85,15 @@
 #endif
 #endif
 
-static void block_heap_gc(void *unused);
+/* elements are aligned to this within a slab */
+#define BLOCK_ALIGN		16
+#define BLOCK_MIN_SIZE		4096
+
+#define BLOCK_HEADER_SIZE	((sizeof(Block) + BLOCK_ALIGN - 1) & ~((size_t) BLOCK_ALIGN - 1))
+#define BLOCK_OF(bh, ptr)	((Block *) ((size_t) (ptr) & ~((bh)->blockSize - 1)))
+#define BLOCK_ELEM(b)		((void *) ((char *) (b) + BLOCK_HEADER_SIZE))
+
 dlink_list heap_lists;
-static int BlockHeapGarbageCollect(BlockHeap *);
 
 #if defined(HAVE_MMAP) && !defined(MAP_ANON)
 static int zero_fd = -1;
@@ -110,7 +116,6 @@ init_balloc(void)
 	if(zero_fd < 0)
 		blockheap_fail("Failed opening /dev/zero");
 #endif
-	eventAdd("block_heap_gc", block_heap_gc, NULL, 30);
 }
 
                
@@ -137,66 +142,98 @@ mem_frob(void *data, unsigned int len)
 #endif
 
 /*
- * static inline void free_block(void *ptr, size_t size)
- *
- * Inputs: The block and its size
- * Output: None
- * Side Effects: Returns memory for the block back to the OS
+ * static void *get_block(size_t size)
+ * 
+ * Input: Size of block to allocate, a power of two
+ * Output: Pointer to new block, aligned to its size
+ * Side Effects: None
  */
-static __inline void
-free_block(void *ptr, size_t size)
+static void *
+get_block(size_t size)
 {
+	char *ptr;
+	char *aligned;
+	void *raw;
+
+	/* take twice what we need, and trim it down to an aligned slab */
 #ifdef HAVE_MMAP
-	munmap(ptr, size);
+#ifdef MAP_ANON
+	ptr = mmap(NULL, size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
 #else
-	free(ptr);
+	ptr = mmap(NULL, size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE, zero_fd, 0);
 #endif
-}
+	if(ptr == MAP_FAILED)
+		return NULL;
+
+	aligned = (char *) (((size_t) ptr + size - 1) & ~(size - 1));
+
+	if(aligned > ptr)
+		munmap(ptr, aligned - ptr);
+
+	if(aligned + size < ptr + size * 2)
+		munmap(aligned + size, (ptr + size * 2) - (aligned + size));
 
+	raw = aligned;
+#else
+	if((ptr = malloc(size * 2)) == NULL)
+		return NULL;
+
+	raw = ptr;
+	aligned = (char *) (((size_t) ptr + size - 1) & ~(size - 1));
+#endif
+
+	((Block *) aligned)->raw = raw;
+	return aligned;
+}
 
 /*
- * static inline void *get_block(size_t size)
- * 
- * Input: Size of block to allocate
- * Output: Pointer to new block
- * Side Effects: None
+ * static void free_block(Block *b, size_t size)
+ *
+ * Inputs: The block and its size
+ * Output: None
+ * Side Effects: Returns memory for the block back to the OS
  */
-static __inline void *
-get_block(size_t size)
+static void
+free_block(Block *b, size_t size)
 {
-	void *ptr;
 #ifdef HAVE_MMAP
-#ifdef MAP_ANON
-	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
-#else
-	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, zero_fd, 0);
-#endif
-	if(ptr == MAP_FAILED)
-	{
-		ptr = NULL;
-	}
+	munmap(b->raw, size);
 #else
-	ptr = malloc(size);
+	free(b->raw);
 #endif
-	return (ptr);
 }
 
+static void
+avail_add(BlockHeap *bh, Block *b)
+{
+	b->prev = NULL;
+	b->next = bh->avail;
+
+	if(bh->avail != NULL)
+		bh->avail->prev = b;
+
+	bh->avail = b;
+}
 
 static void
-block_heap_gc(void *unused)
+avail_del(BlockHeap *bh, Block *b)
 {
-	dlink_node *ptr;
-	DLINK_FOREACH(ptr, heap_lists.head)
-	{
-		BlockHeapGarbageCollect((BlockHeap *)ptr->data);
-	}
+	if(b->prev != NULL)
+		b->prev->next = b->next;
+	else
+		bh->avail = b->next;
+
+	if(b->next != NULL)
+		b->next->prev = b->prev;
+
+	b->next = b->prev = NULL;
 }
 
 /* ************************************************************************ */
 /* FUNCTION DOCUMENTATION:                                                  */
 /*    newblock                                                              */
 /* Description:                                                             */
-/*    Allocates a new block for addition to a blockheap                     */
+/*    Allocates a new slab for addition to a blockheap                      */
 /* Parameters:                                                              */
 /*    bh (IN): Pointer to parent blockheap.                                 */
 /* Returns:                                                                 */
@@ -206,45 +243,31 @@ block_heap_gc(void *unused)
 static int
 newblock(BlockHeap * bh)
 {
-	MemBlock *newblk;
 	Block *b;
+	char *elem;
 	unsigned long i;
-	void *offset;
 
-	/* Setup the initial data structure. */
-	b = (Block *) calloc(1, sizeof(Block));
-	if(b == NULL)
-	{
+	if((b = get_block(bh->blockSize)) == NULL)
 		return (1);
-	}
-	b->free_list.head = b->free_list.tail = NULL;
-	b->used_list.head = b->used_list.tail = NULL;
-	b->next = bh->base;
 
-	b->alloc_size = (bh->elemsPerBlock + 1) * (bh->elemSize + sizeof(MemBlock));
+	b->heap = bh;
+	b->freeCount = bh->elemsPerBlock;
+	b->free_list = NULL;
+
+	/* chain the elements so the first is handed out first */
+	elem = (char *) BLOCK_ELEM(b) + (bh->elemsPerBlock - 1) * bh->elemSize;
 
-	b->elems = get_block(b->alloc_size);
-	if(b->elems == NULL)
-	{
-		return (1);
-	}
-	offset = b->elems;
-	/* Setup our blocks now */
 	for (i = 0; i < bh->elemsPerBlock; i++)
 	{
-		void *data;
-		newblk = (void *) offset;
-		newblk->block = b;
-		data = (void *) ((size_t) offset + sizeof(MemBlock));
-		newblk->block = b;
-		dlink_add(data, &newblk->self, &b->free_list);
-		offset = (unsigned char *) ((unsigned char *) offset +
-					    bh->elemSize + sizeof(MemBlock));
+		*(void **) elem = b->free_list;
+		b->free_list = elem;
+		elem -= bh->elemSize;
 	}
 
+	avail_add(bh, b);
+
 	++bh->blocksAllocated;
 	bh->freeElems += bh->elemsPerBlock;
-	bh->base = b;
 
 	return (0);
 }
@@ -260,8 +283,7 @@ newblock(BlockHeap * bh)
 /* Parameters:                                                              */
 /*   elemsize (IN):  Size of the basic element to be stored                 */
 /*   elemsperblock (IN):  Number of elements to be stored in a single block */
-/*         of memory.  When the blockheap runs out of free memory, it will  */
-/*         allocate elemsize * elemsperblock more.                          */
+/*         of memory.  This is rounded up to fill the slab.                 */
 /* Returns:                                                                 */
 /*   Pointer to new BlockHeap, or NULL if unsuccessful                      */
 /* ************************************************************************ */
@@ -294,23 +316,24 @@ BlockHeapCreate(const char *name, size_t elemsize, int elemsperblock)
 
 	bh->name = my_strdup(name);
 	bh->elemSize = elemsize;
-	bh->elemsPerBlock = elemsperblock;
-	bh->blocksAllocated = 0;
-	bh->freeElems = 0;
-	bh->base = NULL;
+
+	/* slabs are a power of two, so the slab can be found from an
+	 * elements address
+	 */
+	bh->blockSize = BLOCK_MIN_SIZE;
+
+	while(bh->blockSize - BLOCK_HEADER_SIZE < elemsize * elemsperblock)
+		bh->blockSize *= 2;
+
+	bh->elemsPerBlock = (bh->blockSize - BLOCK_HEADER_SIZE) / elemsize;
 
 	/* Be sure our malloc was successful */
 	if(newblock(bh))
 	{
-		if(bh != NULL)
-			free(bh);
+		free(bh);
 		die(0, "Out of memory: newblock() failed");
 	}
 
-	if(bh == NULL)
-	{
-		blockheap_fail("bh == NULL when it shouldn't be");
-	}
 	dlink_add(bh, &bh->hlist, &heap_lists);
 	return (bh);
 }
@@ -330,8 +353,9 @@ BlockHeapCreate(const char *name, size_t elemsize, int elemsperblock)
 void *
 BlockHeapAlloc(BlockHeap * bh)
 {
-	Block *walker;
-	dlink_node *new_node;
+	Block *b;
+	void *elem;
+	unsigned long used;
 
 	s_assert(bh != NULL);
 	if(bh == NULL)
@@ -339,36 +363,34 @@ BlockHeapAlloc(BlockHeap * bh)
 		blockheap_fail("Cannot allocate if bh == NULL");
 	}
 
-	if(bh->freeElems == 0)
-	{
-		/* Allocate new block and assign */
-		/* newblock returns 1 if unsuccessful, 0 if not */
-
-		if(newblock(bh))
-		{
-			/* That didn't work..try to garbage collect */
-			BlockHeapGarbageCollect(bh);
-			if(bh->freeElems == 0)
-				die(0, "Out of memory: newblock() failed with GC");
-		}
-	}
+#ifdef RSERV_BENCH
+	bench_allocs++;
+#endif
 
-	for (walker = bh->base; walker != NULL; walker = walker->next)
-	{
-		if(dlink_list_length(&walker->free_list) > 0)
-		{
-			bh->freeElems--;
-			new_node = walker->free_list.head;
-			dlink_move_node(new_node, &walker->free_list, &walker->used_list);
-			s_assert(new_node->data != NULL);
-			if(new_node->data == NULL)
-				blockheap_fail("new_node->data is NULL and that shouldn't happen!!!");
-			memset(new_node->data, 0, bh->elemSize);
-			return (new_node->data);
-		}
-	}
-	blockheap_fail("BlockHeapAlloc failed, giving up");
-	return NULL;
+	if(bh->avail == NULL && newblock(bh))
+		die(0, "Out of memory: newblock() failed");
+
+	b = bh->avail;
+	elem = b->free_list;
+
+	s_assert(elem != NULL);
+	if(elem == NULL)
+		blockheap_fail("avail block has no free elements");
+
+	b->free_list = *(void **) elem;
+
+	if(--b->freeCount == 0)
+		avail_del(bh, b);
+
+	bh->freeElems--;
+
+	used = bh->blocksAllocated * bh->elemsPerBlock - bh->freeElems;
+
+	if(used > bh->highWater)
+		bh->highWater = used;
+
+	memset(elem, 0, bh->elemSize);
+	return (elem);
 }
 
 
@@ -376,7 +398,8 @@ BlockHeapAlloc(BlockHeap * bh)
 /* FUNCTION DOCUMENTATION:                                                  */
 /*    BlockHeapFree                                                         */
 /* Description:                                                             */
-/*    Returns an element to the free pool, does not free()                  */
+/*    Returns an element to the free pool, and the slab to the OS if it's   */
+/*    no longer needed.                                                     */
 /* Parameters:                                                              */
 /*    bh (IN): Pointer to BlockHeap containing element                      */
 /*    ptr (in):  Pointer to element to be "freed"                           */
@@ -386,8 +409,7 @@ BlockHeapAlloc(BlockHeap * bh)
 int
 BlockHeapFree(BlockHeap * bh, void *ptr)
 {
-	Block *block;
-	struct MemBlock *memblock;
+	Block *b;
 
 	s_assert(bh != NULL);
 	s_assert(ptr != NULL);
@@ -404,78 +426,36 @@ BlockHeapFree(BlockHeap * bh, void *ptr)
 		return (1);
 	}
 
-	memblock = (void *) ((size_t) ptr - sizeof(MemBlock));
-	s_assert(memblock->block != NULL);
-	if(memblock->block == NULL)
+	b = BLOCK_OF(bh, ptr);
+
+	s_assert(b->heap == bh);
+	if(b->heap != bh)
 	{
-		blockheap_fail("memblock->block == NULL, not a valid block?");
+		blockheap_fail("element freed to the wrong heap");
 	}
 
-	block = memblock->block;
-	bh->freeElems++;
 	mem_frob(ptr, bh->elemSize);
-	dlink_move_node(&memblock->self, &block->used_list, &block->free_list);
-	return (0);
-}
 
-/* ************************************************************************ */
-/* FUNCTION DOCUMENTATION:                                                  */
-/*    BlockHeapGarbageCollect                                               */
-/* Description:                                                             */
-/*    Performs garbage collection on the block heap.  Any blocks that are   */
-/*    completely unallocated are removed from the heap.  Garbage collection */
-/*    will never remove the root node of the heap.                          */
-/* Parameters:                                                              */
-/*    bh (IN):  Pointer to the BlockHeap to be cleaned up                   */
-/* Returns:                                                                 */
-/*   0 if successful, 1 if bh == NULL                                       */
-/* ************************************************************************ */
-static int
-BlockHeapGarbageCollect(BlockHeap * bh)
-{
-	Block *walker, *last;
-	if(bh == NULL)
-	{
-		return (1);
-	}
+	*(void **) ptr = b->free_list;
+	b->free_list = ptr;
 
-	if(bh->freeElems < bh->elemsPerBlock || bh->blocksAllocated == 1)
-	{
-		/* There couldn't possibly be an entire free block.  Return. */
-		return (0);
-	}
+	if(b->freeCount++ == 0)
+		avail_add(bh, b);
 
-	last = NULL;
-	walker = bh->base;
+	bh->freeElems++;
 
-	while (walker != NULL)
+	/* keep a slab in hand, so a heap hovering around a slab boundary
+	 * doesn't keep mapping and unmapping one
+	 */
+	if(b->freeCount == bh->elemsPerBlock &&
+	   bh->freeElems >= 2 * bh->elemsPerBlock)
 	{
-		if((dlink_list_length(&walker->free_list) == bh->elemsPerBlock) != 0)
-		{
-			free_block(walker->elems, walker->alloc_size);
-			if(last != NULL)
-			{
-				last->next = walker->next;
-				if(walker != NULL)
-					free(walker);
-				walker = last->next;
-			}
-			else
-			{
-				bh->base = walker->next;
-				if(walker != NULL)
-					free(walker);
-				walker = bh->base;
-			}
-			bh->blocksAllocated--;
-			bh->freeElems -= bh->elemsPerBlock;
-		}
-		else
-		{
-			last = walker;
-			walker = walker->next;
-		}
+		avail_del(bh, b);
+		free_block(b, bh->blockSize);
+		bh->blocksAllocated--;
+		bh->freeElems -= bh->elemsPerBlock;
 	}
+
 	return (0);
 }
 
@@ -483,7 +463,8 @@ BlockHeapGarbageCollect(BlockHeap * bh)
 /* FUNCTION DOCUMENTATION:                                                  */
 /*    BlockHeapDestroy                                                      */
 /* Description:                                                             */
-/*    Completely free()s a BlockHeap.  Use for cleanup.                     */
+/*    Completely free()s a BlockHeap.  Use for cleanup.  Every element must */
+/*    have been freed, as slabs that are full can't be found.               */
 /* Parameters:                                                              */
 /*    bh (IN):  Pointer to the BlockHeap to be destroyed.                   */
 /* Returns:                                                                 */
@@ -499,14 +480,14 @@ BlockHeapDestroy(BlockHeap * bh)
 		return (1);
 	}
 
-	for (walker = bh->base; walker != NULL; walker = next)
+	for (walker = bh->avail; walker != NULL; walker = next)
 	{
 		next = walker->next;
-		free_block(walker->elems, walker->alloc_size);
-		if(walker != NULL)
-			free(walker);
+		free_block(walker, bh->blockSize);
 	}
+
 	dlink_delete(&bh->hlist, &heap_lists);
+	my_free(bh->name);
 	free(bh);
 	return (0);
 }
@@ -526,7 +507,7 @@ BlockHeapUsage(BlockHeap * bh, size_t * bused, size_t * bfree, size_t * bmemusag
 
 	freem = bh->freeElems;
 	used = (bh->blocksAllocated * bh->elemsPerBlock) - bh->freeElems;
-	memusage = used * (bh->elemSize + sizeof(MemBlock));
+	memusage = used * bh->elemSize;
 	freemem = bh->freeElems * bh->elemSize;
 
 	if(bused != NULL)
@@ -538,3 +519,27 @@ BlockHeapUsage(BlockHeap * bh, size_t * bused, size_t * bfree, size_t * bmemusag
 	if(bfreemem != NULL)
 		*bfreemem = freemem;
 }
+
+/* BlockHeapStats()
+ * reports the number of slabs, the most elements ever in use at once,
+ * and the percentage of free elements stranded in slabs that are
+ * partly in use -- memory that can't be given back
+ */
+void
+BlockHeapStats(BlockHeap * bh, unsigned long *slabs, unsigned long *highwater,
+		unsigned int *fragmentation)
+{
+	Block *b;
+	unsigned long stranded = 0;
+	unsigned long total = bh->blocksAllocated * bh->elemsPerBlock;
+
+	for(b = bh->avail; b != NULL; b = b->next)
+	{
+		if(b->freeCount < bh->elemsPerBlock)
+			stranded += b->freeCount;
+	}
+
+	*slabs = bh->blocksAllocated;
+	*highwater = bh->highWater;
+	*fragmentation = total ? (unsigned int) (stranded * 100 / total) : 0;
+}
@@ -0,0 +1,864 @@
+/* src/bench.c
+ *   Contains the protocol replay benchmark.
+ *
+ * Copyright (C) 2010 ircd-ratbox development team
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1.Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 2.Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * 3.The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id$
+ */
+#include "stdinc.h"
+#include <signal.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+
+#include "rserv.h"
+#include "rsdb.h"
+#include "conf.h"
+#include "io.h"
+#include "event.h"
+#include "client.h"
+#include "log.h"
+#include "service.h"
+#include "newconf.h"
+#include "serno.h"
+
+#ifdef ENABLE_BANSERV
+#ifdef PCRE_BUILD
+#include "pcre.h"
+#else
+#include <pcre.h>
+#endif
+#include "s_banserv.h"
+#endif
+
+/* The benchmark is the services binary with a different main(): it
+ * builds a database of registrations in a temporary directory, starts
+ * up against it, and feeds TS6 from a fake uplink straight into
+ * parse_server().  What services send back goes down a socketpair that
+ * we drain and count.
+ */
+
+#define BENCH_UPLINK		"hub.bench"
+#define BENCH_UPLINK_SID	"1HB"
+#define BENCH_PASS		"benchpass"
+#define BENCH_TS		1000000000
+
+/* lines parsed between runs of the main loop */
+#define BENCH_POLL		64
+
+/* room left for the prefix and command when chunking SJOIN members */
+#define BENCH_SJOIN_LEN		400
+
+#define BENCH_MAX_COMMANDS	32
+
+struct bench_stat
+{
+	char command[16];
+	unsigned long *samples;		/* nanoseconds per line */
+	unsigned long count;
+	unsigned long size;
+};
+
+static struct bench_stat bench_stats[BENCH_MAX_COMMANDS];
+static int bench_stat_count;
+
+static unsigned long bench_lines;
+static unsigned long bench_out_lines;
+static unsigned long bench_out_bytes;
+
+static int bench_fd = -1;
+static char bench_dir[PATH_MAX];
+
+static const char *conf_file = "../doc/example.conf";
+static const char *schema_file = "../tools/base/schema-sqlite.txt";
+static const char *replay_file;
+static unsigned int bench_users = 100000;
+static unsigned int bench_servers = 8;
+static unsigned int bench_channels = 1000;
+static unsigned int bench_members = 500;
+static unsigned int bench_logins = 10000;
+static unsigned int bench_privmsgs = 100000;
+static int bench_keep;
+static int bench_flood;
+
+static const char base36[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+static void
+bench_usage(void)
+{
+	fprintf(stderr, "ratbox-bench [-c conf] [-s schema] [-r replayfile] [-n users]\n"
+		"             [-S servers] [-C channels] [-m members] [-l logins]\n"
+		"             [-p privmsgs] [-f] [-k]\n\n"
+		"  -c  services conf to start with [%s]\n"
+		"  -s  sqlite schema for the temporary database [%s]\n"
+		"  -r  file of raw server lines to replay after the synthetic runs\n"
+		"  -n  registered users, all introduced in the burst [%u]\n"
+		"  -S  servers behind the uplink to spread them over [%u]\n"
+		"  -C  registered channels, all sent in SJOINs [%u]\n"
+		"  -m  members per channel [%u]\n"
+		"  -l  USERSERV LOGINs [%u]\n"
+		"  -p  PRIVMSGs to services [%u]\n"
+		"  -f  keep the service and client flood limits\n"
+		"  -k  keep the temporary directory\n\n"
+		"Setting a count to 0 skips that run.\n",
+		conf_file, schema_file, bench_users, bench_servers,
+		bench_channels, bench_members, bench_logins, bench_privmsgs);
+	exit(EXIT_FAILURE);
+}
+
+static void
+bench_fail(const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	fprintf(stderr, "ratbox-bench: ");
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+
+	exit(EXIT_FAILURE);
+}
+
+static unsigned long
+bench_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long) ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static long
+bench_maxrss(void)
+{
+	struct rusage ru;
+
+	if(getrusage(RUSAGE_SELF, &ru) < 0)
+		return 0;
+
+	return ru.ru_maxrss;
+}
+
+/* bench_sid()
+ *   builds the SID of one of the servers behind our uplink
+ */
+static void
+bench_sid(char *buf, unsigned int server)
+{
+	buf[0] = '2';
+	buf[1] = base36[(server / 36) % 36];
+	buf[2] = base36[server % 36];
+	buf[3] = '\0';
+}
+
+/* bench_uid()
+ *   builds the UID of a user, who is on server (user % bench_servers)
+ */
+static void
+bench_uid(char *buf, unsigned int user)
+{
+	int i;
+
+	bench_sid(buf, user % bench_servers);
+
+	buf[3] = base36[(user / (36 * 36 * 36 * 36 * 36)) % 26];
+
+	for(i = 8; i > 3; i--)
+	{
+		buf[i] = base36[user % 36];
+		user /= 36;
+	}
+
+	buf[9] = '\0';
+}
+
+/* bench_drain()
+ *   reads whatever services have sent us, counting it
+ */
+static void
+bench_drain(void)
+{
+	static char buf[65536];
+	char *p;
+	int len;
+
+	while((len = read(bench_fd, buf, sizeof(buf))) > 0)
+	{
+		bench_out_bytes += len;
+
+		for(p = buf; (p = memchr(p, '\n', len - (p - buf))) != NULL; p++)
+			bench_out_lines++;
+	}
+}
+
+/* bench_poll()
+ *   gives the main loop a turn, then drains what it wrote
+ */
+static void
+bench_poll(int block)
+{
+	set_time();
+	io_loop(block);
+	bench_drain();
+}
+
+static struct bench_stat *
+bench_find_stat(const char *command, size_t len)
+{
+	struct bench_stat *stat;
+	int i;
+
+	if(len >= sizeof(stat->command))
+		len = sizeof(stat->command) - 1;
+
+	for(i = 0; i < bench_stat_count; i++)
+	{
+		stat = &bench_stats[i];
+
+		if(strlen(stat->command) == len && !strncmp(stat->command, command, len))
+			return stat;
+	}
+
+	if(bench_stat_count == BENCH_MAX_COMMANDS)
+		return NULL;
+
+	stat = &bench_stats[bench_stat_count++];
+	memcpy(stat->command, command, len);
+	stat->command[len] = '\0';
+	return stat;
+}
+
+/* bench_parse()
+ *   times a single line through parse_server()
+ *
+ * inputs	- line, which is modified
+ * outputs	-
+ */
+static void
+bench_parse(char *line)
+{
+	struct bench_stat *stat;
+	const char *command = line;
+	unsigned long start;
+	size_t len;
+
+	if(*command == ':')
+		command += strcspn(command, " ");
+
+	command += strspn(command, " ");
+	len = strcspn(command, " \r\n");
+
+	if(!len)
+		return;
+
+	stat = bench_find_stat(command, len);
+
+	start = bench_clock();
+	bench_parse_server(line, strlen(line));
+
+	if(stat != NULL)
+	{
+		if(stat->count == stat->size)
+		{
+			stat->size = stat->size ? stat->size * 2 : 1024;
+			stat->samples = my_realloc(stat->samples,
+					stat->size * sizeof(unsigned long));
+		}
+
+		stat->samples[stat->count++] = bench_clock() - start;
+	}
+
+	if((++bench_lines % BENCH_POLL) == 0)
+		bench_poll(0);
+}
+
+static void
+bench_send(const char *format, ...)
+{
+	char buf[BUFSIZE];
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	bench_parse(buf);
+}
+
+/* bench_settle()
+ *   runs the main loop until services have nothing left to write and no
+ *   passwords waiting on the crypt workers
+ */
+static void
+bench_settle(void)
+{
+	bench_poll(0);
+
+	while(server_p != NULL && !ConnDead(server_p) &&
+	      (crypt_pending_count() || get_sendq(server_p)))
+		bench_poll(crypt_pending_count() ? 1 : 0);
+}
+
+static int
+bench_cmp_sample(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *) a;
+	unsigned long y = *(const unsigned long *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void
+bench_run(const char *name, void (*func)(void))
+{
+	struct bench_stat *stat;
+	unsigned long allocs = bench_allocs;
+	unsigned long start;
+	double secs;
+	int i;
+
+	bench_lines = bench_out_lines = bench_out_bytes = 0;
+
+	for(i = 0; i < bench_stat_count; i++)
+		bench_stats[i].count = 0;
+
+	start = bench_clock();
+	func();
+	bench_settle();
+	secs = (bench_clock() - start) / 1e9;
+
+	if(server_p == NULL || ConnDead(server_p))
+		bench_fail("%s: lost the server connection, see %s/%s",
+			name, bench_dir, LOG_PATH);
+
+	printf("%-10s %9lu lines %8.3fs %10.0f lines/s %10lu allocs %8ld KB peak RSS\n",
+		name, bench_lines, secs, secs > 0 ? bench_lines / secs : 0.0,
+		bench_allocs - allocs, bench_maxrss());
+	printf("%-10s %9lu lines %9lu bytes sent back\n",
+		"", bench_out_lines, bench_out_bytes);
+
+	for(i = 0; i < bench_stat_count; i++)
+	{
+		stat = &bench_stats[i];
+
+		if(!stat->count)
+			continue;
+
+		qsort(stat->samples, stat->count, sizeof(unsigned long), bench_cmp_sample);
+
+		printf("%-10s %-9s %9lu lines %10.2fus p50 %10.2fus p99\n",
+			"", stat->command, stat->count,
+			stat->samples[stat->count / 2] / 1e3,
+			stat->samples[(stat->count * 99) / 100] / 1e3);
+	}
+
+	fflush(stdout);
+}
+
+static void
+bench_burst(void)
+{
+	char sid[4];
+	char uid[10];
+	unsigned int i;
+
+	for(i = 0; i < bench_servers; i++)
+	{
+		bench_sid(sid, i);
+		bench_send(":%s SID leaf%u.bench 2 %s :benchmark leaf",
+			BENCH_UPLINK_SID, i, sid);
+	}
+
+	for(i = 0; i < bench_users; i++)
+	{
+		bench_sid(sid, i % bench_servers);
+		bench_uid(uid, i);
+		bench_send(":%s UID n%u 2 %u +i bench%u host%u.bench.example "
+			"10.%u.%u.%u %s :benchmark user",
+			sid, i, BENCH_TS + i, i, i, (i >> 16) & 255,
+			(i >> 8) & 255, i & 255, uid);
+	}
+}
+
+static void
+bench_sjoin(void)
+{
+	char buf[BUFSIZE];
+	char uid[10];
+	unsigned int members;
+	unsigned int i, j;
+	int len;
+
+	members = bench_members < bench_users ? bench_members : bench_users;
+
+	for(i = 0; i < bench_channels; i++)
+	{
+		len = 0;
+
+		for(j = 0; j < members; j++)
+		{
+			bench_uid(uid, (i * members + j) % bench_users);
+			len += snprintf(buf + len, sizeof(buf) - len, "%s%s ",
+					j ? "" : "@", uid);
+
+			if(len >= BENCH_SJOIN_LEN || j == members - 1)
+			{
+				buf[len - 1] = '\0';
+				bench_send(":%s SJOIN %u #bench%u +nt :%s",
+					BENCH_UPLINK_SID, BENCH_TS, i, buf);
+				len = 0;
+			}
+		}
+	}
+}
+
+static void
+bench_login(void)
+{
+	struct client *userserv_p;
+	char uid[10];
+	unsigned int i;
+
+	if((userserv_p = find_service_id("userserv")) == NULL)
+		bench_fail("login: no userserv in %s", conf_file);
+
+	for(i = 0; i < bench_logins; i++)
+	{
+		bench_uid(uid, i % bench_users);
+		bench_send(":%s PRIVMSG %s :LOGIN u%u %s",
+			uid, UID(userserv_p), i % bench_users, BENCH_PASS);
+	}
+}
+
+static void
+bench_privmsg(void)
+{
+	struct client *targets[64];
+	struct client *service_p;
+	dlink_node *ptr;
+	char uid[10];
+	unsigned int count = 0;
+	unsigned int i;
+
+	DLINK_FOREACH(ptr, service_list.head)
+	{
+		service_p = ptr->data;
+
+		if(!ServiceDisabled(service_p) && service_p->service->command != NULL &&
+		   count < sizeof(targets) / sizeof(targets[0]))
+			targets[count++] = service_p;
+	}
+
+	if(!count)
+		bench_fail("privmsg: no services in %s", conf_file);
+
+	for(i = 0; i < bench_privmsgs; i++)
+	{
+		service_p = targets[i % count];
+		bench_uid(uid, i % bench_users);
+
+		if(!strcmp(service_p->service->id, "userserv"))
+			bench_send(":%s PRIVMSG %s :INFO u%u",
+				uid, UID(service_p), (i / count) % bench_users);
+		else if(!strcmp(service_p->service->id, "chanserv") && bench_channels)
+			bench_send(":%s PRIVMSG %s :INFO #bench%u",
+				uid, UID(service_p), (i / count) % bench_channels);
+		else
+			bench_send(":%s PRIVMSG %s :HELP", uid, UID(service_p));
+	}
+}
+
+static void
+bench_replay(void)
+{
+	char buf[BUFSIZE];
+	FILE *in;
+
+	if((in = fopen(replay_file, "r")) == NULL)
+		bench_fail("unable to open %s: %s", replay_file, strerror(errno));
+
+	while(fgets(buf, sizeof(buf), in) != NULL)
+	{
+		if(buf[0] == '#')
+			continue;
+
+		bench_parse(buf);
+	}
+
+	fclose(in);
+}
+
+/* bench_schema()
+ *   creates the tables, a statement at a time
+ */
+static void
+bench_schema(void)
+{
+	struct stat st;
+	char *buf;
+	char *stmt;
+	char *next;
+	FILE *in;
+	size_t len;
+
+	if((in = fopen(schema_file, "r")) == NULL || fstat(fileno(in), &st) < 0)
+		bench_fail("unable to open %s: %s", schema_file, strerror(errno));
+
+	buf = my_malloc(st.st_size + 1);
+	len = fread(buf, 1, st.st_size, in);
+	buf[len] = '\0';
+	fclose(in);
+
+	for(stmt = buf; stmt != NULL; stmt = next)
+	{
+		if((next = strchr(stmt, ';')) != NULL)
+			*next++ = '\0';
+
+		if(stmt[strspn(stmt, " \t\r\n")] != '\0')
+			rsdb_exec(NULL, "%s;", stmt);
+	}
+
+	my_free(buf);
+}
+
+/* bench_fixtures()
+ *   registers the users and channels the runs use.  Channel i is owned
+ *   by the first of its members.
+ */
+static void
+bench_fixtures(void)
+{
+	const char *password;
+	unsigned int members;
+	unsigned int i, j;
+
+	password = LOCAL_COPY(get_crypt(BENCH_PASS, NULL));
+	members = bench_members < bench_users ? bench_members : bench_users;
+
+	rsdb_transaction(RSDB_TRANS_START);
+
+	for(i = 0; i < bench_users; i++)
+		rsdb_exec(NULL, "INSERT INTO users (username, password, email, suspender, "
+			"suspend_reason, suspend_time, reg_time, last_time, flags, "
+			"verify_token, language) VALUES('u%u', '%Q', '', '', '', 0, "
+			"%lu, %lu, 0, '', '')",
+			i, password, (unsigned long) CURRENT_TIME,
+			(unsigned long) CURRENT_TIME);
+
+	for(i = 0; i < bench_channels && bench_users; i++)
+	{
+		rsdb_exec(NULL, "INSERT INTO channels (chname, topic, url, createmodes, "
+			"enforcemodes, tsinfo, reg_time, last_time, flags, suspender, "
+			"suspend_reason, suspend_time) VALUES('#bench%u', '', '', '+nt', "
+			"'', %u, %lu, %lu, 0, '', '', 0)",
+			i, BENCH_TS, (unsigned long) CURRENT_TIME,
+			(unsigned long) CURRENT_TIME);
+
+		/* not every member is registered on the channel, so the
+		 * SJOIN has some of each
+		 */
+		for(j = 0; j < members; j += 4)
+			rsdb_exec(NULL, "INSERT INTO members (chname, username, lastmod, "
+				"level, flags, suspend) VALUES('#bench%u', 'u%u', 'bench', "
+				"%d, 0, 0)",
+				i, (i * members + j) % bench_users, j ? 100 : 200);
+	}
+
+	rsdb_transaction(RSDB_TRANS_END);
+}
+
+/* bench_noflood()
+ *   lifts the flood limits, so the runs measure the commands rather than
+ *   services telling users to slow down
+ */
+static void
+bench_noflood(void)
+{
+	struct client *service_p;
+	dlink_node *ptr;
+
+	config_file.client_flood_max = INT_MAX;
+	config_file.client_flood_max_ignore = INT_MAX;
+
+	DLINK_FOREACH(ptr, service_list.head)
+	{
+		service_p = ptr->data;
+		service_p->service->flood_max = 0;
+	}
+}
+
+/* bench_connect()
+ *   links us to the fake uplink and completes the handshake
+ */
+static void
+bench_connect(void)
+{
+	int fds[2];
+	int i;
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		bench_fail("socketpair() failed: %s", strerror(errno));
+
+	for(i = 0; i < 2; i++)
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL, 0) | O_NONBLOCK);
+
+	bench_fd = fds[1];
+	bench_connect_server(BENCH_UPLINK, BENCH_PASS, fds[0]);
+
+	bench_send("PASS %s TS 6 :%s", BENCH_PASS, BENCH_UPLINK_SID);
+	bench_send("CAPAB :QS EX IE KLN UNKLN ENCAP TB SERVICES EUID");
+	bench_send("SERVER %s 1 :benchmark uplink", BENCH_UPLINK);
+	bench_send("SVINFO 6 6 0 :%lu", (unsigned long) CURRENT_TIME);
+	bench_settle();
+
+	if(server_p == NULL || ConnDead(server_p) || server_p->client_p == NULL)
+		bench_fail("handshake failed, see %s/%s", bench_dir, LOG_PATH);
+}
+
+static void
+bench_eob(void)
+{
+	bench_send(":%s PONG %s :%s", BENCH_UPLINK_SID, BENCH_UPLINK, MYUID);
+}
+
+static void
+bench_copy(const char *from, const char *to)
+{
+	char buf[8192];
+	FILE *in;
+	FILE *out;
+	size_t len;
+
+	if((in = fopen(from, "r")) == NULL)
+		bench_fail("unable to open %s: %s", from, strerror(errno));
+
+	if((out = fopen(to, "w")) == NULL)
+		bench_fail("unable to create %s: %s", to, strerror(errno));
+
+	while((len = fread(buf, 1, sizeof(buf), in)) > 0)
+		fwrite(buf, 1, len, out);
+
+	fclose(in);
+
+	if(fclose(out))
+		bench_fail("unable to write %s: %s", to, strerror(errno));
+}
+
+static void
+bench_cleanup(void)
+{
+	static const char *dirs[] = { "etc", "logs", "run", NULL };
+	char path[PATH_MAX];
+	struct dirent *ent;
+	DIR *dir;
+	int i;
+
+	for(i = 0; dirs[i] != NULL; i++)
+	{
+		if((dir = opendir(dirs[i])) == NULL)
+			continue;
+
+		while((ent = readdir(dir)) != NULL)
+		{
+			if(ent->d_name[0] == '.')
+				continue;
+
+			snprintf(path, sizeof(path), "%s/%s", dirs[i], ent->d_name);
+			unlink(path);
+		}
+
+		closedir(dir);
+		rmdir(dirs[i]);
+	}
+
+	if(chdir("/") == 0)
+		rmdir(bench_dir);
+}
+
+static const char *
+bench_path(const char *path)
+{
+	char buf[PATH_MAX];
+
+	if(realpath(path, buf) == NULL)
+		bench_fail("unable to find %s: %s", path, strerror(errno));
+
+	return my_strdup(buf);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long allocs;
+	unsigned long start;
+#ifdef ENABLE_BANSERV
+	const char *pattern;
+#endif
+	int c;
+
+	while((c = getopt(argc, argv, "c:s:r:n:S:C:m:l:p:fkh")) != -1)
+	{
+		switch(c)
+		{
+			case 'c':
+				conf_file = optarg;
+				break;
+			case 's':
+				schema_file = optarg;
+				break;
+			case 'r':
+				replay_file = optarg;
+				break;
+			case 'n':
+				bench_users = atoi(optarg);
+				break;
+			case 'S':
+				bench_servers = atoi(optarg);
+				break;
+			case 'C':
+				bench_channels = atoi(optarg);
+				break;
+			case 'm':
+				bench_members = atoi(optarg);
+				break;
+			case 'l':
+				bench_logins = atoi(optarg);
+				break;
+			case 'p':
+				bench_privmsgs = atoi(optarg);
+				break;
+			case 'f':
+				bench_flood = 1;
+				break;
+			case 'k':
+				bench_keep = 1;
+				break;
+			default:
+				bench_usage();
+				break;
+		}
+	}
+
+	if(bench_servers < 1 || bench_servers > 36 * 36)
+		bench_fail("-S must be between 1 and %d", 36 * 36);
+
+	if(bench_users > 26 * 36 * 36 * 36 * 36 * 36)
+		bench_fail("-n is too large");
+
+#ifdef ENABLE_BANSERV
+	/* a wrong literal makes banserv skip bans, not just run slower */
+	if((pattern = bench_regexp_literal()) != NULL)
+		bench_fail("regexp_literal() is wrong for %s", pattern);
+#endif
+
+	conf_file = bench_path(conf_file);
+	schema_file = bench_path(schema_file);
+
+	if(replay_file != NULL)
+		replay_file = bench_path(replay_file);
+
+	snprintf(bench_dir, sizeof(bench_dir), "/tmp/rserv-bench.XXXXXX");
+
+	if(mkdtemp(bench_dir) == NULL)
+		bench_fail("unable to create a temporary directory: %s", strerror(errno));
+
+	if(chdir(bench_dir) || mkdir("etc", 0700) || mkdir("logs", 0700) ||
+	   mkdir("run", 0700))
+		bench_fail("unable to set up %s: %s", bench_dir, strerror(errno));
+
+	bench_copy(conf_file, CONF_PATH);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	set_time();
+	open_logfile();
+
+	init_main();
+	first_time = CURRENT_TIME;
+
+	newconf_init();
+	conf_parse(1);
+
+	rsdb_init();
+	bench_schema();
+	bench_fixtures();
+
+	init_crypt_pool();
+
+	printf("ratbox-bench: %s(%s), working in %s\n",
+		RSERV_VERSION, SERIALNUM, bench_dir);
+
+	/* loading the registrations is worth knowing about too */
+	allocs = bench_allocs;
+	start = bench_clock();
+	init_services();
+
+	printf("%-10s %9u users %7u channels %8.3fs %10lu allocs %8ld KB peak RSS\n",
+		"load", bench_users, bench_channels, (bench_clock() - start) / 1e9,
+		bench_allocs - allocs, bench_maxrss());
+
+	eventAdd("update_service_floodcount", update_service_floodcount, NULL, 1);
+
+	if(!bench_flood)
+		bench_noflood();
+
+	bench_connect();
+
+	if(bench_users)
+		bench_run("burst", bench_burst);
+
+	if(bench_users && bench_channels && bench_members)
+		bench_run("sjoin", bench_sjoin);
+
+	bench_eob();
+	bench_settle();
+
+	if(bench_users && bench_logins)
+		bench_run("login", bench_login);
+
+	if(bench_users && bench_privmsgs)
+		bench_run("privmsg", bench_privmsg);
+
+	if(replay_file != NULL)
+		bench_run("replay", bench_replay);
+
+	rsdb_shutdown();
+
+	if(bench_keep)
+		printf("ratbox-bench: kept %s\n", bench_dir);
+	else
+		bench_cleanup();
+
+	return 0;
+}
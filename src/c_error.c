@@ -39,7 +39,7 @@
 #include "log.h"
 
 static void c_error(struct client *, const char *parv[], int parc);
-struct scommand_handler error_command = { "ERROR", c_error, FLAGS_UNKNOWN, DLINK_EMPTY };
+struct scommand_handler error_command = { "ERROR", c_error, FLAGS_UNKNOWN, 0, { NULL } };
 
 static void
 c_error(struct client *client_p, const char *parv[], int parc)
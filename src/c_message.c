@@ -42,7 +42,7 @@
 
 static void c_message(struct client *, const char *parv[], int parc);
 
-struct scommand_handler privmsg_command = { "PRIVMSG", c_message, 0, DLINK_EMPTY };
+struct scommand_handler privmsg_command = { "PRIVMSG", c_message, 0, 0, { NULL } };
 
 static void
 c_message(struct client *client_p, const char *parv[], int parc)
@@ -42,9 +42,9 @@
 static void c_mode(struct client *, const char *parv[], int parc);
 static void c_tmode(struct client *, const char *parv[], int parc);
 static void c_bmask(struct client *, const char *parv[], int parc);
-struct scommand_handler mode_command = { "MODE", c_mode, 0, DLINK_EMPTY };
-struct scommand_handler tmode_command = { "TMODE", c_tmode, 0, DLINK_EMPTY };
-struct scommand_handler bmask_command = { "BMASK", c_bmask, 0, DLINK_EMPTY };
+struct scommand_handler mode_command = { "MODE", c_mode, 0, 0, { NULL } };
+struct scommand_handler tmode_command = { "TMODE", c_tmode, 0, 0, { NULL } };
+struct scommand_handler bmask_command = { "BMASK", c_bmask, 0, 0, { NULL } };
 
 /* linked list of services that were deopped */
 static dlink_list deopped_list;
@@ -41,13 +41,16 @@
 #include "balloc.h"
 #include "io.h"
 #include "hook.h"
+#include "htable.h"
 
-static dlink_list channel_table[MAX_CHANNEL_TABLE];
+static struct htable channel_table;
 dlink_list channel_list;
 
 static BlockHeap *channel_heap;
 static BlockHeap *chmember_heap;
 
+static const char *channel_name_key(void *);
+
 static void c_join(struct client *, const char *parv[], int parc);
 static void c_kick(struct client *, const char *parv[], int parc);
 static void c_part(struct client *, const char *parv[], int parc);
@@ -55,12 +58,12 @@ static void c_sjoin(struct client *, const char *parv[], int parc);
 static void c_tb(struct client *, const char *parv[], int parc);
 static void c_topic(struct client *, const char *parv[], int parc);
 
-static struct scommand_handler join_command = { "JOIN", c_join, 0, DLINK_EMPTY };
-static struct scommand_handler kick_command = { "KICK", c_kick, 0, DLINK_EMPTY };
-static struct scommand_handler part_command = { "PART", c_part, 0, DLINK_EMPTY };
-static struct scommand_handler sjoin_command = { "SJOIN", c_sjoin, 0, DLINK_EMPTY };
-static struct scommand_handler tb_command = { "TB", c_tb, 0, DLINK_EMPTY };
-static struct scommand_handler topic_command = { "TOPIC", c_topic, 0, DLINK_EMPTY };
+static struct scommand_handler join_command = { "JOIN", c_join, 0, 0, { NULL } };
+static struct scommand_handler kick_command = { "KICK", c_kick, 0, 0, { NULL } };
+static struct scommand_handler part_command = { "PART", c_part, 0, 0, { NULL } };
+static struct scommand_handler sjoin_command = { "SJOIN", c_sjoin, 0, 0, { NULL } };
+static struct scommand_handler tb_command = { "TB", c_tb, 0, 0, { NULL } };
+static struct scommand_handler topic_command = { "TOPIC", c_topic, 0, 0, { NULL } };
 
 /* init_channel()
  *   initialises various things
@@ -71,6 +74,8 @@ init_channel(void)
         channel_heap = BlockHeapCreate("Channel", sizeof(struct channel), HEAP_CHANNEL);
         chmember_heap = BlockHeapCreate("Channel Member", sizeof(struct chmember), HEAP_CHMEMBER);
 
+	htable_init(&channel_table, "Channels", CHANNEL_HASH_MIN, channel_name_key, irccmp);
+
 	add_scommand_handler(&join_command);
 	add_scommand_handler(&kick_command);
 	add_scommand_handler(&part_command);
@@ -79,24 +84,10 @@ init_channel(void)
 	add_scommand_handler(&topic_command);
 }
 
-/* hash_channel()
- *   hashes the name of a channel
- *
- * inputs	- channel name
- * outputs	- hash value
- */
-unsigned int
-hash_channel(const char *p)
+static const char *
+channel_name_key(void *data)
 {
-	int i = 30;
-	unsigned int h = 0;
-
-	while(*p && --i)
-	{
-		h = (h << 4) - (h + (unsigned char) ToLower(*p++));
-	}
-
-	return(h & (MAX_CHANNEL_TABLE-1));
+	return ((struct channel *) data)->name;
 }
 
 int
@@ -120,8 +111,7 @@ valid_chname(const char *name)
 void
 add_channel(struct channel *chptr)
 {
-	unsigned int hashv = hash_channel(chptr->name);
-	dlink_add(chptr, &chptr->nameptr, &channel_table[hashv]);
+	htable_add(&channel_table, chptr);
 	dlink_add(chptr, &chptr->listptr, &channel_list);
 }
 
@@ -134,8 +124,7 @@ add_channel(struct channel *chptr)
 void
 del_channel(struct channel *chptr)
 {
-	unsigned int hashv = hash_channel(chptr->name);
-	dlink_delete(&chptr->nameptr, &channel_table[hashv]);
+	htable_del(&channel_table, chptr);
 	dlink_delete(&chptr->listptr, &channel_list);
 }
 
@@ -148,19 +137,104 @@ del_channel(struct channel *chptr)
 struct channel *
 find_channel(const char *name)
 {
-	struct channel *chptr;
+	return htable_find(&channel_table, name);
+}
+
+/* chmember_hashv()
+ *   hashes a client pointer for a channels member hash.  The low bits
+ *   are the same for every client, so they're shifted out first.
+ */
+static unsigned int
+chmember_hashv(struct client *client_p)
+{
+	unsigned long p = (unsigned long) client_p;
+
+	return ((p >> 4) ^ (p >> 16)) * 2654435761U;
+}
+
+/* chmember_hash_insert()
+ *   adds a member to the hash, which must have room for it
+ */
+static void
+chmember_hash_insert(struct channel *chptr, struct chmember *mptr)
+{
+	unsigned int mask = chptr->members_size - 1;
+	unsigned int i;
+
+	for(i = chmember_hashv(mptr->client_p) & mask; chptr->members[i] != NULL;
+	    i = (i + 1) & mask)
+		;
+
+	chptr->members[i] = mptr;
+}
+
+/* chmember_hash_build()
+ *   (re)builds a channels member hash from its users, sized so it is at
+ *   most a quarter full
+ */
+static void
+chmember_hash_build(struct channel *chptr)
+{
+	unsigned int count = dlink_list_length(&chptr->users);
 	dlink_node *ptr;
-	unsigned int hashv = hash_channel(name);
 
-	DLINK_FOREACH(ptr, channel_table[hashv].head)
+	my_free(chptr->members);
+
+	chptr->members_size = CHMEMBER_HASH_MIN * 2;
+
+	while(chptr->members_size < count * 4)
+		chptr->members_size *= 2;
+
+	chptr->members = my_calloc(chptr->members_size, sizeof(struct chmember *));
+
+	DLINK_FOREACH(ptr, chptr->users.head)
 	{
-		chptr = ptr->data;
+		chmember_hash_insert(chptr, ptr->data);
+	}
+}
+
+static void
+chmember_hash_free(struct channel *chptr)
+{
+	my_free(chptr->members);
+	chptr->members = NULL;
+	chptr->members_size = 0;
+}
 
-		if(!irccmp(chptr->name, name))
-			return chptr;
+/* chmember_hash_delete()
+ *   removes a member from the hash, moving back any entries after it
+ *   that could no longer be reached
+ */
+static void
+chmember_hash_delete(struct channel *chptr, struct chmember *mptr)
+{
+	unsigned int mask = chptr->members_size - 1;
+	unsigned int i, j, home;
+
+	for(i = chmember_hashv(mptr->client_p) & mask; chptr->members[i] != mptr;
+	    i = (i + 1) & mask)
+	{
+		if(chptr->members[i] == NULL)
+		{
+			s_assert(0);
+			return;
+		}
 	}
 
-	return NULL;
+	chptr->members[i] = NULL;
+
+	for(j = (i + 1) & mask; chptr->members[j] != NULL; j = (j + 1) & mask)
+	{
+		home = chmember_hashv(chptr->members[j]->client_p) & mask;
+
+		/* leave it if its home is cyclically in (i, j] */
+		if(i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+
+		chptr->members[i] = chptr->members[j];
+		chptr->members[j] = NULL;
+		i = j;
+	}
 }
 
 /* free_channel()
@@ -177,6 +251,9 @@ free_channel(struct channel *chptr)
 
 	del_channel(chptr);
 
+	if(chptr->members != NULL)
+		chmember_hash_free(chptr);
+
 	BlockHeapFree(channel_heap, chptr);
 }
 
@@ -200,6 +277,16 @@ add_chmember(struct channel *chptr, struct client *target_p, int flags)
 	dlink_add(mptr, &mptr->chnode, &chptr->users);
 	dlink_add(mptr, &mptr->usernode, &target_p->user->channels);
 
+	if(chptr->members != NULL)
+	{
+		if(dlink_list_length(&chptr->users) * 2 > chptr->members_size)
+			chmember_hash_build(chptr);
+		else
+			chmember_hash_insert(chptr, mptr);
+	}
+	else if(dlink_list_length(&chptr->users) >= CHMEMBER_HASH_MIN)
+		chmember_hash_build(chptr);
+
 	return mptr;
 }
 
@@ -224,6 +311,16 @@ del_chmember(struct chmember *mptr)
 	dlink_delete(&mptr->chnode, &chptr->users);
 	dlink_delete(&mptr->usernode, &client_p->user->channels);
 
+	if(chptr->members != NULL)
+	{
+		if(dlink_list_length(&chptr->users) < CHMEMBER_HASH_MIN / 2)
+			chmember_hash_free(chptr);
+		else if(dlink_list_length(&chptr->users) * 16 < chptr->members_size)
+			chmember_hash_build(chptr);
+		else
+			chmember_hash_delete(chptr, mptr);
+	}
+
 	if(dlink_list_length(&chptr->users) == 0 &&
 	   dlink_list_length(&chptr->services) == 0)
 		free_channel(chptr);
@@ -231,8 +328,64 @@ del_chmember(struct chmember *mptr)
 	BlockHeapFree(chmember_heap, mptr);
 }
 
+/* del_chmember_split()
+ *   removes a member lost in a netsplit.  The first time a channel is
+ *   touched it drops its member hash, which is cheaper than deleting
+ *   from it member by member, and is added to channels for
+ *   finish_chmember_split().  The hash is rebuilt by the next join, if
+ *   the channel is still large enough to need one.
+ *
+ * inputs	- chmember to remove, channels touched by the split
+ * outputs	-
+ */
+void
+del_chmember_split(struct chmember *mptr, dlink_list *channels)
+{
+	struct channel *chptr = mptr->chptr;
+
+	dlink_delete(&mptr->chnode, &chptr->users);
+	dlink_delete(&mptr->usernode, &mptr->client_p->user->channels);
+
+	if(chptr->splitptr.data == NULL)
+	{
+		if(chptr->members != NULL)
+			chmember_hash_free(chptr);
+
+		dlink_add(chptr, &chptr->splitptr, channels);
+	}
+
+	BlockHeapFree(chmember_heap, mptr);
+}
+
+/* finish_chmember_split()
+ *   frees the channels a netsplit emptied
+ *
+ * inputs	- channels touched by the split
+ * outputs	-
+ */
+void
+finish_chmember_split(dlink_list *channels)
+{
+	struct channel *chptr;
+	dlink_node *ptr, *next_ptr;
+
+	DLINK_FOREACH_SAFE(ptr, next_ptr, channels->head)
+	{
+		chptr = ptr->data;
+
+		dlink_delete(ptr, channels);
+		ptr->data = NULL;
+
+		if(dlink_list_length(&chptr->users) == 0 &&
+		   dlink_list_length(&chptr->services) == 0)
+			free_channel(chptr);
+	}
+}
+
 /* find_chmember()
- *   hunts for a chmember struct for the given user in given channel
+ *   hunts for a chmember struct for the given user in given channel.
+ *   Large channels are looked up in their member hash, otherwise we walk
+ *   whichever is shorter of the channels users and the users channels.
  *
  * inputs	- channel to search, client to search for
  * outputs	- chmember struct if found, else NULL
@@ -242,6 +395,22 @@ find_chmember(struct channel *chptr, struct client *target_p)
 {
 	struct chmember *mptr;
 	dlink_node *ptr;
+	unsigned int mask;
+	unsigned int i;
+
+	if(chptr->members != NULL)
+	{
+		mask = chptr->members_size - 1;
+
+		for(i = chmember_hashv(target_p) & mask; (mptr = chptr->members[i]) != NULL;
+		    i = (i + 1) & mask)
+		{
+			if(mptr->client_p == target_p)
+				return mptr;
+		}
+
+		return NULL;
+	}
 
 	if (dlink_list_length(&chptr->users) < dlink_list_length(&target_p->user->channels))
 	{
@@ -303,6 +472,32 @@ count_topics(void)
         return topic_count;
 }
 
+/* count_chmember_hashes()
+ *   counts the channels with a member hash, and the memory they use
+ *
+ * inputs	- pointers to set to the number of hashes and their size
+ * outputs	-
+ */
+void
+count_chmember_hashes(size_t *count, size_t *sz_mem)
+{
+	struct channel *chptr;
+	dlink_node *ptr;
+
+	*count = *sz_mem = 0;
+
+	DLINK_FOREACH(ptr, channel_list.head)
+	{
+		chptr = ptr->data;
+
+		if(chptr->members == NULL)
+			continue;
+
+		(*count)++;
+		*sz_mem += chptr->members_size * sizeof(struct chmember *);
+	}
+}
+
 /* join service to chname, create channel with TS tsinfo, using mode in the
  * SJOIN. if channel already exists, don't use tsinfo -- jilles */
 /* that is, unless override is specified */
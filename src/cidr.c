@@ -374,3 +374,50 @@ match_cidr(const char *s1, const char *s2)
 		return 1;
 }
 
+/* parse_ip()
+ *
+ * Input - address, buffer of at least 16 bytes for it in binary
+ * Output - 4 or 6 for its family, 0 if it isnt an address
+ */
+int
+parse_ip(const char *ip, unsigned char *addr)
+{
+	if (strchr(ip, ':'))
+		return inet_pton6(ip, addr) ? 6 : 0;
+
+	return inet_pton4(ip, addr) ? 4 : 0;
+}
+
+/* parse_cidr()
+ *
+ * Input - ip/len, buffer of at least 16 bytes for the ip in binary,
+ *	   where to put len
+ * Output - 4 or 6 for its family, 0 if it isnt valid the way
+ *	    match_ips() sees it
+ */
+int
+parse_cidr(const char *mask, unsigned char *addr, int *bits)
+{
+	char ipmask[BUFSIZE];
+	char *len;
+	int family;
+
+	strlcpy(ipmask, mask, sizeof ipmask);
+
+	len = strrchr(ipmask, '/');
+	if (len == NULL)
+		return 0;
+
+	*len++ = '\0';
+
+	*bits = atoi(len);
+	if (*bits == 0)
+		return 0;
+
+	family = parse_ip(ipmask, addr);
+
+	if (*bits > (family == 6 ? 128 : 32))
+		return 0;
+
+	return family;
+}
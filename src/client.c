@@ -44,10 +44,27 @@
 #include "hook.h"
 #include "s_userserv.h"
 #include "conf.h"
+#include "htable.h"
 
-static dlink_list name_table[MAX_NAME_HASH];
-static dlink_list uid_table[MAX_NAME_HASH];
-static dlink_list host_table[MAX_HOST_HASH];
+struct uid_page
+{
+	unsigned int count;
+	struct client *clients[UID_PAGE_SIZE];
+};
+
+struct uid_sid
+{
+	struct client *server;
+	struct uid_page **pages;
+	unsigned int page_count;	/* size of pages */
+	unsigned int used;		/* pages in use */
+};
+
+static struct htable name_table;
+static struct htable uid_table;
+static struct htable host_table;
+
+static struct uid_sid *uid_sids[UID_SID_MAX];
 
 dlink_list user_list;
 dlink_list oper_list;
@@ -61,6 +78,10 @@ static BlockHeap *host_heap;
 
 static void cleanup_host_table(void *);
 
+static const char *client_name_key(void *);
+static const char *client_uid_key(void *);
+static const char *host_name_key(void *);
+
 static void c_kill(struct client *, const char *parv[], int parc);
 static void c_nick(struct client *, const char *parv[], int parc);
 static void c_uid(struct client *, const char *parv[], int parc);
@@ -69,13 +90,13 @@ static void c_server(struct client *, const char *parv[], int parc);
 static void c_sid(struct client *, const char *parv[], int parc);
 static void c_squit(struct client *, const char *parv[], int parc);
 
-static struct scommand_handler kill_command = { "KILL", c_kill, 0, DLINK_EMPTY };
-static struct scommand_handler nick_command = { "NICK", c_nick, 0, DLINK_EMPTY };
-static struct scommand_handler uid_command = { "UID", c_uid, 0, DLINK_EMPTY };
-static struct scommand_handler quit_command = { "QUIT", c_quit, 0, DLINK_EMPTY };
-static struct scommand_handler server_command = { "SERVER", c_server, FLAGS_UNKNOWN, DLINK_EMPTY};
-static struct scommand_handler sid_command = { "SID", c_sid, 0, DLINK_EMPTY};
-static struct scommand_handler squit_command = { "SQUIT", c_squit, 0, DLINK_EMPTY };
+static struct scommand_handler kill_command = { "KILL", c_kill, 0, 0, { NULL } };
+static struct scommand_handler nick_command = { "NICK", c_nick, 0, 0, { NULL } };
+static struct scommand_handler uid_command = { "UID", c_uid, 0, 0, { NULL } };
+static struct scommand_handler quit_command = { "QUIT", c_quit, 0, 0, { NULL } };
+static struct scommand_handler server_command = { "SERVER", c_server, FLAGS_UNKNOWN, 0, { NULL } };
+static struct scommand_handler sid_command = { "SID", c_sid, 0, 0, { NULL } };
+static struct scommand_handler squit_command = { "SQUIT", c_squit, 0, 0, { NULL } };
 
 /* init_client()
  *   initialises various things
@@ -88,6 +109,10 @@ init_client(void)
         server_heap = BlockHeapCreate("Server", sizeof(struct server), HEAP_SERVER);
 	host_heap = BlockHeapCreate("Hostname", sizeof(struct host_entry), HEAP_HOST);
 
+	htable_init(&name_table, "Client names", NAME_HASH_MIN, client_name_key, irccmp);
+	htable_init(&uid_table, "Client UIDs", NAME_HASH_MIN, client_uid_key, strcmp);
+	htable_init(&host_table, "Hostnames", HOST_HASH_MIN, host_name_key, irccmp);
+
 	eventAdd("cleanup_host_table", cleanup_host_table, NULL, 3600);
 
 	add_scommand_handler(&kill_command);
@@ -99,36 +124,189 @@ init_client(void)
 	add_scommand_handler(&squit_command);
 }
 
-/* hash_name()
- *   hashes a nickname
+static const char *
+client_name_key(void *data)
+{
+	return ((struct client *) data)->name;
+}
+
+static const char *
+client_uid_key(void *data)
+{
+	return ((struct client *) data)->uid;
+}
+
+static const char *
+host_name_key(void *data)
+{
+	return ((struct host_entry *) data)->name;
+}
+
+static int
+uid_char(char c)
+{
+	if(c >= 'A' && c <= 'Z')
+		return c - 'A';
+
+	if(c >= '0' && c <= '9')
+		return c - '0' + 26;
+
+	return -1;
+}
+
+/* uid_decode()
+ *   works out where an id lives
  *
- * inputs       - nickname to hash
- * outputs      - hash value of nickname
+ * inputs	- id, pointers to set to its SID slot and index
+ * outputs	- 1 for a SID, 2 for a UID (when index is set too), or 0
+ *		  if its neither, and should be hashed
  */
-unsigned int
-hash_name(const char *p)
+static int
+uid_decode(const char *id, unsigned int *sid, unsigned int *index)
 {
-	unsigned int h = 0;
+	unsigned int value = 0;
+	int c1, c2;
+	int c;
+	int i;
 
-	while(*p)
+	if(!IsDigit(id[0]) || (c1 = uid_char(id[1])) < 0 || (c2 = uid_char(id[2])) < 0)
+		return 0;
+
+	*sid = (id[0] - '0') * 36 * 36 + c1 * 36 + c2;
+
+	if(id[3] == '\0')
+		return 1;
+
+	for(i = 3; i < UIDLEN; i++)
 	{
-		h = (h << 4) - (h + (unsigned char) ToLower(*p++));
+		if((c = uid_char(id[i])) < 0)
+			return 0;
+
+		value = value * 36 + c;
 	}
 
-	return(h & (MAX_NAME_HASH-1));
+	if(id[UIDLEN] != '\0')
+		return 0;
+
+	*index = value;
+	return 2;
 }
 
-static unsigned int
-hash_host(const char *p)
+static struct uid_sid *
+uid_get_sid(unsigned int sid)
 {
-	unsigned int h = 0;
+	if(uid_sids[sid] == NULL)
+		uid_sids[sid] = my_malloc(sizeof(struct uid_sid));
 
-	while(*p)
+	return uid_sids[sid];
+}
+
+/* uid_put_sid()
+ *   frees a SID slot once it has no server or users left
+ */
+static void
+uid_put_sid(unsigned int sid)
+{
+	struct uid_sid *sid_p = uid_sids[sid];
+
+	if(sid_p->server != NULL || sid_p->used)
+		return;
+
+	my_free(sid_p->pages);
+	my_free(sid_p);
+	uid_sids[sid] = NULL;
+}
+
+static void
+add_uid(struct client *target_p)
+{
+	struct uid_sid *sid_p;
+	struct uid_page *page_p;
+	unsigned int sid, index, page;
+	unsigned int count;
+
+	switch(uid_decode(target_p->uid, &sid, &index))
+	{
+		case 1:
+			uid_get_sid(sid)->server = target_p;
+			return;
+
+		case 2:
+			break;
+
+		default:
+			htable_add(&uid_table, target_p);
+			return;
+	}
+
+	sid_p = uid_get_sid(sid);
+	page = index / UID_PAGE_SIZE;
+
+	if(page >= sid_p->page_count)
 	{
-		h = (h << 4) - (h + (unsigned char) ToLower(*p++));
+		for(count = sid_p->page_count ? sid_p->page_count : 16; count <= page; count *= 2)
+			;
+
+		sid_p->pages = my_realloc(sid_p->pages, count * sizeof(struct uid_page *));
+		memset(sid_p->pages + sid_p->page_count, 0,
+			(count - sid_p->page_count) * sizeof(struct uid_page *));
+		sid_p->page_count = count;
 	}
 
-	return (h & (MAX_HOST_HASH - 1));
+	if((page_p = sid_p->pages[page]) == NULL)
+	{
+		page_p = sid_p->pages[page] = my_malloc(sizeof(struct uid_page));
+		sid_p->used++;
+	}
+
+	/* ids are unique, but dont lose count if we're sent one twice */
+	if(page_p->clients[index % UID_PAGE_SIZE] == NULL)
+		page_p->count++;
+
+	page_p->clients[index % UID_PAGE_SIZE] = target_p;
+}
+
+static void
+del_uid(struct client *target_p)
+{
+	struct uid_sid *sid_p;
+	struct uid_page *page_p;
+	unsigned int sid, index, page;
+
+	switch(uid_decode(target_p->uid, &sid, &index))
+	{
+		case 1:
+			if((sid_p = uid_sids[sid]) != NULL && sid_p->server == target_p)
+			{
+				sid_p->server = NULL;
+				uid_put_sid(sid);
+			}
+			return;
+
+		case 2:
+			break;
+
+		default:
+			htable_del(&uid_table, target_p);
+			return;
+	}
+
+	page = index / UID_PAGE_SIZE;
+
+	if((sid_p = uid_sids[sid]) == NULL || page >= sid_p->page_count ||
+	   (page_p = sid_p->pages[page]) == NULL ||
+	   page_p->clients[index % UID_PAGE_SIZE] != target_p)
+		return;
+
+	page_p->clients[index % UID_PAGE_SIZE] = NULL;
+
+	if(--page_p->count == 0)
+	{
+		my_free(page_p);
+		sid_p->pages[page] = NULL;
+		sid_p->used--;
+		uid_put_sid(sid);
+	}
 }
 
 /* add_client()
@@ -140,14 +318,10 @@ hash_host(const char *p)
 void
 add_client(struct client *target_p)
 {
-	unsigned int hashv = hash_name(target_p->name);
-	dlink_add(target_p, &target_p->nameptr, &name_table[hashv]);
+	htable_add(&name_table, target_p);
 
 	if(!EmptyString(target_p->uid))
-	{
-		hashv = hash_name(target_p->uid);
-		dlink_add(target_p, &target_p->uidptr, &uid_table[hashv]);
-	}
+		add_uid(target_p);
 }
 
 /* del_client()
@@ -159,14 +333,10 @@ add_client(struct client *target_p)
 void
 del_client(struct client *target_p)
 {
-	unsigned int hashv = hash_name(target_p->name);
-	dlink_delete(&target_p->nameptr, &name_table[hashv]);
+	htable_del(&name_table, target_p);
 
 	if(!EmptyString(target_p->uid))
-	{
-		hashv = hash_name(target_p->uid);
-		dlink_delete(&target_p->uidptr, &uid_table[hashv]);
-	}
+		del_uid(target_p);
 }
 
 /* find_client()
@@ -179,8 +349,6 @@ struct client *
 find_client(const char *name)
 {
 	struct client *target_p;
-	dlink_node *ptr;
-	unsigned int hashv;
 
 	if(IsDigit(*name))
 	{
@@ -193,55 +361,73 @@ find_client(const char *name)
 	/* search nicks even if its a uid, as it may be possible for a uid
 	 * to be a nick in the future
 	 */
-	hashv = hash_name(name);
-
-	DLINK_FOREACH(ptr, name_table[hashv].head)
-	{
-		target_p = ptr->data;
-
-		if(!irccmp(target_p->name, name))
-			return target_p;
-	}
-
-	return NULL;
+	return htable_find(&name_table, name);
 }
 
 struct client *
 find_named_client(const char *name)
 {
-	struct client *target_p;
-	dlink_node *ptr;
-	unsigned int hashv; 
+	return htable_find(&name_table, name);
+}
 
-	hashv = hash_name(name);
+/* find_uid()
+ *   finds a client by its id, which must match exactly
+ *
+ * inputs	- id to find
+ * outputs	- struct client, or NULL if not found
+ */
+struct client *
+find_uid(const char *name)
+{
+	struct uid_sid *sid_p;
+	struct uid_page *page_p;
+	unsigned int sid, index, page;
 
-	DLINK_FOREACH(ptr, name_table[hashv].head)
+	switch(uid_decode(name, &sid, &index))
 	{
-		target_p = ptr->data;
+		case 1:
+			return uid_sids[sid] != NULL ? uid_sids[sid]->server : NULL;
 
-		if(!irccmp(target_p->name, name))
-			return target_p;
+		case 2:
+			break;
+
+		default:
+			return htable_find(&uid_table, name);
 	}
 
-	return NULL;
+	page = index / UID_PAGE_SIZE;
+
+	if((sid_p = uid_sids[sid]) == NULL || page >= sid_p->page_count ||
+	   (page_p = sid_p->pages[page]) == NULL)
+		return NULL;
+
+	return page_p->clients[index % UID_PAGE_SIZE];
 }
 
-struct client *
-find_uid(const char *name)
+/* count_uid_pages()
+ *   counts the pages of UIDs, and the memory they and the SID slots use
+ *
+ * inputs	- pointers to set to the number of pages and their size
+ * outputs	-
+ */
+void
+count_uid_pages(size_t *count, size_t *sz_mem)
 {
-	struct client *target_p;
-	dlink_node *ptr;
-	unsigned int hashv = hash_name(name);
+	unsigned int i;
+
+	*count = 0;
+	*sz_mem = sizeof(uid_sids);
 
-	DLINK_FOREACH(ptr, uid_table[hashv].head)
+	for(i = 0; i < UID_SID_MAX; i++)
 	{
-		target_p = ptr->data;
+		if(uid_sids[i] == NULL)
+			continue;
 
-		if(!irccmp(target_p->uid, name))
-			return target_p;
+		*count += uid_sids[i]->used;
+		*sz_mem += sizeof(struct uid_sid) +
+			uid_sids[i]->page_count * sizeof(struct uid_page *) +
+			uid_sids[i]->used * sizeof(struct uid_page);
 	}
-
-	return NULL;
 }
 
 /* find_user()
@@ -310,23 +496,20 @@ static void
 cleanup_host_table(void *unused)
 {
 	struct host_entry *hent;
-	dlink_node *ptr, *next_ptr;
-	int i;
+	unsigned int i;
 
-	HASH_WALK_SAFE(i, MAX_HOST_HASH, ptr, next_ptr, host_table)
+	HTABLE_WALK(i, hent, &host_table)
 	{
-		hent = ptr->data;
-
 		if(hent->flood_expire < CURRENT_TIME &&
 		   hent->cregister_expire < CURRENT_TIME &&
 		   hent->uregister_expire < CURRENT_TIME)
 		{
-			dlink_delete(&hent->node, &host_table[i]);
+			htable_del(&host_table, hent);
 			my_free(hent->name);
 			BlockHeapFree(host_heap, hent);
 		}
 	}
-	HASH_WALK_END
+	HTABLE_WALK_END
 }
 
 /* find_host()
@@ -339,20 +522,13 @@ struct host_entry *
 find_host(const char *name)
 {
 	struct host_entry *hent;
-	dlink_node *ptr;
-	unsigned int hashv = hash_host(name);
 
-	DLINK_FOREACH(ptr, host_table[hashv].head)
-	{
-		hent = ptr->data;
-
-		if(!irccmp(hent->name, name))
-			return hent;
-	}
+	if((hent = htable_find(&host_table, name)) != NULL)
+		return hent;
 
 	hent = BlockHeapAlloc(host_heap);
 	hent->name = my_strdup(name);
-	dlink_add(hent, &hent->node, &host_table[hashv]);
+	htable_add(&host_table, hent);
 
 	return hent;
 }
@@ -408,76 +584,113 @@ generate_uid(void)
 }
 
 
-/* exit_user()
- *   exits a user, removing them from channels and lists
+/* unlink_user()
+ *   removes a user from the lists and channels they are in, without
+ *   searching for them in any of them
  *
- * inputs       - client to exit
- * outputs      -
+ * inputs	- client to unlink, list to gather a netsplits channels on
+ *		  (NULL if this user is exiting alone)
+ * outputs	-
  */
 static void
-exit_user(struct client *target_p)
+unlink_user(struct client *target_p, dlink_list *channels)
 {
 	dlink_node *ptr;
 	dlink_node *next_ptr;
 
-	if(IsDead(target_p))
-		return;
-
-	SetDead(target_p);
-
-	hook_call(HOOK_USER_EXIT, target_p, NULL);
-
 #ifdef ENABLE_USERSERV
 	if(target_p->user->user_reg)
-		dlink_find_destroy(target_p, &target_p->user->user_reg->users);
+		dlink_delete(&target_p->user->regptr, &target_p->user->user_reg->users);
 #endif
 
 	if(target_p->user->oper)
 	{
-		dlink_find_destroy(target_p, &oper_list);
+		dlink_delete(&target_p->user->operptr, &oper_list);
 		deallocate_conf_oper(target_p->user->oper);
 	}
 
 	DLINK_FOREACH_SAFE(ptr, next_ptr, target_p->user->channels.head)
 	{
-		del_chmember(ptr->data);
+		if(channels != NULL)
+			del_chmember_split(ptr->data, channels);
+		else
+			del_chmember(ptr->data);
 	}
 
-	dlink_move_node(&target_p->listnode, &user_list, &exited_list);
 	dlink_delete(&target_p->upnode, &target_p->uplink->server->users);
 }
 
-/* exit_server()
- *   exits a server, removing their dependencies
+/* exit_user()
+ *   exits a user, removing them from channels and lists
  *
  * inputs       - client to exit
  * outputs      -
  */
 static void
-exit_server(struct client *target_p)
+exit_user(struct client *target_p)
 {
-	dlink_node *ptr;
-	dlink_node *next_ptr;
-
 	if(IsDead(target_p))
 		return;
 
 	SetDead(target_p);
 
-        /* first exit each of this servers users */
-	DLINK_FOREACH_SAFE(ptr, next_ptr, target_p->server->users.head)
+	hook_call(HOOK_USER_EXIT, target_p, NULL);
+
+	/* any passwords still being hashed for them are now moot */
+	crypt_cancel(target_p);
+
+	unlink_user(target_p, NULL);
+
+	dlink_move_node(&target_p->listnode, &user_list, &exited_list);
+}
+
+/* exit_server_collect()
+ *   marks a server and everything behind it dead, moving their users
+ *   from user_list onto users
+ *
+ * inputs	- server, list to collect users on
+ * outputs	-
+ */
+static void
+exit_server_collect(struct client *target_p, dlink_list *users)
+{
+	struct client *client_p;
+	dlink_node *ptr;
+
+	SetDead(target_p);
+
+	DLINK_FOREACH(ptr, target_p->server->users.head)
 	{
-		exit_client(ptr->data);
+		client_p = ptr->data;
+
+		SetDead(client_p);
+		dlink_move_node(&client_p->listnode, &user_list, users);
 	}
 
-        /* then exit each of their servers.. */
-	DLINK_FOREACH_SAFE(ptr, next_ptr, target_p->server->servers.head)
+	DLINK_FOREACH(ptr, target_p->server->servers.head)
 	{
-		exit_client(ptr->data);
+		exit_server_collect(ptr->data, users);
 	}
+}
+
+/* exit_server_tree()
+ *   moves a server and everything behind it onto exited_list, once
+ *   their users have gone
+ *
+ * inputs	- server
+ * outputs	-
+ */
+static void
+exit_server_tree(struct client *target_p)
+{
+	dlink_node *ptr;
+	dlink_node *next_ptr;
 
-	/* do this after all its leaf servers have been removed */
-	hook_call(HOOK_SERVER_EXIT, target_p, NULL);
+	DLINK_FOREACH_SAFE(ptr, next_ptr, target_p->server->servers.head)
+	{
+		exit_server_tree(ptr->data);
+		del_client(ptr->data);
+	}
 
 	dlink_move_node(&target_p->listnode, &server_list, &exited_list);
 
@@ -486,6 +699,54 @@ exit_server(struct client *target_p)
 		dlink_delete(&target_p->upnode, &target_p->uplink->server->servers);
 }
 
+/* exit_server()
+ *   exits a server and everything behind it in one go.  The users lost
+ *   are gathered up first and handed to HOOK_SERVER_EXIT together, then
+ *   torn down with the channels they were in tidied once at the end.
+ *   Everything lost is left on exited_list, to be freed on the next pass
+ *   of the io loop.
+ *
+ * inputs       - client to exit
+ * outputs      -
+ */
+static void
+exit_server(struct client *target_p)
+{
+	struct client *client_p;
+	dlink_list users;
+	dlink_list channels;
+	dlink_node *ptr;
+	dlink_node *next_ptr;
+
+	if(IsDead(target_p))
+		return;
+
+	memset(&users, 0, sizeof(dlink_list));
+	memset(&channels, 0, sizeof(dlink_list));
+
+	exit_server_collect(target_p, &users);
+
+	/* the whole split is still linked up for the hook to look at */
+	hook_call(HOOK_SERVER_EXIT, target_p, &users);
+
+	if(dlink_list_length(&users))
+		crypt_cancel_dead();
+
+	DLINK_FOREACH_SAFE(ptr, next_ptr, users.head)
+	{
+		client_p = ptr->data;
+
+		unlink_user(client_p, &channels);
+		del_client(client_p);
+
+		dlink_move_node(ptr, &users, &exited_list);
+	}
+
+	finish_chmember_split(&channels);
+
+	exit_server_tree(target_p);
+}
+
 /* exit_client()
  *   exits a generic client, calling functions specific for that client
  *
@@ -707,7 +968,7 @@ c_nick(struct client *client_p, const char *parv[], int parc)
 		if(IsEOB(uplink_p))
 			hook_call(HOOK_NEW_CLIENT, target_p, NULL);
 		else
-			hook_call(HOOK_NEW_CLIENT_BURST, target_p, NULL);
+			hook_call_batch(HOOK_NEW_CLIENT_BURST, target_p);
 	}
 
         /* client changing nicks */
@@ -733,6 +994,9 @@ c_nick(struct client *client_p, const char *parv[], int parc)
 		my_free(client_p->user->mask);
 		client_p->user->mask = my_strdup(buf);
 
+		/* ignores are matched against the mask */
+		client_p->user->ignore_serial = 0;
+
 		client_p->user->tsinfo = atol(parv[1]);
 
 		hook_call(HOOK_NICKCHANGE, client_p, NULL);
@@ -829,7 +1093,7 @@ c_uid(struct client *client_p, const char *parv[], int parc)
 	if(IsEOB(client_p))
 		hook_call(HOOK_NEW_CLIENT, target_p, NULL);
 	else
-		hook_call(HOOK_NEW_CLIENT_BURST, target_p, NULL);
+		hook_call_batch(HOOK_NEW_CLIENT_BURST, target_p);
 }
 
 /* c_quit()
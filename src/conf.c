@@ -62,6 +62,8 @@ set_default_conf(void)
 
 	config_file.ping_time = 300;
 	config_file.reconnect_time = 300;
+	config_file.crypt_threads = 2;
+	config_file.crypt_scheme = CRYPT_MD5;
 
 	config_file.ratbox = 1;
 	config_file.allow_stats_o = 1;
@@ -173,6 +175,23 @@ validate_conf(void)
 	if(config_file.reconnect_time <= 0)
 		config_file.reconnect_time = 300;
 
+	if(config_file.cork_size < 0)
+		config_file.cork_size = 0;
+
+	if(config_file.crypt_threads < 0)
+		config_file.crypt_threads = 0;
+
+	if(!crypt_supported(config_file.crypt_scheme))
+	{
+		mlog("warning: crypt() does not support the configured crypt_scheme, using %s",
+			crypt_supported(CRYPT_MD5) ? "md5" : "des");
+		config_file.crypt_scheme = crypt_supported(CRYPT_MD5) ? CRYPT_MD5 : CRYPT_DES;
+	}
+
+	/* sha crypt clamps rounds to 1000-999999999 itself */
+	if(config_file.crypt_rounds < 0)
+		config_file.crypt_rounds = 0;
+
 	if(config_file.pending_time <= 0)
 		config_file.pending_time = 1800;
 
@@ -23,11 +23,71 @@
 */
 #include "stdinc.h"
 #include "rserv.h"
+#include "tools.h"
+#include "io.h"
+#include "client.h"
+#include "conf.h"
+#include "log.h"
 
 #ifdef HAVE_CRYPT_H
 #include <crypt.h>
 #endif
 
+/* long enough for the output of any crypt() format we generate */
+#define CRYPT_RESULT_LEN	(CRYPTLEN + 1)
+
+#define CRYPT_MAX_THREADS	16
+
+/* once this many hashes are outstanding, further ones are done inline */
+#define CRYPT_MAX_PENDING	256
+
+struct crypt_job
+{
+	struct crypt_job *next;		/* worker queues, under crypt_lock */
+	dlink_node node;		/* crypt_pending, main thread only */
+
+	struct client *client_p;	/* NULL once they've exited */
+	crypt_callback callback;
+	void *arg;
+
+	char password[BUFSIZE];
+	char salt[BUFSIZE];
+	char result[CRYPT_RESULT_LEN];
+};
+
+/* jobs handed to the workers whose results havent been delivered */
+static dlink_list crypt_pending;
+
+#ifdef USE_THREADS
+static pthread_mutex_t crypt_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t crypt_cond = PTHREAD_COND_INITIALIZER;
+#ifndef HAVE_CRYPT_R
+static pthread_mutex_t crypt_call_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static struct crypt_job *crypt_queue_head;
+static struct crypt_job *crypt_queue_tail;
+static struct crypt_job *crypt_done_head;
+static struct crypt_job *crypt_done_tail;
+
+/* set once a worker has written to crypt_pipe, cleared when the main
+ * loop takes the finished list.  Under crypt_lock.
+ */
+static int crypt_woken;
+static int crypt_wake_errno;
+
+static int crypt_threads;
+static int crypt_pipe[2] = { -1, -1 };
+
+/* the read end of crypt_pipe, registered with the io backend so
+ * finished jobs wake the main loop
+ */
+static struct lconn crypt_conn;
+#endif
+
+/* which of the CRYPT_ schemes crypt() understands, see init_crypt_schemes() */
+static int crypt_have[CRYPT_SHA512 + 1];
+
 static char saltChars[] =
        "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
        /* 0 .. 63, ascii - 64 */
@@ -78,22 +138,406 @@ make_des_salt()
 }
 
 
+/* make_sha_salt()
+ *   generates a salt for SHA-256 or SHA-512 crypt, with the configured
+ *   number of rounds if there is one
+ */
+static char *
+make_sha_salt(int scheme)
+{
+	static char salt[48];
+	int len;
+
+	if(config_file.crypt_rounds)
+		len = snprintf(salt, sizeof(salt), "$%c$rounds=%d$",
+				scheme == CRYPT_SHA512 ? '6' : '5',
+				config_file.crypt_rounds);
+	else
+		len = snprintf(salt, sizeof(salt), "$%c$",
+				scheme == CRYPT_SHA512 ? '6' : '5');
+
+	generate_salt(&salt[len], 16);
+	salt[len + 16] = '\0';
+
+	return salt;
+}
+
+/* crypt_check()
+ *   tests whether crypt() takes a salt, by checking its output starts
+ *   with it rather than being an error or a DES hash of it
+ */
+static int
+crypt_check(const char *salt)
+{
+	const char *result;
+	size_t len = strlen(salt);
+
+	if((result = crypt("validate", salt)) == NULL)
+		return 0;
+
+	return (!strncmp(result, salt, len) && result[len] == '$');
+}
+
+/* init_crypt_schemes()
+ *   finds which hash formats crypt() supports.  Must be called before
+ *   any threads are started.
+ */
+void
+init_crypt_schemes(void)
+{
+	crypt_have[CRYPT_DES] = 1;
+	crypt_have[CRYPT_MD5] = crypt_check("$1$tEsTiNg1");
+	crypt_have[CRYPT_SHA256] = crypt_check("$5$rounds=1000$tEsTiNg1");
+	crypt_have[CRYPT_SHA512] = crypt_check("$6$rounds=1000$tEsTiNg1");
+}
+
+/* crypt_supported()
+ *   returns whether crypt() can generate hashes with the given scheme
+ */
+int
+crypt_supported(int scheme)
+{
+	if(scheme < 0 || scheme > CRYPT_SHA512)
+		return 0;
+
+	return crypt_have[scheme];
+}
+
+static const char *
+crypt_salt(const char *salt)
+{
+	if(salt != NULL)
+		return salt;
+
+	/* validate_conf() only leaves schemes crypt() supports */
+	switch(config_file.crypt_scheme)
+	{
+		case CRYPT_SHA512:
+		case CRYPT_SHA256:
+			return make_sha_salt(config_file.crypt_scheme);
+		case CRYPT_MD5:
+			return make_md5_salt();
+		default:
+			return make_des_salt();
+	}
+}
+
+/* crypt_copy()
+ *   calls crypt() and copies the result out.  Without crypt_r() the
+ *   workers and the main thread share crypt()s static buffer, so every
+ *   call goes through here under crypt_call_lock.
+ *
+ * inputs	- password, salt, buffer for the result and its length
+ * outputs	- the buffer, or NULL if crypt() failed
+ */
+static const char *
+crypt_copy(const char *password, const char *salt, char *buf, size_t len)
+{
+	const char *result;
+
+#if defined(USE_THREADS) && !defined(HAVE_CRYPT_R)
+	pthread_mutex_lock(&crypt_call_lock);
+#endif
+
+	if((result = crypt(password, salt)) != NULL)
+	{
+		strlcpy(buf, result, len);
+		result = buf;
+	}
+
+#if defined(USE_THREADS) && !defined(HAVE_CRYPT_R)
+	pthread_mutex_unlock(&crypt_call_lock);
+#endif
+
+	return result;
+}
+
 const char *
 get_crypt(const char *password, const char *csalt)
 {
-	const char *salt = csalt;
+	static char buf[CRYPT_RESULT_LEN];
+
+	return crypt_copy(password, crypt_salt(csalt), buf, sizeof(buf));
+}
+
+static void
+crypt_finish(struct crypt_job *job)
+{
+	(job->callback)(job->client_p, job->result, job->arg);
+
+	memset(job->password, 0, sizeof(job->password));
+	my_free(job);
+}
+
+/* crypt_async()
+ *   hashes a password, off the main loop if we have workers
+ *
+ * inputs	- client its for, password, salt (NULL for a new one),
+ *		  callback and argument for the result
+ * outputs	-
+ * side effects - callback is called exactly once, either before we
+ *		  return or from the main loop later.  The client passed
+ *		  to it is NULL if they exited in the meantime, in which
+ *		  case it should only free its argument.
+ */
+void
+crypt_async(struct client *client_p, const char *password, const char *salt,
+		crypt_callback callback, void *arg)
+{
+	struct crypt_job *job;
+
+	job = my_malloc(sizeof(struct crypt_job));
+	job->client_p = client_p;
+	job->callback = callback;
+	job->arg = arg;
+	strlcpy(job->password, password, sizeof(job->password));
+
+	/* rand() isnt ours to call from the workers */
+	strlcpy(job->salt, crypt_salt(salt), sizeof(job->salt));
+
+#ifdef USE_THREADS
+	if(crypt_threads && dlink_list_length(&crypt_pending) < CRYPT_MAX_PENDING)
+	{
+		dlink_add(job, &job->node, &crypt_pending);
+
+		pthread_mutex_lock(&crypt_lock);
+
+		if(crypt_queue_tail)
+			crypt_queue_tail->next = job;
+		else
+			crypt_queue_head = job;
+
+		crypt_queue_tail = job;
+		pthread_cond_signal(&crypt_cond);
+		pthread_mutex_unlock(&crypt_lock);
+		return;
+	}
+#endif
+
+	crypt_copy(job->password, job->salt, job->result, sizeof(job->result));
+	crypt_finish(job);
+}
+
+/* crypt_pending_count()
+ *   returns how many hashes are with the workers
+ */
+int
+crypt_pending_count(void)
+{
+	return dlink_list_length(&crypt_pending);
+}
+
+/* crypt_cancel()
+ *   called when a client exits, so results for them are thrown away
+ */
+void
+crypt_cancel(struct client *client_p)
+{
+	struct crypt_job *job;
+	dlink_node *ptr;
+
+	DLINK_FOREACH(ptr, crypt_pending.head)
+	{
+		job = ptr->data;
+
+		if(job->client_p == client_p)
+			job->client_p = NULL;
+	}
+}
+
+/* crypt_cancel_dead()
+ *   crypt_cancel() for every client marked dead, in one pass
+ */
+void
+crypt_cancel_dead(void)
+{
+	struct crypt_job *job;
+	dlink_node *ptr;
+
+	DLINK_FOREACH(ptr, crypt_pending.head)
+	{
+		job = ptr->data;
+
+		if(IsDead(job->client_p))
+			job->client_p = NULL;
+	}
+}
+
+#ifdef USE_THREADS
+static void *
+crypt_worker(void *data)
+{
+	struct crypt_job *job;
+#ifdef HAVE_CRYPT_R
 	const char *result;
+#endif
+
+	pthread_mutex_lock(&crypt_lock);
 
-	if(have_md5_crypt)
+	while(1)
 	{
-		if(salt == NULL)
-			salt = make_md5_salt();
+		while(crypt_queue_head == NULL)
+			pthread_cond_wait(&crypt_cond, &crypt_lock);
+
+		job = crypt_queue_head;
+
+		if((crypt_queue_head = job->next) == NULL)
+			crypt_queue_tail = NULL;
+
+		pthread_mutex_unlock(&crypt_lock);
+
+#ifdef HAVE_CRYPT_R
+		((struct crypt_data *) data)->initialized = 0;
+
+		if((result = crypt_r(job->password, job->salt, data)) != NULL)
+			strlcpy(job->result, result, sizeof(job->result));
+#else
+		/* without crypt_r() we still keep the hashing off the
+		 * main loop, but only one thread can hash at a time
+		 */
+		crypt_copy(job->password, job->salt, job->result,
+				sizeof(job->result));
+#endif
+
+		pthread_mutex_lock(&crypt_lock);
+
+		job->next = NULL;
+
+		if(crypt_done_tail)
+			crypt_done_tail->next = job;
+		else
+			crypt_done_head = job;
+
+		crypt_done_tail = job;
+
+		/* the main loop takes the whole list each time its woken,
+		 * so one wakeup covers every job finished before it runs.
+		 * A full pipe means one is already waiting, anything else
+		 * leaves the next job to finish to try again.
+		 */
+		if(!crypt_woken)
+		{
+			if(write(crypt_pipe[1], "x", 1) == 1 || errno == EAGAIN)
+				crypt_woken = 1;
+			else
+				crypt_wake_errno = errno;
+		}
 	}
-	else if(salt == NULL)
-		salt = make_des_salt();
 
-	result = crypt(password, salt);
-	return result;
+	return NULL;
+}
+
+/* crypt_read()
+ *   delivers the results of finished jobs to their callbacks
+ */
+static void
+crypt_read(struct lconn *conn_p)
+{
+	struct crypt_job *job;
+	struct crypt_job *next_job;
+	char buf[64];
+	int wake_errno;
+
+	/* must be emptied before we take the list, or we could swallow
+	 * a wakeup for a job we then miss
+	 */
+	while(read(conn_p->fd, buf, sizeof(buf)) > 0)
+		;
+
+	pthread_mutex_lock(&crypt_lock);
+	job = crypt_done_head;
+	crypt_done_head = crypt_done_tail = NULL;
+	crypt_woken = 0;
+	wake_errno = crypt_wake_errno;
+	crypt_wake_errno = 0;
+	pthread_mutex_unlock(&crypt_lock);
+
+	/* the workers cant log, so they leave it for us */
+	if(wake_errno)
+		mlog("warning: crypt thread failed to wake the main loop: %s",
+			strerror(wake_errno));
+
+	for(; job != NULL; job = next_job)
+	{
+		next_job = job->next;
+
+		dlink_delete(&job->node, &crypt_pending);
+		crypt_finish(job);
+	}
+}
+#endif
+
+/* init_crypt_pool()
+ *   starts the worker threads for crypt_async().  Must be called after
+ *   the conf is read and we've forked, as it isnt resized on rehash.
+ */
+void
+init_crypt_pool(void)
+{
+#ifdef USE_THREADS
+	pthread_t thread;
+	void *data = NULL;
+	int flags;
+	int i;
+
+	if(config_file.crypt_threads <= 0)
+		return;
+
+	if(pipe(crypt_pipe) < 0)
+	{
+		mlog("warning: unable to create crypt pipe, hashing synchronously: %s",
+			strerror(errno));
+		return;
+	}
+
+	for(i = 0; i < 2; i++)
+	{
+		flags = fcntl(crypt_pipe[i], F_GETFL, 0);
+		fcntl(crypt_pipe[i], F_SETFL, flags | O_NONBLOCK);
+	}
+
+	crypt_conn.name = my_strdup("crypt");
+	crypt_conn.fd = crypt_pipe[0];
+	crypt_conn.io_read = crypt_read;
+
+	if(io_backend->update(&crypt_conn, IO_READ) < 0)
+	{
+		mlog("warning: unable to watch crypt pipe, hashing synchronously");
+		close(crypt_pipe[0]);
+		close(crypt_pipe[1]);
+		return;
+	}
+
+	for(i = 0; i < config_file.crypt_threads && i < CRYPT_MAX_THREADS; i++)
+	{
+#ifdef HAVE_CRYPT_R
+		/* crypt_r() state is large, so give each worker its own */
+		data = my_malloc(sizeof(struct crypt_data));
+#endif
+
+		if((errno = create_thread(&thread, crypt_worker, data)) != 0)
+		{
+			mlog("warning: failed to create crypt thread: %s",
+				strerror(errno));
+			my_free(data);
+			break;
+		}
+
+		pthread_detach(thread);
+		crypt_threads++;
+	}
+
+	if(!crypt_threads)
+	{
+		mlog("warning: no crypt threads, hashing synchronously");
+		io_backend->update(&crypt_conn, 0);
+		close(crypt_pipe[0]);
+		close(crypt_pipe[1]);
+	}
+#else
+	if(config_file.crypt_threads > 0)
+		mlog("warning: crypt_threads requires thread support, hashing synchronously");
+#endif
 }
 
 const char *
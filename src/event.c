@@ -48,9 +48,24 @@
 #include "rserv.h"
 #include "event.h"
 #include "io.h"
+#include "tools.h"
 
-struct ev_entry event_table[MAX_EVENTS];
-static time_t event_time_min = -1;
+/* pending events are kept in a binary heap ordered on when they're next
+ * due.  Disabled events, and one being run, aren't in the heap.
+ */
+static struct ev_entry **event_heap;
+static int event_heap_len;
+static int event_heap_size;
+
+/* every event, for lookups by name and event_show() */
+static dlink_list event_list;
+
+/* the event eventRun() is calling, if it deletes itself we cant free it */
+static struct ev_entry *event_running;
+
+static struct ev_task task_table[MAX_TASKS];
+static int task_count;
+static struct timeval task_deadline;
 
 static int
 event_get_delta(time_t duration)
@@ -74,6 +89,128 @@ event_get_delta(time_t duration)
 	return i;
 }
 
+/* event_set_when()
+ *   sets an event to be due msec milliseconds from now
+ */
+static void
+event_set_when(struct ev_entry *ev, long msec)
+{
+	ev->when.tv_sec = system_time.tv_sec + msec / 1000;
+	ev->when.tv_usec = system_time.tv_usec + (msec % 1000) * 1000;
+
+	if(ev->when.tv_usec >= 1000000)
+	{
+		ev->when.tv_sec++;
+		ev->when.tv_usec -= 1000000;
+	}
+}
+
+static int
+event_before(struct timeval *a, struct timeval *b)
+{
+	if(a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec;
+
+	return a->tv_usec < b->tv_usec;
+}
+
+static void
+event_heap_set(int i, struct ev_entry *ev)
+{
+	event_heap[i] = ev;
+	ev->index = i;
+}
+
+static void
+event_heap_up(int i)
+{
+	struct ev_entry *ev = event_heap[i];
+	int parent;
+
+	while(i > 0)
+	{
+		parent = (i - 1) / 2;
+
+		if(!event_before(&ev->when, &event_heap[parent]->when))
+			break;
+
+		event_heap_set(i, event_heap[parent]);
+		i = parent;
+	}
+
+	event_heap_set(i, ev);
+}
+
+static void
+event_heap_down(int i)
+{
+	struct ev_entry *ev = event_heap[i];
+	int child;
+
+	while((child = i * 2 + 1) < event_heap_len)
+	{
+		if(child + 1 < event_heap_len &&
+		   event_before(&event_heap[child + 1]->when, &event_heap[child]->when))
+			child++;
+
+		if(!event_before(&event_heap[child]->when, &ev->when))
+			break;
+
+		event_heap_set(i, event_heap[child]);
+		i = child;
+	}
+
+	event_heap_set(i, ev);
+}
+
+static void
+event_heap_add(struct ev_entry *ev)
+{
+	if(event_heap_len == event_heap_size)
+	{
+		event_heap_size = event_heap_size ? event_heap_size * 2 : 64;
+		event_heap = my_realloc(event_heap,
+				sizeof(struct ev_entry *) * event_heap_size);
+	}
+
+	event_heap_set(event_heap_len++, ev);
+	event_heap_up(ev->index);
+}
+
+static void
+event_heap_delete(struct ev_entry *ev)
+{
+	int i = ev->index;
+
+	if(i < 0)
+		return;
+
+	ev->index = -1;
+
+	if(i == --event_heap_len)
+		return;
+
+	event_heap_set(i, event_heap[event_heap_len]);
+
+	/* the entry moved in could need to go either way */
+	event_heap_up(i);
+	event_heap_down(event_heap[i]->index);
+}
+
+static struct ev_entry *
+event_create(const char *name, EVH * func, void *arg)
+{
+	struct ev_entry *ev = my_malloc(sizeof(struct ev_entry));
+
+	ev->func = func;
+	ev->name = name;
+	ev->arg = arg;
+	ev->index = -1;
+
+	dlink_add_tail(ev, &ev->node, &event_list);
+	return ev;
+}
+
 /*
  * void eventAdd(const char *name, EVH *func, void *arg, time_t when)
  *
@@ -85,66 +222,61 @@ event_get_delta(time_t duration)
 void
 eventAdd(const char *name, EVH * func, void *arg, time_t when)
 {
-	int i;
+	struct ev_entry *ev = event_create(name, func, arg);
 
-	/* find first inactive index */
-	for (i = 0; i < MAX_EVENTS; i++)
+	if(when)
 	{
-		if(event_table[i].active == 0)
-		{
-			int delta = event_get_delta(when);
-
-			event_table[i].func = func;
-			event_table[i].name = name;
-			event_table[i].arg = arg;
-			event_table[i].active = 1;
-
-			if(when)
-			{
-				event_table[i].when = CURRENT_TIME + when + delta;
-				event_table[i].frequency = when + delta;
-
-				if((event_table[i].when < event_time_min) || (event_time_min == -1))
-					event_time_min = event_table[i].when;
-			}
-			/* when == 0 means "disabled", set frequency to -1
-			 * because events with a frequency of 0 are
-			 * "oneshot" --anfl
-			 */
-			else
-			{
-				event_table[i].when = 0;
-				event_table[i].frequency = -1;
-			}
-
-			return;
-		}
+		ev->frequency = (when + event_get_delta(when)) * 1000;
+		event_set_when(ev, ev->frequency);
+		event_heap_add(ev);
 	}
+	/* when == 0 means "disabled", set frequency to -1
+	 * because events with a frequency of 0 are
+	 * "oneshot" --anfl
+	 */
+	else
+		ev->frequency = -1;
 }
 
 void
 eventAddOnce(const char *name, EVH * func, void *arg, time_t when)
 {
-	int i;
+	eventAddOnceMsec(name, func, arg, (long) when * 1000);
+}
 
-	/* find first inactive index */
-	for (i = 0; i < MAX_EVENTS; i++)
-	{
-		if(event_table[i].active == 0)
-		{
-			event_table[i].func = func;
-			event_table[i].name = name;
-			event_table[i].arg = arg;
-			event_table[i].when = CURRENT_TIME + when;
-			event_table[i].frequency = 0;
-			event_table[i].active = 1;
+/*
+ * void eventAddOnceMsec(const char *name, EVH *func, void *arg, long msec)
+ *
+ * Input: Name of event, function to call, arguments to pass, and delay
+ *	  in milliseconds.
+ * Output: None
+ * Side Effects: Adds a oneshot event.  It wont run before the next
+ *		 eventRun(), even with no delay.
+ */
+void
+eventAddOnceMsec(const char *name, EVH * func, void *arg, long msec)
+{
+	struct ev_entry *ev = event_create(name, func, arg);
 
-			if((event_table[i].when < event_time_min) || (event_time_min == -1))
-				event_time_min = event_table[i].when;
+	ev->frequency = 0;
+	event_set_when(ev, msec > 0 ? msec : 1);
+	event_heap_add(ev);
+}
 
-			return;
-		}
+static void
+event_free(struct ev_entry *ev)
+{
+	event_heap_delete(ev);
+	dlink_delete(&ev->node, &event_list);
+
+	/* eventRun() frees it once the function returns */
+	if(ev == event_running)
+	{
+		ev->func = NULL;
+		return;
 	}
+
+	my_free(ev);
 }
 
 /*
@@ -157,17 +289,10 @@ eventAddOnce(const char *name, EVH * func, void *arg, time_t when)
 void
 eventDelete(EVH * func, void *arg)
 {
-	int i;
+	struct ev_entry *ev;
 
-	i = eventFind(func, arg);
-
-	if(i == -1)
-		return;
-
-	event_table[i].name = NULL;
-	event_table[i].func = NULL;
-	event_table[i].arg = NULL;
-	event_table[i].active = 0;
+	if((ev = eventFind(func, arg)) != NULL)
+		event_free(ev);
 }
 
 /*
@@ -180,91 +305,223 @@ eventDelete(EVH * func, void *arg)
 void
 eventRun(void)
 {
-	int i;
+	struct ev_entry *ev;
 
-	for (i = 0; i < MAX_EVENTS; i++)
+	while(event_heap_len > 0 && !event_before(&system_time, &event_heap[0]->when))
 	{
-		/* skip inactive events, and ones "disabled" (freq == -1) */
-		if(event_table[i].active && event_table[i].frequency >= 0 &&
-			(event_table[i].when <= CURRENT_TIME))
-		{
-			event_table[i].func(event_table[i].arg);
+		ev = event_heap[0];
+		event_heap_delete(ev);
 
-			/* if the event is only scheduled to run once, remove it from
-			 * the table.
-			 */
-			if(event_table[i].frequency)
-			{
-				event_table[i].when = CURRENT_TIME + event_table[i].frequency;
-			}
-			else
-			{
-				event_table[i].name = NULL;
-				event_table[i].func = NULL;
-				event_table[i].arg = NULL;
-				event_table[i].active = 0;
-			}
+		event_running = ev;
+		ev->func(ev->arg);
+		event_running = NULL;
 
-			event_time_min = -1;
+		/* deleted itself */
+		if(ev->func == NULL)
+		{
+			my_free(ev);
+			continue;
 		}
+
+		/* if the event is only scheduled to run once, remove it from
+		 * the table.
+		 */
+		if(ev->frequency > 0)
+		{
+			event_set_when(ev, ev->frequency);
+			event_heap_add(ev);
+		}
+		else if(ev->frequency == 0)
+			event_free(ev);
 	}
 }
 
-
 /*
- * time_t eventNextTime(void)
+ * long eventNextTimeout(void)
  * 
  * Input: None
- * Output: Specifies the next time eventRun() should be run
+ * Output: Milliseconds until eventRun() next has something to do, or -1
  * Side Effects: None
  */
-time_t
-eventNextTime(void)
+long
+eventNextTimeout(void)
 {
-	int i;
+	struct timeval *when;
+	long timeout;
+
+	if(event_heap_len == 0)
+		return -1;
+
+	when = &event_heap[0]->when;
+
+	/* dont wait on an event thats due any later than a day away, the
+	 * caller has its own cap anyway
+	 */
+	if(when->tv_sec - system_time.tv_sec > 86400)
+		return 86400 * 1000;
 
-	if(event_time_min == -1)
+	timeout = (long) (when->tv_sec - system_time.tv_sec) * 1000 +
+			(when->tv_usec - system_time.tv_usec) / 1000;
+
+	/* round up, so we dont wake just before its due */
+	if((when->tv_usec - system_time.tv_usec) % 1000 > 0)
+		timeout++;
+
+	return timeout < 0 ? 0 : timeout;
+}
+
+void
+eventUpdate(const char *name, time_t freq)
+{
+	struct ev_entry *ev;
+	struct timeval when;
+	dlink_node *ptr;
+
+	DLINK_FOREACH(ptr, event_list.head)
 	{
-		for (i = 0; i < MAX_EVENTS; i++)
+		ev = ptr->data;
+
+		if(irccmp(ev->name, name))
+			continue;
+
+		if(freq > 0)
 		{
-			/* skip inactive events, and ones "disabled" (freq == -1) */
-			if(event_table[i].active && event_table[i].frequency >= 0 &&
-			   ((event_table[i].when < event_time_min) || (event_time_min == -1)))
-				event_time_min = event_table[i].when;
+			ev->frequency = freq * 1000;
+			when = ev->when;
+			event_set_when(ev, ev->frequency);
+
+			/* keep when its scheduled to run if thats sooner
+			 * than the new frequency
+			 */
+			if(ev->index >= 0 && event_before(&when, &ev->when))
+				ev->when = when;
+
+			if(ev->index >= 0)
+			{
+				event_heap_up(ev->index);
+				event_heap_down(ev->index);
+			}
+			else if(ev != event_running)
+				event_heap_add(ev);
+		}
+		else
+		{
+			ev->frequency = -1;
+			event_heap_delete(ev);
 		}
-	}
 
-	return event_time_min;
+		return;
+	}
 }
 
+/*
+ * void eventTaskAdd(const char *name, ETH *func, void *arg)
+ *
+ * Input: Name of task, function to call, arguments to pass.
+ * Output: None
+ * Side Effects: Starts the task, unless its still running from a
+ *		 previous start, in which case it just carries on.
+ */
 void
-eventUpdate(const char *name, time_t freq)
+eventTaskAdd(const char *name, ETH * func, void *arg)
 {
 	int i;
 
-	for(i = 0; i < MAX_EVENTS; i++)
+	for(i = 0; i < MAX_TASKS; i++)
+	{
+		if(task_table[i].active && task_table[i].func == func &&
+		   task_table[i].arg == arg)
+			return;
+	}
+
+	for(i = 0; i < MAX_TASKS; i++)
 	{
-		if(event_table[i].active && 
-		   !irccmp(event_table[i].name, name))
+		if(task_table[i].active == 0)
 		{
-			if(freq > 0)
-			{
-				event_table[i].frequency = freq;
+			task_table[i].func = func;
+			task_table[i].arg = arg;
+			task_table[i].name = name;
+			task_table[i].active = 1;
+			task_count++;
+			return;
+		}
+	}
+}
 
-				/* update when its scheduled to run if its higher
-				 * than the new frequency
-				 */
-				if((CURRENT_TIME + freq) < event_table[i].when)
-					event_table[i].when = CURRENT_TIME + freq;
-			}
-			else
-				event_table[i].frequency = -1;
+/*
+ * void eventTaskRun(void)
+ *
+ * Input: None
+ * Output: None
+ * Side Effects: Gives each running task a slice of up to TASK_SLICE_MSEC,
+ *		 removing those that finish.
+ */
+void
+eventTaskRun(void)
+{
+	int i;
 
-			return;
+	if(!task_count)
+		return;
+
+	for(i = 0; i < MAX_TASKS; i++)
+	{
+		if(!task_table[i].active)
+			continue;
+
+		gettimeofday(&task_deadline, NULL);
+		task_deadline.tv_usec += TASK_SLICE_MSEC * 1000;
+
+		if(task_deadline.tv_usec >= 1000000)
+		{
+			task_deadline.tv_sec++;
+			task_deadline.tv_usec -= 1000000;
 		}
+
+		if(task_table[i].func(task_table[i].arg))
+			continue;
+
+		task_table[i].name = NULL;
+		task_table[i].func = NULL;
+		task_table[i].arg = NULL;
+		task_table[i].active = 0;
+		task_count--;
 	}
 }
 
+/*
+ * int eventTaskPending(void)
+ *
+ * Input: None
+ * Output: Whether any tasks have work left, so the io loop shouldnt sleep
+ * Side Effects: None
+ */
+int
+eventTaskPending(void)
+{
+	return task_count;
+}
+
+/*
+ * int eventTaskYield(void)
+ *
+ * Input: None
+ * Output: Whether the running task has used up its slice
+ * Side Effects: None
+ */
+int
+eventTaskYield(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	if(now.tv_sec != task_deadline.tv_sec)
+		return now.tv_sec > task_deadline.tv_sec;
+
+	return now.tv_usec >= task_deadline.tv_usec;
+}
+
 /*
  * void eventInit(void)
  *
@@ -275,50 +532,65 @@ eventUpdate(const char *name, time_t freq)
 void
 init_events(void)
 {
-	memset((void *) event_table, 0, sizeof(event_table));
+	memset((void *) task_table, 0, sizeof(task_table));
+	task_count = 0;
 }
 
 /*
- * int eventFind(EVH *func, void *arg)
+ * struct ev_entry *eventFind(EVH *func, void *arg)
  *
  * Input: Event function and the argument passed to it
- * Output: Index to the slow in the event_table
+ * Output: The event, or NULL
  * Side Effects: None
  */
-int
+struct ev_entry *
 eventFind(EVH * func, void *arg)
 {
-	int i;
+	struct ev_entry *ev;
+	dlink_node *ptr;
 
-	for (i = 0; i < MAX_EVENTS; i++)
+	DLINK_FOREACH(ptr, event_list.head)
 	{
-		if((event_table[i].func == func) &&
-		   (event_table[i].arg == arg) && event_table[i].active)
-			return i;
+		ev = ptr->data;
+
+		if(ev->func == func && ev->arg == arg)
+			return ev;
 	}
 
-	return -1;
+	return NULL;
 }
 
 void
 event_show(struct lconn *conn_p)
 {
+	struct ev_entry *ev;
+	dlink_node *ptr;
 	time_t duration;
-        int i;
+	int i;
 
         sendto_one(conn_p, "Events: Function                    Next");
         
-        for(i = 0; i < MAX_EVENTS; i++)
-        {
-                if(!event_table[i].active)
-                        continue;
+	DLINK_FOREACH(ptr, event_list.head)
+	{
+		ev = ptr->data;
 
-		duration = event_table[i].when - CURRENT_TIME;
+		duration = ev->when.tv_sec - CURRENT_TIME;
 
-		if(event_table[i].frequency == -1)
+		if(ev->frequency == -1)
 			duration = -1;
 
                 sendto_one(conn_p, "        %-27s %-4ld seconds",
-                           event_table[i].name, duration);
+                           ev->name, (long) duration);
         }
+
+	if(!task_count)
+		return;
+
+	sendto_one(conn_p, "Tasks:  Function");
+
+	for(i = 0; i < MAX_TASKS; i++)
+	{
+		if(task_table[i].active)
+			sendto_one(conn_p, "        %s", task_table[i].name);
+	}
 }
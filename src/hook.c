@@ -34,7 +34,21 @@
 #include "rserv.h"
 #include "hook.h"
 
+/* Batch hooks are handed an array of everything their hook was called
+ * with since they were last run, rather than being run for each call.
+ * The array is passed on once it is full, and otherwise by
+ * hook_flush_batches() on each pass of the io loop -- before anything
+ * exited is freed, so entries may be dead but are never dangling.
+ */
+struct hook_batch
+{
+	dlink_list funcs;
+	void **data;
+	int count;
+};
+
 static dlink_list hooks[HOOK_LAST_HOOK];
+static struct hook_batch batches[HOOK_LAST_HOOK];
 
 void
 hook_add(hook_func func, int hook)
@@ -63,3 +77,72 @@ hook_call(int hook, void *arg, void *arg2)
 
 	return 0;
 }
+
+void
+hook_add_batch(hook_batch_func func, int hook)
+{
+	if(hook >= HOOK_LAST_HOOK)
+		return;
+
+	if(batches[hook].data == NULL)
+		batches[hook].data = my_malloc(sizeof(void *) * HOOK_BATCH_SIZE);
+
+	dlink_add_tail_alloc(func, &batches[hook].funcs);
+}
+
+static void
+hook_flush_batch(struct hook_batch *batch)
+{
+	hook_batch_func func;
+	dlink_node *ptr;
+
+	DLINK_FOREACH(ptr, batch->funcs.head)
+	{
+		func = ptr->data;
+		(*func)(batch->data, batch->count);
+	}
+
+	batch->count = 0;
+}
+
+/* hook_call_batch()
+ *   runs the normal hooks for arg now, and queues it for the batch hooks
+ *
+ * inputs	- hook, arg to pass
+ * outputs	- as hook_call()
+ */
+int
+hook_call_batch(int hook, void *arg)
+{
+	struct hook_batch *batch;
+
+	if(hook >= HOOK_LAST_HOOK)
+		return 0;
+
+	batch = &batches[hook];
+
+	if(dlink_list_length(&batch->funcs))
+	{
+		batch->data[batch->count++] = arg;
+
+		if(batch->count == HOOK_BATCH_SIZE)
+			hook_flush_batch(batch);
+	}
+
+	return hook_call(hook, arg, NULL);
+}
+
+/* hook_flush_batches()
+ *   passes on everything queued for batch hooks
+ */
+void
+hook_flush_batches(void)
+{
+	int i;
+
+	for(i = 0; i < HOOK_LAST_HOOK; i++)
+	{
+		if(batches[i].count)
+			hook_flush_batch(&batches[i]);
+	}
+}
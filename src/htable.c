@@ -0,0 +1,220 @@
+/* src/htable.c
+ *   Contains code for open addressed hash tables of named objects.
+ *
+ * Copyright (C) 2010 ircd-ratbox development team
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1.Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 2.Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * 3.The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id$
+ */
+#include "stdinc.h"
+#include "rserv.h"
+#include "io.h"
+#include "log.h"
+#include "htable.h"
+
+/* Tables are linearly probed.  They grow to keep at most three quarters
+ * of their slots in use (tombstones included), and shrink when under an
+ * eighth are live, so walking a table costs a small multiple of its
+ * entries rather than of its largest size.
+ */
+
+dlink_list htable_list;
+char htable_tombstone;
+
+/* htable_hash()
+ *   hashes a name, case folded
+ *
+ * inputs	- name to hash
+ * outputs	- hash value
+ */
+unsigned int
+htable_hash(const char *name)
+{
+	unsigned int hashv = 2166136261U;
+
+	while(*name)
+	{
+		hashv ^= ToLower(*name++);
+		hashv *= 16777619U;
+	}
+
+	return hashv;
+}
+
+static void
+htable_resize(struct htable *table, unsigned int count)
+{
+	struct htable_slot *slots = table->slots;
+	unsigned int size = table->size;
+	unsigned int mask;
+	unsigned int i, j;
+
+	table->size = table->min_size;
+
+	while(table->size < count * 2)
+		table->size *= 2;
+
+	table->slots = my_calloc(table->size, sizeof(struct htable_slot));
+	table->used = table->count;
+	mask = table->size - 1;
+
+	for(i = 0; i < size; i++)
+	{
+		if(!HTABLE_LIVE(&slots[i]))
+			continue;
+
+		for(j = slots[i].hashv & mask; table->slots[j].data != NULL; j = (j + 1) & mask)
+			;
+
+		table->slots[j] = slots[i];
+	}
+
+	my_free(slots);
+}
+
+/* htable_init()
+ *   sets up a table
+ *
+ * inputs	- table, its name for stats, the fewest slots it should
+ *		  have (a power of two), functions returning an entries name
+ *		  and comparing two names
+ * outputs	-
+ */
+void
+htable_init(struct htable *table, const char *name, unsigned int min_size,
+		const char *(*key)(void *), int (*cmp)(const char *, const char *))
+{
+	s_assert(min_size > 0 && (min_size & (min_size - 1)) == 0);
+
+	table->name = name;
+	table->key = key;
+	table->cmp = cmp;
+	table->min_size = min_size;
+	table->size = min_size;
+	table->count = table->used = 0;
+	table->slots = my_calloc(table->size, sizeof(struct htable_slot));
+
+	dlink_add(table, &table->node, &htable_list);
+}
+
+/* htable_add()
+ *   adds an entry to a table, resizing it first if needed
+ *
+ * inputs	- table, entry to add
+ * outputs	-
+ */
+void
+htable_add(struct htable *table, void *data)
+{
+	unsigned int hashv = htable_hash(table->key(data));
+	unsigned int mask;
+	unsigned int i;
+
+	if((table->used + 1) * 4 > table->size * 3 ||
+	   (table->size > table->min_size && (table->count + 1) * 8 < table->size))
+		htable_resize(table, table->count + 1);
+
+	mask = table->size - 1;
+
+	for(i = hashv & mask; HTABLE_LIVE(&table->slots[i]); i = (i + 1) & mask)
+		;
+
+	if(table->slots[i].data == NULL)
+		table->used++;
+
+	table->slots[i].hashv = hashv;
+	table->slots[i].data = data;
+	table->count++;
+}
+
+/* htable_del()
+ *   removes an entry from a table.  The entry must still have the name it
+ *   was added with.
+ *
+ * inputs	- table, entry to remove
+ * outputs	-
+ */
+void
+htable_del(struct htable *table, void *data)
+{
+	unsigned int hashv = htable_hash(table->key(data));
+	unsigned int mask = table->size - 1;
+	unsigned int i;
+
+	for(i = hashv & mask; table->slots[i].data != NULL; i = (i + 1) & mask)
+	{
+		if(table->slots[i].data != data)
+			continue;
+
+		/* nothing probes past an empty slot, so if the next one
+		 * is empty this can be too
+		 */
+		if(table->slots[(i + 1) & mask].data == NULL)
+		{
+			table->slots[i].data = NULL;
+			table->used--;
+		}
+		else
+			table->slots[i].data = HTABLE_DELETED;
+
+		table->count--;
+		return;
+	}
+
+	s_assert(0);
+}
+
+/* htable_find()
+ *   finds an entry in a table by name
+ *
+ * inputs	- table, name to find
+ * outputs	- entry, or NULL if not found
+ */
+void *
+htable_find(struct htable *table, const char *name)
+{
+	struct htable_slot *slot;
+	unsigned int hashv = htable_hash(name);
+	unsigned int mask = table->size - 1;
+	unsigned int i;
+
+	for(i = hashv & mask; (slot = &table->slots[i])->data != NULL; i = (i + 1) & mask)
+	{
+		if(slot->hashv == hashv && slot->data != HTABLE_DELETED &&
+		   !table->cmp(table->key(slot->data), name))
+			return slot->data;
+	}
+
+	return NULL;
+}
+
+void
+htable_usage(struct htable *table, size_t *count, size_t *size, size_t *sz_mem)
+{
+	*count = table->count;
+	*size = table->size;
+	*sz_mem = table->size * sizeof(struct htable_slot);
+}
@@ -0,0 +1,279 @@
+/* src/intern.c
+ *   Contains code for sharing repeated strings.
+ *
+ * Copyright (C) 2010 ircd-ratbox development team
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1.Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 2.Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * 3.The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id$
+ */
+#include "stdinc.h"
+#include <stddef.h>
+#include "rserv.h"
+#include "io.h"
+#include "log.h"
+#include "intern.h"
+
+/* entries are carved out of arenas, and go back onto a free list for
+ * their size class when released.  Anything too big for a class is
+ * allocated on its own.
+ */
+#define INTERN_ARENA_SIZE	65536
+#define INTERN_CLASS_SIZE	16
+#define INTERN_MAX_CLASSES	32
+#define INTERN_HASH_MIN		1024
+
+struct intern_entry
+{
+	struct intern_entry *next;	/* hash chain, or free list */
+	unsigned int hashv;
+	unsigned int refcount;
+	unsigned int len;
+	char str[1];
+};
+
+#define INTERN_ENTRY(x)		((struct intern_entry *) ((x) - offsetof(struct intern_entry, str)))
+#define INTERN_SIZE(len)	(offsetof(struct intern_entry, str) + (len) + 1)
+#define INTERN_CLASS(size)	(((size) + INTERN_CLASS_SIZE - 1) / INTERN_CLASS_SIZE)
+
+static struct intern_entry **intern_table;
+static unsigned int intern_table_size;
+
+static struct intern_entry *intern_free[INTERN_MAX_CLASSES + 1];
+static char *intern_arena;
+static size_t intern_arena_left;
+
+static size_t intern_count;		/* distinct strings */
+static size_t intern_refs;		/* references to them */
+static size_t intern_ref_bytes;		/* what the references would cost unshared */
+static size_t intern_used;		/* bytes handed out for entries */
+static size_t intern_arena_bytes;
+
+static unsigned int
+intern_hash(const char *str, size_t len)
+{
+	unsigned int hashv = 2166136261U;
+
+	while(len--)
+	{
+		hashv ^= (unsigned char) *str++;
+		hashv *= 16777619U;
+	}
+
+	return hashv;
+}
+
+static struct intern_entry *
+intern_alloc(size_t size)
+{
+	struct intern_entry *entry;
+	unsigned int class = INTERN_CLASS(size);
+
+	if(class > INTERN_MAX_CLASSES)
+	{
+		intern_used += size;
+		return my_malloc(size);
+	}
+
+	size = class * INTERN_CLASS_SIZE;
+	intern_used += size;
+
+	if((entry = intern_free[class]) != NULL)
+	{
+		intern_free[class] = entry->next;
+		return entry;
+	}
+
+	/* whatever is left of the old arena is too small, so it's wasted --
+	 * at most one entry's worth
+	 */
+	if(intern_arena_left < size)
+	{
+		intern_arena = my_malloc(INTERN_ARENA_SIZE);
+		intern_arena_left = INTERN_ARENA_SIZE;
+		intern_arena_bytes += INTERN_ARENA_SIZE;
+	}
+
+	entry = (struct intern_entry *) intern_arena;
+	intern_arena += size;
+	intern_arena_left -= size;
+
+	return entry;
+}
+
+static void
+intern_free_entry(struct intern_entry *entry)
+{
+	size_t size = INTERN_SIZE(entry->len);
+	unsigned int class = INTERN_CLASS(size);
+
+	if(class > INTERN_MAX_CLASSES)
+	{
+		intern_used -= size;
+		my_free(entry);
+		return;
+	}
+
+	intern_used -= class * INTERN_CLASS_SIZE;
+
+	entry->next = intern_free[class];
+	intern_free[class] = entry;
+}
+
+static void
+intern_grow(void)
+{
+	struct intern_entry **table;
+	struct intern_entry *entry, *next_entry;
+	unsigned int size;
+	unsigned int i;
+
+	size = intern_table_size ? intern_table_size * 2 : INTERN_HASH_MIN;
+	table = my_malloc(sizeof(struct intern_entry *) * size);
+
+	for(i = 0; i < intern_table_size; i++)
+	{
+		for(entry = intern_table[i]; entry; entry = next_entry)
+		{
+			next_entry = entry->next;
+			entry->next = table[entry->hashv & (size - 1)];
+			table[entry->hashv & (size - 1)] = entry;
+		}
+	}
+
+	my_free(intern_table);
+	intern_table = table;
+	intern_table_size = size;
+}
+
+static const char *
+intern_add(const char *str, size_t len)
+{
+	struct intern_entry *entry;
+	unsigned int hashv = intern_hash(str, len);
+
+	if(intern_count >= intern_table_size)
+		intern_grow();
+
+	for(entry = intern_table[hashv & (intern_table_size - 1)]; entry; entry = entry->next)
+	{
+		if(entry->hashv == hashv && entry->len == len &&
+		   !memcmp(entry->str, str, len))
+			break;
+	}
+
+	if(entry == NULL)
+	{
+		entry = intern_alloc(INTERN_SIZE(len));
+		entry->hashv = hashv;
+		entry->refcount = 0;
+		entry->len = len;
+		memcpy(entry->str, str, len);
+		entry->str[len] = '\0';
+
+		entry->next = intern_table[hashv & (intern_table_size - 1)];
+		intern_table[hashv & (intern_table_size - 1)] = entry;
+		intern_count++;
+	}
+
+	entry->refcount++;
+	intern_refs++;
+	intern_ref_bytes += len + 1;
+
+	return entry->str;
+}
+
+/* intern_string()
+ * returns a shared copy of str, NULL if str is
+ */
+const char *
+intern_string(const char *str)
+{
+	if(str == NULL)
+		return NULL;
+
+	return intern_add(str, strlen(str));
+}
+
+/* intern_stringn()
+ * as intern_string(), but truncates str to fit a buffer of len like
+ * my_strndup()
+ */
+const char *
+intern_stringn(const char *str, size_t len)
+{
+	size_t slen;
+
+	if(str == NULL || len == 0)
+		return NULL;
+
+	slen = strlen(str);
+	return intern_add(str, slen < len ? slen : len - 1);
+}
+
+void
+intern_release(const char *str)
+{
+	struct intern_entry *entry, **prev;
+
+	if(str == NULL)
+		return;
+
+	entry = INTERN_ENTRY(str);
+
+	s_assert(entry->refcount > 0);
+
+	intern_refs--;
+	intern_ref_bytes -= entry->len + 1;
+
+	if(--entry->refcount)
+		return;
+
+	for(prev = &intern_table[entry->hashv & (intern_table_size - 1)]; *prev;
+	    prev = &(*prev)->next)
+	{
+		if(*prev == entry)
+		{
+			*prev = entry->next;
+			break;
+		}
+	}
+
+	intern_count--;
+	intern_free_entry(entry);
+}
+
+void
+intern_countmem(size_t *count, size_t *refs, size_t *sz_used,
+		size_t *sz_arena, size_t *sz_saved)
+{
+	size_t sz_total = intern_used + sizeof(struct intern_entry *) * intern_table_size;
+
+	*count = intern_count;
+	*refs = intern_refs;
+	*sz_used = intern_used;
+	*sz_arena = intern_arena_bytes;
+	*sz_saved = intern_ref_bytes > sz_total ? intern_ref_bytes - sz_total : 0;
+}
@@ -35,6 +35,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/uio.h>
 
 #include "stdinc.h"
 #include "scommand.h"
@@ -51,6 +52,7 @@
 #include "hook.h"
 #include "serno.h"
 #include "watch.h"
+#include "balloc.h"
 
 #define IO_HOST	0
 #define IO_IP	1
@@ -61,8 +63,17 @@ struct lconn *server_p;
 time_t last_connect_time;
 time_t current_time;
 
-fd_set readfds;
-fd_set writefds;
+struct io_backend *io_backend;
+
+static BlockHeap *sendq_heap;
+
+/* maximum number of sendq chunks passed to a single writev() */
+#define SENDQ_IOV_MAX	64
+
+/* the longest we'll sleep waiting for io, the connection timeouts in
+ * read_io() are checked with this granularity.
+ */
+#define IO_MAX_WAIT	1000
 
 static int signon_server(struct lconn *conn_p);
 static void signon_client_in(struct lconn *conn_p);
@@ -74,8 +85,11 @@ static void signoff_client(struct lconn *conn_p);
 static void read_server(struct lconn *conn_p);
 static void read_client(struct lconn *conn_p);
 static int write_sendq(struct lconn *conn_p);
+static void sendq_add(struct lconn *conn_p, const char *buf, size_t len);
+static void sendq_clear(struct lconn *conn_p);
 static void parse_server(char *buf, int len);
 static void parse_client(struct lconn *conn_p, char *buf, int len);
+static void io_set_interest(struct lconn *conn_p);
 #ifdef HAVE_GETADDRINFO
 static struct addrinfo *gethostinfo(char const *host, int port);
 #endif
@@ -103,22 +117,29 @@ ignore_errno(int ierrno)
 	}
 }
 
-/* get_line()
- *   Gets a line of data from a given connection
+/* fill_recvbuf()
+ *   reads as much data as will fit into a connections recvbuf with a
+ *   single read(), the lines are then taken out with get_line()
  *
- * inputs	- connection to get line for, buffer to put in, size of buffer
- * outputs	- characters read
+ * inputs	- connection to read for
+ * outputs	- characters read, 0 if nothing was available, -1 on error
  */
 static int
-get_line(struct lconn *conn_p)
+fill_recvbuf(struct lconn *conn_p)
 {
-	char *p;
 	ssize_t n;
-	int term;
-	size_t buflen;
 
-	if((n = recv(conn_p->fd, conn_p->recvbuf + conn_p->recvbuf_offset, 
-			sizeof(conn_p->recvbuf) - conn_p->recvbuf_offset, MSG_PEEK)) <= 0)
+	/* shift any partial line down to the start of the buffer */
+	if(conn_p->recvbuf_pos > 0)
+	{
+		conn_p->recvbuf_len -= conn_p->recvbuf_pos;
+		memmove(conn_p->recvbuf, conn_p->recvbuf + conn_p->recvbuf_pos,
+			conn_p->recvbuf_len);
+		conn_p->recvbuf_pos = 0;
+	}
+
+	if((n = read(conn_p->fd, conn_p->recvbuf + conn_p->recvbuf_len,
+			sizeof(conn_p->recvbuf) - conn_p->recvbuf_len)) <= 0)
 	{
 		if(n == -1 && ignore_errno(errno))
 			return 0;
@@ -126,66 +147,191 @@ get_line(struct lconn *conn_p)
 		return -1;
 	}
 
-	/* if we found a '\n', set n to the position of it in the stream,
-	 * that way the following read() call will only read a single line
-	 */
-	if((p = memchr(conn_p->recvbuf, '\n', conn_p->recvbuf_offset + n)) != NULL)
-		n = p - conn_p->recvbuf - conn_p->recvbuf_offset + 1;
+	conn_p->recvbuf_len += n;
+	conn_p->recv_count++;
+
+	return n;
+}
+
+/* get_line()
+ *   Gets the next complete line from a connections recvbuf
+ *
+ * inputs	- connection to get line for, pointer to set to the line
+ * outputs	- length of line, 0 if theres no complete line left
+ */
+static int
+get_line(struct lconn *conn_p, char **line)
+{
+	char *start;
+	char *p;
+	size_t avail;
+	size_t linelen;
 
-	if((n = read(conn_p->fd, conn_p->recvbuf + conn_p->recvbuf_offset, n)) <= 0)
+	while(conn_p->recvbuf_pos < conn_p->recvbuf_len)
 	{
-		if(n == -1 && ignore_errno(errno))
-			return 0;
+		start = conn_p->recvbuf + conn_p->recvbuf_pos;
+		avail = conn_p->recvbuf_len - conn_p->recvbuf_pos;
 
-		return -1;
+		if((p = memchr(start, '\n', avail)) == NULL)
+		{
+			/* we dont want to parse this.. its the remainder of
+			 * an unterminated line --fl
+			 */
+			if(conn_p->flags & CONN_FLAGS_UNTERMINATED)
+			{
+				conn_p->recvbuf_pos = conn_p->recvbuf_len;
+				return 0;
+			}
+
+			/* if this is still under the length limit then we
+			 * likely have a short read and more data is coming.
+			 */
+			if(avail < BUFSIZE)
+				return 0;
+
+			/* we're allowed to parse the start of this line, but
+			 * the rest of it up to the '\n' gets thrown away
+			 */
+			conn_p->flags |= CONN_FLAGS_UNTERMINATED;
+			conn_p->recvbuf_pos = conn_p->recvbuf_len;
+			linelen = BUFSIZE - 1;
+		}
+		else
+		{
+			linelen = p - start;
+			conn_p->recvbuf_pos += linelen + 1;
+
+			/* found a \n, can begin parsing again.. */
+			if(conn_p->flags & CONN_FLAGS_UNTERMINATED)
+			{
+				conn_p->flags &= ~CONN_FLAGS_UNTERMINATED;
+				continue;
+			}
+
+			if(linelen == 0)
+				continue;
+
+			if(linelen >= BUFSIZE)
+				linelen = BUFSIZE - 1;
+		}
+
+		start[linelen] = '\0';
+		*line = start;
+		conn_p->recv_lines++;
+
+		return linelen;
 	}
 
-	buflen = conn_p->recvbuf_offset + n;
+	return 0;
+}
 
-	/* for sanity reasons, this makes sure that when recv() told us we
-	 * were getting a '\n', we actually did from read() --fl
-	 */
-	if(memchr(conn_p->recvbuf, '\n', buflen))
-		term = 1;
-	else
-		term = 0;
+/* init_io()
+ *   picks the io backend to use, preferring epoll where its available
+ *
+ * inputs	-
+ * outputs	-
+ */
+void
+init_io(void)
+{
+	sendq_heap = BlockHeapCreate("Send Queue", sizeof(struct sendq_chunk), HEAP_SENDQ);
 
-	/* if this isnt terminated, and is still under the length limit then
-	 * we likely have a short read and more data is coming.
-	 *
-	 * update the offset so we dont trash the recvbuf and return a
-	 * non-fatal error
-	 */
-	if(!term && (buflen < sizeof(conn_p->recvbuf)))
+#ifdef USE_EPOLL
+	io_backend = &io_epoll_backend;
+
+	if(io_backend->init() == 0)
+		return;
+
+	mlog("warning: unable to initialise epoll io backend (%s), "
+		"falling back to select", strerror(errno));
+#endif
+
+	io_backend = &io_select_backend;
+
+	if(io_backend->init() < 0)
+		die(0, "Unable to initialise io backend %s", io_backend->name);
+}
+
+/* io_set_interest()
+ *   updates the events a connection is registered for with the io
+ *   backend.  This is only passed to the backend when it changes, which
+ *   happens when the connection finishes connecting, or the sendq
+ *   becomes empty/non-empty.
+ *
+ * inputs	- connection to update
+ * outputs	-
+ */
+static void
+io_set_interest(struct lconn *conn_p)
+{
+	int flags;
+
+	/* corked data is written by flush_server() before we next wait */
+	if(conn_p->flags & CONN_FLAGS_CORKED)
+		return;
+
+	if(conn_p->fd < 0 || ConnDead(conn_p))
+		flags = 0;
+	else if(ConnConnecting(conn_p))
+		flags = ConnDccIn(conn_p) ? IO_READ : IO_WRITE;
+	else
 	{
-		conn_p->recvbuf_offset += n;
-		return 0;
+		flags = IO_READ;
+
+		if(conn_p->sendq_len > 0)
+			flags |= IO_WRITE;
 	}
-	else
-		conn_p->recvbuf_offset = 0;
 
-	/* we're allowed to parse this line.. */
-	if((conn_p->flags & CONN_FLAGS_UNTERMINATED) == 0)
+	if(flags != conn_p->io_flags)
+		io_backend->update(conn_p, flags);
+}
+
+/* io_dispatch()
+ *   called by the io backend when a connection has events pending
+ *
+ * inputs	- connection, IO_READ|IO_WRITE
+ * outputs	-
+ */
+void
+io_dispatch(struct lconn *conn_p, int flags)
+{
+	if(ConnDead(conn_p))
+		return;
+
+	if((flags & IO_READ) && conn_p->io_read != NULL)
 	{
-		if(buflen >= sizeof(conn_p->recvbuf))
-			conn_p->recvbuf[sizeof(conn_p->recvbuf) - 1] = '\0';
-		else
-			conn_p->recvbuf[buflen] = '\0';
+		conn_p->last_time = CURRENT_TIME;
 
-		if(!term)
-			conn_p->flags |= CONN_FLAGS_UNTERMINATED;
+		if(conn_p == server_p)
+			ClearConnSentPing(conn_p);
 
-		return buflen;
+		(conn_p->io_read)(conn_p);
 	}
 
-	/* found a \n, can begin parsing again.. */
-	if(term)
-		conn_p->flags &= ~CONN_FLAGS_UNTERMINATED;
+	/* couldve died during read.. */
+	if(!ConnDead(conn_p) && (flags & IO_WRITE) && conn_p->io_write != NULL)
+		(conn_p->io_write)(conn_p);
+}
 
-	/* we dont want to parse this.. its the remainder of an unterminated
-	 * line --fl
-	 */
-	return 0;
+/* io_get_timeout()
+ *   works out how long we can wait for io before the next event is due
+ *
+ * inputs	-
+ * outputs	- timeout in milliseconds
+ */
+static long
+io_get_timeout(void)
+{
+	long timeout;
+
+	/* tasks have work waiting, just check for io and carry on */
+	if(eventTaskPending())
+		return 0;
+
+	if((timeout = eventNextTimeout()) == -1 || timeout > IO_MAX_WAIT)
+		return IO_MAX_WAIT;
+
+	return timeout;
 }
 
 /* read_io()
@@ -196,20 +342,24 @@ get_line(struct lconn *conn_p)
  */
 void
 read_io(void)
+{
+	while(1)
+		io_loop(1);
+}
+
+/* io_loop()
+ *   a single pass of the main loop: reaps dead connections and clients,
+ *   runs events and waits for io
+ *
+ * inputs	- whether to wait for io until the next event is due
+ * outputs	-
+ */
+void
+io_loop(int block)
 {
 	struct lconn *conn_p;
 	dlink_node *ptr;
 	dlink_node *next_ptr;
-	struct timeval read_time_out;
-	int select_result;
-
-	while(1)
-	{
-	FD_ZERO(&readfds);
-	FD_ZERO(&writefds);
-
-	read_time_out.tv_sec = 1L;
-	read_time_out.tv_usec = 0L;
 
 	if(server_p != NULL)
 	{
@@ -306,6 +456,9 @@ read_io(void)
 		}
 	}
 
+	/* batch hooks may still be holding exited clients */
+	hook_flush_batches();
+
 	/* we can safely exit anything thats dead at this point */
 	DLINK_FOREACH_SAFE(ptr, next_ptr, exited_list.head)
 	{
@@ -314,94 +467,16 @@ read_io(void)
 	exited_list.head = exited_list.tail = NULL;
 	exited_list.length = 0;
 
-	if(server_p != NULL)
-	{
-		if(ConnConnecting(server_p))
-		{
-			FD_SET(server_p->fd, &writefds);
-		}
-		else
-		{
-			if(dlink_list_length(&server_p->sendq) > 0)
-				FD_SET(server_p->fd, &writefds);
-			FD_SET(server_p->fd, &readfds);
-		}
-	}
-
-	DLINK_FOREACH(ptr, connection_list.head)
-	{
-		conn_p = ptr->data;
-
-		if(ConnConnecting(conn_p))
-		{
-			if(ConnDccIn(conn_p))
-				FD_SET(conn_p->fd, &readfds);
-			else
-				FD_SET(conn_p->fd, &writefds);
-		}
-		else
-		{
-			if(dlink_list_length(&conn_p->sendq) > 0)
-				FD_SET(conn_p->fd, &writefds);
-			FD_SET(conn_p->fd, &readfds);
-		}
-	}
-
 	set_time();
 	eventRun();
+	eventTaskRun();
 
-	select_result = select(FD_SETSIZE, &readfds, &writefds, NULL,
-			&read_time_out);
-
-	if(select_result == 0)
-		continue;
-
-	/* have data to parse */
-	if(select_result > 0)
-	{
-		if(server_p != NULL && !ConnDead(server_p))
-		{
-			/* data from server to read */
-			if(FD_ISSET(server_p->fd, &readfds) &&
-					server_p->io_read != NULL)
-			{
-				server_p->last_time = CURRENT_TIME;
-				ClearConnSentPing(server_p);
-				(server_p->io_read)(server_p);
-			}
-
-			/* couldve died during read.. */
-			if(!ConnDead(server_p) &&
-			   FD_ISSET(server_p->fd, &writefds) &&
-			   server_p->io_write != NULL)
-			{
-				(server_p->io_write)(server_p);
-			}
-		}
-
-		DLINK_FOREACH(ptr, connection_list.head)
-		{
-			conn_p = ptr->data;
-
-			if(ConnDead(conn_p))
-				continue;
-
-			if(FD_ISSET(conn_p->fd, &readfds) &&
-					conn_p->io_read != NULL)
-			{
-				conn_p->last_time = CURRENT_TIME;
-				(conn_p->io_read)(conn_p);
-			}
+	/* anything we've buffered for the server gets written now */
+	flush_server();
 
-			if(!ConnDead(conn_p) && 
-			   FD_ISSET(conn_p->fd, &writefds) &&
-			   conn_p->io_write != NULL)
-			{
-				(conn_p->io_write)(conn_p);
-			}
-		}
-	}
-	}
+	if(io_backend->wait(block ? io_get_timeout() : 0) < 0 && !ignore_errno(errno))
+		mlog("warning: io backend %s failed: %s",
+			io_backend->name, strerror(errno));
 }
 
 /* next_autoconn()
@@ -495,8 +570,56 @@ connect_to_server(void *target_server)
 	SetConnConnecting(conn_p);
 
 	server_p = conn_p;
+	io_set_interest(conn_p);
+}
+
+#ifdef RSERV_BENCH
+/* bench_connect_server()
+ *   sets up our server connection over an fd thats already connected,
+ *   and signs on to it.  The benchmark feeds the lines the server would
+ *   send through bench_parse_server() itself.
+ *
+ * inputs	- server name, password, connected fd
+ * outputs	-
+ */
+void
+bench_connect_server(const char *name, const char *pass, int fd)
+{
+	struct lconn *conn_p;
+
+	conn_p = my_malloc(sizeof(struct lconn));
+	conn_p->name = my_strdup(name);
+	conn_p->fd = fd;
+	conn_p->first_time = conn_p->last_time = CURRENT_TIME;
+	conn_p->pass = my_strdup(pass);
+	conn_p->io_close = signoff_server;
+
+	server_p = conn_p;
+	signon_server(conn_p);
+
+	/* we never read from it, the lines come from the benchmark */
+	conn_p->io_read = NULL;
 }
 
+/* bench_parse_server()
+ *   parses a line as if it had been read from our server
+ *
+ * inputs	- line, length of line
+ * outputs	-
+ */
+void
+bench_parse_server(char *buf, int len)
+{
+	if(server_p == NULL || ConnDead(server_p))
+		return;
+
+	server_p->last_time = CURRENT_TIME;
+	ClearConnSentPing(server_p);
+
+	parse_server(buf, len);
+}
+#endif
+
 /* connect_to_client()
  *   connects to a client
  *
@@ -532,6 +655,7 @@ connect_to_client(struct client *client_p, struct conf_oper *oper_p,
 	SetConnDccOut(conn_p);
 
 	dlink_add_alloc(conn_p, &connection_list);
+	io_set_interest(conn_p);
 }
 
 void
@@ -599,6 +723,7 @@ connect_from_client(struct client *client_p, struct conf_oper *oper_p,
 	SetConnDccIn(conn_p);
 
 	dlink_add_alloc(conn_p, &connection_list);
+	io_set_interest(conn_p);
 
 	memcpy(&local_ip, local_addr->h_addr, local_addr->h_length);
 	local_ip = htonl(local_ip);
@@ -621,6 +746,7 @@ signon_server(struct lconn *conn_p)
 
 	conn_p->io_read = read_server;
 	conn_p->io_write = write_sendq;
+	io_set_interest(conn_p);
 
 	/* ok, if connect() failed, this will cause an error.. */
 	sendto_server("PASS %s TS 6 %s", conn_p->pass, config_file.sid);
@@ -666,10 +792,14 @@ signon_client_in(struct lconn *conn_p)
 	conn_p->io_read = read_client;
 	conn_p->io_write = write_sendq;
 
+	/* the listening socket gets replaced with the accepted one */
+	if(conn_p->io_flags)
+		io_backend->update(conn_p, 0);
 	shutdown(conn_p->fd, SHUT_RDWR);
 	close(conn_p->fd);
 
 	conn_p->fd = sock;
+	io_set_interest(conn_p);
 
 	sendto_one(conn_p, "Welcome to %s, version ratbox-services-%s",
 		   MYNAME, RSERV_VERSION);
@@ -695,6 +825,7 @@ signon_client_out(struct lconn *conn_p)
 	ClearConnConnecting(conn_p);
 	conn_p->io_read = read_client;
 	conn_p->io_write = write_sendq;
+	io_set_interest(conn_p);
 
 	/* ok, if connect() failed, this will cause an error.. */
 	sendto_one(conn_p, "Welcome to %s, version ratbox-services-%s",
@@ -771,10 +902,20 @@ signoff_server(struct lconn *conn_p)
 static void
 read_server(struct lconn *conn_p)
 {
+	char *line;
 	int n;
 
-	if((n = get_line(server_p)) > 0)
-		parse_server(server_p->recvbuf, n);
+	if((n = fill_recvbuf(conn_p)) > 0)
+	{
+		/* parse every complete line we got from the read() */
+		while((n = get_line(conn_p, &line)) > 0)
+		{
+			parse_server(line, n);
+
+			if(ConnDead(conn_p))
+				return;
+		}
+	}
 
         /* we had a fatal error.. close the socket */
 	else if(n < 0)
@@ -807,10 +948,19 @@ read_server(struct lconn *conn_p)
 static void
 read_client(struct lconn *conn_p)
 {
+	char *line;
 	int n;
 
-	if((n = get_line(conn_p)) > 0)
-		parse_client(conn_p, conn_p->recvbuf, n);
+	if((n = fill_recvbuf(conn_p)) > 0)
+	{
+		while((n = get_line(conn_p, &line)) > 0)
+		{
+			parse_client(conn_p, line, n);
+
+			if(ConnDead(conn_p))
+				return;
+		}
+	}
 
         /* fatal error */
 	else if(n < 0)
@@ -1040,6 +1190,22 @@ sendto_server(const char *format, ...)
 
 	strcat(buf, "\r\n");
 
+	/* once we're linked, output to the server can be corked and is
+	 * written out by flush_server() in one go.
+	 */
+	if(config_file.cork_size > 0 && !ConnConnecting(server_p) &&
+	   !ConnHandshake(server_p))
+	{
+		server_p->flags |= CONN_FLAGS_CORKED;
+		server_p->cork_lines++;
+		sendq_add(server_p, buf, strlen(buf));
+
+		if(server_p->sendq_len >= (unsigned long) config_file.cork_size)
+			flush_server();
+
+		return;
+	}
+
 	if(sock_write(server_p, buf, strlen(buf)) < 0)
 	{
 		mlog("Connection to server %s lost: (Write error: %s)",
@@ -1050,6 +1216,39 @@ sendto_server(const char *format, ...)
 	}
 }
 
+/* flush_server()
+ *   writes out anything corked for our server
+ *
+ * inputs	-
+ * outputs	-
+ */
+void
+flush_server(void)
+{
+	if(server_p == NULL || !(server_p->flags & CONN_FLAGS_CORKED))
+		return;
+
+	server_p->flags &= ~CONN_FLAGS_CORKED;
+
+	if(ConnDead(server_p))
+		return;
+
+	server_p->cork_flushes++;
+
+	if(write_sendq(server_p) < 0)
+	{
+		mlog("Connection to server %s lost: (Write error: %s)",
+		     server_p->name, strerror(errno));
+		sendto_all("Connection to server %s lost: (Write error: %s)",
+				server_p->name, strerror(errno));
+		(server_p->io_close)(server_p);
+		return;
+	}
+
+	/* partial write, wait for it to become writable */
+	io_set_interest(server_p);
+}
+
 /* sendto_one()
  *   attempts to send the given data to a given connection
  *
@@ -1147,22 +1346,60 @@ sendto_all_chat(struct lconn *one, const char *format, ...)
 unsigned long
 get_sendq(struct lconn *conn_p)
 {
-        struct send_queue *sendq_ptr;
-        dlink_node *ptr;
-        unsigned long sendq = 0;
+        return conn_p->sendq_len;
+}
 
-        DLINK_FOREACH(ptr, conn_p->sendq.head)
-        {
-                sendq_ptr = ptr->data;
+/* sendq_consume()
+ *   removes data that has been written from the front of a sendq
+ *
+ * inputs	- connection, amount of data written
+ * outputs	-
+ */
+static void
+sendq_consume(struct lconn *conn_p, size_t len)
+{
+	struct sendq_chunk *chunk;
+	dlink_node *ptr;
+	dlink_node *next_ptr;
+	size_t n;
 
-                sendq += sendq_ptr->len;
-        }
+	DLINK_FOREACH_SAFE(ptr, next_ptr, conn_p->sendq.head)
+	{
+		if(len == 0)
+			break;
+
+		chunk = ptr->data;
+		n = chunk->len - chunk->pos;
 
-        return sendq;
+		if(len < n)
+		{
+			chunk->pos += len;
+			conn_p->sendq_len -= len;
+			break;
+		}
+
+		len -= n;
+		conn_p->sendq_len -= n;
+
+		dlink_delete(ptr, &conn_p->sendq);
+		BlockHeapFree(sendq_heap, chunk);
+	}
+}
+
+/* sendq_clear()
+ *   throws away the entire sendq of a connection
+ *
+ * inputs	- connection to clear sendq of
+ * outputs	-
+ */
+static void
+sendq_clear(struct lconn *conn_p)
+{
+	sendq_consume(conn_p, conn_p->sendq_len);
 }
 
 /* write_sendq()
- *   write()'s as much of a given users sendq as possible
+ *   writev()'s as much of a given users sendq as possible
  *
  * inputs	- connection to flush sendq of
  * outputs	- -1 on fatal error, 0 on partial write, otherwise 1
@@ -1170,57 +1407,89 @@ get_sendq(struct lconn *conn_p)
 static int
 write_sendq(struct lconn *conn_p)
 {
-	struct send_queue *sendq;
+	struct iovec iov[SENDQ_IOV_MAX];
+	struct sendq_chunk *chunk;
 	dlink_node *ptr;
-	dlink_node *next_ptr;
-	int n;
+	ssize_t n;
+	size_t len;
+	int count;
 
-	DLINK_FOREACH_SAFE(ptr, next_ptr, conn_p->sendq.head)
+	while(conn_p->sendq_len > 0)
 	{
-		sendq = ptr->data;
+		count = 0;
+		len = 0;
+
+		DLINK_FOREACH(ptr, conn_p->sendq.head)
+		{
+			if(count >= SENDQ_IOV_MAX)
+				break;
+
+			chunk = ptr->data;
+			iov[count].iov_base = chunk->buf + chunk->pos;
+			iov[count].iov_len = chunk->len - chunk->pos;
+			len += iov[count].iov_len;
+			count++;
+		}
 
-		/* write, starting at the offset */
-		if((n = write(conn_p->fd, sendq->buf + sendq->pos, sendq->len)) < 0)
+		if((n = writev(conn_p->fd, iov, count)) < 0)
 		{
-			if(n == -1 && ignore_errno(errno))
+			if(ignore_errno(errno))
 				return 0;
 
 			return -1;
 		}
 
-		/* wrote full sendq? */
-		if(n == sendq->len)
-		{
-			dlink_destroy(ptr, &conn_p->sendq);
-			my_free((void *)sendq->buf);
-			my_free(sendq);
-		}
-		else
-		{
-			sendq->pos += n;
-			sendq->len -= n;
+		sendq_consume(conn_p, n);
+
+		/* partial write, wait until we're writable again */
+		if((size_t) n < len)
 			return 0;
-		}
 	}
 
+	/* sendq is empty, stop waiting for it to become writable */
+	io_set_interest(conn_p);
 	return 1;
 }
 
 /* sendq_add()
- *   adds a given buffer to a connections sendq
+ *   appends a given buffer to a connections sendq
  *
- * inputs	- connection to add to, buffer to add, length of buffer,
- *		  offset at where to start writing
+ * inputs	- connection to add to, buffer to add, length of buffer
  * outputs	-
  */
 static void
-sendq_add(struct lconn *conn_p, const char *buf, size_t len, size_t offset)
+sendq_add(struct lconn *conn_p, const char *buf, size_t len)
 {
-	struct send_queue *sendq = my_calloc(1, sizeof(struct send_queue));
-	sendq->buf = my_strdup(buf);
-	sendq->len = len - offset;
-	sendq->pos = offset;
-	dlink_add_tail_alloc(sendq, &conn_p->sendq);
+	struct sendq_chunk *chunk = NULL;
+	size_t n;
+	int was_empty = (conn_p->sendq_len == 0);
+
+	if(conn_p->sendq.tail != NULL)
+		chunk = conn_p->sendq.tail->data;
+
+	while(len > 0)
+	{
+		if(chunk == NULL || chunk->len == SENDQ_CHUNK_SIZE)
+		{
+			chunk = BlockHeapAlloc(sendq_heap);
+			dlink_add_tail(chunk, &chunk->node, &conn_p->sendq);
+		}
+
+		n = SENDQ_CHUNK_SIZE - chunk->len;
+
+		if(n > len)
+			n = len;
+
+		memcpy(chunk->buf + chunk->len, buf, n);
+		chunk->len += n;
+		conn_p->sendq_len += n;
+
+		buf += n;
+		len -= n;
+	}
+
+	if(was_empty)
+		io_set_interest(conn_p);
 }
 
 int
@@ -1431,16 +1700,16 @@ sock_open(const char *host, int port, const char *vhost, int type)
 int
 sock_write(struct lconn *conn_p, const char *buf, size_t len)
 {
-	size_t n;
+	ssize_t n;
 
-	if(dlink_list_length(&conn_p->sendq) > 0)
+	if(conn_p->sendq_len > 0)
 	{
 		n = (conn_p->io_write)(conn_p);
 
 		/* got a partial write, add the new line to the sendq */
 		if(n == 0)
 		{
-			sendq_add(conn_p, buf, len, 0);
+			sendq_add(conn_p, buf, len);
 			return 0;
 		}
 		else if(n == -1)
@@ -1461,8 +1730,8 @@ sock_write(struct lconn *conn_p, const char *buf, size_t len)
 	/* partial write.. add this line to sendq with offset of however
 	 * much we wrote
 	 */
-	if(n != len)
-		sendq_add(conn_p, buf, len, n);
+	if((size_t) n != len)
+		sendq_add(conn_p, buf + n, len - n);
 
 	return 1;
 }
@@ -1470,6 +1739,10 @@ sock_write(struct lconn *conn_p, const char *buf, size_t len)
 void
 sock_close(struct lconn *conn_p)
 {
+	if(conn_p->io_flags)
+		io_backend->update(conn_p, 0);
+
+	sendq_clear(conn_p);
 	close(conn_p->fd);
 	conn_p->fd = -1;
 
@@ -0,0 +1,144 @@
+/* src/io_epoll.c
+ *   Contains the epoll() io backend.
+ *
+ * Copyright (C) 2010 ircd-ratbox development team
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1.Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 2.Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * 3.The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id$
+ */
+#include "stdinc.h"
+#include "rserv.h"
+#include "io.h"
+#include "log.h"
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+
+#define EPOLL_MAX_EVENTS	64
+
+static int epoll_fd = -1;
+static struct epoll_event epoll_events[EPOLL_MAX_EVENTS];
+
+static int
+epoll_init(void)
+{
+	if((epoll_fd = epoll_create(EPOLL_MAX_EVENTS)) < 0)
+		return -1;
+
+	/* dont leak the epoll fd into the email/sendmail children */
+	fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+	return 0;
+}
+
+/* epoll_update()
+ *   sets the events we're interested in for a connection.  The
+ *   connection is only touched in the kernel when this changes.
+ *
+ * inputs	- connection, IO_READ|IO_WRITE, 0 to remove it
+ * outputs	- 0 on success, -1 on error
+ */
+static int
+epoll_update(struct lconn *conn_p, int flags)
+{
+	struct epoll_event ev;
+	int op;
+
+	if(conn_p->fd < 0)
+		return -1;
+
+	if(flags == 0)
+		op = EPOLL_CTL_DEL;
+	else if(conn_p->io_flags == 0)
+		op = EPOLL_CTL_ADD;
+	else
+		op = EPOLL_CTL_MOD;
+
+	memset(&ev, 0, sizeof(struct epoll_event));
+	ev.data.ptr = conn_p;
+
+	if(flags & IO_READ)
+		ev.events |= EPOLLIN;
+	if(flags & IO_WRITE)
+		ev.events |= EPOLLOUT;
+
+	if(epoll_ctl(epoll_fd, op, conn_p->fd, &ev) < 0)
+	{
+		mlog("epoll_ctl() failed for %s: %s",
+			conn_p->name, strerror(errno));
+		return -1;
+	}
+
+	conn_p->io_flags = flags;
+	return 0;
+}
+
+static int
+epoll_wait_events(long timeout)
+{
+	struct lconn *conn_p;
+	int flags;
+	int result;
+	int i;
+
+	result = epoll_wait(epoll_fd, epoll_events, EPOLL_MAX_EVENTS, (int) timeout);
+
+	if(result <= 0)
+		return result;
+
+	set_time();
+
+	/* connections are only freed at the top of read_io(), so the
+	 * pointers here remain valid even if an earlier handler in this
+	 * batch closed them.
+	 */
+	for(i = 0; i < result; i++)
+	{
+		conn_p = epoll_events[i].data.ptr;
+		flags = 0;
+
+		if(epoll_events[i].events & EPOLLIN)
+			flags |= IO_READ;
+		if(epoll_events[i].events & EPOLLOUT)
+			flags |= IO_WRITE;
+
+		/* errors get passed to whatever handlers are waiting, so
+		 * the failing read()/write() closes the connection
+		 */
+		if(epoll_events[i].events & (EPOLLERR|EPOLLHUP))
+			flags |= conn_p->io_flags;
+
+		io_dispatch(conn_p, flags);
+	}
+
+	return 0;
+}
+
+struct io_backend io_epoll_backend =
+{
+	"epoll", epoll_init, epoll_update, epoll_wait_events
+};
+
+#endif
@@ -0,0 +1,157 @@
+/* src/io_select.c
+ *   Contains the select() io backend.
+ *
+ * Copyright (C) 2010 ircd-ratbox development team
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1.Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 2.Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * 3.The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id$
+ */
+#include "stdinc.h"
+#include "rserv.h"
+#include "io.h"
+#include "log.h"
+
+static fd_set select_readfds;
+static fd_set select_writefds;
+static struct lconn *select_fdtable[FD_SETSIZE];
+static int select_maxfd = -1;
+
+static int
+select_init(void)
+{
+	FD_ZERO(&select_readfds);
+	FD_ZERO(&select_writefds);
+	memset(select_fdtable, 0, sizeof(select_fdtable));
+	select_maxfd = -1;
+	return 0;
+}
+
+/* select_update()
+ *   sets the events we're interested in for a connection
+ *
+ * inputs	- connection, IO_READ|IO_WRITE, 0 to remove it
+ * outputs	- 0 on success, -1 on error
+ */
+static int
+select_update(struct lconn *conn_p, int flags)
+{
+	int fd = conn_p->fd;
+
+	if(fd < 0)
+		return -1;
+
+	if(fd >= FD_SETSIZE)
+	{
+		mlog("fatal error: fd %d for %s exceeds FD_SETSIZE (%d)",
+			fd, conn_p->name, FD_SETSIZE);
+		return -1;
+	}
+
+	if(flags & IO_READ)
+		FD_SET(fd, &select_readfds);
+	else
+		FD_CLR(fd, &select_readfds);
+
+	if(flags & IO_WRITE)
+		FD_SET(fd, &select_writefds);
+	else
+		FD_CLR(fd, &select_writefds);
+
+	if(flags)
+	{
+		select_fdtable[fd] = conn_p;
+
+		if(fd > select_maxfd)
+			select_maxfd = fd;
+	}
+	else
+	{
+		select_fdtable[fd] = NULL;
+
+		while(select_maxfd >= 0 && select_fdtable[select_maxfd] == NULL)
+			select_maxfd--;
+	}
+
+	conn_p->io_flags = flags;
+	return 0;
+}
+
+static int
+select_wait(long timeout)
+{
+	struct timeval tv;
+	fd_set readfds;
+	fd_set writefds;
+	struct lconn *conn_p;
+	int maxfd = select_maxfd;
+	int flags;
+	int result;
+	int fd;
+
+	memcpy(&readfds, &select_readfds, sizeof(fd_set));
+	memcpy(&writefds, &select_writefds, sizeof(fd_set));
+
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	result = select(maxfd + 1, &readfds, &writefds, NULL, &tv);
+
+	if(result <= 0)
+		return result;
+
+	set_time();
+
+	for(fd = 0; fd <= maxfd && result > 0; fd++)
+	{
+		flags = 0;
+
+		if(FD_ISSET(fd, &readfds))
+		{
+			flags |= IO_READ;
+			result--;
+		}
+
+		if(FD_ISSET(fd, &writefds))
+		{
+			flags |= IO_WRITE;
+			result--;
+		}
+
+		if(!flags)
+			continue;
+
+		/* may have been closed by an earlier handler */
+		if((conn_p = select_fdtable[fd]) != NULL)
+			io_dispatch(conn_p, flags);
+	}
+
+	return 0;
+}
+
+struct io_backend io_select_backend =
+{
+	"select", select_init, select_update, select_wait
+};
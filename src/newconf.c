@@ -525,6 +525,24 @@ conf_set_serverinfo_lang(void *data)
 	config_file.default_language = lang_get_langcode((const char *) data);
 }
 
+static void
+conf_set_serverinfo_crypt_scheme(void *data)
+{
+	const char *scheme = data;
+
+	if(!strcasecmp(scheme, "sha512"))
+		config_file.crypt_scheme = CRYPT_SHA512;
+	else if(!strcasecmp(scheme, "sha256"))
+		config_file.crypt_scheme = CRYPT_SHA256;
+	else if(!strcasecmp(scheme, "md5"))
+		config_file.crypt_scheme = CRYPT_MD5;
+	else if(!strcasecmp(scheme, "des"))
+		config_file.crypt_scheme = CRYPT_DES;
+	else
+		conf_report_error("Warning -- unknown crypt_scheme %s; ignoring.",
+				scheme);
+}
+
 static void
 conf_set_email_program(void *data)
 {
@@ -1009,6 +1027,10 @@ static struct ConfEntry conf_serverinfo_table[] =
 	{ "dcc_high_port",	CF_INT,     NULL, 0, &config_file.dcc_high_port },
 	{ "reconnect_time",	CF_TIME,    NULL, 0, &config_file.reconnect_time },
 	{ "ping_time",		CF_TIME,    NULL, 0, &config_file.ping_time	},
+	{ "cork_size",		CF_TIME,    NULL, 0, &config_file.cork_size	},
+	{ "crypt_threads",	CF_INT,     NULL, 0, &config_file.crypt_threads },
+	{ "crypt_scheme",	CF_QSTRING, conf_set_serverinfo_crypt_scheme, 0, NULL },
+	{ "crypt_rounds",	CF_INT,     NULL, 0, &config_file.crypt_rounds	},
 	{ "ratbox",		CF_YESNO,   NULL, 0, &config_file.ratbox	},
 	{ "allow_stats_o",	CF_YESNO,   NULL, 0, &config_file.allow_stats_o },
 	{ "allow_sslonly",	CF_YESNO,   NULL, 0, &config_file.allow_sslonly },
@@ -1035,6 +1057,7 @@ static struct ConfEntry conf_database_table[] =
 	{ "name",	CF_QSTRING,	NULL, 0, &config_file.db_name		},
 	{ "username",	CF_QSTRING,	NULL, 0, &config_file.db_username	},
 	{ "password",	CF_QSTRING,	NULL, 0, &config_file.db_password	},
+	{ "async_writes", CF_YESNO,	NULL, 0, &config_file.db_async_writes	},
 	{ "\0", 0, NULL, 0, NULL }
 };
 
@@ -41,10 +41,26 @@
 
 #define RSDB_MAXCOLS			30
 #define RSDB_MAX_RECONNECT_TIME		30
+#define RSDB_MAXPARAMS			30
+#define RSDB_STMT_HASH			64	/* must be a power of two */
 
 MYSQL *rsdb_database;
 int rsdb_doing_transaction;
 
+/* cache of prepared statements, keyed on the sql text.  The handle is
+ * prepared lazily, and dropped whenever the connection is reestablished.
+ */
+struct rsdb_stmt
+{
+	char *sql;
+	MYSQL_STMT *handle;
+	struct rsdb_stmt *next;
+};
+
+static struct rsdb_stmt *rsdb_stmt_table[RSDB_STMT_HASH];
+
+static void rsdb_stmt_invalidate(void);
+
 static int rsdb_connect(int initial);
 
 /* rsdb_init()
@@ -79,7 +95,13 @@ rsdb_connect(int initial)
 				config_file.db_name, 0, NULL, 0);
 
 	if(unused)
+	{
+		/* prepared statements are lost with the old connection */
+		if(!initial)
+			rsdb_stmt_invalidate();
+
 		return 0;
+	}
 
 	/* all errors on startup are fatal */
 	if(initial)
@@ -102,6 +124,23 @@ rsdb_connect(int initial)
 void
 rsdb_shutdown(void)
 {
+	struct rsdb_stmt *stmt, *next_stmt;
+	int i;
+
+	rsdb_stmt_invalidate();
+
+	for(i = 0; i < RSDB_STMT_HASH; i++)
+	{
+		for(stmt = rsdb_stmt_table[i]; stmt; stmt = next_stmt)
+		{
+			next_stmt = stmt->next;
+			my_free(stmt->sql);
+			my_free(stmt);
+		}
+
+		rsdb_stmt_table[i] = NULL;
+	}
+
 	mysql_close(rsdb_database);
 }
 
@@ -200,15 +239,100 @@ rsdb_quote(const char *src)
 	return buf;
 }
 
+/* rsdb_cursor_start()
+ * executes a query, leaving the result on the server to be fetched a
+ * row at a time.  No other query may be issued until the cursor is closed.
+ */
+static void
+rsdb_cursor_start(struct rsdb_cursor *cursor, const char *sql)
+{
+	MYSQL_RES *rsdb_result = NULL;
+
+	if(mysql_query(rsdb_database, sql))
+		rsdb_handle_error(NULL, sql);
+
+	cursor->col_count = mysql_field_count(rsdb_database);
+	cursor->row_count = 0;
+	cursor->row = NULL;
+
+	if(cursor->col_count &&
+	   (rsdb_result = mysql_use_result(rsdb_database)) == NULL)
+	{
+		mlog("fatal error: problem with db file: %s",
+			mysql_error(rsdb_database));
+		die(0, "problem with db file");
+	}
+
+	cursor->arg = rsdb_result;
+}
+
+void
+rsdb_cursor_open(struct rsdb_cursor *cursor, const char *format, ...)
+{
+	static char buf[BUFSIZE*4];
+	va_list args;
+	int i;
+
+	va_start(args, format);
+	i = rs_vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	if(i >= sizeof(buf))
+	{
+		mlog("fatal error: length problem compiling sql statement: %s", buf);
+		die(0, "length problem compiling sql statement");
+	}
+
+	rsdb_cursor_start(cursor, buf);
+}
+
+int
+rsdb_cursor_step(struct rsdb_cursor *cursor)
+{
+	if(cursor->arg == NULL)
+		return 0;
+
+	if((cursor->row = mysql_fetch_row((MYSQL_RES *) cursor->arg)) == NULL)
+	{
+		/* unbuffered results report errors when fetching */
+		if(mysql_errno(rsdb_database))
+		{
+			mlog("fatal error: problem with db file: %s",
+				mysql_error(rsdb_database));
+			die(0, "problem with db file");
+		}
+
+		return 0;
+	}
+
+	cursor->row_count++;
+	return 1;
+}
+
+const char *
+rsdb_cursor_column(struct rsdb_cursor *cursor, int col)
+{
+	return ((MYSQL_ROW) cursor->row)[col];
+}
+
+void
+rsdb_cursor_close(struct rsdb_cursor *cursor)
+{
+	/* this also reads off any rows we didn't step through */
+	if(cursor->arg)
+		mysql_free_result((MYSQL_RES *) cursor->arg);
+
+	cursor->arg = NULL;
+	cursor->row = NULL;
+}
+
 void
 rsdb_exec(rsdb_callback cb, const char *format, ...)
 {
 	static char buf[BUFSIZE*4];
 	static const char *coldata[RSDB_MAXCOLS+1];
-	MYSQL_RES *rsdb_result;
-	MYSQL_ROW row;
+	struct rsdb_cursor cursor;
 	va_list args;
-	unsigned int field_count;
 	int i;
 
 	va_start(args, format);
@@ -221,32 +345,35 @@ rsdb_exec(rsdb_callback cb, const char *format, ...)
 		die(0, "length problem compiling sql statement");
 	}
 
-	if(mysql_query(rsdb_database, buf))
-		rsdb_handle_error(NULL, buf);
-
-	field_count = mysql_field_count(rsdb_database);
+	if(!cb)
+	{
+		if(mysql_query(rsdb_database, buf))
+			rsdb_handle_error(NULL, buf);
 
-	if(field_count > RSDB_MAXCOLS)
-		die(0, "too many columns in result set -- contact the ratbox team");
+		/* discard any result set */
+		if(mysql_field_count(rsdb_database))
+			mysql_free_result(mysql_use_result(rsdb_database));
 
-	if(!field_count || !cb)
 		return;
+	}
 
-	if((rsdb_result = mysql_store_result(rsdb_database)) == NULL)
-		rsdb_handle_error(&rsdb_result, NULL);
+	rsdb_cursor_start(&cursor, buf);
+
+	if(cursor.col_count > RSDB_MAXCOLS)
+		die(0, "too many columns in result set -- contact the ratbox team");
 
-	while((row = mysql_fetch_row(rsdb_result)))
+	while(rsdb_cursor_step(&cursor))
 	{
-		for(i = 0; i < field_count; i++)
+		for(i = 0; i < cursor.col_count; i++)
 		{
-			coldata[i] = row[i];
+			coldata[i] = rsdb_cursor_column(&cursor, i);
 		}
 		coldata[i] = NULL;
 
-		(cb)((int) field_count, coldata);
+		(cb)(cursor.col_count, coldata);
 	}
 
-	mysql_free_result(rsdb_result);
+	rsdb_cursor_close(&cursor);
 }
 
 void
@@ -333,6 +460,266 @@ rsdb_exec_fetch_end(struct rsdb_table *table)
 	mysql_free_result((MYSQL_RES *) table->arg);
 }
 
+static unsigned int
+rsdb_stmt_hash(const char *sql)
+{
+	unsigned int hashv = 0;
+
+	while(*sql)
+		hashv = (hashv * 33) ^ (unsigned char) *sql++;
+
+	return hashv & (RSDB_STMT_HASH-1);
+}
+
+/* rsdb_stmt_invalidate()
+ * closes every prepared statement, they will be prepared again on
+ * their next use.  Statements do not survive a reconnection.
+ */
+static void
+rsdb_stmt_invalidate(void)
+{
+	struct rsdb_stmt *stmt;
+	int i;
+
+	for(i = 0; i < RSDB_STMT_HASH; i++)
+	{
+		for(stmt = rsdb_stmt_table[i]; stmt; stmt = stmt->next)
+		{
+			if(stmt->handle)
+			{
+				mysql_stmt_close(stmt->handle);
+				stmt->handle = NULL;
+			}
+		}
+	}
+}
+
+static struct rsdb_stmt *
+rsdb_stmt_find(const char *sql)
+{
+	struct rsdb_stmt *stmt;
+	unsigned int hashv = rsdb_stmt_hash(sql);
+
+	for(stmt = rsdb_stmt_table[hashv]; stmt; stmt = stmt->next)
+	{
+		if(!strcmp(stmt->sql, sql))
+			return stmt;
+	}
+
+	stmt = my_malloc(sizeof(struct rsdb_stmt));
+	stmt->sql = my_strdup(sql);
+	stmt->next = rsdb_stmt_table[hashv];
+	rsdb_stmt_table[hashv] = stmt;
+
+	return stmt;
+}
+
+/* rsdb_stmt_prepare()
+ * prepares a cached statement if it has no handle
+ *
+ * inputs	- statement
+ * outputs	- 0 on success, otherwise the mysql error number
+ * side effects -
+ */
+static unsigned int
+rsdb_stmt_prepare(struct rsdb_stmt *stmt)
+{
+	if(stmt->handle)
+		return 0;
+
+	if((stmt->handle = mysql_stmt_init(rsdb_database)) == NULL)
+		die(0, "Out of memory -- failed to initialise mysql statement");
+
+	if(mysql_stmt_prepare(stmt->handle, stmt->sql, strlen(stmt->sql)))
+	{
+		unsigned int err = mysql_stmt_errno(stmt->handle);
+
+		if(err != CR_SERVER_GONE_ERROR && err != CR_SERVER_LOST)
+		{
+			mlog("fatal error: problem preparing sql statement %s: %s",
+				stmt->sql, mysql_stmt_error(stmt->handle));
+			die(0, "problem with db file");
+		}
+
+		mysql_stmt_close(stmt->handle);
+		stmt->handle = NULL;
+		return err;
+	}
+
+	return 0;
+}
+
+/* rsdb_stmt_execute()
+ * executes a prepared statement with the given parameters
+ *
+ * inputs	- statement, parameters
+ * outputs	- 0 on success, otherwise the mysql error number
+ * side effects -
+ */
+static unsigned int
+rsdb_stmt_execute(struct rsdb_stmt *stmt, MYSQL_BIND *params, int count)
+{
+	unsigned int err;
+
+	if((err = rsdb_stmt_prepare(stmt)))
+		return err;
+
+	if(count != mysql_stmt_param_count(stmt->handle))
+	{
+		mlog("fatal error: parameter count mismatch for sql statement %s",
+			stmt->sql);
+		die(0, "problem compiling sql statement");
+	}
+
+	if((count && mysql_stmt_bind_param(stmt->handle, params)) ||
+	   mysql_stmt_execute(stmt->handle))
+		return mysql_stmt_errno(stmt->handle);
+
+	return 0;
+}
+
+void
+rsdb_exec_prepared(rsdb_callback cb, const char *sql, const char *types, ...)
+{
+	static MYSQL_BIND params[RSDB_MAXPARAMS];
+	static MYSQL_BIND results[RSDB_MAXCOLS];
+	static long long numbers[RSDB_MAXPARAMS];
+	static char coltext[RSDB_MAXCOLS][BUFSIZE*2];
+	static const char *coldata[RSDB_MAXCOLS+1];
+	static my_bool colnull[RSDB_MAXCOLS];
+	static my_bool is_null = 1;
+	struct rsdb_stmt *stmt;
+	const char *str;
+	va_list args;
+	unsigned int field_count;
+	unsigned int err;
+	int count = 0;
+	int i;
+
+	stmt = rsdb_stmt_find(sql);
+
+	memset(params, 0, sizeof(params));
+
+	va_start(args, types);
+	for(; *types; types++, count++)
+	{
+		if(count >= RSDB_MAXPARAMS)
+			die(0, "too many parameters in sql statement -- contact the ratbox team");
+
+		switch(*types)
+		{
+			case 'd':
+				numbers[count] = va_arg(args, int);
+				params[count].buffer_type = MYSQL_TYPE_LONGLONG;
+				params[count].buffer = &numbers[count];
+				break;
+
+			case 'u':
+				numbers[count] = (long long) va_arg(args, unsigned long);
+				params[count].buffer_type = MYSQL_TYPE_LONGLONG;
+				params[count].buffer = &numbers[count];
+				break;
+
+			case 's':
+				params[count].buffer_type = MYSQL_TYPE_STRING;
+
+				if((str = va_arg(args, const char *)) == NULL)
+					params[count].is_null = &is_null;
+				else
+				{
+					params[count].buffer = (char *) str;
+					params[count].buffer_length = strlen(str);
+				}
+				break;
+
+			default:
+				mlog("fatal error: unknown parameter type '%c' for sql statement %s",
+					*types, sql);
+				die(0, "problem compiling sql statement");
+				break;
+		}
+	}
+	va_end(args);
+
+	if((err = rsdb_stmt_execute(stmt, params, count)))
+	{
+		if(rsdb_doing_transaction ||
+		   (err != CR_SERVER_GONE_ERROR && err != CR_SERVER_LOST))
+		{
+			mlog("fatal error: problem with db file: %s",
+				stmt->handle ? mysql_stmt_error(stmt->handle) :
+				mysql_error(rsdb_database));
+			die(0, "problem with db file");
+		}
+
+		/* reconnect, and try again with fresh statements */
+		if(rsdb_connect(0))
+			rsdb_try_reconnect();
+
+		if(rsdb_stmt_execute(stmt, params, count))
+		{
+			mlog("fatal error: problem with db file: %s",
+				stmt->handle ? mysql_stmt_error(stmt->handle) :
+				mysql_error(rsdb_database));
+			die(0, "problem with db file");
+		}
+	}
+
+	field_count = mysql_stmt_field_count(stmt->handle);
+
+	if(!field_count)
+		return;
+
+	if(!cb)
+	{
+		mysql_stmt_free_result(stmt->handle);
+		return;
+	}
+
+	if(field_count > RSDB_MAXCOLS)
+		die(0, "too many columns in result set -- contact the ratbox team");
+
+	memset(results, 0, sizeof(MYSQL_BIND) * field_count);
+
+	for(i = 0; i < field_count; i++)
+	{
+		results[i].buffer_type = MYSQL_TYPE_STRING;
+		results[i].buffer = coltext[i];
+		results[i].buffer_length = sizeof(coltext[i]);
+		results[i].is_null = &colnull[i];
+	}
+
+	if(mysql_stmt_bind_result(stmt->handle, results))
+	{
+		mlog("fatal error: problem with db file: %s",
+			mysql_stmt_error(stmt->handle));
+		die(0, "problem with db file");
+	}
+
+	while((err = mysql_stmt_fetch(stmt->handle)) != MYSQL_NO_DATA)
+	{
+		if(err == 1)
+		{
+			mlog("fatal error: problem with db file: %s",
+				mysql_stmt_error(stmt->handle));
+			die(0, "problem with db file");
+		}
+
+		if(err == MYSQL_DATA_TRUNCATED)
+			mlog("warning: truncated column in result of %s", stmt->sql);
+
+		for(i = 0; i < field_count; i++)
+		{
+			coldata[i] = colnull[i] ? NULL : coltext[i];
+		}
+		coldata[i] = NULL;
+
+		(cb)((int) field_count, coldata);
+	}
+
+	mysql_stmt_free_result(stmt->handle);
+}
+
 void
 rsdb_transaction(rsdb_transtype type)
 {
@@ -348,3 +735,20 @@ rsdb_transaction(rsdb_transtype type)
 	}
 }
 
+/* rsdb_sync()
+ * writes are always synchronous with this backend
+ */
+void
+rsdb_sync(void)
+{
+}
+
+/* rsdb_change_counter()
+ * there's no cheap way of telling whether the database has changed, so
+ * snapshots are never used with this backend
+ */
+int
+rsdb_change_counter(unsigned long *counter)
+{
+	return 0;
+}
@@ -40,10 +40,30 @@
 
 #define RSDB_MAXCOLS			30
 #define RSDB_MAX_RECONNECT_TIME		30
+#define RSDB_MAXPARAMS			30
+#define RSDB_STMT_HASH			64	/* must be a power of two */
 
 PGconn *rsdb_database;
 int rsdb_doing_transaction;
 
+/* cache of prepared statements, keyed on the sql text.  Statements are
+ * prepared server side lazily, and must be prepared again whenever the
+ * connection is reestablished.
+ */
+struct rsdb_stmt
+{
+	char *sql;
+	char *pgsql;		/* sql with placeholders as $1, $2.. */
+	char name[16];
+	int prepared;
+	struct rsdb_stmt *next;
+};
+
+static struct rsdb_stmt *rsdb_stmt_table[RSDB_STMT_HASH];
+static unsigned int rsdb_stmt_count;
+
+static void rsdb_stmt_invalidate(void);
+
 static int rsdb_connect(int initial);
 
 /* rsdb_init()
@@ -76,7 +96,13 @@ rsdb_connect(int initial)
 	                             config_file.db_password);
 
 	if(rsdb_database != NULL && PQstatus(rsdb_database) == CONNECTION_OK)
+	{
+		/* prepared statements are lost with the old connection */
+		if(!initial)
+			rsdb_stmt_invalidate();
+
 		return 0;
+	}
 
 	/* all errors on startup are fatal */
 	if(initial)
@@ -99,6 +125,22 @@ rsdb_connect(int initial)
 void
 rsdb_shutdown(void)
 {
+	struct rsdb_stmt *stmt, *next_stmt;
+	int i;
+
+	for(i = 0; i < RSDB_STMT_HASH; i++)
+	{
+		for(stmt = rsdb_stmt_table[i]; stmt; stmt = next_stmt)
+		{
+			next_stmt = stmt->next;
+			my_free(stmt->sql);
+			my_free(stmt->pgsql);
+			my_free(stmt);
+		}
+
+		rsdb_stmt_table[i] = NULL;
+	}
+
 	PQfinish(rsdb_database);
 }
 
@@ -148,6 +190,8 @@ rsdb_handle_connerror(PGresult **rsdb_result, const char *buf)
 
 			if(PQstatus(rsdb_database) != CONNECTION_OK)
 				rsdb_try_reconnect();
+			else
+				rsdb_stmt_invalidate();
 
 			break;
 
@@ -185,16 +229,40 @@ rsdb_quote(const char *src)
 	return buf;
 }
 
+/* rsdb_cursor_start()
+ * sends a query with results returned a row at a time, rather than
+ * collected into one result.  No other query may be issued until the
+ * cursor is closed.
+ */
+static void
+rsdb_cursor_start(struct rsdb_cursor *cursor, const char *sql)
+{
+	if(!PQsendQuery(rsdb_database, sql))
+	{
+		rsdb_handle_connerror(NULL, NULL);
+
+		if(!PQsendQuery(rsdb_database, sql))
+		{
+			mlog("fatal error: problem with db file: %s",
+				PQerrorMessage(rsdb_database));
+			die(0, "problem with db file");
+		}
+	}
+
+	PQsetSingleRowMode(rsdb_database);
+
+	cursor->col_count = 0;
+	cursor->row_count = 0;
+	cursor->row = NULL;
+	cursor->arg = rsdb_database;
+}
+
 void
-rsdb_exec(rsdb_callback cb, const char *format, ...)
+rsdb_cursor_open(struct rsdb_cursor *cursor, const char *format, ...)
 {
 	static char buf[BUFSIZE*4];
-	static const char *coldata[RSDB_MAXCOLS+1];
-	PGresult *rsdb_result;
 	va_list args;
-	unsigned int field_count, row_count;
 	int i;
-	int cur_row;
 
 	va_start(args, format);
 	i = rs_vsnprintf(buf, sizeof(buf), format, args);
@@ -206,45 +274,139 @@ rsdb_exec(rsdb_callback cb, const char *format, ...)
 		die(0, "length problem compiling sql statement");
 	}
 
-	if((rsdb_result = PQexec(rsdb_database, buf)) == NULL)
-		rsdb_handle_connerror(&rsdb_result, buf);
+	rsdb_cursor_start(cursor, buf);
+}
+
+int
+rsdb_cursor_step(struct rsdb_cursor *cursor)
+{
+	PGresult *rsdb_result;
+
+	if(cursor->row)
+	{
+		PQclear((PGresult *) cursor->row);
+		cursor->row = NULL;
+	}
+
+	/* query has finished */
+	if(cursor->arg == NULL)
+		return 0;
+
+	if((rsdb_result = PQgetResult(rsdb_database)) == NULL)
+	{
+		cursor->arg = NULL;
+		return 0;
+	}
 
 	switch(PQresultStatus(rsdb_result))
 	{
+		case PGRES_SINGLE_TUPLE:
+			cursor->col_count = PQnfields(rsdb_result);
+			cursor->row_count++;
+			cursor->row = rsdb_result;
+			return 1;
+
 		case PGRES_FATAL_ERROR:
 		case PGRES_BAD_RESPONSE:
-		case PGRES_EMPTY_QUERY: /* i'm gonna guess this is bad for us too */
+		case PGRES_EMPTY_QUERY:
 			mlog("fatal error: problem with db file: %s",
 				PQresultErrorMessage(rsdb_result));
 			die(0, "problem with db file");
 			break;
+
 		default:
 			break;
 	}
 
-	field_count = PQnfields(rsdb_result);
-	row_count = PQntuples(rsdb_result);
+	/* the final, empty result.  Collect the NULL that follows it. */
+	cursor->col_count = PQnfields(rsdb_result);
+	PQclear(rsdb_result);
 
-	if(field_count > RSDB_MAXCOLS)
-		die(0, "too many columns in result set -- contact the ratbox team");
+	while((rsdb_result = PQgetResult(rsdb_database)) != NULL)
+		PQclear(rsdb_result);
 
-	if(!field_count || !row_count || !cb)
+	cursor->arg = NULL;
+	return 0;
+}
+
+const char *
+rsdb_cursor_column(struct rsdb_cursor *cursor, int col)
+{
+	PGresult *rsdb_result = cursor->row;
+
+	if(PQgetisnull(rsdb_result, 0, col))
+		return NULL;
+
+	return PQgetvalue(rsdb_result, 0, col);
+}
+
+void
+rsdb_cursor_close(struct rsdb_cursor *cursor)
+{
+	/* read off anything we didn't step through */
+	while(rsdb_cursor_step(cursor))
+		;
+}
+
+void
+rsdb_exec(rsdb_callback cb, const char *format, ...)
+{
+	static char buf[BUFSIZE*4];
+	static const char *coldata[RSDB_MAXCOLS+1];
+	struct rsdb_cursor cursor;
+	PGresult *rsdb_result;
+	va_list args;
+	int i;
+
+	va_start(args, format);
+	i = rs_vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	if(i >= sizeof(buf))
 	{
+		mlog("fatal error: length problem compiling sql statement: %s", buf);
+		die(0, "length problem compiling sql statement");
+	}
+
+	if(!cb)
+	{
+		if((rsdb_result = PQexec(rsdb_database, buf)) == NULL)
+			rsdb_handle_connerror(&rsdb_result, buf);
+
+		switch(PQresultStatus(rsdb_result))
+		{
+			case PGRES_FATAL_ERROR:
+			case PGRES_BAD_RESPONSE:
+			case PGRES_EMPTY_QUERY: /* i'm gonna guess this is bad for us too */
+				mlog("fatal error: problem with db file: %s",
+					PQresultErrorMessage(rsdb_result));
+				die(0, "problem with db file");
+				break;
+			default:
+				break;
+		}
+
 		PQclear(rsdb_result);
 		return;
-	}		
-	
-	for(cur_row = 0; cur_row < row_count; cur_row++)
+	}
+
+	rsdb_cursor_start(&cursor, buf);
+
+	while(rsdb_cursor_step(&cursor))
 	{
-		for(i = 0; i < field_count; i++)
+		if(cursor.col_count > RSDB_MAXCOLS)
+			die(0, "too many columns in result set -- contact the ratbox team");
+
+		for(i = 0; i < cursor.col_count; i++)
 		{
-			coldata[i] = PQgetvalue(rsdb_result, cur_row, i);
+			coldata[i] = rsdb_cursor_column(&cursor, i);
 		}
 		coldata[i] = NULL;
 
-		(cb)((int) field_count, coldata);
+		(cb)(cursor.col_count, coldata);
 	}
-	PQclear(rsdb_result);
+
+	rsdb_cursor_close(&cursor);
 }
 
 void
@@ -354,6 +516,233 @@ rsdb_exec_fetch_end(struct rsdb_table *table)
 	PQclear(table->arg);
 }
 
+static unsigned int
+rsdb_stmt_hash(const char *sql)
+{
+	unsigned int hashv = 0;
+
+	while(*sql)
+		hashv = (hashv * 33) ^ (unsigned char) *sql++;
+
+	return hashv & (RSDB_STMT_HASH-1);
+}
+
+static void
+rsdb_stmt_invalidate(void)
+{
+	struct rsdb_stmt *stmt;
+	int i;
+
+	for(i = 0; i < RSDB_STMT_HASH; i++)
+	{
+		for(stmt = rsdb_stmt_table[i]; stmt; stmt = stmt->next)
+			stmt->prepared = 0;
+	}
+}
+
+/* rsdb_stmt_find()
+ * finds a statement in the cache, adding it the first time its seen
+ *
+ * inputs	- sql text of the statement
+ * outputs	- cached statement
+ * side effects - '?' placeholders outside of quotes are rewritten into
+ *		  the $n form postgresql uses
+ */
+static struct rsdb_stmt *
+rsdb_stmt_find(const char *sql)
+{
+	struct rsdb_stmt *stmt;
+	unsigned int hashv = rsdb_stmt_hash(sql);
+	const char *s;
+	char *p;
+	int quoted = 0;
+	int count = 0;
+
+	for(stmt = rsdb_stmt_table[hashv]; stmt; stmt = stmt->next)
+	{
+		if(!strcmp(stmt->sql, sql))
+			return stmt;
+	}
+
+	stmt = my_malloc(sizeof(struct rsdb_stmt));
+	stmt->sql = my_strdup(sql);
+
+	/* each '?' grows to at most "$30" */
+	stmt->pgsql = my_malloc(strlen(sql) * 3 + 1);
+
+	for(s = sql, p = stmt->pgsql; *s; s++)
+	{
+		if(*s == '\'')
+			quoted = !quoted;
+		else if(*s == '?' && !quoted)
+		{
+			p += sprintf(p, "$%d", ++count);
+			continue;
+		}
+
+		*p++ = *s;
+	}
+	*p = '\0';
+
+	snprintf(stmt->name, sizeof(stmt->name), "rsdb_%u", ++rsdb_stmt_count);
+
+	stmt->next = rsdb_stmt_table[hashv];
+	rsdb_stmt_table[hashv] = stmt;
+
+	return stmt;
+}
+
+/* rsdb_stmt_execute()
+ * executes a prepared statement, preparing it first if needed
+ *
+ * inputs	- statement, parameters
+ * outputs	- result, or NULL on a connection error
+ * side effects -
+ */
+static PGresult *
+rsdb_stmt_execute(struct rsdb_stmt *stmt, const char **values, int count)
+{
+	PGresult *rsdb_result;
+
+	if(!stmt->prepared)
+	{
+		if((rsdb_result = PQprepare(rsdb_database, stmt->name, stmt->pgsql,
+						count, NULL)) == NULL)
+			return NULL;
+
+		if(PQresultStatus(rsdb_result) != PGRES_COMMAND_OK)
+		{
+			if(PQstatus(rsdb_database) == CONNECTION_BAD)
+			{
+				PQclear(rsdb_result);
+				return NULL;
+			}
+
+			mlog("fatal error: problem preparing sql statement %s: %s",
+				stmt->sql, PQresultErrorMessage(rsdb_result));
+			die(0, "problem with db file");
+		}
+
+		PQclear(rsdb_result);
+		stmt->prepared = 1;
+	}
+
+	rsdb_result = PQexecPrepared(rsdb_database, stmt->name, count, values,
+					NULL, NULL, 0);
+
+	if(rsdb_result != NULL && PQstatus(rsdb_database) == CONNECTION_BAD)
+	{
+		PQclear(rsdb_result);
+		return NULL;
+	}
+
+	return rsdb_result;
+}
+
+void
+rsdb_exec_prepared(rsdb_callback cb, const char *sql, const char *types, ...)
+{
+	static char numbers[RSDB_MAXPARAMS][24];
+	static const char *values[RSDB_MAXPARAMS];
+	static const char *coldata[RSDB_MAXCOLS+1];
+	struct rsdb_stmt *stmt;
+	PGresult *rsdb_result;
+	va_list args;
+	unsigned int field_count, row_count;
+	int count = 0;
+	int cur_row;
+	int i;
+
+	stmt = rsdb_stmt_find(sql);
+
+	va_start(args, types);
+	for(; *types; types++, count++)
+	{
+		if(count >= RSDB_MAXPARAMS)
+			die(0, "too many parameters in sql statement -- contact the ratbox team");
+
+		switch(*types)
+		{
+			case 'd':
+				snprintf(numbers[count], sizeof(numbers[count]), "%d",
+					va_arg(args, int));
+				values[count] = numbers[count];
+				break;
+
+			case 'u':
+				snprintf(numbers[count], sizeof(numbers[count]), "%lu",
+					va_arg(args, unsigned long));
+				values[count] = numbers[count];
+				break;
+
+			case 's':
+				values[count] = va_arg(args, const char *);
+				break;
+
+			default:
+				mlog("fatal error: unknown parameter type '%c' for sql statement %s",
+					*types, sql);
+				die(0, "problem compiling sql statement");
+				break;
+		}
+	}
+	va_end(args);
+
+	if((rsdb_result = rsdb_stmt_execute(stmt, values, count)) == NULL)
+	{
+		/* dies if we're in a transaction, otherwise reconnects
+		 * and invalidates the statements so they're prepared again
+		 */
+		rsdb_handle_connerror(NULL, NULL);
+
+		if((rsdb_result = rsdb_stmt_execute(stmt, values, count)) == NULL)
+		{
+			mlog("fatal error: problem with db file: %s",
+				PQerrorMessage(rsdb_database));
+			die(0, "problem with db file");
+		}
+	}
+
+	switch(PQresultStatus(rsdb_result))
+	{
+		case PGRES_FATAL_ERROR:
+		case PGRES_BAD_RESPONSE:
+		case PGRES_EMPTY_QUERY:
+			mlog("fatal error: problem with db file: %s",
+				PQresultErrorMessage(rsdb_result));
+			die(0, "problem with db file");
+			break;
+		default:
+			break;
+	}
+
+	field_count = PQnfields(rsdb_result);
+	row_count = PQntuples(rsdb_result);
+
+	if(field_count > RSDB_MAXCOLS)
+		die(0, "too many columns in result set -- contact the ratbox team");
+
+	if(!field_count || !row_count || !cb)
+	{
+		PQclear(rsdb_result);
+		return;
+	}
+
+	for(cur_row = 0; cur_row < row_count; cur_row++)
+	{
+		for(i = 0; i < field_count; i++)
+		{
+			coldata[i] = PQgetisnull(rsdb_result, cur_row, i) ?
+					NULL : PQgetvalue(rsdb_result, cur_row, i);
+		}
+		coldata[i] = NULL;
+
+		(cb)((int) field_count, coldata);
+	}
+
+	PQclear(rsdb_result);
+}
+
 void
 rsdb_transaction(rsdb_transtype type)
 {
@@ -369,3 +758,20 @@ rsdb_transaction(rsdb_transtype type)
 	}
 }
 
+/* rsdb_sync()
+ * writes are always synchronous with this backend
+ */
+void
+rsdb_sync(void)
+{
+}
+
+/* rsdb_change_counter()
+ * there's no cheap way of telling whether the database has changed, so
+ * snapshots are never used with this backend
+ */
+int
+rsdb_change_counter(unsigned long *counter)
+{
+	return 0;
+}
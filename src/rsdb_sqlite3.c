@@ -34,6 +34,7 @@
 #include "rsdb.h"
 #include "rserv.h"
 #include "log.h"
+#include "conf.h"
 
 /* build sqlite, so use local version */
 #ifdef SQLITE_BUILD
@@ -42,8 +43,70 @@
 #include <sqlite3.h>
 #endif
 
+#define RSDB_MAXCOLS		30
+#define RSDB_MAXPARAMS		30
+#define RSDB_STMT_HASH		64	/* must be a power of two */
+
 struct sqlite3 *rserv_db;
 
+/* cache of prepared statements, keyed on the sql text */
+struct rsdb_stmt
+{
+	char *sql;
+	sqlite3_stmt *handle;
+	struct rsdb_stmt *next;
+};
+
+/* a value bound to a prepared statement, see rsdb_exec_prepared() */
+struct rsdb_param
+{
+	char type;
+	sqlite_int64 num;
+	const char *str;
+};
+
+static struct rsdb_stmt *rsdb_stmt_table[RSDB_STMT_HASH];
+
+/* set when writes are handed off to the writer thread */
+static int rsdb_async;
+
+#ifdef USE_THREADS
+/* a write queued for the writer thread */
+struct rsdb_job
+{
+	struct rsdb_job *next;
+	const char *sql;
+	int param_count;		/* -1 for plain sql */
+	struct rsdb_param *params;
+};
+
+static struct sqlite3 *rsdb_writer_db;
+static struct rsdb_stmt *rsdb_writer_stmt_table[RSDB_STMT_HASH];
+static pthread_t rsdb_writer_thread;
+static pthread_mutex_t rsdb_writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rsdb_writer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t rsdb_writer_idle = PTHREAD_COND_INITIALIZER;
+
+/* everything below is protected by rsdb_writer_lock */
+static struct rsdb_job *rsdb_writer_head;
+static struct rsdb_job *rsdb_writer_tail;
+static int rsdb_writer_busy;
+static int rsdb_writer_exit;
+static char rsdb_writer_error[BUFSIZE];
+
+static void rsdb_writer_start(void);
+static void rsdb_writer_stop(void);
+static void rsdb_writer_queue(const char *sql, struct rsdb_param *params, int count);
+static void rsdb_writer_wait(void);
+static void *rsdb_writer(void *unused);
+#else
+#define rsdb_writer_stop()
+#define rsdb_writer_queue(sql, params, count)
+#define rsdb_writer_wait()
+#endif
+
+static void rsdb_stmt_clear(struct rsdb_stmt **table);
+
 /* rsdb_init()
  */
 void
@@ -53,11 +116,26 @@ rsdb_init(void)
 	{
 		die(0, "Failed to open db file: %s", sqlite3_errmsg(rserv_db));
 	}
+
+	if(config_file.db_async_writes)
+	{
+#ifdef USE_THREADS
+		rsdb_writer_start();
+#else
+		mlog("warning: async_writes requires thread support, writing synchronously");
+#endif
+	}
 }
 
 void
 rsdb_shutdown(void)
 {
+	/* commits anything still queued */
+	rsdb_writer_stop();
+
+	/* sqlite3_close() refuses to close with statements outstanding */
+	rsdb_stmt_clear(rsdb_stmt_table);
+
 	if(rserv_db)
 		sqlite3_close(rserv_db);
 }
@@ -84,22 +162,44 @@ rsdb_quote(const char *src)
 	return buf;
 }
 
-static int
-rsdb_callback_func(void *cbfunc, int argc, char **argv, char **colnames)
+static void
+rsdb_cursor_start(struct rsdb_cursor *cursor, const char *sql)
 {
-	rsdb_callback cb = cbfunc;
-	(cb)(argc, (const char **) argv);
-	return 0;
+	sqlite3_stmt *handle;
+	const char *tail;
+	int errcount = 0;
+	int i;
+
+	/* make sure we read back anything still queued to the writer */
+	rsdb_writer_wait();
+
+tryprepare:
+	if((i = sqlite3_prepare(rserv_db, sql, -1, &handle, &tail)) != SQLITE_OK)
+	{
+		/* sleep for upto 5 seconds in 10 iterations
+		 * to try and get through..
+		 */
+		if(i == SQLITE_BUSY && ++errcount <= 10)
+		{
+			my_sleep(0, 500000);
+			goto tryprepare;
+		}
+
+		mlog("fatal error: problem with db file: %s", sqlite3_errmsg(rserv_db));
+		die(0, "problem with db file");
+	}
+
+	cursor->arg = handle;
+	cursor->row = NULL;
+	cursor->row_count = 0;
+	cursor->col_count = handle ? sqlite3_column_count(handle) : 0;
 }
 
 void
-rsdb_exec(rsdb_callback cb, const char *format, ...)
+rsdb_cursor_open(struct rsdb_cursor *cursor, const char *format, ...)
 {
-	static char errmsg_busy[] = "Database file locked";
 	static char buf[BUFSIZE*4];
 	va_list args;
-	char *errmsg;
-	int errcount = 0;
 	int i;
 
 	va_start(args, format);
@@ -112,8 +212,77 @@ rsdb_exec(rsdb_callback cb, const char *format, ...)
 		die(0, "problem with compiling sql statement");
 	}
 
+	rsdb_cursor_start(cursor, buf);
+}
+
+int
+rsdb_cursor_step(struct rsdb_cursor *cursor)
+{
+	sqlite3_stmt *handle = cursor->arg;
+	int errcount = 0;
+	int i, j;
+
+	if(handle == NULL)
+		return 0;
+
+tryexec:
+	i = sqlite3_step(handle);
+
+	if(i == SQLITE_ROW)
+	{
+		cursor->row_count++;
+		return 1;
+	}
+
+	if(i == SQLITE_DONE)
+		return 0;
+
+	/* the legacy interface only gives the real error from reset */
+	j = sqlite3_reset(handle);
+
+	if(i == SQLITE_ERROR)
+		i = j;
+
+	/* a locked database can only be retried safely before we've
+	 * handed back any rows
+	 */
+	if(i == SQLITE_BUSY && !cursor->row_count && ++errcount <= 10)
+	{
+		my_sleep(0, 500000);
+		goto tryexec;
+	}
+
+	mlog("fatal error: problem with db file: %s",
+		i == SQLITE_BUSY ? "Database file locked" : sqlite3_errmsg(rserv_db));
+	die(0, "problem with db file");
+	return 0;
+}
+
+const char *
+rsdb_cursor_column(struct rsdb_cursor *cursor, int col)
+{
+	return (const char *) sqlite3_column_text((sqlite3_stmt *) cursor->arg, col);
+}
+
+void
+rsdb_cursor_close(struct rsdb_cursor *cursor)
+{
+	if(cursor->arg)
+		sqlite3_finalize((sqlite3_stmt *) cursor->arg);
+
+	cursor->arg = NULL;
+}
+
+static void
+rsdb_exec_sql(const char *sql)
+{
+	static char errmsg_busy[] = "Database file locked";
+	char *errmsg;
+	int errcount = 0;
+	int i;
+
 tryexec:
-	if((i = sqlite3_exec(rserv_db, buf, (cb ? rsdb_callback_func : NULL), cb, &errmsg)))
+	if((i = sqlite3_exec(rserv_db, sql, NULL, NULL, &errmsg)))
 	{
 		switch(i)
 		{
@@ -140,6 +309,54 @@ tryexec:
 	}
 }
 
+void
+rsdb_exec(rsdb_callback cb, const char *format, ...)
+{
+	static char buf[BUFSIZE*4];
+	static const char *coldata[RSDB_MAXCOLS+1];
+	struct rsdb_cursor cursor;
+	va_list args;
+	int i;
+
+	va_start(args, format);
+	i = rs_vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	if(i >= sizeof(buf))
+	{
+		mlog("fatal error: length problem with compiling sql");
+		die(0, "problem with compiling sql statement");
+	}
+
+	/* results are streamed a row at a time through a cursor */
+	if(cb)
+	{
+		rsdb_cursor_start(&cursor, buf);
+
+		if(cursor.col_count > RSDB_MAXCOLS)
+			die(0, "too many columns in result set -- contact the ratbox team");
+
+		while(rsdb_cursor_step(&cursor))
+		{
+			for(i = 0; i < cursor.col_count; i++)
+			{
+				coldata[i] = rsdb_cursor_column(&cursor, i);
+			}
+			coldata[i] = NULL;
+
+			(cb)(cursor.col_count, coldata);
+		}
+
+		rsdb_cursor_close(&cursor);
+		return;
+	}
+
+	if(rsdb_async)
+		rsdb_writer_queue(buf, NULL, -1);
+	else
+		rsdb_exec_sql(buf);
+}
+
 void
 rsdb_exec_insert(unsigned int *insert_id, const char *table_name, const char *field_name, const char *format, ...)
 {
@@ -157,7 +374,9 @@ rsdb_exec_insert(unsigned int *insert_id, const char *table_name, const char *fi
 		die(0, "problem with compiling sql statement");
 	}
 
-	rsdb_exec(NULL, "%s", buf);
+	/* we need the id back, so this can't go through the writer */
+	rsdb_writer_wait();
+	rsdb_exec_sql(buf);
 
 	*insert_id = (unsigned int) sqlite3_last_insert_rowid(rserv_db);
 }
@@ -184,6 +403,8 @@ rsdb_exec_fetch(struct rsdb_table *table, const char *format, ...)
 		die(0, "problem with compiling sql statement");
 	}
 
+	rsdb_writer_wait();
+
 tryexec:
 	if((i = sqlite3_get_table(rserv_db, buf, &data, &table->row_count, &table->col_count, &errmsg)))
 	{
@@ -248,9 +469,555 @@ rsdb_exec_fetch_end(struct rsdb_table *table)
 	sqlite3_free_table((char **) table->arg);
 }
 
+static unsigned int
+rsdb_stmt_hash(const char *sql)
+{
+	unsigned int hashv = 0;
+
+	while(*sql)
+		hashv = (hashv * 33) ^ (unsigned char) *sql++;
+
+	return hashv & (RSDB_STMT_HASH-1);
+}
+
+/* rsdb_stmt_find()
+ * finds a statement in a connections cache, preparing it the first time
+ * its seen
+ *
+ * inputs	- statement cache, connection, sql text of the statement
+ * outputs	- cached statement, NULL if it couldn't be prepared
+ * side effects	-
+ */
+static struct rsdb_stmt *
+rsdb_stmt_find(struct rsdb_stmt **table, struct sqlite3 *db, const char *sql)
+{
+	struct rsdb_stmt *stmt;
+	sqlite3_stmt *handle;
+	const char *tail;
+	unsigned int hashv = rsdb_stmt_hash(sql);
+
+	for(stmt = table[hashv]; stmt; stmt = stmt->next)
+	{
+		if(!strcmp(stmt->sql, sql))
+			return stmt;
+	}
+
+	if(sqlite3_prepare(db, sql, -1, &handle, &tail) != SQLITE_OK)
+		return NULL;
+
+	stmt = my_malloc(sizeof(struct rsdb_stmt));
+	stmt->sql = my_strdup(sql);
+	stmt->handle = handle;
+	stmt->next = table[hashv];
+	table[hashv] = stmt;
+
+	return stmt;
+}
+
+static void
+rsdb_stmt_clear(struct rsdb_stmt **table)
+{
+	struct rsdb_stmt *stmt, *next_stmt;
+	int i;
+
+	for(i = 0; i < RSDB_STMT_HASH; i++)
+	{
+		for(stmt = table[i]; stmt; stmt = next_stmt)
+		{
+			next_stmt = stmt->next;
+
+			sqlite3_finalize(stmt->handle);
+			my_free(stmt->sql);
+			my_free(stmt);
+		}
+
+		table[i] = NULL;
+	}
+}
+
+/* rsdb_stmt_run()
+ * binds the parameters to a statement and steps through it
+ *
+ * inputs	- connection, statement, parameters, optional callback
+ * outputs	- SQLITE_OK on success, otherwise the error
+ * side effects	- SQLITE_RANGE is returned for a parameter count mismatch
+ */
+static int
+rsdb_stmt_run(struct sqlite3 *db, struct rsdb_stmt *stmt, 
+		struct rsdb_param *params, int count, rsdb_callback cb)
+{
+	static const char *coldata[RSDB_MAXCOLS+1];
+	sqlite3_stmt *handle;
+	const char *tail;
+	int errcount = 0;
+	int field_count;
+	int i, j;
+
+	if(count != sqlite3_bind_parameter_count(stmt->handle))
+		return SQLITE_RANGE;
+
+	for(i = 0; i < count; i++)
+	{
+		if(params[i].type != 's')
+			j = sqlite3_bind_int64(stmt->handle, i+1, params[i].num);
+		else if(params[i].str == NULL)
+			j = sqlite3_bind_null(stmt->handle, i+1);
+		else
+			j = sqlite3_bind_text(stmt->handle, i+1, params[i].str, -1, SQLITE_STATIC);
+
+		if(j != SQLITE_OK)
+			return j;
+	}
+
+	while(1)
+	{
+		i = sqlite3_step(stmt->handle);
+
+		if(i == SQLITE_ROW)
+		{
+			if(!cb)
+				continue;
+
+			field_count = sqlite3_column_count(stmt->handle);
+
+			if(field_count > RSDB_MAXCOLS)
+				die(0, "too many columns in result set -- contact the ratbox team");
+
+			for(j = 0; j < field_count; j++)
+			{
+				coldata[j] = (const char *) sqlite3_column_text(stmt->handle, j);
+			}
+			coldata[j] = NULL;
+
+			(cb)(field_count, coldata);
+			continue;
+		}
+
+		if(i == SQLITE_DONE)
+			break;
+
+		/* the legacy interface only gives the real error from reset */
+		j = sqlite3_reset(stmt->handle);
+
+		if(i == SQLITE_ERROR)
+			i = j;
+
+		if(i == SQLITE_BUSY)
+		{
+			/* sleep for upto 5 seconds in 10 iterations
+			 * to try and get through..
+			 */
+			if(++errcount <= 10)
+			{
+				my_sleep(0, 500000);
+				continue;
+			}
+
+			return i;
+		}
+		else if(i == SQLITE_SCHEMA)
+		{
+			/* the schema changed underneath us, recompile the
+			 * statement and carry the bindings across
+			 */
+			if(sqlite3_prepare(db, stmt->sql, -1, &handle, &tail) != SQLITE_OK)
+				return SQLITE_SCHEMA;
+
+			sqlite3_transfer_bindings(stmt->handle, handle);
+			sqlite3_finalize(stmt->handle);
+			stmt->handle = handle;
+			continue;
+		}
+
+		return i;
+	}
+
+	/* release any locks the statement holds until its next use */
+	sqlite3_reset(stmt->handle);
+	return SQLITE_OK;
+}
+
+static const char *
+rsdb_stmt_error(struct sqlite3 *db, int error)
+{
+	if(error == SQLITE_RANGE)
+		return "parameter count mismatch";
+	else if(error == SQLITE_BUSY)
+		return "Database file locked";
+
+	return sqlite3_errmsg(db);
+}
+
+static int
+rsdb_parse_params(struct rsdb_param *params, const char *sql, const char *types, va_list args)
+{
+	int count;
+
+	for(count = 0; types[count]; count++)
+	{
+		if(count >= RSDB_MAXPARAMS)
+			die(0, "too many parameters in sql statement -- contact the ratbox team");
+
+		params[count].type = types[count];
+		params[count].str = NULL;
+		params[count].num = 0;
+
+		switch(types[count])
+		{
+			case 'd':
+				params[count].num = va_arg(args, int);
+				break;
+
+			case 'u':
+				params[count].num = (sqlite_int64) va_arg(args, unsigned long);
+				break;
+
+			case 's':
+				params[count].str = va_arg(args, const char *);
+				break;
+
+			default:
+				mlog("fatal error: unknown parameter type '%c' for sql statement %s",
+					types[count], sql);
+				die(0, "problem compiling sql statement");
+				break;
+		}
+	}
+
+	return count;
+}
+
+void
+rsdb_exec_prepared(rsdb_callback cb, const char *sql, const char *types, ...)
+{
+	struct rsdb_param params[RSDB_MAXPARAMS];
+	struct rsdb_stmt *stmt;
+	va_list args;
+	int count;
+	int i;
+
+	va_start(args, types);
+	count = rsdb_parse_params(params, sql, types, args);
+	va_end(args);
+
+	/* nothing needed back, the writer can deal with it */
+	if(!cb && rsdb_async)
+	{
+		rsdb_writer_queue(sql, params, count);
+		return;
+	}
+
+	rsdb_writer_wait();
+
+	if((stmt = rsdb_stmt_find(rsdb_stmt_table, rserv_db, sql)) == NULL)
+	{
+		mlog("fatal error: problem preparing sql statement %s: %s",
+			sql, sqlite3_errmsg(rserv_db));
+		die(0, "problem with db file");
+	}
+
+	if((i = rsdb_stmt_run(rserv_db, stmt, params, count, cb)) != SQLITE_OK)
+	{
+		mlog("fatal error: problem with db file: %s: %s",
+			sql, rsdb_stmt_error(rserv_db, i));
+		die(0, "problem with db file");
+	}
+}
+
+#ifdef USE_THREADS
+/* rsdb_writer_start()
+ * opens a second connection to the database, and starts the thread
+ * that executes writes through it
+ */
+static void
+rsdb_writer_start(void)
+{
+#ifdef SQLITE_BUILD
+	/* the bundled sqlite is configured without thread support, so
+	 * its locking would let the two connections race each other
+	 */
+	mlog("warning: async_writes needs a threadsafe sqlite, which the bundled one is not, writing synchronously");
+	return;
+#endif
+
+	if(sqlite3_open(DB_PATH, &rsdb_writer_db))
+	{
+		mlog("warning: failed to open db file for writer, writing synchronously: %s",
+			sqlite3_errmsg(rsdb_writer_db));
+		sqlite3_close(rsdb_writer_db);
+		rsdb_writer_db = NULL;
+		return;
+	}
+
+	/* the two connections lock each other out briefly, let sqlite
+	 * wait for them rather than erroring straight away
+	 */
+	sqlite3_busy_timeout(rsdb_writer_db, 5000);
+	sqlite3_busy_timeout(rserv_db, 5000);
+
+	if((errno = create_thread(&rsdb_writer_thread, rsdb_writer, NULL)) != 0)
+	{
+		mlog("warning: failed to create writer thread, writing synchronously: %s",
+			strerror(errno));
+		sqlite3_close(rsdb_writer_db);
+		rsdb_writer_db = NULL;
+		return;
+	}
+
+	rsdb_async = 1;
+}
+
+/* rsdb_writer_stop()
+ * waits for the writer to commit everything queued, then stops it
+ */
+static void
+rsdb_writer_stop(void)
+{
+	if(!rsdb_async)
+		return;
+
+	rsdb_async = 0;
+
+	pthread_mutex_lock(&rsdb_writer_lock);
+	rsdb_writer_exit = 1;
+	pthread_cond_signal(&rsdb_writer_cond);
+	pthread_mutex_unlock(&rsdb_writer_lock);
+
+	pthread_join(rsdb_writer_thread, NULL);
+
+	if(rsdb_writer_error[0])
+		mlog("fatal error: problem with db file in writer: %s",
+			rsdb_writer_error);
+
+	rsdb_stmt_clear(rsdb_writer_stmt_table);
+	sqlite3_close(rsdb_writer_db);
+	rsdb_writer_db = NULL;
+}
+
+/* rsdb_writer_check()
+ * dies if the writer has hit an error, called with the lock held
+ */
+static void
+rsdb_writer_check(void)
+{
+	if(!rsdb_writer_error[0])
+		return;
+
+	pthread_mutex_unlock(&rsdb_writer_lock);
+	die(0, "problem with db file");
+}
+
+/* rsdb_writer_queue()
+ * queues a statement for the writer thread
+ *
+ * inputs	- sql, parameters, parameter count (-1 for plain sql)
+ * outputs	-
+ * side effects - the statement and its parameters are copied into a
+ *		  single allocation, which the writer frees
+ */
+static void
+rsdb_writer_queue(const char *sql, struct rsdb_param *params, int count)
+{
+	struct rsdb_job *job;
+	size_t len = sizeof(struct rsdb_job) + strlen(sql) + 1;
+	char *p;
+	int i;
+
+	for(i = 0; i < count; i++)
+	{
+		len += sizeof(struct rsdb_param);
+
+		if(params[i].str)
+			len += strlen(params[i].str) + 1;
+	}
+
+	job = my_malloc(len);
+	job->param_count = count;
+	job->params = (struct rsdb_param *) (job + 1);
+	p = (char *) (job->params + (count > 0 ? count : 0));
+
+	for(i = 0; i < count; i++)
+	{
+		job->params[i] = params[i];
+
+		if(params[i].str)
+		{
+			strcpy(p, params[i].str);
+			job->params[i].str = p;
+			p += strlen(p) + 1;
+		}
+	}
+
+	strcpy(p, sql);
+	job->sql = p;
+
+	pthread_mutex_lock(&rsdb_writer_lock);
+	rsdb_writer_check();
+
+	if(rsdb_writer_tail)
+		rsdb_writer_tail->next = job;
+	else
+	{
+		rsdb_writer_head = job;
+		pthread_cond_signal(&rsdb_writer_cond);
+	}
+
+	rsdb_writer_tail = job;
+	pthread_mutex_unlock(&rsdb_writer_lock);
+}
+
+/* rsdb_writer_wait()
+ * blocks until everything queued to the writer is committed
+ */
+static void
+rsdb_writer_wait(void)
+{
+	if(!rsdb_async)
+		return;
+
+	pthread_mutex_lock(&rsdb_writer_lock);
+
+	while((rsdb_writer_head || rsdb_writer_busy) && !rsdb_writer_error[0])
+		pthread_cond_wait(&rsdb_writer_idle, &rsdb_writer_lock);
+
+	rsdb_writer_check();
+	pthread_mutex_unlock(&rsdb_writer_lock);
+}
+
+static int
+rsdb_writer_exec(struct rsdb_job *job)
+{
+	struct rsdb_stmt *stmt;
+	char *errmsg;
+	int i;
+
+	if(job->param_count < 0)
+	{
+		if((i = sqlite3_exec(rsdb_writer_db, job->sql, NULL, NULL, &errmsg)) != SQLITE_OK)
+		{
+			snprintf(rsdb_writer_error, sizeof(rsdb_writer_error), "%s: %s",
+				job->sql, errmsg ? errmsg : "unknown error");
+			sqlite3_free(errmsg);
+		}
+
+		return i;
+	}
+
+	if((stmt = rsdb_stmt_find(rsdb_writer_stmt_table, rsdb_writer_db, job->sql)) == NULL)
+		i = SQLITE_ERROR;
+	else
+		i = rsdb_stmt_run(rsdb_writer_db, stmt, job->params, job->param_count, NULL);
+
+	if(i != SQLITE_OK)
+		snprintf(rsdb_writer_error, sizeof(rsdb_writer_error), "%s: %s",
+			job->sql, rsdb_stmt_error(rsdb_writer_db, i));
+
+	return i;
+}
+
+/* rsdb_writer()
+ * the writer thread, takes everything queued and commits it as one
+ * transaction
+ */
+static void *
+rsdb_writer(void *unused)
+{
+	struct rsdb_job *job, *next_job;
+	struct rsdb_job begin, commit;
+	int error;
+
+	memset(&begin, 0, sizeof(begin));
+	memset(&commit, 0, sizeof(commit));
+	begin.param_count = commit.param_count = -1;
+	begin.sql = "BEGIN TRANSACTION";
+	commit.sql = "COMMIT TRANSACTION";
+
+	pthread_mutex_lock(&rsdb_writer_lock);
+
+	while(1)
+	{
+		while(rsdb_writer_head == NULL && !rsdb_writer_exit)
+			pthread_cond_wait(&rsdb_writer_cond, &rsdb_writer_lock);
+
+		/* asked to exit, and everything has been written */
+		if(rsdb_writer_head == NULL)
+			break;
+
+		job = rsdb_writer_head;
+		rsdb_writer_head = rsdb_writer_tail = NULL;
+		rsdb_writer_busy = 1;
+		pthread_mutex_unlock(&rsdb_writer_lock);
+
+		error = rsdb_writer_exec(&begin);
+
+		for(; job; job = next_job)
+		{
+			next_job = job->next;
+
+			if(!error)
+				error = rsdb_writer_exec(job);
+
+			my_free(job);
+		}
+
+		if(!error)
+			error = rsdb_writer_exec(&commit);
+
+		pthread_mutex_lock(&rsdb_writer_lock);
+		rsdb_writer_busy = 0;
+		pthread_cond_broadcast(&rsdb_writer_idle);
+
+		if(error)
+			break;
+	}
+
+	pthread_mutex_unlock(&rsdb_writer_lock);
+	return NULL;
+}
+#endif
+
+/* rsdb_sync()
+ * blocks until every write issued so far is committed to the database
+ */
+void
+rsdb_sync(void)
+{
+	rsdb_writer_wait();
+}
+
+/* rsdb_change_counter()
+ * fetches the file change counter from the database header, which
+ * sqlite bumps on every commit
+ */
+int
+rsdb_change_counter(unsigned long *counter)
+{
+	unsigned char header[28];
+	int fd, len;
+
+	if((fd = open(DB_PATH, O_RDONLY)) < 0)
+		return 0;
+
+	len = read(fd, header, sizeof(header));
+	close(fd);
+
+	if(len != sizeof(header) || memcmp(header, "SQLite format 3", 16))
+		return 0;
+
+	*counter = ((unsigned long) header[24] << 24) | (header[25] << 16) |
+			(header[26] << 8) | header[27];
+	return 1;
+}
+
 void
 rsdb_transaction(rsdb_transtype type)
 {
+	/* the writer already groups everything into transactions, and an
+	 * open transaction here would lock it out
+	 */
+	if(rsdb_async)
+		return;
+
 	if(type == RSDB_TRANS_START)
 		rsdb_exec(NULL, "BEGIN TRANSACTION");
 	else if(type == RSDB_TRANS_END)
@@ -34,10 +34,6 @@
 #include <signal.h>
 #include <sys/resource.h>
 
-#ifdef HAVE_CRYPT_H
-#include <crypt.h>
-#endif
-
 #ifdef HAVE_GETOPT_H
 #include <getopt.h>
 #endif
@@ -63,10 +59,12 @@
 #include "serno.h"
 #include "s_userserv.h"
 #include "s_chanserv.h"
+#include "snapshot.h"
+#include "intern.h"
+#include "htable.h"
 
 struct timeval system_time;
 
-int have_md5_crypt;
 int current_mark;
 int testing_conf = 0;
 
@@ -86,7 +84,13 @@ die(int graceful, const char *format, ...)
 	va_list args;
 
 	if(graceful)
+	{
 		hook_call(HOOK_DBSYNC, NULL, NULL);
+		snapshot_sync();
+	}
+
+	/* dont lose anything thats still corked */
+	flush_server();
 
 	rsdb_shutdown();
 
@@ -187,15 +191,6 @@ print_help(void)
 	printf(" -u change the real and effective user ID\n");
 }
 
-static void
-check_md5_crypt(void)
-{
-	if(strcmp((crypt("validate", "$1$tEsTiNg1")), "$1$tEsTiNg1$Orp/Maa6pOxfOpGWjmtVE/") == 0)
-		have_md5_crypt = 1;
-	else
-		have_md5_crypt = 0;
-}
-
 static void
 print_startup(int pid, int nofork)
 {
@@ -206,6 +201,91 @@ print_startup(int pid, int nofork)
 		nofork ? "foreground" : "background");
 }
 
+/* init_main()
+ *   initialises everything that doesnt depend on the config
+ *
+ * inputs	-
+ * outputs	-
+ */
+void
+init_main(void)
+{
+	init_crypt_schemes();
+
+	current_mark = 0;
+
+	init_events();
+
+	/* adding events uses the PRNG */
+	init_crypt_seed();
+
+	/* balloc requires events */
+        init_balloc();
+
+	/* tools requires balloc */
+	init_tools();
+
+	/* io requires balloc */
+	init_io();
+
+	/* conf/commands/help all need base language stuff */
+	init_langs();
+
+	/* commands require cache */
+	init_cache();
+	init_scommand();
+	init_ucommand();
+	init_client();
+	init_channel();
+
+	/* pre initialise our services so the conf parser is ok, these
+	 * require the balloc, events and init_client()
+	 */
+#ifdef ENABLE_USERSERV
+	preinit_s_userserv();
+#ifdef ENABLE_CHANSERV
+	/* requires userserv inited */
+	preinit_s_chanserv();
+#endif
+#ifdef ENABLE_NICKSERV
+	/* requires userserv inited */
+	preinit_s_nickserv();
+#endif
+#endif
+#ifdef ENABLE_OPERSERV
+	preinit_s_operserv();
+#endif
+#ifdef ENABLE_JUPESERV
+	preinit_s_jupeserv();
+#endif
+#ifdef ENABLE_GLOBAL
+	preinit_s_global();
+#endif
+#ifdef ENABLE_BANSERV
+	preinit_s_banserv();
+#endif
+#ifdef ENABLE_ALIS
+	preinit_s_alis();
+#endif
+#ifdef ENABLE_OPERBOT
+	preinit_s_operbot();
+#endif
+#ifdef ENABLE_WATCHSERV
+	preinit_s_watchserv();
+#endif
+#ifdef ENABLE_MEMOSERV
+	preinit_s_memoserv();
+#endif
+
+	/* load specific commands */
+        add_scommand_handler(&error_command);
+	add_scommand_handler(&mode_command);
+	add_scommand_handler(&tmode_command);
+	add_scommand_handler(&bmask_command);
+	add_scommand_handler(&privmsg_command);
+}
+
+#ifndef RSERV_BENCH
 int 
 main(int argc, char *argv[])
 {
@@ -361,8 +441,6 @@ main(int argc, char *argv[])
 		return -1;
 	}
 
-	check_md5_crypt();
-
 	setup_corefile();
 
 	set_time();
@@ -421,74 +499,7 @@ main(int argc, char *argv[])
 	/* in case of typo */
 	signal(SIGUSR2, SIG_IGN);
 
-	current_mark = 0;
-
-	init_events();
-
-	/* adding events uses the PRNG */
-	init_crypt_seed();
-
-	/* balloc requires events */
-        init_balloc();
-
-	/* tools requires balloc */
-	init_tools();
-
-	/* conf/commands/help all need base language stuff */
-	init_langs();
-
-	/* commands require cache */
-	init_cache();
-	init_scommand();
-	init_ucommand();
-	init_client();
-	init_channel();
-
-	/* pre initialise our services so the conf parser is ok, these
-	 * require the balloc, events and init_client()
-	 */
-#ifdef ENABLE_USERSERV
-	preinit_s_userserv();
-#ifdef ENABLE_CHANSERV
-	/* requires userserv inited */
-	preinit_s_chanserv();
-#endif
-#ifdef ENABLE_NICKSERV
-	/* requires userserv inited */
-	preinit_s_nickserv();
-#endif
-#endif
-#ifdef ENABLE_OPERSERV
-	preinit_s_operserv();
-#endif
-#ifdef ENABLE_JUPESERV
-	preinit_s_jupeserv();
-#endif
-#ifdef ENABLE_GLOBAL
-	preinit_s_global();
-#endif
-#ifdef ENABLE_BANSERV
-	preinit_s_banserv();
-#endif
-#ifdef ENABLE_ALIS
-	preinit_s_alis();
-#endif
-#ifdef ENABLE_OPERBOT
-	preinit_s_operbot();
-#endif
-#ifdef ENABLE_WATCHSERV
-	preinit_s_watchserv();
-#endif
-#ifdef ENABLE_MEMOSERV
-	preinit_s_memoserv();
-#endif
-
-	/* load specific commands */
-        add_scommand_handler(&error_command);
-	add_scommand_handler(&mode_command);
-	add_scommand_handler(&tmode_command);
-	add_scommand_handler(&bmask_command);
-	add_scommand_handler(&privmsg_command);
+	init_main();
 
 	first_time = CURRENT_TIME;
 
@@ -509,6 +520,9 @@ main(int argc, char *argv[])
 	/* must be done after parsing the config, for database {}; */
 	rsdb_init();
 
+	/* needs the config and io, and must be after we've forked */
+	init_crypt_pool();
+
 	/* db must be done before this */
 	init_services();
 
@@ -529,6 +543,7 @@ main(int argc, char *argv[])
 
 	return 0;
 }
+#endif
 
 void sig_hup(int sig)
 {
@@ -681,7 +696,15 @@ count_memory(struct client *client_p)
 	size_t sz_ban_reg_username = 0;
 #endif
 
+	size_t intern_count, intern_refs;
+	size_t sz_intern_used, sz_intern_arena, sz_intern_saved;
+	unsigned int intern_ratio;
+
 	size_t sz_hash_overhead = 0;
+	size_t chmember_hashes;
+	size_t sz_chmember_hashes;
+	size_t uid_pages;
+	size_t sz_uid_pages;
 
 	size_t sz_conf = 0;
 
@@ -727,6 +750,22 @@ count_memory(struct client *client_p)
 			MYNAME, client_p->name, (unsigned int) sz_ban_reg_username);
 #endif
 
+	intern_countmem(&intern_count, &intern_refs, &sz_intern_used,
+			&sz_intern_arena, &sz_intern_saved);
+
+	/* references per string, in hundredths */
+	intern_ratio = intern_count ? (unsigned int) (intern_refs * 100 / intern_count) : 0;
+
+	sendto_server(":%s 988 %s :INTERNED", MYNAME, client_p->name);
+	sendto_server(":%s 988 %s :   Strings   : %u (%u refs, %u.%02u each)",
+			MYNAME, client_p->name, (unsigned int) intern_count,
+			(unsigned int) intern_refs, intern_ratio / 100, intern_ratio % 100);
+	sendto_server(":%s 988 %s :   Memory    : %u (%u arena)",
+			MYNAME, client_p->name, (unsigned int) sz_intern_used,
+			(unsigned int) sz_intern_arena);
+	sendto_server(":%s 988 %s :   Saved     : %u",
+			MYNAME, client_p->name, (unsigned int) sz_intern_saved);
+
 	sendto_server(":%s 988 %s :BLOCKHEAP", MYNAME, client_p->name);
 
 	DLINK_FOREACH(ptr, heap_lists.head)
@@ -735,24 +774,53 @@ count_memory(struct client *client_p)
 		size_t sz_bh_free;
 		size_t sz_bh_usedmem;
 		size_t sz_bh_freemem;
+		unsigned long bh_slabs;
+		unsigned long bh_highwater;
+		unsigned int bh_frag;
 
 		bh = ptr->data;
 
 		BlockHeapUsage(bh, &sz_bh_used, &sz_bh_free, &sz_bh_usedmem, &sz_bh_freemem);
+		BlockHeapStats(bh, &bh_slabs, &bh_highwater, &bh_frag);
 
-		sendto_server(":%s 988 %s :   %s: %u(%u) %u(%u)",
+		sendto_server(":%s 988 %s :   %s: %u(%u) %u(%u) slabs %lu peak %lu frag %u%%",
 				MYNAME, client_p->name, bh->name, 
 				sz_bh_used, sz_bh_usedmem,
-				sz_bh_free, sz_bh_freemem);
+				sz_bh_free, sz_bh_freemem,
+				bh_slabs, bh_highwater, bh_frag);
+	}
+
+	sendto_server(":%s 988 %s :HASH TABLES", MYNAME, client_p->name);
+
+	DLINK_FOREACH(ptr, htable_list.head)
+	{
+		struct htable *table = ptr->data;
+		size_t ht_count;
+		size_t ht_size;
+		size_t sz_ht_mem;
+
+		htable_usage(table, &ht_count, &ht_size, &sz_ht_mem);
+		sz_hash_overhead += sz_ht_mem;
+
+		sendto_server(":%s 988 %s :   %s: %u/%u slots (%u)",
+				MYNAME, client_p->name, table->name,
+				(unsigned int) ht_count, (unsigned int) ht_size,
+				(unsigned int) sz_ht_mem);
 	}
 
-	sz_hash_overhead += sizeof(dlink_list) * MAX_NAME_HASH;		/* name_table */
-	sz_hash_overhead += sizeof(dlink_list) * MAX_NAME_HASH;		/* uid_table */
-	sz_hash_overhead += sizeof(dlink_list) * MAX_HOST_HASH;		/* host_table */
-	sz_hash_overhead += sizeof(dlink_list) * MAX_CHANNEL_TABLE;	/* channel_table */
-	sz_hash_overhead += sizeof(dlink_list) * MAX_NAME_HASH;		/* user_reg_table */
-	sz_hash_overhead += sizeof(dlink_list) * MAX_CHANNEL_TABLE;	/* chan_reg_table */
-	sz_hash_overhead += sizeof(dlink_list) * MAX_NAME_HASH;		/* nick_reg_table */
+	count_chmember_hashes(&chmember_hashes, &sz_chmember_hashes);
+	sz_hash_overhead += sz_chmember_hashes;
+
+	sendto_server(":%s 988 %s :   Channel Members: %u channels (%u)",
+			MYNAME, client_p->name, (unsigned int) chmember_hashes,
+			(unsigned int) sz_chmember_hashes);
+
+	count_uid_pages(&uid_pages, &sz_uid_pages);
+	sz_hash_overhead += sz_uid_pages;
+
+	sendto_server(":%s 988 %s :   Client UID pages: %u (%u)",
+			MYNAME, client_p->name, (unsigned int) uid_pages,
+			(unsigned int) sz_uid_pages);
 
 	sendto_server(":%s 988 %s :Hash Overhead: %u",
 			MYNAME, client_p->name, (unsigned int) sz_hash_overhead);
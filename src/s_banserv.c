@@ -129,13 +129,18 @@ static void e_banserv_expire(void *unused);
 static void e_banserv_autosync(void *unused);
 
 static int h_banserv_new_client(void *_client_p, void *unused);
+static void h_banserv_new_clients(void **clients, int count);
 
 static void expire_operbans(void);
+static void expire_regexps(void);
 
 static void push_unban(const char *target, char type, const char *mask);
 static void sync_bans(const char *target, char banletter);
 
 static void regexp_free(struct regexp_ban *regexp_p, int neg);
+static void regexp_prepare(struct regexp_ban *regexp_p);
+static void regexp_scan_prefilter(const char *buf, unsigned int serial);
+static int regexp_prefilter_seen(struct regexp_ban *regexp_p, unsigned int serial);
 
 void
 preinit_s_banserv(void)
@@ -164,7 +169,7 @@ init_s_banserv(void)
 			DEFAULT_AUTOSYNC_FREQUENCY);
 
 	hook_add(h_banserv_new_client, HOOK_NEW_CLIENT);
-	hook_add(h_banserv_new_client, HOOK_NEW_CLIENT_BURST);
+	hook_add_batch(h_banserv_new_clients, HOOK_NEW_CLIENT_BURST);
 
 	rsdb_exec(regexp_callback, "SELECT id, regex, reason, hold, create_time, oper FROM operbans_regexp");
 	rsdb_exec(regexp_neg_callback, "SELECT id, parent_id, regex, oper FROM operbans_regexp_neg");
@@ -194,6 +199,7 @@ regexp_callback(int argc, const char **argv)
 	regexp_p->create_time = atol(argv[4]);
 	regexp_p->oper = my_strdup(argv[5]);
 	regexp_p->regexp = regexp_comp;
+	regexp_prepare(regexp_p);
 
 	dlink_add_tail(regexp_p, &regexp_p->ptr, &regexp_list);
 	return 0;
@@ -238,6 +244,8 @@ regexp_neg_callback(int argc, const char **argv)
 	regexp_p->regexp_str = my_strdup(argv[2]);
 	regexp_p->oper = my_strdup(argv[3]);
 	regexp_p->parent = parent_p;
+	regexp_p->regexp = regexp_comp;
+	regexp_p->regexp_extra = pcre_study(regexp_comp, 0, &re_error);
 
 	dlink_add_tail(regexp_p, &regexp_p->ptr, &parent_p->negations);
 	return 0;
@@ -260,14 +268,12 @@ expire_operbans(void)
 }
 
 static void
-e_banserv_expire(void *unused)
+expire_regexps(void)
 {
 	struct regexp_ban *regexp_p;
 	dlink_node *ptr;
 	dlink_node *next_ptr;
 
-	expire_operbans();
-
 	DLINK_FOREACH_SAFE(ptr, next_ptr, regexp_list.head)
 	{
 		regexp_p = ptr->data;
@@ -277,56 +283,501 @@ e_banserv_expire(void *unused)
 	}
 }
 
-static int
-h_banserv_new_client(void *_target_p, void *unused)
+static void
+e_banserv_expire(void *unused)
 {
+	expire_operbans();
+	expire_regexps();
+}
+
+/* regexp_match_client()
+ *   klines a client if they match a regexp, expired regexps having
+ *   already been removed
+ *
+ * inputs	- client to check
+ * outputs	-
+ */
+static void
+regexp_match_client(struct client *target_p)
+{
+	static unsigned int serial = 0;
 	char buf[BUFSIZE];
 	int ovector[30];
 	struct regexp_ban *regexp_p;
 	struct regexp_ban *neg_p;
-	struct client *target_p = _target_p;
 	int buflen;
 	dlink_node *ptr;
-	dlink_node *next_ptr;
 	dlink_node *neg_ptr;
 
 	buflen = snprintf(buf, sizeof(buf), "%s#%s",
 			target_p->user->mask, target_p->info);
 
-	DLINK_FOREACH_SAFE(ptr, next_ptr, regexp_list.head)
+	/* mark the regexps whose literal appears in the mask */
+	if(++serial == 0)
+		serial = 1;
+
+	regexp_scan_prefilter(buf, serial);
+
+	DLINK_FOREACH(ptr, regexp_list.head)
 	{
 		regexp_p = ptr->data;
 
-		/* regexp has expired */
-		if(regexp_p->hold && regexp_p->hold <= CURRENT_TIME)
+		/* it cant match without its literal */
+		if(regexp_p->literal && !regexp_prefilter_seen(regexp_p, serial))
+			continue;
+
+		if(pcre_exec(regexp_p->regexp, regexp_p->regexp_extra, 
+				buf, buflen, 0, 0, ovector, 30) < 0)
+			continue;
+
+		DLINK_FOREACH(neg_ptr, regexp_p->negations.head)
 		{
-			regexp_free(regexp_p, 0);
+			neg_p = neg_ptr->data;
+
+			if(pcre_exec(neg_p->regexp, neg_p->regexp_extra,
+					buf, buflen, 0, 0, ovector, 30) >= 0)
+				break;
+		}
+
+		/* matches a negation, so this regexp doesnt apply */
+		if(neg_ptr != NULL)
 			continue;
+
+		sendto_server(":%s ENCAP %s KLINE %u * %s :%s",
+				SVC_UID(banserv_p), target_p->user->servername,
+				config_file.bs_regexp_time,
+				target_p->user->host, regexp_p->reason);
+		return;
+	}
+}
+
+static int
+h_banserv_new_client(void *_target_p, void *unused)
+{
+	if(!dlink_list_length(&regexp_list))
+		return 0;
+
+	expire_regexps();
+	regexp_match_client(_target_p);
+	return 0;
+}
+
+/* h_banserv_new_clients()
+ *   checks a batch of clients from a burst against the regexps in one
+ *   go, so the automaton and compiled regexps stay warm between them
+ */
+static void
+h_banserv_new_clients(void **clients, int count)
+{
+	int i;
+
+	if(!dlink_list_length(&regexp_list))
+		return;
+
+	expire_regexps();
+
+	for(i = 0; i < count; i++)
+	{
+		/* they may have gone again already */
+		if(!IsDead((struct client *) clients[i]))
+			regexp_match_client(clients[i]);
+	}
+}
+
+/* The regexp prefilter.
+ *
+ * Most regexps cannot match unless some literal text appears in the
+ * mask, eg "^.+!.+@.+\.example\.com#.*$" needs ".example.com".  The
+ * longest such literal is pulled out of each regexp, and they are all
+ * built into an Aho-Corasick automaton.  One pass of a clients mask
+ * through it marks which regexps are worth running pcre_exec() on.
+ */
+#define REGEXP_MIN_LITERAL	3
+
+struct regexp_ac_node
+{
+	int child;		/* first child */
+	int sibling;		/* next child of our parent */
+	int fail;		/* longest proper suffix in the trie */
+	int output;		/* nearest node on fail chain ending a literal */
+	int literal;		/* a literal ends here */
+	unsigned int seen;	/* serial of the last scan that reached us */
+	unsigned char ch;
+};
+
+static struct regexp_ac_node *regexp_ac;
+static int regexp_ac_count;
+static int regexp_ac_dirty = 1;
+
+/* regexp_long_escape()
+ * checks for escapes that run on past the character after the
+ * backslash, like \x41, \012, \cX, \k<name> or \p{L}.  regexp_literal()
+ * would take the rest of them as literal text.
+ *
+ * inputs	- regexp string
+ * outputs	- 1 if there are any, else 0
+ * side effects -
+ */
+static int
+regexp_long_escape(const char *pattern)
+{
+	const char *p;
+
+	for(p = pattern; *p; p++)
+	{
+		if(*p != '\\' || p[1] == '\0')
+			continue;
+
+		p++;
+
+		if(IsDigit(*p) || strchr("xockgpPN", *p) != NULL)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* regexp_literal()
+ * finds the longest run of literal text every match of a regexp must
+ * contain.  Anything it doesn't understand just ends the current run,
+ * so it errs towards finding nothing.
+ *
+ * inputs	- regexp string
+ * outputs	- literal, or NULL if nothing usable was found
+ * side effects -
+ */
+static char *
+regexp_literal(const char *pattern)
+{
+	char run[BUFSIZE];
+	char best[BUFSIZE];
+	const char *p;
+	int runlen = 0;
+	int bestlen = 0;
+	int depth = 0;
+
+	/* inline options may make it caseless, quoting hides the
+	 * metacharacters from us, and long escapes hide what they match
+	 */
+	if(strstr(pattern, "(?") || strstr(pattern, "\\Q") ||
+	   regexp_long_escape(pattern))
+		return NULL;
+
+	for(p = pattern; *p; p++)
+	{
+		switch(*p)
+		{
+			case '\\':
+				/* an escaped metacharacter is literal, anything
+				 * else is a class or assertion
+				 */
+				if(p[1] && !isalnum((unsigned char) p[1]))
+				{
+					p++;
+
+					if(depth == 0 && runlen < sizeof(run) - 1)
+					{
+						run[runlen++] = *p;
+						continue;
+					}
+				}
+				else if(p[1])
+					p++;
+
+				break;
+
+			case '|':
+				/* alternation at the top level, nothing is required */
+				if(depth == 0)
+					return NULL;
+				break;
+
+			case '(':
+				depth++;
+				break;
+
+			case ')':
+				depth--;
+				break;
+
+			case '[':
+				/* skip the class, ']' straight after the opening
+				 * (or its negation) is part of it
+				 */
+				p++;
+
+				if(*p == '^')
+					p++;
+				if(*p == ']')
+					p++;
+
+				while(*p && *p != ']')
+				{
+					if(*p == '\\' && p[1])
+						p++;
+					p++;
+				}
+
+				if(*p == '\0')
+					p--;
+				break;
+
+			case '{':
+				while(*p && *p != '}')
+					p++;
+
+				if(*p == '\0')
+					p--;
+
+				/* FALLTHROUGH */
+			case '?':
+			case '*':
+				/* the previous character may not appear at all */
+				if(runlen)
+					runlen--;
+				break;
+
+			default:
+				if(depth == 0 && runlen < sizeof(run) - 1 &&
+				   !strchr(".^$+", *p))
+				{
+					run[runlen++] = *p;
+					continue;
+				}
+
+				break;
 		}
 
-		if(pcre_exec(regexp_p->regexp, NULL, buf, buflen, 0, 0, ovector, 30) >= 0)
+		/* anything that got here ends the run */
+		if(runlen > bestlen)
 		{
-			DLINK_FOREACH(neg_ptr, regexp_p->negations.head)
-			{
-				neg_p = neg_ptr->data;
+			memcpy(best, run, runlen);
+			bestlen = runlen;
+		}
+
+		runlen = 0;
+	}
+
+	if(runlen > bestlen)
+	{
+		memcpy(best, run, runlen);
+		bestlen = runlen;
+	}
+
+	if(bestlen < REGEXP_MIN_LITERAL)
+		return NULL;
+
+	best[bestlen] = '\0';
+	return my_strdup(best);
+}
+
+#ifdef RSERV_BENCH
+/* bench_regexp_literal()
+ * runs regexp_literal() over patterns whose literal is known, so a
+ * change that has it require text a match may not contain -- and so
+ * silently skip a ban -- fails the benchmark
+ *
+ * inputs	-
+ * outputs	- the first pattern it gets wrong, or NULL
+ * side effects -
+ */
+const char *
+bench_regexp_literal(void)
+{
+	static const char *checks[][2] = {
+		{ "^.+!.+@.+\\.example\\.com#.*$",	".example.com#"	},
+		{ "^evil\\d+!.*",			"evil"		},
+		{ "\\\\x41bcdef",			"\\x41bcdef"	},
+		{ "^abc|^def",				NULL		},
+		{ "(?i)abcdef",				NULL		},
+		{ "\\x41bcdef",				NULL		},
+		{ "\\x{41}bcdef",			NULL		},
+		{ "\\012345",				NULL		},
+		{ "\\cXyzzy",				NULL		},
+		{ "(a)\\1bcdef",			NULL		},
+		{ "\\k<n>barbaz",			NULL		},
+		{ "\\k{n}barbaz",			NULL		},
+		{ "\\g{1}barbaz",			NULL		},
+		{ "\\g1barbaz",				NULL		},
+		{ "\\p{Lu}abcdef",			NULL		},
+		{ "\\P{Lu}abcdef",			NULL		},
+		{ "\\N{U+41}bcdef",			NULL		},
+		{ "\\o{101}bcdef",			NULL		}
+	};
+	char *literal;
+	int i, ok;
+
+	for(i = 0; i < sizeof(checks) / sizeof(checks[0]); i++)
+	{
+		literal = regexp_literal(checks[i][0]);
 
-				/* matches a negation, return */
-				if(pcre_exec(regexp_p->regexp, NULL, buf, buflen, 0, 0, ovector, 30) >= 0)
-					return 0;
+		if(checks[i][1] == NULL)
+			ok = (literal == NULL);
+		else
+			ok = (literal != NULL && !strcmp(literal, checks[i][1]));
+
+		my_free(literal);
+
+		if(!ok)
+			return checks[i][0];
+	}
+
+	return NULL;
+}
+#endif
+
+/* regexp_prepare()
+ * studies a regexp ban and finds its literal, ready for matching
+ */
+static void
+regexp_prepare(struct regexp_ban *regexp_p)
+{
+	const char *re_error;
+
+	regexp_p->regexp_extra = pcre_study(regexp_p->regexp, 0, &re_error);
+	regexp_p->literal = regexp_literal(regexp_p->regexp_str);
+	regexp_ac_dirty = 1;
+}
+
+static int
+regexp_ac_child(int node, unsigned char ch)
+{
+	int child;
+
+	for(child = regexp_ac[node].child; child; child = regexp_ac[child].sibling)
+	{
+		if(regexp_ac[child].ch == ch)
+			return child;
+	}
+
+	return 0;
+}
+
+/* regexp_build_prefilter()
+ * builds the automaton from the literals of every regexp ban
+ */
+static void
+regexp_build_prefilter(void)
+{
+	struct regexp_ban *regexp_p;
+	dlink_node *ptr;
+	const unsigned char *p;
+	int *queue;
+	int head, tail;
+	int size = 1;
+	int node, child, fail;
+
+	my_free(regexp_ac);
+	regexp_ac_dirty = 0;
+
+	DLINK_FOREACH(ptr, regexp_list.head)
+	{
+		regexp_p = ptr->data;
+
+		if(regexp_p->literal)
+			size += strlen(regexp_p->literal);
+	}
+
+	regexp_ac = my_malloc(sizeof(struct regexp_ac_node) * size);
+	regexp_ac_count = 1;
+
+	/* the trie, node 0 is the root */
+	DLINK_FOREACH(ptr, regexp_list.head)
+	{
+		regexp_p = ptr->data;
+
+		if(regexp_p->literal == NULL)
+			continue;
+
+		for(node = 0, p = (const unsigned char *) regexp_p->literal; *p; p++)
+		{
+			if((child = regexp_ac_child(node, *p)) == 0)
+			{
+				child = regexp_ac_count++;
+				regexp_ac[child].ch = *p;
+				regexp_ac[child].sibling = regexp_ac[node].child;
+				regexp_ac[node].child = child;
 			}
 
-			/* no negations matched */
-			sendto_server(":%s ENCAP %s KLINE %u * %s :%s",
-					SVC_UID(banserv_p), target_p->user->servername,
-					config_file.bs_regexp_time,
-					target_p->user->host, regexp_p->reason);
-			return 0;
+			node = child;
 		}
+
+		regexp_ac[node].literal = 1;
+		regexp_p->literal_node = node;
 	}
 
-	return 0;
+	/* failure links, breadth first so shorter suffixes are done first */
+	queue = my_malloc(sizeof(int) * regexp_ac_count);
+	head = tail = 0;
+
+	for(child = regexp_ac[0].child; child; child = regexp_ac[child].sibling)
+	{
+		regexp_ac[child].fail = 0;
+		queue[tail++] = child;
+	}
+
+	while(head < tail)
+	{
+		node = queue[head++];
+
+		regexp_ac[node].output = regexp_ac[node].literal ? 
+				node : regexp_ac[regexp_ac[node].fail].output;
+
+		for(child = regexp_ac[node].child; child; child = regexp_ac[child].sibling)
+		{
+			fail = regexp_ac[node].fail;
+
+			while(fail && !regexp_ac_child(fail, regexp_ac[child].ch))
+				fail = regexp_ac[fail].fail;
+
+			regexp_ac[child].fail = regexp_ac_child(fail, regexp_ac[child].ch);
+			queue[tail++] = child;
+		}
+	}
+
+	my_free(queue);
+}
+
+/* regexp_scan_prefilter()
+ * marks the end of every literal that appears in buf
+ *
+ * inputs	- mask to scan, serial to mark candidates with
+ * outputs	-
+ * side effects - the automaton is rebuilt if regexps have changed
+ */
+static void
+regexp_scan_prefilter(const char *buf, unsigned int serial)
+{
+	const unsigned char *p;
+	int node = 0;
+	int child, out;
+
+	if(regexp_ac_dirty)
+		regexp_build_prefilter();
+
+	for(p = (const unsigned char *) buf; *p; p++)
+	{
+		while((child = regexp_ac_child(node, *p)) == 0 && node)
+			node = regexp_ac[node].fail;
+
+		node = child;
+
+		for(out = regexp_ac[node].output; out; out = regexp_ac[regexp_ac[out].fail].output)
+		{
+			/* already marked, so is everything on its fail chain */
+			if(regexp_ac[out].seen == serial)
+				break;
+
+			regexp_ac[out].seen = serial;
+		}
+	}
 }
 
+static int
+regexp_prefilter_seen(struct regexp_ban *regexp_p, unsigned int serial)
+{
+	return regexp_ac[regexp_p->literal_node].seen == serial;
+}
 
 static int
 split_ban(const char *mask, char **user, char **host)
@@ -446,6 +897,7 @@ regexp_free(struct regexp_ban *regexp_p, int neg)
 	}
 
 	pcre_free(regexp_p->regexp);
+	pcre_free(regexp_p->regexp_extra);
 
 	if(neg)
 		dlink_delete(&regexp_p->ptr, &regexp_p->parent->negations);
@@ -455,7 +907,10 @@ regexp_free(struct regexp_ban *regexp_p, int neg)
 	my_free(regexp_p->regexp_str);
 	my_free(regexp_p->reason);
 	my_free(regexp_p->oper);
+	my_free(regexp_p->literal);
 	my_free(regexp_p);
+
+	regexp_ac_dirty = 1;
 }
 
 static void
@@ -519,64 +974,65 @@ push_unban(const char *target, char type, const char *mask)
 static void
 sync_bans(const char *target, char banletter)
 {
-	struct rsdb_table data;
-	int i;
+	struct rsdb_cursor cursor;
 
 	/* first is temporary bans */
 	if(banletter)
-		rsdb_exec_fetch(&data, "SELECT type, mask, reason, hold FROM operbans "
+		rsdb_cursor_open(&cursor, "SELECT type, mask, reason, hold FROM operbans "
 					"WHERE hold > '%lu' AND remove='0' AND type='%c'",
 				CURRENT_TIME, banletter);
 	else
-		rsdb_exec_fetch(&data, "SELECT type, mask, reason, hold FROM operbans "
+		rsdb_cursor_open(&cursor, "SELECT type, mask, reason, hold FROM operbans "
 					"WHERE hold > '%lu' AND remove='0'",
 				CURRENT_TIME);
 
-	for(i = 0; i < data.row_count; i++)
+	while(rsdb_cursor_step(&cursor))
 	{
-		push_ban(target, data.row[i][0][0], data.row[i][1], data.row[i][2],
-			(unsigned long) (atol(data.row[i][3]) - CURRENT_TIME));
+		push_ban(target, rsdb_cursor_column(&cursor, 0)[0],
+			rsdb_cursor_column(&cursor, 1), rsdb_cursor_column(&cursor, 2),
+			(unsigned long) (atol(rsdb_cursor_column(&cursor, 3)) - CURRENT_TIME));
 	}
 
-	rsdb_exec_fetch_end(&data);
+	rsdb_cursor_close(&cursor);
 
 	/* permanent bans */
 	if(banletter)
-		rsdb_exec_fetch(&data, "SELECT type, mask, reason, hold FROM operbans "
+		rsdb_cursor_open(&cursor, "SELECT type, mask, reason, hold FROM operbans "
 					"WHERE hold='0' AND remove='0' AND type='%c'",
-				CURRENT_TIME, banletter);
+				banletter);
 	else
-		rsdb_exec_fetch(&data, "SELECT type, mask, reason, hold FROM operbans "
-					"WHERE hold='0' AND remove='0'",
-				CURRENT_TIME);
+		rsdb_cursor_open(&cursor, "SELECT type, mask, reason, hold FROM operbans "
+					"WHERE hold='0' AND remove='0'");
 
-	for(i = 0; i < data.row_count; i++)
+	while(rsdb_cursor_step(&cursor))
 	{
-		push_ban(target, data.row[i][0][0], data.row[i][1], data.row[i][2], 0);
+		push_ban(target, rsdb_cursor_column(&cursor, 0)[0],
+			rsdb_cursor_column(&cursor, 1), rsdb_cursor_column(&cursor, 2), 0);
 	}
 
-	rsdb_exec_fetch_end(&data);
+	rsdb_cursor_close(&cursor);
 
 	/* bans to remove */
 	if(banletter)
-		rsdb_exec_fetch(&data, "SELECT type, mask FROM operbans "
+		rsdb_cursor_open(&cursor, "SELECT type, mask FROM operbans "
 					"WHERE hold > '%lu' AND remove='1' AND type='%c'",
 				CURRENT_TIME, banletter);
 	else
-		rsdb_exec_fetch(&data, "SELECT type, mask FROM operbans "
+		rsdb_cursor_open(&cursor, "SELECT type, mask FROM operbans "
 					"WHERE hold > '%lu' AND remove='1'",
 				CURRENT_TIME);
 
-	for(i = 0; i < data.row_count; i++)
+	while(rsdb_cursor_step(&cursor))
 	{
-		push_unban(target, data.row[i][0][0], data.row[i][1]);
+		push_unban(target, rsdb_cursor_column(&cursor, 0)[0],
+				rsdb_cursor_column(&cursor, 1));
 	}
 
-	rsdb_exec_fetch_end(&data);
+	rsdb_cursor_close(&cursor);
 }
 
 static int
-regexp_match(pcre *regexp, int kline, const char *kline_reason)
+regexp_match(pcre *regexp, pcre_extra *regexp_extra, int kline, const char *kline_reason)
 {
 	char buf[BUFSIZE];
 	int ovector[30];
@@ -592,7 +1048,7 @@ regexp_match(pcre *regexp, int kline, const char *kline_reason)
 		buflen = snprintf(buf, sizeof(buf), "%s#%s", 
 				target_p->user->mask, target_p->info);
 
-		if(pcre_exec(regexp, NULL, buf, buflen, 0, 0, ovector, 30) >= 0)
+		if(pcre_exec(regexp, regexp_extra, buf, buflen, 0, 0, ovector, 30) >= 0)
 		{
 			matches++;
 
@@ -1019,7 +1475,7 @@ o_banserv_addregexp(struct client *client_p, struct lconn *conn_p, const char *p
 	}
 
 	/* run the regexp over clients to see how many it matches */
-	matches = regexp_match(regexp_comp, 0, NULL);
+	matches = regexp_match(regexp_comp, NULL, 0, NULL);
 
 	/* then check its not over the limit */
 	if(config_file.bs_max_regexp_matches && (matches > config_file.bs_max_regexp_matches))
@@ -1038,6 +1494,7 @@ o_banserv_addregexp(struct client *client_p, struct lconn *conn_p, const char *p
 	regexp_p->oper = my_strdup(OPER_NAME(client_p, conn_p));
 	regexp_p->hold = temptime ? CURRENT_TIME + temptime : 0;
 	regexp_p->create_time = CURRENT_TIME;
+	regexp_prepare(regexp_p);
 
 	dlink_add_tail(regexp_p, &regexp_p->ptr, &regexp_list);
 
@@ -1048,7 +1505,7 @@ o_banserv_addregexp(struct client *client_p, struct lconn *conn_p, const char *p
 			temptime ? CURRENT_TIME + temptime : 0,
 			CURRENT_TIME, OPER_NAME(client_p, conn_p));
 
-	matches = regexp_match(regexp_p->regexp, 1, regexp_p->reason);
+	matches = regexp_match(regexp_p->regexp, regexp_p->regexp_extra, 1, regexp_p->reason);
 
 	service_snd(banserv_p, client_p, conn_p, SVC_BAN_REGEXPSUCCESS,
 			banserv_p->name, mask, matches);
@@ -1104,7 +1561,7 @@ o_banserv_addregexpneg(struct client *client_p, struct lconn *conn_p, const char
 	{
 		regexp_p = ptr->data;
 
-		if(!strcmp(parent_p->regexp_str, parv[1]))
+		if(!strcmp(regexp_p->regexp_str, parv[1]))
 		{
 			service_snd(banserv_p, client_p, conn_p, SVC_BAN_ALREADYPLACED,
 					"REGEXPNEG", parv[1]);
@@ -1131,6 +1588,7 @@ o_banserv_addregexpneg(struct client *client_p, struct lconn *conn_p, const char
 
 	regexp_p = my_malloc(sizeof(struct regexp_ban));
 	regexp_p->regexp = regexp_comp;
+	regexp_p->regexp_extra = pcre_study(regexp_comp, 0, &re_error);
 	regexp_p->regexp_str = my_strdup(parv[1]);
 	regexp_p->oper = my_strdup(OPER_NAME(client_p, conn_p));
 	regexp_p->create_time = CURRENT_TIME;
@@ -1506,34 +1964,37 @@ static void
 list_bans(struct client *client_p, struct lconn *conn_p, 
 		const char *mask, char type)
 {
-	struct rsdb_table data;
+	struct rsdb_cursor cursor;
+	const char *operreason;
 	time_t duration;
-	int i;
 
-	rsdb_exec_fetch(&data, "SELECT mask, reason, operreason, hold, oper "
+	rsdb_cursor_open(&cursor, "SELECT mask, reason, operreason, hold, oper "
 				"FROM operbans WHERE type='%c' AND remove='0' AND (hold='0' OR hold > '%lu')",
 			type, (unsigned long) CURRENT_TIME);
 
 	service_snd(banserv_p, client_p, conn_p, SVC_BAN_LISTSTART, mask);
 
-	for(i = 0; i < data.row_count; i++)
+	while(rsdb_cursor_step(&cursor))
 	{
-		if(!match(mask, data.row[i][0]))
+		if(!match(mask, rsdb_cursor_column(&cursor, 0)))
 			continue;
 
-		duration = (unsigned long) atol(data.row[i][3]);
+		duration = (unsigned long) atol(rsdb_cursor_column(&cursor, 3));
 
 		if(duration)
 			duration -= CURRENT_TIME;
 
+		operreason = rsdb_cursor_column(&cursor, 2);
+
 		service_send(banserv_p, client_p, conn_p,
 				"  %-30s exp:%s oper:%s [%s%s]",
-				data.row[i][0], duration ? get_short_duration(duration) : "never",
-				data.row[i][4], data.row[i][1],
-				EmptyString(data.row[i][2]) ? "" : data.row[i][2]);
+				rsdb_cursor_column(&cursor, 0),
+				duration ? get_short_duration(duration) : "never",
+				rsdb_cursor_column(&cursor, 4), rsdb_cursor_column(&cursor, 1),
+				EmptyString(operreason) ? "" : operreason);
 	}
 
-	rsdb_exec_fetch_end(&data);
+	rsdb_cursor_close(&cursor);
 
 	service_snd(banserv_p, client_p, conn_p, SVC_ENDOFLIST);
 }
@@ -51,6 +51,9 @@
 #include "event.h"
 #include "watch.h"
 #include "email.h"
+#include "snapshot.h"
+#include "intern.h"
+#include "htable.h"
 
 #define S_C_OWNER	200
 #define S_C_MANAGER	190
@@ -75,7 +78,41 @@ static BlockHeap *channel_reg_heap;
 static BlockHeap *member_reg_heap;
 static BlockHeap *ban_reg_heap;
 
-static dlink_list chan_reg_table[MAX_CHANNEL_TABLE];
+/* channels with fewer bans than this are just scanned on join */
+#define BAN_INDEX_MIN	8
+
+/* the bans of a registered channel, indexed on the host part of their
+ * mask.  Hosts are stored reversed in a trie, so walking a joining
+ * users host backwards finds the bans on that exact host, and those on
+ * "*" followed by any suffix of it.  Anything else, such as a host with
+ * a wildcard in the middle, goes on the other list.
+ */
+struct ban_index_node
+{
+	struct ban_index_node *child;
+	struct ban_index_node *sibling;
+	dlink_list suffix;		/* bans on "*" followed by the path here */
+	dlink_list exact;		/* bans on exactly the path here */
+	unsigned char ch;
+};
+
+struct ban_index
+{
+	struct ban_index_node root;
+	dlink_list other;
+};
+
+static struct htable chan_reg_table;
+
+static const char *chan_reg_key(void *);
+
+/* every member_reg, keyed on its user and channel */
+static struct member_reg **member_reg_table;
+static unsigned int member_reg_table_size;
+static unsigned int member_reg_count;
+
+/* registrations with CS_FLAGS_NEEDUPDATE set */
+static dlink_list chan_reg_update_list;
 
 static int o_chan_chanregister(struct client *, struct lconn *, const char **, int);
 static int o_chan_chandrop(struct client *, struct lconn *, const char **, int);
@@ -161,6 +198,7 @@ static struct service_handler chanserv_service = {
 
 static void load_channel_db(void);
 static void free_ban_reg(struct chan_reg *chreg_p, struct ban_reg *banreg_p);
+static void clear_ban_index(struct chan_reg *chreg_p);
 static void enable_inhabit(struct chan_reg *chreg_p, struct channel *chptr, int autojoin);
 
 static int h_chanserv_join(void *members, void *unused);
@@ -171,6 +209,7 @@ static int h_chanserv_mode_ban(void *chptr, void *list);
 static int h_chanserv_sjoin_lowerts(void *chptr, void *unused);
 static int h_chanserv_user_login(void *client, void *unused);
 static int h_chanserv_dbsync(void *unused, void *unusedd);
+static int h_chanserv_snapshot(void *counter, void *unused);
 static int h_chanserv_eob_uplink(void *unused, void *unusedd);
 static int h_chanserv_topic(void *unused, void *unusedd);
 static void e_chanserv_updatechan(void *unused);
@@ -184,6 +223,7 @@ static void dump_info_extended(struct client *, struct lconn *, struct chan_reg
 static void dump_info_accesslist(struct client *, struct lconn *, struct chan_reg *);
 
 static void expire_chan_suspend(struct chan_reg *chreg_p);
+static void mark_chan_reg_update(struct chan_reg *chreg_p);
 
 void
 preinit_s_chanserv(void)
@@ -198,6 +238,8 @@ init_s_chanserv(void)
 	member_reg_heap = BlockHeapCreate("Member Reg", sizeof(struct member_reg), HEAP_MEMBER_REG);
 	ban_reg_heap = BlockHeapCreate("Ban Reg", sizeof(struct ban_reg), HEAP_BAN_REG);
 
+	htable_init(&chan_reg_table, "Channel Regs", CHANNEL_HASH_MIN, chan_reg_key, irccmp);
+
 	load_channel_db();
 
 	hook_add(h_chanserv_join, HOOK_JOIN_CHANNEL);
@@ -208,6 +250,7 @@ init_s_chanserv(void)
 	hook_add(h_chanserv_sjoin_lowerts, HOOK_SJOIN_LOWERTS);
 	hook_add(h_chanserv_user_login, HOOK_USER_LOGIN);
 	hook_add(h_chanserv_dbsync, HOOK_DBSYNC);
+	hook_add(h_chanserv_snapshot, HOOK_DBSNAPSHOT);
 	hook_add(h_chanserv_eob_uplink, HOOK_FINISHED_BURSTING);
 	hook_add(h_chanserv_topic, HOOK_CHANNEL_TOPIC);
 
@@ -230,8 +273,6 @@ free_channel_reg(struct chan_reg *reg_p)
 {
 	dlink_node *ptr, *next_ptr;
 
-	unsigned int hashv = hash_channel(reg_p->name);
-
 	part_service(chanserv_p, reg_p->name);
 
 	rsdb_exec(NULL, "DELETE FROM channels_dropowner WHERE chname='%Q'", reg_p->name);
@@ -244,7 +285,10 @@ free_channel_reg(struct chan_reg *reg_p)
 		free_ban_reg(reg_p, ptr->data);
 	}
 
-	dlink_delete(&reg_p->node, &chan_reg_table[hashv]);
+	htable_del(&chan_reg_table, reg_p);
+
+	if(reg_p->flags & CS_FLAGS_NEEDUPDATE)
+		dlink_delete(&reg_p->update_node, &chan_reg_update_list);
 
 	rsdb_exec(NULL, "DELETE FROM channels WHERE chname = '%Q'",
 			reg_p->name);
@@ -252,8 +296,9 @@ free_channel_reg(struct chan_reg *reg_p)
 	my_free(reg_p->name);
 	my_free(reg_p->topic);
 	my_free(reg_p->url);
-	my_free(reg_p->suspender);
-	my_free(reg_p->suspend_reason);
+	intern_release(reg_p->suspender);
+	intern_release(reg_p->suspend_reason);
+	my_free(reg_p->users.entry);
 
 	BlockHeapFree(channel_reg_heap, reg_p);
 }
@@ -261,24 +306,31 @@ free_channel_reg(struct chan_reg *reg_p)
 static void
 destroy_channel_reg(struct chan_reg *reg_p)
 {
-	dlink_node *ptr, *next_ptr;
+	unsigned int i;
 
 	rsdb_exec(NULL, "DELETE FROM members WHERE chname = '%Q'",
 			reg_p->name);
 
-	/* free_member_reg() will call free_channel_reg() when its done */
-	DLINK_FOREACH_SAFE(ptr, next_ptr, reg_p->users.head)
+	/* free_member_reg() will call free_channel_reg() when its done,
+	 * so reg_p mustn't be touched after the last one
+	 */
+	for(i = reg_p->users.count; i > 0; i--)
 	{
-		free_member_reg(ptr->data, 0);
+		free_member_reg(reg_p->users.entry[i - 1], 0);
 	}
 }
 
+static const char *
+chan_reg_key(void *data)
+{
+	return ((struct chan_reg *) data)->name;
+}
+
 static void
 add_channel_reg(struct chan_reg *reg_p)
 {
-	unsigned int hashv = hash_channel(reg_p->name);
 	reg_p->bants = 1L; /* initially allow UNBAN */
-	dlink_add(reg_p, &reg_p->node, &chan_reg_table[hashv]);
+	htable_add(&chan_reg_table, reg_p);
 }
 
 static void
@@ -307,16 +359,9 @@ static struct chan_reg *
 find_channel_reg(struct client *client_p, const char *name)
 {
 	struct chan_reg *reg_p;
-	unsigned int hashv = hash_channel(name);
-	dlink_node *ptr;
 
-	DLINK_FOREACH(ptr, chan_reg_table[hashv].head)
-	{
-		reg_p = ptr->data;
-
-		if(!irccmp(reg_p->name, name))
-			return reg_p;
-	}
+	if((reg_p = htable_find(&chan_reg_table, name)) != NULL)
+		return reg_p;
 
 	if(client_p != NULL)
 		service_err(chanserv_p, client_p, SVC_CHAN_NOTREG, name);
@@ -324,20 +369,80 @@ find_channel_reg(struct client *client_p, const char *name)
 	return NULL;
 }
 
+static unsigned int
+hash_member_reg(struct user_reg *ureg_p, struct chan_reg *chreg_p)
+{
+	unsigned long hashv = ((unsigned long) ureg_p >> 4) * 31 + ((unsigned long) chreg_p >> 4);
+
+	return (unsigned int) (hashv * 2654435761UL) >> 8;
+}
+
+static void
+grow_member_reg_table(void)
+{
+	struct member_reg **table;
+	struct member_reg *mreg_p, *next_mreg_p;
+	unsigned int size, hashv;
+	unsigned int i;
+
+	size = member_reg_table_size ? member_reg_table_size * 2 : 1024;
+	table = my_malloc(sizeof(struct member_reg *) * size);
+
+	for(i = 0; i < member_reg_table_size; i++)
+	{
+		for(mreg_p = member_reg_table[i]; mreg_p; mreg_p = next_mreg_p)
+		{
+			next_mreg_p = mreg_p->hnext;
+			hashv = hash_member_reg(mreg_p->user_reg, mreg_p->channel_reg) & (size - 1);
+			mreg_p->hnext = table[hashv];
+			table[hashv] = mreg_p;
+		}
+	}
+
+	my_free(member_reg_table);
+	member_reg_table = table;
+	member_reg_table_size = size;
+}
+
+/* member_list_add()
+ * appends mreg_p to list, returning its index
+ */
+static unsigned int
+member_list_add(struct member_list *list, struct member_reg *mreg_p)
+{
+	if(list->count == list->size)
+	{
+		list->size = list->size ? list->size * 2 : 4;
+		list->entry = my_realloc(list->entry, sizeof(struct member_reg *) * list->size);
+	}
+
+	list->entry[list->count] = mreg_p;
+	return list->count++;
+}
+
 static struct member_reg *
 make_member_reg(struct user_reg *ureg_p, struct chan_reg *chreg_p,
 		const char *lastmod, int level, int flags)
 {
 	struct member_reg *mreg_p = BlockHeapAlloc(member_reg_heap);
+	unsigned int hashv;
 
 	mreg_p->user_reg = ureg_p;
 	mreg_p->channel_reg = chreg_p;
 	mreg_p->level = level;
 	mreg_p->flags = flags;
-	mreg_p->lastmod = my_strdup(lastmod);
+	mreg_p->lastmod = intern_string(lastmod);
 
-	dlink_add(mreg_p, &mreg_p->usernode, &ureg_p->channels);
-	dlink_add(mreg_p, &mreg_p->channode, &chreg_p->users);
+	mreg_p->userpos = member_list_add(&ureg_p->channels, mreg_p);
+	mreg_p->chanpos = member_list_add(&chreg_p->users, mreg_p);
+
+	if(member_reg_count >= member_reg_table_size)
+		grow_member_reg_table();
+
+	hashv = hash_member_reg(ureg_p, chreg_p) & (member_reg_table_size - 1);
+	mreg_p->hnext = member_reg_table[hashv];
+	member_reg_table[hashv] = mreg_p;
+	member_reg_count++;
 
 	return mreg_p;
 }
@@ -346,16 +451,38 @@ void
 free_member_reg(struct member_reg *mreg_p, int upgrade)
 {
 	struct chan_reg *chreg_p = mreg_p->channel_reg;
+	struct user_reg *ureg_p = mreg_p->user_reg;
+	struct member_reg **prev;
+	struct member_reg *last;
 	int level = mreg_p->level;
 
-	/* remove the user before we find highest */
-	dlink_delete(&mreg_p->usernode, &mreg_p->user_reg->channels);
-	dlink_delete(&mreg_p->channode, &mreg_p->channel_reg->users);
+	/* remove the user before we find highest, moving the last entry
+	 * in each list into the hole
+	 */
+	last = ureg_p->channels.entry[--ureg_p->channels.count];
+	ureg_p->channels.entry[mreg_p->userpos] = last;
+	last->userpos = mreg_p->userpos;
 
-	my_free(mreg_p->lastmod);
+	last = chreg_p->users.entry[--chreg_p->users.count];
+	chreg_p->users.entry[mreg_p->chanpos] = last;
+	last->chanpos = mreg_p->chanpos;
+
+	for(prev = &member_reg_table[hash_member_reg(ureg_p, chreg_p) & (member_reg_table_size - 1)];
+	    *prev; prev = &(*prev)->hnext)
+	{
+		if(*prev == mreg_p)
+		{
+			*prev = mreg_p->hnext;
+			break;
+		}
+	}
+
+	member_reg_count--;
+
+	intern_release(mreg_p->lastmod);
 	BlockHeapFree(member_reg_heap, mreg_p);
 
-	if(!dlink_list_length(&chreg_p->users))
+	if(!chreg_p->users.count)
 	{
 		free_channel_reg(chreg_p);
 	}
@@ -365,13 +492,13 @@ free_member_reg(struct member_reg *mreg_p, int upgrade)
 		struct member_reg *mreg_tp;
 		struct member_reg *mreg_top = NULL;
 		struct member_reg *mreg_topsus = NULL;
-		dlink_node *ptr;
+		unsigned int i;
 
 		level = 0;
 
-		DLINK_FOREACH(ptr, chreg_p->users.head)
+		for(i = 0; i < chreg_p->users.count; i++)
 		{
-			mreg_tp = ptr->data;
+			mreg_tp = chreg_p->users.entry[i];
 
 			if(mreg_tp->suspend)
 			{
@@ -390,7 +517,8 @@ free_member_reg(struct member_reg *mreg_p, int upgrade)
 
 		/* now promote the highest user */
 		mreg_top->level = S_C_OWNER;
-		mreg_top->lastmod = my_strdup(MYNAME);
+		intern_release(mreg_top->lastmod);
+		mreg_top->lastmod = intern_string(MYNAME);
 
 		rsdb_exec(NULL, 
 				"UPDATE members SET level = '%d', suspend = '0', lastmod = '%Q' "
@@ -404,16 +532,14 @@ static struct member_reg *
 find_member_reg(struct user_reg *ureg_p, struct chan_reg *chreg_p)
 {
 	struct member_reg *mreg_p;
-	dlink_node *ptr;
 
-	if(ureg_p == NULL)
+	if(ureg_p == NULL || !member_reg_count)
 		return NULL;
 
-	DLINK_FOREACH(ptr, ureg_p->channels.head)
+	for(mreg_p = member_reg_table[hash_member_reg(ureg_p, chreg_p) & (member_reg_table_size - 1)];
+	    mreg_p; mreg_p = mreg_p->hnext)
 	{
-		mreg_p = ptr->data;
-
-		if(mreg_p->channel_reg == chreg_p)
+		if(mreg_p->user_reg == ureg_p && mreg_p->channel_reg == chreg_p)
 			return mreg_p;
 	}
 
@@ -469,7 +595,7 @@ verify_member_reg(struct client *client_p, struct channel **chptr,
 
 	/* this is called when someone issues a command.. */
 	mreg_p->channel_reg->last_time = CURRENT_TIME;
-	mreg_p->channel_reg->flags |= CS_FLAGS_NEEDUPDATE;
+	mark_chan_reg_update(mreg_p->channel_reg);
 
 	return mreg_p;
 }
@@ -569,16 +695,16 @@ channel_db_callback(int argc, const char **argv)
 	reg_p->tsinfo = atol(argv[5]);
 	reg_p->reg_time = atol(argv[6]);
 	reg_p->last_time = atol(argv[7]);
-	reg_p->flags = atoi(argv[8]);
+	reg_p->flags = atoi(argv[8]) & ~CS_FLAGS_NEEDUPDATE;
 
 	if(!EmptyString(argv[9]))
-		reg_p->suspender = my_strdup(argv[9]);
+		reg_p->suspender = intern_string(argv[9]);
 
 	/* note: suspend_reason may be blank even when a channel is
 	 * suspended, as they were introduced in rserv-1.1
 	 */
 	if(!EmptyString(argv[10]))
-		reg_p->suspend_reason = my_strdup(argv[10]);
+		reg_p->suspend_reason = intern_string(argv[10]);
 
 	if(!EmptyString(argv[11]) && atol(argv[11]))
 		reg_p->suspend_time = atol(argv[11]);
@@ -615,16 +741,19 @@ make_ban_reg(struct chan_reg *chreg_p, const char *mask, const char *reason,
               const char *username, int level, int hold)
 {
 	struct ban_reg *banreg_p = BlockHeapAlloc(ban_reg_heap);
+	char *tmpmask = LOCAL_COPY(mask);
+
+	/* the interned copy is shared, so collapse it first */
+	collapse(tmpmask);
 
-	banreg_p->mask = my_strdup(mask);
-	banreg_p->reason = my_strdup(EmptyString(reason) ? "No Reason" : reason);
-	banreg_p->username = my_strdup(EmptyString(username) ? "unknown" : username);
+	banreg_p->mask = intern_string(tmpmask);
+	banreg_p->reason = intern_string(EmptyString(reason) ? "No Reason" : reason);
+	banreg_p->username = intern_string(EmptyString(username) ? "unknown" : username);
 	banreg_p->level = level;
 	banreg_p->hold = hold;
 
-	collapse(banreg_p->mask);
-
 	dlink_add(banreg_p, &banreg_p->channode, &chreg_p->bans);
+	clear_ban_index(chreg_p);
 	return banreg_p;
 }
 
@@ -632,10 +761,11 @@ static void
 free_ban_reg(struct chan_reg *chreg_p, struct ban_reg *banreg_p)
 {
 	dlink_delete(&banreg_p->channode, &chreg_p->bans);
+	clear_ban_index(chreg_p);
 
-	my_free(banreg_p->mask);
-	my_free(banreg_p->reason);
-	my_free(banreg_p->username);
+	intern_release(banreg_p->mask);
+	intern_release(banreg_p->reason);
+	intern_release(banreg_p->username);
 
 	BlockHeapFree(ban_reg_heap, banreg_p);
 }
@@ -677,16 +807,206 @@ ban_db_callback(int argc, const char **argv)
 	return 0;
 }
 
+#define CHAN_SNAPSHOT_VERSION	1
+
+#define CHAN_SNAPSHOT_CHANNELS	0
+#define CHAN_SNAPSHOT_MEMBERS	1
+
+/* a chan_reg as stored in the snapshot, strings are offsets */
+struct chan_snapshot
+{
+	unsigned int name;
+	unsigned int topic;
+	unsigned int url;
+	unsigned int suspender;
+	unsigned int suspend_reason;
+	int flags;
+	time_t suspend_time;
+	time_t tsinfo;
+	time_t reg_time;
+	time_t last_time;
+	struct chmode cmode;
+	struct chmode emode;
+};
+
+struct member_snapshot
+{
+	unsigned int channel;		/* index into the channel records */
+	unsigned int username;
+	unsigned int lastmod;
+	int level;
+	int flags;
+	int suspend;
+};
+
+static int
+h_chanserv_snapshot(void *counter, void *unused)
+{
+	struct chan_snapshot chan_record;
+	struct member_snapshot member_record;
+	struct snapshot *snap;
+	struct chan_reg *chreg_p;
+	struct member_reg *mreg_p;
+	unsigned int count = 0;
+	unsigned int i, j;
+
+	snap = snapshot_create(CHAN_SNAPSHOT_PATH, CHAN_SNAPSHOT_VERSION,
+				*(unsigned long *) counter);
+
+	HTABLE_WALK(i, chreg_p, &chan_reg_table)
+	{
+		memset(&chan_record, 0, sizeof(chan_record));
+		chan_record.name = snapshot_string(snap, chreg_p->name);
+		chan_record.topic = snapshot_string(snap, chreg_p->topic);
+		chan_record.url = snapshot_string(snap, chreg_p->url);
+		chan_record.suspender = snapshot_string(snap, chreg_p->suspender);
+		chan_record.suspend_reason = snapshot_string(snap, chreg_p->suspend_reason);
+		chan_record.flags = chreg_p->flags & ~CS_FLAGS_INHABIT;
+		chan_record.suspend_time = chreg_p->suspend_time;
+		chan_record.tsinfo = chreg_p->tsinfo;
+		chan_record.reg_time = chreg_p->reg_time;
+		chan_record.last_time = chreg_p->last_time;
+		chan_record.cmode = chreg_p->cmode;
+		chan_record.emode = chreg_p->emode;
+
+		snapshot_add(snap, CHAN_SNAPSHOT_CHANNELS, &chan_record, sizeof(chan_record));
+
+		for(j = 0; j < chreg_p->users.count; j++)
+		{
+			mreg_p = chreg_p->users.entry[j];
+
+			memset(&member_record, 0, sizeof(member_record));
+			member_record.channel = count;
+			member_record.username = snapshot_string(snap, mreg_p->user_reg->name);
+			member_record.lastmod = snapshot_string(snap, mreg_p->lastmod);
+			member_record.level = mreg_p->level;
+			member_record.flags = mreg_p->flags;
+			member_record.suspend = mreg_p->suspend;
+
+			snapshot_add(snap, CHAN_SNAPSHOT_MEMBERS, &member_record,
+					sizeof(member_record));
+		}
+
+		count++;
+	}
+	HTABLE_WALK_END
+
+	snapshot_commit(snap);
+	return 0;
+}
+
+/* load_channel_snapshot()
+ * loads the channels and their members from the snapshot, if it's
+ * current.  This must mirror channel_db_callback() and
+ * member_db_callback()
+ */
+static int
+load_channel_snapshot(void)
+{
+	struct snapshot_map map;
+	const struct chan_snapshot *chan_record;
+	const struct member_snapshot *member_record;
+	struct chan_reg **channels;
+	struct chan_reg *reg_p;
+	struct user_reg *ureg_p;
+	struct member_reg *mreg_p;
+	const char *name;
+	const char *lastmod;
+	unsigned int chan_count, member_count, i;
+
+	if(!snapshot_open(&map, CHAN_SNAPSHOT_PATH, CHAN_SNAPSHOT_VERSION))
+		return 0;
+
+	chan_record = snapshot_records(&map, CHAN_SNAPSHOT_CHANNELS,
+					sizeof(struct chan_snapshot), &chan_count);
+	member_record = snapshot_records(&map, CHAN_SNAPSHOT_MEMBERS,
+					sizeof(struct member_snapshot), &member_count);
+
+	if(chan_record == NULL || member_record == NULL)
+	{
+		snapshot_close(&map);
+		return 0;
+	}
+
+	/* members refer to their channel by its position in the snapshot */
+	channels = my_malloc(sizeof(struct chan_reg *) * (chan_count + 1));
+
+	for(i = 0; i < chan_count; i++, chan_record++)
+	{
+		name = snapshot_get_string(&map, chan_record->name);
+
+		if(EmptyString(name))
+			continue;
+
+		reg_p = BlockHeapAlloc(channel_reg_heap);
+		reg_p->name = my_strdup(name);
+		reg_p->topic = snapshot_strdup(&map, chan_record->topic);
+		reg_p->url = snapshot_strdup(&map, chan_record->url);
+		reg_p->cmode = chan_record->cmode;
+		reg_p->emode = chan_record->emode;
+
+		if(!config_file.allow_sslonly)
+		{
+			reg_p->cmode.mode &= ~MODE_SSLONLY;
+			reg_p->emode.mode &= ~MODE_SSLONLY;
+		}
+
+		reg_p->tsinfo = chan_record->tsinfo;
+		reg_p->reg_time = chan_record->reg_time;
+		reg_p->last_time = chan_record->last_time;
+		reg_p->flags = chan_record->flags & ~CS_FLAGS_NEEDUPDATE;
+		reg_p->suspender = snapshot_intern(&map, chan_record->suspender);
+		reg_p->suspend_reason = snapshot_intern(&map, chan_record->suspend_reason);
+		reg_p->suspend_time = chan_record->suspend_time;
+		add_channel_reg(reg_p);
+
+		if(config_file.cautojoin_empty && reg_p->flags & CS_FLAGS_AUTOJOIN)
+			enable_inhabit(reg_p, NULL, 1);
+
+		channels[i] = reg_p;
+	}
+
+	for(i = 0; i < member_count; i++, member_record++)
+	{
+		if(member_record->channel >= chan_count ||
+		   channels[member_record->channel] == NULL)
+			continue;
+
+		name = snapshot_get_string(&map, member_record->username);
+
+		if(EmptyString(name) || (ureg_p = find_user_reg(NULL, name)) == NULL)
+			continue;
+
+		lastmod = snapshot_get_string(&map, member_record->lastmod);
+
+		mreg_p = make_member_reg(ureg_p, channels[member_record->channel],
+				lastmod ? lastmod : "", member_record->level,
+				member_record->flags & CS_MEMBER_ALL);
+		mreg_p->suspend = member_record->suspend;
+	}
+
+	mlog("Loaded %u channel registrations from snapshot", chan_count);
+
+	my_free(channels);
+	snapshot_close(&map);
+	return 1;
+}
+
 static void
 load_channel_db(void)
 {
-	rsdb_exec(channel_db_callback, 
-			"SELECT chname, topic, url, createmodes, "
-			"enforcemodes, tsinfo, reg_time, last_time, "
-			"flags, suspender, suspend_reason, suspend_time FROM channels");
-	rsdb_exec(member_db_callback, 
-			"SELECT chname, username, lastmod, level, "
-			"flags, suspend FROM members");
+	if(!load_channel_snapshot())
+	{
+		rsdb_exec(channel_db_callback, 
+				"SELECT chname, topic, url, createmodes, "
+				"enforcemodes, tsinfo, reg_time, last_time, "
+				"flags, suspender, suspend_reason, suspend_time FROM channels");
+		rsdb_exec(member_db_callback, 
+				"SELECT chname, username, lastmod, level, "
+				"flags, suspend FROM members");
+	}
+
+	/* bans aren't part of the snapshot */
 	rsdb_exec(ban_db_callback, 
 			"SELECT chname, mask, reason, username, "
 			"level, hold FROM bans");
@@ -709,7 +1029,7 @@ enable_inhabit(struct chan_reg *chreg_p, struct channel *chptr, int autojoin)
 	if(chptr && chptr->tsinfo < chreg_p->tsinfo)
 	{
 		chreg_p->tsinfo = chptr->tsinfo;
-		chreg_p->flags |= CS_FLAGS_NEEDUPDATE;
+		mark_chan_reg_update(chreg_p);
 	}
 
 	/* Join with stored TS */
@@ -761,11 +1081,11 @@ static const char *
 find_owner(struct chan_reg *chreg_p)
 {
 	struct member_reg *mreg_p;
-	dlink_node *ptr;
+	unsigned int i;
 
-	DLINK_FOREACH(ptr, chreg_p->users.head)
+	for(i = 0; i < chreg_p->users.count; i++)
 	{
-		mreg_p = ptr->data;
+		mreg_p = chreg_p->users.entry[i];
 
 		if(mreg_p->level == S_C_OWNER)
 			return mreg_p->user_reg->name;
@@ -802,6 +1122,19 @@ access_users_on_channel(struct chan_reg *chreg_p)
 	return 0;
 }
 
+/* mark_chan_reg_update()
+ * queues a channel to have its last_time and tsinfo written out
+ */
+static void
+mark_chan_reg_update(struct chan_reg *chreg_p)
+{
+	if(chreg_p->flags & CS_FLAGS_NEEDUPDATE)
+		return;
+
+	chreg_p->flags |= CS_FLAGS_NEEDUPDATE;
+	dlink_add(chreg_p, &chreg_p->update_node, &chan_reg_update_list);
+}
+
 /* e_chanserv_updatechan()
  *
  * inputs	-
@@ -813,24 +1146,23 @@ e_chanserv_updatechan(void *unused)
 {
 	struct chan_reg *chreg_p;
 	dlink_node *ptr, *next_ptr;
-	int i;
+
+	if(!dlink_list_length(&chan_reg_update_list))
+		return;
 
 	/* Start a transaction, we're going to make a lot of changes */
 	rsdb_transaction(RSDB_TRANS_START);
 
-	HASH_WALK_SAFE(i, MAX_CHANNEL_TABLE, ptr, next_ptr, chan_reg_table)
+	DLINK_FOREACH_SAFE(ptr, next_ptr, chan_reg_update_list.head)
 	{
 		chreg_p = ptr->data;
 
-		if(chreg_p->flags & CS_FLAGS_NEEDUPDATE)
-		{
-			chreg_p->flags &= ~CS_FLAGS_NEEDUPDATE;
-			rsdb_exec(NULL, "UPDATE channels "
-					"SET last_time='%lu', tsinfo='%lu' WHERE chname = '%Q'",
-					chreg_p->last_time, chreg_p->tsinfo, chreg_p->name);
-		}
+		chreg_p->flags &= ~CS_FLAGS_NEEDUPDATE;
+		dlink_delete(&chreg_p->update_node, &chan_reg_update_list);
+
+		rsdb_exec_prepared(NULL, "UPDATE channels SET last_time=?, tsinfo=? WHERE chname=?",
+				"uus", chreg_p->last_time, chreg_p->tsinfo, chreg_p->name);
 	}
-	HASH_WALK_END
 
 	rsdb_transaction(RSDB_TRANS_END);
 }
@@ -842,19 +1174,17 @@ h_chanserv_dbsync(void *unused, void *unusedd)
 	return 0;
 }
 
-static void
-e_chanserv_expirechan(void *unused)
+static int
+t_chanserv_expirechan(void *unused)
 {
+	static unsigned int hash_pos = 0;
 	struct chan_reg *chreg_p;
-	dlink_node *ptr, *next_ptr;
-	int i;
 
 	/* Start a transaction, we're going to make a lot of changes */
 	rsdb_transaction(RSDB_TRANS_START);
 
-	HASH_WALK_SAFE(i, MAX_CHANNEL_TABLE, ptr, next_ptr, chan_reg_table)
+	HTABLE_WALK_SLICE(hash_pos, chreg_p, &chan_reg_table)
 	{
-		chreg_p = ptr->data;
 
 		if(CHAN_SUSPEND_EXPIRED(chreg_p))
 			expire_chan_suspend(chreg_p);
@@ -884,28 +1214,39 @@ e_chanserv_expirechan(void *unused)
 
 		destroy_channel_reg(chreg_p);
 	}
-	HASH_WALK_END
+	HTABLE_WALK_SLICE_END
 
 	rsdb_transaction(RSDB_TRANS_END);
-}	
+
+	if(hash_pos < chan_reg_table.size)
+		return 1;
+
+	hash_pos = 0;
+	return 0;
+}
 
 static void
-e_chanserv_expireban(void *unused)
+e_chanserv_expirechan(void *unused)
 {
+	eventTaskAdd("chanserv_expirechan", t_chanserv_expirechan, NULL);
+}
+
+static int
+t_chanserv_expireban(void *unused)
+{
+	static unsigned int hash_pos = 0;
 	struct chan_reg *chreg_p;
 	struct ban_reg *banreg_p;
-	dlink_node *hptr;
 	dlink_node *ptr, *next_ptr;
 	dlink_node *bptr;
-	int i, any;
+	int any;
 	struct channel *chptr;
 
 	/* Start a transaction, we're going to make a lot of changes */
 	rsdb_transaction(RSDB_TRANS_START);
 
-	HASH_WALK(i, MAX_CHANNEL_TABLE, hptr, chan_reg_table)
+	HTABLE_WALK_SLICE(hash_pos, chreg_p, &chan_reg_table)
 	{
-		chreg_p = hptr->data;
 		any = 0;
 		chptr = NULL;
 
@@ -944,26 +1285,32 @@ e_chanserv_expireban(void *unused)
 		if (chptr != NULL)
 			modebuild_finish();
 	}
-	HASH_WALK_END
+	HTABLE_WALK_SLICE_END
 
 	rsdb_transaction(RSDB_TRANS_END);
+
+	if(hash_pos < chan_reg_table.size)
+		return 1;
+
+	hash_pos = 0;
+	return 0;
 }
 
 static void
-e_chanserv_enforcetopic(void *unused)
+e_chanserv_expireban(void *unused)
 {
+	eventTaskAdd("chanserv_expireban", t_chanserv_expireban, NULL);
+}
+
+static int
+t_chanserv_enforcetopic(void *unused)
+{
+	static unsigned int hash_pos = 0;
 	struct channel *chptr;
 	struct chan_reg *chreg_p;
-	dlink_node *ptr;
-	int i;
-
-	/* topics are enforced automatically */
-	if(config_file.cenforcetopic_frequency == 0)
-		return;
 
-	HASH_WALK(i, MAX_CHANNEL_TABLE, ptr, chan_reg_table)
+	HTABLE_WALK_SLICE(hash_pos, chreg_p, &chan_reg_table)
 	{
-		chreg_p = ptr->data;
 
 		if(EmptyString(chreg_p->topic))
 			continue;
@@ -985,7 +1332,23 @@ e_chanserv_enforcetopic(void *unused)
 		strlcpy(chptr->topicwho, MYNAME, sizeof(chptr->topicwho));
 		chptr->topic_tsinfo = CURRENT_TIME;
 	}
-	HASH_WALK_END
+	HTABLE_WALK_SLICE_END
+
+	if(hash_pos < chan_reg_table.size)
+		return 1;
+
+	hash_pos = 0;
+	return 0;
+}
+
+static void
+e_chanserv_enforcetopic(void *unused)
+{
+	/* topics are enforced automatically */
+	if(config_file.cenforcetopic_frequency == 0)
+		return;
+
+	eventTaskAdd("chanserv_enforcetopic", t_chanserv_enforcetopic, NULL);
 }
 
 static void
@@ -1001,14 +1364,12 @@ e_chanserv_partinhabit(void *unused)
 	struct channel *chptr;
 	struct chan_reg *chreg_p;
 	struct chmember *member_p;
-	dlink_node *ptr, *vptr;
-	int i;
+	dlink_node *vptr;
+	unsigned int i;
 	int found_opped = 0;
 
-	HASH_WALK(i, MAX_CHANNEL_TABLE, ptr, chan_reg_table)
+	HTABLE_WALK(i, chreg_p, &chan_reg_table)
 	{
-		chreg_p = ptr->data;
-
 		if((chreg_p->flags & (CS_FLAGS_INHABIT|CS_FLAGS_AUTOJOIN)) == 0)
 			continue;
 
@@ -1070,7 +1431,7 @@ e_chanserv_partinhabit(void *unused)
 			continue;
 		}
 	}
-	HASH_WALK_END
+	HTABLE_WALK_END
 }
 
 static int
@@ -1091,7 +1452,7 @@ h_chanserv_sjoin_lowerts(void *v_chptr, void *unused)
 		chreg_p->flags & CS_FLAGS_AUTOJOIN)
 	{
 		chreg_p->tsinfo = chptr->tsinfo;
-		chreg_p->flags |= CS_FLAGS_NEEDUPDATE;
+		mark_chan_reg_update(chreg_p);
 	}
 
 	if(!chreg_p->emode.mode || 
@@ -1327,6 +1688,222 @@ h_chanserv_mode_ban(void *v_chptr, void *v_list)
 }
 
 
+static void
+free_ban_index_list(dlink_list *list)
+{
+	dlink_node *ptr, *next_ptr;
+
+	DLINK_FOREACH_SAFE(ptr, next_ptr, list->head)
+	{
+		dlink_destroy(ptr, list);
+	}
+}
+
+static void
+free_ban_index_node(struct ban_index_node *node)
+{
+	struct ban_index_node *child, *next_child;
+
+	for(child = node->child; child != NULL; child = next_child)
+	{
+		next_child = child->sibling;
+		free_ban_index_node(child);
+		my_free(child);
+	}
+
+	free_ban_index_list(&node->suffix);
+	free_ban_index_list(&node->exact);
+}
+
+/* clear_ban_index()
+ *   throws away a channels ban index, called whenever a ban is added or
+ *   removed.  Only the masks are indexed, so level/hold changes dont
+ *   need this.
+ */
+static void
+clear_ban_index(struct chan_reg *chreg_p)
+{
+	if(chreg_p->ban_index == NULL)
+		return;
+
+	free_ban_index_node(&chreg_p->ban_index->root);
+	free_ban_index_list(&chreg_p->ban_index->other);
+	my_free(chreg_p->ban_index);
+	chreg_p->ban_index = NULL;
+}
+
+static void
+add_ban_index(struct ban_index *index, struct ban_reg *banreg_p)
+{
+	struct ban_index_node *node, *child;
+	const char *host;
+	const char *p;
+	int wild = 0;
+
+	/* the host is only known if the mask has a single '@', to line up
+	 * with the one in the users mask
+	 */
+	if((host = strchr(banreg_p->mask, '@')) == NULL ||
+	   strchr(host + 1, '@') != NULL)
+	{
+		dlink_add_alloc(banreg_p, &index->other);
+		return;
+	}
+
+	host++;
+
+	if(*host == '*')
+	{
+		wild = 1;
+		host++;
+	}
+
+	if(strpbrk(host, "*?") != NULL)
+	{
+		dlink_add_alloc(banreg_p, &index->other);
+		return;
+	}
+
+	node = &index->root;
+
+	for(p = host + strlen(host) - 1; p >= host; p--)
+	{
+		for(child = node->child; child != NULL; child = child->sibling)
+		{
+			if(child->ch == ToLower(*p))
+				break;
+		}
+
+		if(child == NULL)
+		{
+			child = my_malloc(sizeof(struct ban_index_node));
+			child->ch = ToLower(*p);
+			child->sibling = node->child;
+			node->child = child;
+		}
+
+		node = child;
+	}
+
+	if(wild)
+		dlink_add_alloc(banreg_p, &node->suffix);
+	else
+		dlink_add_alloc(banreg_p, &node->exact);
+}
+
+static void
+build_ban_index(struct chan_reg *chreg_p)
+{
+	struct ban_reg *banreg_p;
+	dlink_node *ptr;
+	int position = 0;
+
+	chreg_p->ban_index = my_malloc(sizeof(struct ban_index));
+
+	DLINK_FOREACH(ptr, chreg_p->bans.head)
+	{
+		banreg_p = ptr->data;
+		banreg_p->position = position++;
+		add_ban_index(chreg_p->ban_index, banreg_p);
+	}
+}
+
+static int
+ban_applies(struct ban_reg *banreg_p, struct client *target_p,
+		struct member_reg *mreg_p)
+{
+	/* ban has expired? */
+	if(banreg_p->hold && banreg_p->hold <= CURRENT_TIME)
+		return 0;
+
+	if(mreg_p && mreg_p->level >= banreg_p->level)
+		return 0;
+
+	return match(banreg_p->mask, target_p->user->mask);
+}
+
+/* find_ban_list()
+ *   finds the earliest ban on a list of ban index candidates that applies
+ */
+static struct ban_reg *
+find_ban_list(dlink_list *list, struct ban_reg *found,
+		struct client *target_p, struct member_reg *mreg_p)
+{
+	struct ban_reg *banreg_p;
+	dlink_node *ptr;
+
+	DLINK_FOREACH(ptr, list->head)
+	{
+		banreg_p = ptr->data;
+
+		if(found && found->position <= banreg_p->position)
+			continue;
+
+		if(ban_applies(banreg_p, target_p, mreg_p))
+			found = banreg_p;
+	}
+
+	return found;
+}
+
+/* find_join_ban()
+ *   finds the ban that applies to a user joining a registered channel
+ *
+ * inputs	- channel reg, user, their access (if not suspended)
+ * outputs	- the first ban in the channels list that applies, or NULL
+ */
+static struct ban_reg *
+find_join_ban(struct chan_reg *chreg_p, struct client *target_p,
+		struct member_reg *mreg_p)
+{
+	struct ban_index_node *node;
+	struct ban_reg *found;
+	const char *host;
+	const char *p;
+	dlink_node *ptr;
+
+	if(dlink_list_length(&chreg_p->bans) < BAN_INDEX_MIN)
+	{
+		DLINK_FOREACH(ptr, chreg_p->bans.head)
+		{
+			if(ban_applies(ptr->data, target_p, mreg_p))
+				return ptr->data;
+		}
+
+		return NULL;
+	}
+
+	if(chreg_p->ban_index == NULL)
+		build_ban_index(chreg_p);
+
+	found = find_ban_list(&chreg_p->ban_index->other, NULL, target_p, mreg_p);
+
+	node = &chreg_p->ban_index->root;
+	host = target_p->user->host;
+
+	for(p = host + strlen(host) - 1; ; p--)
+	{
+		found = find_ban_list(&node->suffix, found, target_p, mreg_p);
+
+		if(p < host)
+		{
+			found = find_ban_list(&node->exact, found, target_p, mreg_p);
+			break;
+		}
+
+		for(node = node->child; node != NULL; node = node->sibling)
+		{
+			if(node->ch == ToLower(*p))
+				break;
+		}
+
+		if(node == NULL)
+			break;
+	}
+
+	return found;
+}
+
 static int
 h_chanserv_join(void *v_chptr, void *v_members)
 {
@@ -1337,7 +1914,6 @@ h_chanserv_join(void *v_chptr, void *v_members)
 	struct chmember *member_p;
 	dlink_list *members = v_members;
 	dlink_node *ptr, *next_ptr;
-	dlink_node *bptr;
 	int hit;
 
 	/* another hook couldve altered this.. */
@@ -1371,23 +1947,9 @@ h_chanserv_join(void *v_chptr, void *v_members)
 		if(mreg_p != NULL && mreg_p->suspend)
 			mreg_p = NULL;
 
-		DLINK_FOREACH(bptr, chreg_p->bans.head)
+		if((banreg_p = find_join_ban(chreg_p, member_p->client_p, mreg_p)) != NULL &&
+		   !find_exempt(member_p->chptr, member_p->client_p))
 		{
-			banreg_p = bptr->data;
-
-			/* ban has expired? */
-			if(banreg_p->hold && banreg_p->hold <= CURRENT_TIME)
-				continue;
-
-			if(!match(banreg_p->mask, member_p->client_p->user->mask))
-				continue;
-
-			if(mreg_p && mreg_p->level >= banreg_p->level)
-				continue;
-
-			if(find_exempt(member_p->chptr, member_p->client_p))
-				break;
-
 			/* explained in delban */
 			if(mreg_p)
 				mreg_p->bants = chreg_p->bants;
@@ -1415,20 +1977,14 @@ h_chanserv_join(void *v_chptr, void *v_members)
 
 			dlink_destroy(ptr, members);
 			del_chmember(member_p);
-			hit++;
-			break;
-		}
-
-		if(hit)
 			continue;
-		else
-			hit = 0;
+		}
 
 		if(mreg_p != NULL)
 		{
 			/* update last_time whenever a user with access joins */
 			mreg_p->channel_reg->last_time = CURRENT_TIME;
-			mreg_p->channel_reg->flags |= CS_FLAGS_NEEDUPDATE;
+			mark_chan_reg_update(mreg_p->channel_reg);
 		}
 
 		if(is_opped(member_p))
@@ -1538,7 +2094,7 @@ h_chanserv_user_login(void *v_client_p, void *unused)
 
 		/* channel is being used */
 		mreg_p->channel_reg->last_time = CURRENT_TIME;
-		mreg_p->channel_reg->flags |= CS_FLAGS_NEEDUPDATE;
+		mark_chan_reg_update(mreg_p->channel_reg);
 
 		/* autoop/voice dont work on +o users */
 		if(is_opped(member_p))
@@ -1637,9 +2193,9 @@ static void
 expire_chan_suspend(struct chan_reg *chreg_p)
 {
 	chreg_p->flags &= ~CS_FLAGS_SUSPENDED;
-	my_free(chreg_p->suspender);
+	intern_release(chreg_p->suspender);
 	chreg_p->suspender = NULL;
-	my_free(chreg_p->suspend_reason);
+	intern_release(chreg_p->suspend_reason);
 	chreg_p->suspend_reason = NULL;
 	chreg_p->suspend_time = 0;
 	chreg_p->last_time = CURRENT_TIME;
@@ -1751,8 +2307,8 @@ o_chan_chansuspend(struct client *client_p, struct lconn *conn_p, const char *pa
 		"CHANSUSPEND %s %s", reg_p->name, reason);
 
 	reg_p->flags |= CS_FLAGS_SUSPENDED;
-	reg_p->suspender = my_strdup(OPER_NAME(client_p, conn_p));
-	reg_p->suspend_reason = my_strndup(reason, SUSPENDREASONLEN);
+	reg_p->suspender = intern_string(OPER_NAME(client_p, conn_p));
+	reg_p->suspend_reason = intern_stringn(reason, SUSPENDREASONLEN);
 	reg_p->last_time = CURRENT_TIME;
 
 	if(suspend_time)
@@ -1792,9 +2348,9 @@ o_chan_chanunsuspend(struct client *client_p, struct lconn *conn_p, const char *
 		"CHANUNSUSPEND %s", reg_p->name);
 
 	reg_p->flags &= ~CS_FLAGS_SUSPENDED;
-	my_free(reg_p->suspender);
+	intern_release(reg_p->suspender);
 	reg_p->suspender = NULL;
-	my_free(reg_p->suspend_reason);
+	intern_release(reg_p->suspend_reason);
 	reg_p->suspend_reason = NULL;
 	reg_p->last_time = CURRENT_TIME;
 
@@ -1815,11 +2371,10 @@ o_chan_chanlist(struct client *client_p, struct lconn *conn_p, const char *parv[
 	static char buf[BUFSIZE];
 	struct chan_reg *chreg_p;
 	const char *mask = def_mask;
-	dlink_node *ptr;
 	unsigned int limit = 100;
+	unsigned int i;
 	int para = 0;
 	int longlist = 0, suspended = 0;
-	int i;
 	int buflen = 0;
 	int arglen;
 
@@ -1849,10 +2404,8 @@ o_chan_chanlist(struct client *client_p, struct lconn *conn_p, const char *parv[
 	service_snd(chanserv_p, client_p, conn_p, SVC_CHAN_LISTSTART,
 			mask, limit, suspended ? ", suspended" : "");
 
-	HASH_WALK(i, MAX_CHANNEL_TABLE, ptr, chan_reg_table)
+	HTABLE_WALK(i, chreg_p, &chan_reg_table)
 	{
-		chreg_p = ptr->data;
-
 		if(!match(mask, chreg_p->name))
 			continue;
 
@@ -1909,15 +2462,11 @@ o_chan_chanlist(struct client *client_p, struct lconn *conn_p, const char *parv[
 		}
 
 		if(limit == 1)
-		{
-			/* two loops to exit here, kludge it */
-			i = MAX_CHANNEL_TABLE;
 			break;
-		}
 
 		limit--;
 	}
-	HASH_WALK_END
+	HTABLE_WALK_END
 
 	if(!longlist)
 		service_send(chanserv_p, client_p, conn_p, "  %s", buf);
@@ -2368,8 +2917,8 @@ s_chan_moduser(struct client *client_p, struct lconn *conn_p, const char *parv[]
 		parv[0], mreg_tp->user_reg->name, level);
 
 	mreg_tp->level = level;
-	my_free(mreg_tp->lastmod);
-	mreg_tp->lastmod = my_strdup(mreg_p->user_reg->name);
+	intern_release(mreg_tp->lastmod);
+	mreg_tp->lastmod = intern_string(mreg_p->user_reg->name);
 
 	service_err(chanserv_p, client_p, SVC_CHAN_USERSETACCESS,
 			mreg_tp->user_reg->name, level, mreg_tp->channel_reg->name);
@@ -2434,8 +2983,8 @@ s_chan_modauto(struct client *client_p, struct lconn *conn_p, const char *parv[]
 		"MODAUTO %s %s %s",
 		parv[0], mreg_tp->user_reg->name, parv[2]);
 
-	my_free(mreg_tp->lastmod);
-	mreg_tp->lastmod = my_strdup(mreg_p->user_reg->name);
+	intern_release(mreg_tp->lastmod);
+	mreg_tp->lastmod = intern_string(mreg_p->user_reg->name);
 
 	service_err(chanserv_p, client_p, SVC_CHAN_USERSETAUTOLEVEL,
 			mreg_tp->user_reg->name, parv[2], mreg_tp->channel_reg->name);
@@ -2516,8 +3065,8 @@ s_chan_suspend(struct client *client_p, struct lconn *conn_p, const char *parv[]
 		parv[0], mreg_tp->user_reg->name, level);
 
 	mreg_tp->suspend = level;
-	my_free(mreg_tp->lastmod);
-	mreg_tp->lastmod = my_strdup(mreg_p->user_reg->name);
+	intern_release(mreg_tp->lastmod);
+	mreg_tp->lastmod = intern_string(mreg_p->user_reg->name);
 
 	service_err(chanserv_p, client_p, SVC_CHAN_USERSETSUSPEND,
 			mreg_tp->user_reg->name, level, mreg_tp->channel_reg->name);
@@ -2565,8 +3114,8 @@ s_chan_unsuspend(struct client *client_p, struct lconn *conn_p, const char *parv
 		parv[0], mreg_tp->user_reg->name);
 
 	mreg_tp->suspend = 0;
-	my_free(mreg_tp->lastmod);
-	mreg_tp->lastmod = my_strdup(mreg_p->user_reg->name);
+	intern_release(mreg_tp->lastmod);
+	mreg_tp->lastmod = intern_string(mreg_p->user_reg->name);
 
 	service_err(chanserv_p, client_p, SVC_CHAN_USERSUSPENDREMOVED,
 			 mreg_tp->user_reg->name, mreg_tp->channel_reg->name);
@@ -2894,7 +3443,7 @@ s_chan_set(struct client *client_p, struct lconn *conn_p, const char *parv[], in
 
 			if(chptr != NULL && chptr->tsinfo != chreg_p->tsinfo)
 			{
-				chreg_p->flags |= CS_FLAGS_NEEDUPDATE;
+				mark_chan_reg_update(chreg_p);
 				chreg_p->tsinfo = chptr->tsinfo;
 			}
 
@@ -3600,8 +4149,8 @@ s_chan_modban(struct client *client_p, struct lconn *conn_p, const char *parv[],
 	}
 
 	banreg_p->level = level;
-	my_free(banreg_p->username);
-	banreg_p->username = my_strdup(mreg_p->user_reg->name);
+	intern_release(banreg_p->username);
+	banreg_p->username = intern_string(mreg_p->user_reg->name);
 
 	service_err(chanserv_p, client_p, SVC_CHAN_BANSET,
 			parv[1], level, mreg_p->channel_reg->name);
@@ -3754,15 +4303,15 @@ dump_info_accesslist(struct client *client_p, struct lconn *conn_p,
 			struct chan_reg *chreg_p)
 {
 	struct member_reg *mreg_p;
-	dlink_node *ptr;
+	unsigned int i;
 	char buf[30];
 
 	service_snd(chanserv_p, client_p, conn_p, SVC_INFO_ACCESSLIST,
 			chreg_p->name, "");
 
-	DLINK_FOREACH(ptr, chreg_p->users.head)
+	for(i = 0; i < chreg_p->users.count; i++)
 	{
-		mreg_p = ptr->data;
+		mreg_p = chreg_p->users.entry[i];
 		snprintf(buf, sizeof(buf), "(susp %d) ", mreg_p->suspend);
 
 		service_send(chanserv_p, client_p, conn_p, 
@@ -3829,13 +4378,11 @@ s_chanserv_countmem(size_t *sz_chan_reg_name, size_t *sz_chan_reg_topic,
 {
 	struct chan_reg *chreg_p;
 	struct ban_reg *banreg_p;
-	dlink_node *ptr, *vptr;
-	int i;
+	dlink_node *vptr;
+	unsigned int i;
 
-	HASH_WALK(i, MAX_CHANNEL_TABLE, ptr, chan_reg_table)
+	HTABLE_WALK(i, chreg_p, &chan_reg_table)
 	{
-		chreg_p = ptr->data;
-
 		if(!EmptyString(chreg_p->name))
 			*sz_chan_reg_name += strlen(chreg_p->name) + 1;
 
@@ -3865,6 +4412,6 @@ s_chanserv_countmem(size_t *sz_chan_reg_name, size_t *sz_chan_reg_topic,
 				*sz_ban_reg_username += strlen(banreg_p->username) + 1;
 		}
 	}
-	HASH_WALK_END
+	HTABLE_WALK_END
 }
 
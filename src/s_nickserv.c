@@ -48,13 +48,16 @@
 #include "balloc.h"
 #include "hook.h"
 #include "watch.h"
+#include "htable.h"
 
 static void init_s_nickserv(void);
 
 static struct client *nickserv_p;
 static BlockHeap *nick_reg_heap;
 
-static dlink_list nick_reg_table[MAX_NAME_HASH];
+static struct htable nick_reg_table;
+
+static const char *nick_reg_key(void *);
 
 static int o_nick_nickdrop(struct client *, struct lconn *, const char **, int);
 
@@ -103,6 +106,7 @@ static void
 init_s_nickserv(void)
 {
 	nick_reg_heap = BlockHeapCreate("Nick Reg", sizeof(struct nick_reg), HEAP_NICK_REG);
+	htable_init(&nick_reg_table, "Nick Regs", NICK_REG_HASH_MIN, nick_reg_key, irccmp);
 
 	rsdb_exec(nick_db_callback, 
 			"SELECT nickname, username, reg_time, last_time, flags FROM nicks");
@@ -112,22 +116,25 @@ init_s_nickserv(void)
 	hook_add(h_nick_server_eob, HOOK_SERVER_EOB);
 }
 
+static const char *
+nick_reg_key(void *data)
+{
+	return ((struct nick_reg *) data)->name;
+}
+
 static void
 add_nick_reg(struct nick_reg *nreg_p)
 {
-	unsigned int hashv = hash_name(nreg_p->name);
-	dlink_add(nreg_p, &nreg_p->node, &nick_reg_table[hashv]);
+	htable_add(&nick_reg_table, nreg_p);
 }
 
 void
 free_nick_reg(struct nick_reg *nreg_p)
 {
-	unsigned int hashv = hash_name(nreg_p->name);
-
 	rsdb_exec(NULL, "DELETE FROM nicks WHERE nickname = '%Q'",
 			nreg_p->name);
 
-	dlink_delete(&nreg_p->node, &nick_reg_table[hashv]);
+	htable_del(&nick_reg_table, nreg_p);
 	dlink_delete(&nreg_p->usernode, &nreg_p->user_reg->nicks);
 	BlockHeapFree(nick_reg_heap, nreg_p);
 }
@@ -136,15 +143,9 @@ static struct nick_reg *
 find_nick_reg(struct client *client_p, const char *name)
 {
 	struct nick_reg *nreg_p;
-	dlink_node *ptr;
-	unsigned int hashv = hash_name(name);
 
-	DLINK_FOREACH(ptr, nick_reg_table[hashv].head)
-	{
-		nreg_p = ptr->data;
-		if(!irccmp(nreg_p->name, name))
-			return nreg_p;
-	}
+	if((nreg_p = htable_find(&nick_reg_table, name)) != NULL)
+		return nreg_p;
 
 	if(client_p)
 		service_err(nickserv_p, client_p, SVC_NICK_NOTREG, name);
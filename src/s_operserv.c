@@ -47,6 +47,7 @@
 #include "modebuild.h"
 #include "log.h"
 #include "watch.h"
+#include "snapshot.h"
 
 static void init_s_operserv(void);
 
@@ -414,6 +415,11 @@ o_oper_dbsync(struct client *client_p, struct lconn *conn_p, const char *parv[],
 {
 	hook_call(HOOK_DBSYNC, NULL, NULL);
 
+	/* dont report success until its actually on disk, this
+	 * commits everything before taking the snapshots
+	 */
+	snapshot_sync();
+
 	zlog(operserv_p, 2, WATCH_OPERSERV, 1, client_p, conn_p, "DBSYNC");
 
 	service_snd(operserv_p, client_p, conn_p, SVC_SUCCESSFUL,
@@ -474,6 +480,7 @@ o_oper_addignore(struct client *client_p, struct lconn *conn_p, const char *parv
 {
 	struct service_ignore *ignore_p;
 	dlink_node *ptr;
+	char *mask;
 
 	if(!valid_ban(parv[0]))
 	{
@@ -483,21 +490,21 @@ o_oper_addignore(struct client *client_p, struct lconn *conn_p, const char *parv
 
 	DLINK_FOREACH(ptr, ignore_list.head)
 	{
-		if(match(ptr->data, parv[0]))
+		ignore_p = ptr->data;
+
+		if(match(ignore_p->mask, parv[0]))
 		{
 			service_snd(operserv_p, client_p, conn_p, SVC_OPER_IGNOREALREADY,
-					parv[0], ptr->data);
+					parv[0], ignore_p->mask);
 			return 0;
 		}
 	}
 
-	ignore_p = my_malloc(sizeof(struct service_ignore));
-	ignore_p->mask = my_strdup(parv[0]);
-	collapse(ignore_p->mask);
-	ignore_p->reason = my_strdup(rebuild_params(parv, parc, 1));
-	ignore_p->oper = my_strdup(OPER_NAME(client_p, conn_p));
+	mask = LOCAL_COPY(parv[0]);
+	collapse(mask);
 
-	dlink_add(ignore_p, &ignore_p->ptr, &ignore_list);
+	ignore_p = add_ignore(mask, OPER_NAME(client_p, conn_p),
+				rebuild_params(parv, parc, 1));
 
 	rsdb_exec(NULL, "INSERT INTO ignore_hosts (hostname, oper, reason) VALUES('%Q', '%Q', '%Q')",
 			ignore_p->mask, ignore_p->oper, ignore_p->reason);
@@ -519,12 +526,7 @@ o_oper_delignore(struct client *client_p, struct lconn *conn_p, const char *parv
 
 		if(!irccmp(ignore_p->mask, parv[0]))
 		{
-			dlink_delete(&ignore_p->ptr, &ignore_list);
-
-			my_free(ignore_p->mask);
-			my_free(ignore_p->oper);
-			my_free(ignore_p->reason);
-			my_free(ignore_p);
+			del_ignore(ignore_p);
 
 			rsdb_exec(NULL, "DELETE FROM ignore_hosts WHERE hostname='%Q'", parv[0]);
 
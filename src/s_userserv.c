@@ -41,8 +41,8 @@
 #include "channel.h"
 #include "c_init.h"
 #include "log.h"
-#include "s_chanserv.h"
 #include "s_userserv.h"
+#include "s_chanserv.h"
 #include "s_nickserv.h"
 #include "ucommand.h"
 #include "balloc.h"
@@ -53,15 +53,21 @@
 #include "email.h"
 #include "dbhook.h"
 #include "watch.h"
-
-#define MAX_HASH_WALK	1024
+#include "snapshot.h"
+#include "intern.h"
+#include "htable.h"
 
 static void init_s_userserv(void);
 
 static struct client *userserv_p;
 static BlockHeap *user_reg_heap;
 
-dlink_list user_reg_table[MAX_NAME_HASH];
+static struct htable user_reg_table;
+
+static const char *user_reg_key(void *);
+
+/* registrations with US_FLAGS_NEEDUPDATE set */
+static dlink_list user_reg_update_list;
 
 static int o_user_userregister(struct client *, struct lconn *, const char **, int);
 static int o_user_userdrop(struct client *, struct lconn *, const char **, int);
@@ -126,6 +132,8 @@ static int dbh_user_setpass(struct rsdb_hook *, const char *data);
 static int dbh_user_setemail(struct rsdb_hook *, const char *data);
 static int h_user_burst_login(void *, void *);
 static int h_user_dbsync(void *, void *);
+static int h_user_snapshot(void *, void *);
+static int load_user_snapshot(void);
 static void e_user_expire(void *unused);
 static void e_user_expire_reset(void *unused);
 
@@ -145,8 +153,10 @@ static void
 init_s_userserv(void)
 {
 	user_reg_heap = BlockHeapCreate("User Reg", sizeof(struct user_reg), HEAP_USER_REG);
+	htable_init(&user_reg_table, "User Regs", USER_REG_HASH_MIN, user_reg_key, strcasecmp);
 
-	rsdb_exec(user_db_callback, 
+	if(!load_user_snapshot())
+		rsdb_exec(user_db_callback, 
 			"SELECT username, password, email, suspender, suspend_reason, "
 			"suspend_time, reg_time, last_time, flags, language, id FROM users");
 
@@ -156,25 +166,33 @@ init_s_userserv(void)
 
 	hook_add(h_user_burst_login, HOOK_BURST_LOGIN);
 	hook_add(h_user_dbsync, HOOK_DBSYNC);
+	hook_add(h_user_snapshot, HOOK_DBSNAPSHOT);
 
 	eventAdd("userserv_expire", e_user_expire, NULL, 900);
 	eventAdd("userserv_expire_reset", e_user_expire_reset, NULL, 3600);
 }
 
+static const char *
+user_reg_key(void *data)
+{
+	return ((struct user_reg *) data)->name;
+}
+
 static void
 add_user_reg(struct user_reg *reg_p)
 {
-	unsigned int hashv = hash_name(reg_p->name);
-	dlink_add(reg_p, &reg_p->node, &user_reg_table[hashv]);
+	htable_add(&user_reg_table, reg_p);
 }
 
 static void
 free_user_reg(struct user_reg *ureg_p)
 {
 	dlink_node *ptr, *next_ptr;
-	unsigned int hashv = hash_name(ureg_p->name);
 
-	dlink_delete(&ureg_p->node, &user_reg_table[hashv]);
+	htable_del(&user_reg_table, ureg_p);
+
+	if(ureg_p->flags & US_FLAGS_NEEDUPDATE)
+		dlink_delete(&ureg_p->update_node, &user_reg_update_list);
 
 	rsdb_exec(NULL, "DELETE FROM users_resetpass WHERE username = '%Q'",
 			ureg_p->name);
@@ -184,10 +202,8 @@ free_user_reg(struct user_reg *ureg_p)
 			ureg_p->name);
 
 #ifdef ENABLE_CHANSERV
-	DLINK_FOREACH_SAFE(ptr, next_ptr, ureg_p->channels.head)
-	{
-		free_member_reg(ptr->data, 1);
-	}
+	while(ureg_p->channels.count)
+		free_member_reg(ureg_p->channels.entry[ureg_p->channels.count - 1], 1);
 #endif
 
 #ifdef ENABLE_NICKSERV
@@ -201,9 +217,10 @@ free_user_reg(struct user_reg *ureg_p)
 			ureg_p->name);
 
 	my_free(ureg_p->password);
-	my_free(ureg_p->email);
-	my_free(ureg_p->suspender);
-	my_free(ureg_p->suspend_reason);
+	intern_release(ureg_p->email);
+	intern_release(ureg_p->suspender);
+	intern_release(ureg_p->suspend_reason);
+	my_free(ureg_p->channels.entry);
 	BlockHeapFree(user_reg_heap, ureg_p);
 }
 
@@ -230,20 +247,20 @@ user_db_callback(int argc, const char **argv)
 	reg_p->password = my_strdup(argv[1]);
 
 	if(!EmptyString(argv[2]))
-		reg_p->email = my_strdup(argv[2]);
+		reg_p->email = intern_string(argv[2]);
 
 	if(!EmptyString(argv[3]))
-		reg_p->suspender = my_strdup(argv[3]);
+		reg_p->suspender = intern_string(argv[3]);
 
 	if(!EmptyString(argv[4]))
-		reg_p->suspend_reason = my_strdup(argv[4]);
+		reg_p->suspend_reason = intern_string(argv[4]);
 
 	if(!EmptyString(argv[5]))
 		reg_p->suspend_time = atol(argv[5]);
 
 	reg_p->reg_time = atol(argv[6]);
 	reg_p->last_time = atol(argv[7]);
-	reg_p->flags = atoi(argv[8]);
+	reg_p->flags = atoi(argv[8]) & ~US_FLAGS_NEEDUPDATE;
 
 	/* entries may not have a language */
 	if(!EmptyString(argv[9]))
@@ -256,21 +273,127 @@ user_db_callback(int argc, const char **argv)
 	return 0;
 }
 
-struct user_reg *
-find_user_reg(struct client *client_p, const char *username)
+#define USER_SNAPSHOT_VERSION	1
+
+/* a user_reg as stored in the snapshot, strings are offsets */
+struct user_snapshot
+{
+	unsigned int id;
+	unsigned int name;
+	unsigned int password;
+	unsigned int email;
+	unsigned int suspender;
+	unsigned int suspend_reason;
+	unsigned int language;
+	int flags;
+	time_t suspend_time;
+	time_t reg_time;
+	time_t last_time;
+};
+
+static int
+h_user_snapshot(void *counter, void *unused)
 {
+	struct user_snapshot record;
+	struct snapshot *snap;
+	struct user_reg *ureg_p;
+	unsigned int i;
+
+	snap = snapshot_create(USER_SNAPSHOT_PATH, USER_SNAPSHOT_VERSION,
+				*(unsigned long *) counter);
+
+	HTABLE_WALK(i, ureg_p, &user_reg_table)
+	{
+		memset(&record, 0, sizeof(record));
+		record.id = ureg_p->id;
+		record.name = snapshot_string(snap, ureg_p->name);
+		record.password = snapshot_string(snap, ureg_p->password);
+		record.email = snapshot_string(snap, ureg_p->email);
+		record.suspender = snapshot_string(snap, ureg_p->suspender);
+		record.suspend_reason = snapshot_string(snap, ureg_p->suspend_reason);
+		record.language = snapshot_string(snap, langs_available[ureg_p->language]);
+		record.flags = ureg_p->flags;
+		record.suspend_time = ureg_p->suspend_time;
+		record.reg_time = ureg_p->reg_time;
+		record.last_time = ureg_p->last_time;
+
+		snapshot_add(snap, 0, &record, sizeof(record));
+	}
+	HTABLE_WALK_END
+
+	snapshot_commit(snap);
+	return 0;
+}
+
+/* load_user_snapshot()
+ * loads the registrations from the snapshot, if it's current.  This
+ * must mirror user_db_callback()
+ */
+static int
+load_user_snapshot(void)
+{
+	struct snapshot_map map;
+	const struct user_snapshot *record;
 	struct user_reg *reg_p;
-	unsigned int hashv = hash_name(username);
-	dlink_node *ptr;
+	const char *name;
+	const char *password;
+	const char *language;
+	unsigned int count, i;
+
+	if(!snapshot_open(&map, USER_SNAPSHOT_PATH, USER_SNAPSHOT_VERSION))
+		return 0;
+
+	if((record = snapshot_records(&map, 0, sizeof(struct user_snapshot), &count)) == NULL)
+	{
+		snapshot_close(&map);
+		return 0;
+	}
 
-	DLINK_FOREACH(ptr, user_reg_table[hashv].head)
+	for(i = 0; i < count; i++, record++)
 	{
-		reg_p = ptr->data;
+		name = snapshot_get_string(&map, record->name);
+
+		if(EmptyString(name) || strlen(name) > USERREGNAME_LEN)
+			continue;
+
+		reg_p = BlockHeapAlloc(user_reg_heap);
+		strlcpy(reg_p->name, name, sizeof(reg_p->name));
+
+		password = snapshot_get_string(&map, record->password);
+		reg_p->password = my_strdup(password ? password : "");
 
-		if(!strcasecmp(reg_p->name, username))
-			return reg_p;
+		reg_p->email = snapshot_intern(&map, record->email);
+		reg_p->suspender = snapshot_intern(&map, record->suspender);
+		reg_p->suspend_reason = snapshot_intern(&map, record->suspend_reason);
+		reg_p->suspend_time = record->suspend_time;
+		reg_p->reg_time = record->reg_time;
+		reg_p->last_time = record->last_time;
+		reg_p->flags = record->flags & ~US_FLAGS_NEEDUPDATE;
+
+		language = snapshot_get_string(&map, record->language);
+
+		if(!EmptyString(language))
+			reg_p->language = lang_get_langcode(language);
+
+		reg_p->id = record->id;
+
+		add_user_reg(reg_p);
 	}
 
+	mlog("Loaded %u user registrations from snapshot", count);
+
+	snapshot_close(&map);
+	return 1;
+}
+
+struct user_reg *
+find_user_reg(struct client *client_p, const char *username)
+{
+	struct user_reg *reg_p;
+
+	if((reg_p = htable_find(&user_reg_table, username)) != NULL)
+		return reg_p;
+
 	if(client_p != NULL)
 		service_err(userserv_p, client_p, SVC_USER_NOTREG, username);
 
@@ -333,7 +456,7 @@ logout_user_reg(struct user_reg *ureg_p)
 		sendto_server(":%s ENCAP * SU %s", MYUID, UID(target_p));
 
 		target_p->user->user_reg = NULL;
-		dlink_destroy(ptr, &ureg_p->users);
+		dlink_delete(ptr, &ureg_p->users);
 	}
 }
 
@@ -383,7 +506,7 @@ dbh_user_register(struct rsdb_hook *dbh, const char *c_data)
 	ureg_p->password = my_strdup(argv[1]);
 
 	if(!EmptyString(argv[2]))
-		ureg_p->email = my_strdup(argv[2]);
+		ureg_p->email = intern_string(argv[2]);
 
 	ureg_p->reg_time = ureg_p->last_time = CURRENT_TIME;
 
@@ -440,8 +563,8 @@ dbh_user_setemail(struct rsdb_hook *dbh, const char *c_data)
 	if((ureg_p = find_user_reg(NULL, argv[0])) == NULL)
 		return 1;
 
-	my_free(ureg_p->email);
-	ureg_p->email = my_strdup(argv[1]);
+	intern_release(ureg_p->email);
+	ureg_p->email = intern_string(argv[1]);
 
 	rsdb_hook_schedule(NULL, NULL, "UPDATE users SET email='%Q' WHERE username='%Q'",
 			ureg_p->email, ureg_p->name);
@@ -469,7 +592,10 @@ h_user_burst_login(void *v_client_p, void *v_username)
 
 	/* already logged in.. hmm, this shouldnt really happen */
 	if(client_p->user->user_reg)
-		dlink_find_destroy(client_p, &client_p->user->user_reg->users);
+	{
+		dlink_delete(&client_p->user->regptr, &client_p->user->user_reg->users);
+		client_p->user->user_reg = NULL;
+	}
 
 	/* username is suspended, ignore it and log them out */
 	if(ureg_p->flags & US_FLAGS_SUSPENDED)
@@ -479,44 +605,74 @@ h_user_burst_login(void *v_client_p, void *v_username)
 	}
 
 	client_p->user->user_reg = ureg_p;
-	dlink_add_alloc(client_p, &ureg_p->users);
+	dlink_add(client_p, &client_p->user->regptr, &ureg_p->users);
 
 	ureg_p->last_time = CURRENT_TIME;
-	ureg_p->flags |= US_FLAGS_NEEDUPDATE;
+	mark_user_reg_update(ureg_p);
 
 	return 0;
 }
 
-static int
-h_user_dbsync(void *unused, void *unusedd)
+/* mark_user_reg_update()
+ * queues a registration to have its last_time written out
+ */
+void
+mark_user_reg_update(struct user_reg *ureg_p)
+{
+	if(ureg_p->flags & US_FLAGS_NEEDUPDATE)
+		return;
+
+	ureg_p->flags |= US_FLAGS_NEEDUPDATE;
+	dlink_add(ureg_p, &ureg_p->update_node, &user_reg_update_list);
+}
+
+/* flush_user_reg_updates()
+ * writes out every registration queued by mark_user_reg_update()
+ */
+static void
+flush_user_reg_updates(void)
 {
 	struct user_reg *ureg_p;
-	dlink_node *ptr;
-	int i;
+	dlink_node *ptr, *next_ptr;
+
+	if(!dlink_list_length(&user_reg_update_list))
+		return;
 
 	rsdb_transaction(RSDB_TRANS_START);
 
-	HASH_WALK(i, MAX_NAME_HASH, ptr, user_reg_table)
+	DLINK_FOREACH_SAFE(ptr, next_ptr, user_reg_update_list.head)
 	{
 		ureg_p = ptr->data;
 
-		/* if they're logged in, reset the expiry */
-		if(dlink_list_length(&ureg_p->users))
-		{
-			ureg_p->last_time = CURRENT_TIME;
-			ureg_p->flags |= US_FLAGS_NEEDUPDATE;
-		}
+		ureg_p->flags &= ~US_FLAGS_NEEDUPDATE;
+		dlink_delete(&ureg_p->update_node, &user_reg_update_list);
+
+		rsdb_exec_prepared(NULL, "UPDATE users SET last_time=? WHERE username=?",
+				"us", ureg_p->last_time, ureg_p->name);
+	}
+
+	rsdb_transaction(RSDB_TRANS_END);
+}
+
+static int
+h_user_dbsync(void *unused, void *unusedd)
+{
+	struct client *target_p;
+	dlink_node *ptr;
 
-		if(ureg_p->flags & US_FLAGS_NEEDUPDATE)
+	/* if they're logged in, reset the expiry */
+	DLINK_FOREACH(ptr, user_list.head)
+	{
+		target_p = ptr->data;
+
+		if(target_p->user->user_reg)
 		{
-			ureg_p->flags &= ~US_FLAGS_NEEDUPDATE;
-			rsdb_exec(NULL, "UPDATE users SET last_time='%lu' WHERE username='%Q'",
-					ureg_p->last_time, ureg_p->name);
+			target_p->user->user_reg->last_time = CURRENT_TIME;
+			mark_user_reg_update(target_p->user->user_reg);
 		}
 	}
-	HASH_WALK_END
 
-	rsdb_transaction(RSDB_TRANS_END);
+	flush_user_reg_updates();
 
 	return 0;
 }
@@ -541,21 +697,17 @@ expire_bonus(time_t duration)
 	return bonus;
 }
 
-static void
-e_user_expire(void *unused)
+static int
+t_user_expire(void *unused)
 {
-	static int hash_pos = 0;
+	static unsigned int hash_pos = 0;
 	struct user_reg *ureg_p;
-	dlink_node *ptr, *next_ptr;
-	int i;
 
 	/* Start a transaction, we're going to make a lot of changes */
 	rsdb_transaction(RSDB_TRANS_START);
 
-	HASH_WALK_SAFE_POS(i, hash_pos, MAX_HASH_WALK, MAX_NAME_HASH, ptr, next_ptr, user_reg_table)
+	HTABLE_WALK_SLICE(hash_pos, ureg_p, &user_reg_table)
 	{
-		ureg_p = ptr->data;
-
 		/* nuke unverified accounts first */
 		if(ureg_p->flags & US_FLAGS_NEVERLOGGEDIN &&
 		   (ureg_p->reg_time + config_file.uexpire_unverified_time) <= CURRENT_TIME)
@@ -568,14 +720,7 @@ e_user_expire(void *unused)
 		if(dlink_list_length(&ureg_p->users))
 		{
 			ureg_p->last_time = CURRENT_TIME;
-			ureg_p->flags |= US_FLAGS_NEEDUPDATE;
-		}
-
-		if(ureg_p->flags & US_FLAGS_NEEDUPDATE)
-		{
-			ureg_p->flags &= ~US_FLAGS_NEEDUPDATE;
-			rsdb_exec(NULL, "UPDATE users SET last_time='%lu' WHERE username='%Q'",
-				ureg_p->last_time, ureg_p->name);
+			mark_user_reg_update(ureg_p);
 		}
 
 		if(ureg_p->flags & US_FLAGS_SUSPENDED)
@@ -594,9 +739,23 @@ e_user_expire(void *unused)
 
 		free_user_reg(ureg_p);
 	}
-	HASH_WALK_SAFE_POS_END(i, hash_pos, MAX_NAME_HASH);
+	HTABLE_WALK_SLICE_END
 
 	rsdb_transaction(RSDB_TRANS_END);
+
+	flush_user_reg_updates();
+
+	if(hash_pos < user_reg_table.size)
+		return 1;
+
+	hash_pos = 0;
+	return 0;
+}
+
+static void
+e_user_expire(void *unused)
+{
+	eventTaskAdd("userserv_expire", t_user_expire, NULL);
 }
 
 static void
@@ -612,9 +771,9 @@ static void
 expire_user_suspend(struct user_reg *ureg_p)
 {
 	ureg_p->flags &= ~US_FLAGS_SUSPENDED;
-	my_free(ureg_p->suspender);
+	intern_release(ureg_p->suspender);
 	ureg_p->suspender = NULL;
-	my_free(ureg_p->suspend_reason);
+	intern_release(ureg_p->suspend_reason);
 	ureg_p->suspend_reason = NULL;
 	ureg_p->suspend_time = 0;
 	ureg_p->last_time = CURRENT_TIME;
@@ -661,7 +820,7 @@ o_user_userregister(struct client *client_p, struct lconn *conn_p, const char *p
 	if(!EmptyString(parv[2]))
 	{
 		if(valid_email(parv[2]))
-			reg_p->email = my_strdup(parv[2]);
+			reg_p->email = intern_string(parv[2]);
 		else
 			service_snd(userserv_p, client_p, conn_p, SVC_EMAIL_INVALIDIGNORED, parv[2]);
 	}
@@ -758,8 +917,8 @@ o_user_usersuspend(struct client *client_p, struct lconn *conn_p, const char *pa
 	else
 		reg_p->suspend_time = 0;
 
-	reg_p->suspender = my_strdup(OPER_NAME(client_p, conn_p));
-	reg_p->suspend_reason = my_strndup(reason, SUSPENDREASONLEN);
+	reg_p->suspender = intern_string(OPER_NAME(client_p, conn_p));
+	reg_p->suspend_reason = intern_stringn(reason, SUSPENDREASONLEN);
 
 	rsdb_exec(NULL, "UPDATE users SET flags='%d', suspender='%Q', "
 			"suspend_reason='%Q',last_time='%lu', suspend_time='%lu' WHERE username='%Q'",
@@ -793,9 +952,9 @@ o_user_userunsuspend(struct client *client_p, struct lconn *conn_p, const char *
 		"USERUNSUSPEND %s", reg_p->name);
 
 	reg_p->flags &= ~US_FLAGS_SUSPENDED;
-	my_free(reg_p->suspender);
+	intern_release(reg_p->suspender);
 	reg_p->suspender = NULL;
-	my_free(reg_p->suspend_reason);
+	intern_release(reg_p->suspend_reason);
 	reg_p->suspend_reason = NULL;
 	reg_p->suspend_time = 0;
 	reg_p->last_time = CURRENT_TIME;
@@ -817,11 +976,10 @@ o_user_userlist(struct client *client_p, struct lconn *conn_p, const char *parv[
 	static char buf[BUFSIZE];
 	struct user_reg *ureg_p;
 	const char *mask = def_mask;
-	dlink_node *ptr;
 	unsigned int limit = 100;
+	unsigned int i;
 	int para = 0;
 	int longlist = 0, suspended = 0;
-	int i;
 	int buflen = 0;
 	int arglen;
 
@@ -851,10 +1009,8 @@ o_user_userlist(struct client *client_p, struct lconn *conn_p, const char *parv[
 	service_snd(userserv_p, client_p, conn_p, SVC_USER_UL_START,
 			mask, limit, suspended ? ", suspended" : "");
 
-	HASH_WALK(i, MAX_NAME_HASH, ptr, user_reg_table)
+	HTABLE_WALK(i, ureg_p, &user_reg_table)
 	{
-		ureg_p = ptr->data;
-
 		if(!match(mask, ureg_p->name))
 			continue;
 
@@ -916,15 +1072,11 @@ o_user_userlist(struct client *client_p, struct lconn *conn_p, const char *parv[
 		}
 
 		if(limit == 1)
-		{
-			/* two loops to exit here, kludge it */
-			i = MAX_NAME_HASH;
 			break;
-		}
 
 		limit--;
 	}
-	HASH_WALK_END
+	HTABLE_WALK_END
 
 	if(!longlist)
 		service_send(userserv_p, client_p, conn_p, "  %s", buf);
@@ -1035,8 +1187,8 @@ o_user_usersetemail(struct client *client_p, struct lconn *conn_p, const char *p
 	zlog(userserv_p, 1, WATCH_USADMIN, 1, client_p, conn_p,
 		"USERSETEMAIL %s", ureg_p->name);
 
-	my_free(ureg_p->email);
-	ureg_p->email = my_strdup(parv[1]);
+	intern_release(ureg_p->email);
+	ureg_p->email = intern_string(parv[1]);
 
 	rsdb_exec(NULL, "UPDATE users SET email='%Q' WHERE username='%Q'", 
 			parv[1], ureg_p->name);
@@ -1102,12 +1254,84 @@ valid_email_domain(const char *email)
 	return retval;
 }
 
+/* what s_user_register() needs once the password is hashed */
+struct user_register_req
+{
+	char name[USERREGNAME_LEN+1];
+	char *email;
+	char *token;
+};
+
+static void
+s_user_register_crypted(struct client *client_p, const char *password, void *arg)
+{
+	struct user_register_req *req = arg;
+	struct user_reg *reg_p;
+
+	if(client_p == NULL)
+		goto out;
+
+	/* someone else may have taken it whilst we were hashing */
+	if((reg_p = find_user_reg(NULL, req->name)) != NULL)
+	{
+		service_err(userserv_p, client_p, SVC_USER_ALREADYREG, req->name);
+		goto out;
+	}
+
+	reg_p = BlockHeapAlloc(user_reg_heap);
+	strcpy(reg_p->name, req->name);
+	reg_p->password = my_strdup(password);
+
+	if(!EmptyString(req->email))
+		reg_p->email = intern_string(req->email);
+
+	reg_p->reg_time = reg_p->last_time = CURRENT_TIME;
+
+	if(config_file.uregister_verify)
+		reg_p->flags |= US_FLAGS_NEVERLOGGEDIN;
+
+	add_user_reg(reg_p);
+
+	rsdb_exec_insert(&reg_p->id, "users", "id",
+			"INSERT INTO users (username, password, email, reg_time, last_time, flags, verify_token, language) "
+			"VALUES('%Q', '%Q', '%Q', '%lu', '%lu', '%u', '%Q', '')",
+			reg_p->name, reg_p->password, 
+			EmptyString(reg_p->email) ? "" : reg_p->email, 
+			reg_p->reg_time, reg_p->last_time, reg_p->flags, 
+			EmptyString(req->token) ? "" : req->token);
+
+	if(config_file.uregister_verify)
+		service_err(userserv_p, client_p, SVC_USER_NOWREGEMAILED, req->name);
+
+	/* they may have logged in elsewhere meanwhile */
+	else if(client_p->user->user_reg != NULL)
+		service_err(userserv_p, client_p, SVC_USER_NOWREG, req->name);
+
+	else
+	{
+		dlink_add(client_p, &client_p->user->regptr, &reg_p->users);
+		client_p->user->user_reg = reg_p;
+
+		sendto_server(":%s ENCAP * SU %s %s", 
+				MYUID, UID(client_p), reg_p->name);
+
+		service_err(userserv_p, client_p, SVC_USER_NOWREGLOGGEDIN, req->name);
+
+		hook_call(HOOK_USER_LOGIN, client_p, NULL);
+	}
+
+out:
+	my_free(req->email);
+	my_free(req->token);
+	my_free(req);
+}
+
 static int
 s_user_register(struct client *client_p, struct lconn *conn_p, const char *parv[], int parc)
 {
 	struct user_reg *reg_p;
+	struct user_register_req *req;
 	struct host_entry *hent = NULL;
-	const char *password;
 	const char *token = NULL;
 
 	if(config_file.disable_uregister)
@@ -1252,45 +1476,16 @@ s_user_register(struct client *client_p, struct lconn *conn_p, const char *parv[
 	zlog(userserv_p, 2, WATCH_USREGISTER, 0, client_p, NULL,
 		"REGISTER %s %s", parv[0], EmptyString(parv[2]) ? "" : parv[2]);
 
-	password = get_crypt(parv[1], NULL);
-
-	reg_p = BlockHeapAlloc(user_reg_heap);
-	strcpy(reg_p->name, parv[0]);
-	reg_p->password = my_strdup(password);
+	req = my_malloc(sizeof(struct user_register_req));
+	strlcpy(req->name, parv[0], sizeof(req->name));
 
 	if(!EmptyString(parv[2]))
-		reg_p->email = my_strdup(parv[2]);
-
-	reg_p->reg_time = reg_p->last_time = CURRENT_TIME;
+		req->email = my_strdup(parv[2]);
 
-	if(config_file.uregister_verify)
-		reg_p->flags |= US_FLAGS_NEVERLOGGEDIN;
-
-	add_user_reg(reg_p);
-
-	rsdb_exec_insert(&reg_p->id, "users", "id",
-			"INSERT INTO users (username, password, email, reg_time, last_time, flags, verify_token, language) "
-			"VALUES('%Q', '%Q', '%Q', '%lu', '%lu', '%u', '%Q', '')",
-			reg_p->name, reg_p->password, 
-			EmptyString(reg_p->email) ? "" : reg_p->email, 
-			reg_p->reg_time, reg_p->last_time, reg_p->flags, 
-			EmptyString(token) ? "" : token);
-
-	if(!config_file.uregister_verify)
-	{
-		dlink_add_alloc(client_p, &reg_p->users);
-		client_p->user->user_reg = reg_p;
-
-		sendto_server(":%s ENCAP * SU %s %s", 
-				MYUID, UID(client_p), reg_p->name);
-
-		service_err(userserv_p, client_p, SVC_USER_NOWREGLOGGEDIN, parv[0]);
-
-		hook_call(HOOK_USER_LOGIN, client_p, NULL);
-	}
-	else
-		service_err(userserv_p, client_p, SVC_USER_NOWREGEMAILED, parv[0]);
+	if(!EmptyString(token))
+		req->token = my_strdup(token);
 
+	crypt_async(client_p, parv[1], NULL, s_user_register_crypted, req);
 	return 5;
 }
 
@@ -1349,28 +1544,33 @@ s_user_activate(struct client *client_p, struct lconn *conn_p, const char *parv[
 	return 1;
 }
 
-static int
-s_user_login(struct client *client_p, struct lconn *conn_p, const char *parv[], int parc)
+/* user_login_check()
+ *   checks a client may log into a username, done both before and after
+ *   their password is hashed as things may change in the meantime
+ *
+ * inputs	- client, username
+ * outputs	- registration, or NULL if they cant log in (error sent)
+ */
+static struct user_reg *
+user_login_check(struct client *client_p, const char *name)
 {
 	struct user_reg *reg_p;
-	const char *password;
-	dlink_node *ptr;
 
 	if(client_p->user->user_reg != NULL)
 	{
 		service_err(userserv_p, client_p, SVC_USER_ALREADYLOGGEDIN);
-		return 1;
+		return NULL;
 	}
 
-	if((reg_p = find_user_reg(client_p, parv[0])) == NULL)
-		return 1;
+	if((reg_p = find_user_reg(client_p, name)) == NULL)
+		return NULL;
 
 	if(reg_p->flags & US_FLAGS_SUSPENDED)
 	{
 		if(!USER_SUSPEND_EXPIRED(reg_p))
 		{
 			service_err(userserv_p, client_p, SVC_USER_LOGINSUSPENDED);
-			return 1;
+			return NULL;
 		}
 		else
 			expire_user_suspend(reg_p);
@@ -1380,7 +1580,7 @@ s_user_login(struct client *client_p, struct lconn *conn_p, const char *parv[],
 	{
 		service_err(userserv_p, client_p, SVC_USER_LOGINUNACTIVATED,
 				userserv_p->name);
-		return 1;
+		return NULL;
 	}
 
 	if(config_file.umax_logins && 
@@ -1388,15 +1588,31 @@ s_user_login(struct client *client_p, struct lconn *conn_p, const char *parv[],
 	{
 		service_err(userserv_p, client_p, SVC_USER_LOGINMAX,
 				config_file.umax_logins);
-		return 1;
+		return NULL;
+	}
+
+	return reg_p;
+}
+
+static void
+s_user_login_crypted(struct client *client_p, const char *password, void *arg)
+{
+	struct user_reg *reg_p;
+	char *name = arg;
+	dlink_node *ptr;
+
+	if(client_p == NULL || (reg_p = user_login_check(client_p, name)) == NULL)
+	{
+		my_free(name);
+		return;
 	}
 
-	password = get_crypt(parv[1], reg_p->password);
+	my_free(name);
 
 	if(strcmp(password, reg_p->password))
 	{
 		service_err(userserv_p, client_p, SVC_USER_INVALIDPASSWORD);
-		return 1;
+		return;
 	}
 
 	zlog(userserv_p, 5, 0, 0, client_p, NULL,
@@ -1413,20 +1629,31 @@ s_user_login(struct client *client_p, struct lconn *conn_p, const char *parv[],
 
 	client_p->user->user_reg = reg_p;
 	reg_p->last_time = CURRENT_TIME;
-	reg_p->flags |= US_FLAGS_NEEDUPDATE;
-	dlink_add_alloc(client_p, &reg_p->users);
+	mark_user_reg_update(reg_p);
+	dlink_add(client_p, &client_p->user->regptr, &reg_p->users);
 	service_err(userserv_p, client_p, SVC_SUCCESSFUL,
 			userserv_p->name, "LOGIN");
 
 	hook_call(HOOK_USER_LOGIN, client_p, NULL);
+}
 
+static int
+s_user_login(struct client *client_p, struct lconn *conn_p, const char *parv[], int parc)
+{
+	struct user_reg *reg_p;
+
+	if((reg_p = user_login_check(client_p, parv[0])) == NULL)
+		return 1;
+
+	crypt_async(client_p, parv[1], reg_p->password,
+			s_user_login_crypted, my_strdup(reg_p->name));
 	return 1;
 }
 
 static int
 s_user_logout(struct client *client_p, struct lconn *conn_p, const char *parv[], int parc)
 {
-	dlink_find_destroy(client_p, &client_p->user->user_reg->users);
+	dlink_delete(&client_p->user->regptr, &client_p->user->user_reg->users);
 	client_p->user->user_reg = NULL;
 	service_err(userserv_p, client_p, SVC_SUCCESSFUL,
 			userserv_p->name, "LOGOUT");
@@ -1436,6 +1663,34 @@ s_user_logout(struct client *client_p, struct lconn *conn_p, const char *parv[],
 	return 1;
 }
 
+static void
+s_user_resetpass_crypted(struct client *client_p, const char *password, void *arg)
+{
+	struct user_reg *reg_p;
+	char *name = arg;
+
+	/* the token was checked before hashing, so the reset only needs the
+	 * username to still be registered
+	 */
+	if(client_p == NULL || (reg_p = find_user_reg(client_p, name)) == NULL)
+	{
+		my_free(name);
+		return;
+	}
+
+	my_free(name);
+
+	rsdb_exec(NULL, "DELETE FROM users_resetpass WHERE username='%Q'",
+			reg_p->name);
+	rsdb_exec(NULL, "UPDATE users SET password='%Q' WHERE username='%Q'",
+			password, reg_p->name);
+
+	my_free(reg_p->password);
+	reg_p->password = my_strdup(password);
+
+	service_err(userserv_p, client_p, SVC_USER_CHANGEDPASSWORD, reg_p->name);
+}
+
 static int
 s_user_resetpass(struct client *client_p, struct lconn *conn_p, const char *parv[], int parc)
 {
@@ -1575,20 +1830,10 @@ s_user_resetpass(struct client *client_p, struct lconn *conn_p, const char *parv
 	{
 		if(strcmp(data.row[0][0], parv[1]) == 0)
 		{
-			const char *password = get_crypt(parv[2], NULL);
-
-			/* need to execute another query.. */
 			rsdb_exec_fetch_end(&data);
 
-			rsdb_exec(NULL, "DELETE FROM users_resetpass WHERE username='%Q'",
-					reg_p->name);
-			rsdb_exec(NULL, "UPDATE users SET password='%Q' WHERE username='%Q'",
-					password, reg_p->name);
-
-			my_free(reg_p->password);
-			reg_p->password = my_strdup(password);
-
-			service_err(userserv_p, client_p, SVC_USER_CHANGEDPASSWORD, reg_p->name);
+			crypt_async(client_p, parv[2], NULL, s_user_resetpass_crypted,
+					my_strdup(reg_p->name));
 			return 1;
 		}
 		else
@@ -1789,8 +2034,8 @@ s_user_resetemail(struct client *client_p, struct lconn *conn_p, const char *par
 			{
 				const char *email = data.row[0][1];
 				
-				my_free(reg_p->email);
-				reg_p->email = my_strdup(email);
+				intern_release(reg_p->email);
+				reg_p->email = intern_string(email);
 
 				/* need to execute another query.. */
 				rsdb_exec_fetch_end(&data);
@@ -1829,6 +2074,81 @@ s_user_resetemail(struct client *client_p, struct lconn *conn_p, const char *par
 	return 1;
 }
 
+/* SET PASSWORD hashes the old password to check it, then the new one */
+struct user_setpass_req
+{
+	char name[USERREGNAME_LEN+1];
+	char password[PASSWDLEN+1];
+};
+
+static void
+s_user_setpass_free(struct user_setpass_req *req)
+{
+	memset(req->password, 0, sizeof(req->password));
+	my_free(req);
+}
+
+/* s_user_setpass_reg()
+ *   finds the registration a SET PASSWORD is for, they may have logged
+ *   out whilst it was being hashed
+ */
+static struct user_reg *
+s_user_setpass_reg(struct client *client_p, struct user_setpass_req *req)
+{
+	struct user_reg *ureg_p;
+
+	if(client_p == NULL || (ureg_p = client_p->user->user_reg) == NULL ||
+	   irccmp(ureg_p->name, req->name))
+		return NULL;
+
+	return ureg_p;
+}
+
+static void
+s_user_setpass_crypted(struct client *client_p, const char *password, void *arg)
+{
+	struct user_setpass_req *req = arg;
+	struct user_reg *ureg_p;
+
+	if((ureg_p = s_user_setpass_reg(client_p, req)) != NULL)
+	{
+		my_free(ureg_p->password);
+		ureg_p->password = my_strdup(password);
+
+		rsdb_exec(NULL, "UPDATE users SET password='%Q' "
+				"WHERE username='%Q'", password, ureg_p->name);
+
+		service_err(userserv_p, client_p, SVC_USER_CHANGEDPASSWORD,
+				ureg_p->name);
+	}
+
+	s_user_setpass_free(req);
+}
+
+static void
+s_user_setpass_checked(struct client *client_p, const char *password, void *arg)
+{
+	struct user_setpass_req *req = arg;
+	struct user_reg *ureg_p;
+
+	if((ureg_p = s_user_setpass_reg(client_p, req)) == NULL)
+	{
+		s_user_setpass_free(req);
+		return;
+	}
+
+	if(strcmp(password, ureg_p->password))
+	{
+		service_err(userserv_p, client_p, SVC_USER_INVALIDPASSWORD);
+		s_user_setpass_free(req);
+		return;
+	}
+
+	zlog(userserv_p, 3, 0, 0, client_p, NULL, "SET PASS");
+
+	crypt_async(client_p, req->password, NULL, s_user_setpass_crypted, req);
+}
+
 static int
 s_user_set(struct client *client_p, struct lconn *conn_p, const char *parv[], int parc)
 {
@@ -1841,7 +2161,7 @@ s_user_set(struct client *client_p, struct lconn *conn_p, const char *parv[], in
 
 	if(!strcasecmp(parv[0], "PASSWORD"))
 	{
-		const char *password;
+		struct user_setpass_req *req;
 
 		if(!config_file.allow_set_password)
 		{
@@ -1863,25 +2183,12 @@ s_user_set(struct client *client_p, struct lconn *conn_p, const char *parv[], in
 			return 0;
 		}
 
-		password = get_crypt(parv[1], ureg_p->password);
-
-		if(strcmp(password, ureg_p->password))
-		{
-			service_err(userserv_p, client_p, SVC_USER_INVALIDPASSWORD);
-			return 1;
-		}
-
-		zlog(userserv_p, 3, 0, 0, client_p, NULL, "SET PASS");
+		req = my_malloc(sizeof(struct user_setpass_req));
+		strlcpy(req->name, ureg_p->name, sizeof(req->name));
+		strlcpy(req->password, parv[2], sizeof(req->password));
 
-		password = get_crypt(parv[2], NULL);
-		my_free(ureg_p->password);
-		ureg_p->password = my_strdup(password);
-
-		rsdb_exec(NULL, "UPDATE users SET password='%Q' "
-				"WHERE username='%Q'", password, ureg_p->name);
-
-		service_err(userserv_p, client_p, SVC_USER_CHANGEDPASSWORD,
-				ureg_p->name);
+		crypt_async(client_p, parv[1], ureg_p->password,
+				s_user_setpass_checked, req);
 		return 1;
 	}
 	else if(!strcasecmp(parv[0], "EMAIL"))
@@ -1914,8 +2221,8 @@ s_user_set(struct client *client_p, struct lconn *conn_p, const char *parv[], in
 		zlog(userserv_p, 3, 0, 0, client_p, NULL, 
 			"SET EMAIL %s", arg);
 
-		my_free(ureg_p->email);
-		ureg_p->email = my_strdup(arg);
+		intern_release(ureg_p->email);
+		ureg_p->email = intern_string(arg);
 
 		rsdb_exec(NULL, "UPDATE users SET email='%Q' "
 				"WHERE username='%Q'", arg, ureg_p->name);
@@ -2040,14 +2347,15 @@ dump_user_info(struct client *client_p, struct lconn *conn_p, struct user_reg *u
 	struct client *target_p;
 	dlink_node *ptr;
 	char *p;
+	unsigned int i;
 	int buflen = 0;
 	int mlen;
 
 	p = buf;
 
-	DLINK_FOREACH(ptr, ureg_p->channels.head)
+	for(i = 0; i < ureg_p->channels.count; i++)
 	{
-		mreg_p = ptr->data;
+		mreg_p = ureg_p->channels.entry[i];
 
 		/* "Access to: " + " 200, " */
 		if((buflen + strlen(mreg_p->channel_reg->name) + 17) >= (BUFSIZE - 3))
@@ -2165,13 +2473,10 @@ s_userserv_countmem(size_t *sz_user_reg_password, size_t *sz_user_reg_email,
 {
 	struct user_reg *ureg_p;
 	struct member_reg *mreg_p;
-	dlink_node *ptr, *vptr;
-	int i;
+	unsigned int i, j;
 
-	HASH_WALK(i, MAX_NAME_HASH, ptr, user_reg_table)
+	HTABLE_WALK(i, ureg_p, &user_reg_table)
 	{
-		ureg_p = ptr->data;
-
 		if(!EmptyString(ureg_p->password))
 			*sz_user_reg_password += strlen(ureg_p->password) + 1;
 
@@ -2184,13 +2489,13 @@ s_userserv_countmem(size_t *sz_user_reg_password, size_t *sz_user_reg_email,
 		if(!EmptyString(ureg_p->suspend_reason))
 			*sz_user_reg_suspend += strlen(ureg_p->suspend_reason) + 1;
 
-		DLINK_FOREACH(vptr, ureg_p->channels.head)
+		for(j = 0; j < ureg_p->channels.count; j++)
 		{
-			mreg_p = vptr->data;
+			mreg_p = ureg_p->channels.entry[j];
 			*sz_member_reg_lastmod += strlen(mreg_p->lastmod) + 1;
 		}
 	}
-	HASH_WALK_END
+	HTABLE_WALK_END
 }
 
 #endif
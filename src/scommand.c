@@ -44,7 +44,12 @@
 #include "hook.h"
 #include "s_userserv.h"
 
-static dlink_list scommand_table[MAX_SCOMMAND_HASH];
+/* scommand_table is a perfect hash of every registered command, it is
+ * rebuilt with a new seed whenever a command is added that collides.
+ */
+static struct scommand_handler *scommand_table[MAX_SCOMMAND_HASH];
+static unsigned int scommand_seed;
+static dlink_list scommand_list;
 
 static void c_admin(struct client *, const char *parv[], int parc);
 static void c_capab(struct client *, const char *parv[], int parc);
@@ -57,16 +62,16 @@ static void c_trace(struct client *, const char *parv[], int parc);
 static void c_version(struct client *, const char *parv[], int parc);
 static void c_whois(struct client *, const char *parv[], int parc);
 
-static struct scommand_handler admin_command = { "ADMIN", c_admin, 0, DLINK_EMPTY };
-static struct scommand_handler capab_command = { "CAPAB", c_capab, FLAGS_UNKNOWN, DLINK_EMPTY };
-static struct scommand_handler encap_command = { "ENCAP", c_encap, 0, DLINK_EMPTY };
-static struct scommand_handler pass_command = { "PASS", c_pass, FLAGS_UNKNOWN, DLINK_EMPTY };
-static struct scommand_handler ping_command = { "PING", c_ping, 0, DLINK_EMPTY };
-static struct scommand_handler pong_command = { "PONG", c_pong, 0, DLINK_EMPTY };
-static struct scommand_handler stats_command = { "STATS", c_stats, 0, DLINK_EMPTY };
-static struct scommand_handler trace_command = { "TRACE", c_trace, 0, DLINK_EMPTY };
-static struct scommand_handler version_command = { "VERSION", c_version, 0, DLINK_EMPTY };
-static struct scommand_handler whois_command = { "WHOIS", c_whois, 0, DLINK_EMPTY };
+static struct scommand_handler admin_command = { "ADMIN", c_admin, 0, 0, { NULL } };
+static struct scommand_handler capab_command = { "CAPAB", c_capab, FLAGS_UNKNOWN, 0, { NULL } };
+static struct scommand_handler encap_command = { "ENCAP", c_encap, 0, 0, { NULL } };
+static struct scommand_handler pass_command = { "PASS", c_pass, FLAGS_UNKNOWN, 0, { NULL } };
+static struct scommand_handler ping_command = { "PING", c_ping, 0, 0, { NULL } };
+static struct scommand_handler pong_command = { "PONG", c_pong, 0, 0, { NULL } };
+static struct scommand_handler stats_command = { "STATS", c_stats, 0, 0, { NULL } };
+static struct scommand_handler trace_command = { "TRACE", c_trace, 0, 0, { NULL } };
+static struct scommand_handler version_command = { "VERSION", c_version, 0, 0, { NULL } };
+static struct scommand_handler whois_command = { "WHOIS", c_whois, 0, 0, { NULL } };
 
 void
 init_scommand(void)
@@ -83,37 +88,88 @@ init_scommand(void)
 	add_scommand_handler(&whois_command);
 }
 
-static int
-hash_command(const char *p)
+static unsigned int
+hash_command(const char *p, unsigned int seed)
 {
-	unsigned int hash_val = 0;
+	unsigned int hash_val = 2166136261U ^ seed;
 
+	/* FNV-1a, ignoring case */
 	while(*p)
 	{
-		hash_val += ((int) (*p) & 0xDF);
+		hash_val = (hash_val ^ ((unsigned int) (*p) & 0xDF)) * 16777619U;
 		p++;
 	}
 
-	return(hash_val % MAX_SCOMMAND_HASH);
+	hash_val ^= hash_val >> 16;
+	hash_val *= 0x45d9f3bU;
+	hash_val ^= hash_val >> 16;
+
+	return(hash_val & (MAX_SCOMMAND_HASH - 1));
 }
 
-static void
-handle_scommand_unknown(const char *command, const char *parv[], int parc)
+/* rehash_scommand()
+ *   finds a seed that gives every command its own slot in the table
+ *
+ * inputs	-
+ * outputs	- 1 on success, 0 if no seed could be found
+ */
+static int
+rehash_scommand(void)
 {
 	struct scommand_handler *handler;
 	dlink_node *ptr;
-	unsigned int hashv = hash_command(command);
-	
-	DLINK_FOREACH(ptr, scommand_table[hashv].head)
+	unsigned int seed;
+	unsigned int hashv;
+
+	for(seed = 1; seed < 65536; seed++)
 	{
-		handler = ptr->data;
-		if(!strcasecmp(command, handler->cmd))
+		memset(scommand_table, 0, sizeof(scommand_table));
+
+		DLINK_FOREACH(ptr, scommand_list.head)
 		{
-			if(handler->flags & FLAGS_UNKNOWN)
-				handler->func(NULL, parv, parc);
-			return;
+			handler = ptr->data;
+			hashv = hash_command(handler->cmd, seed);
+
+			if(scommand_table[hashv] != NULL)
+				break;
+
+			scommand_table[hashv] = handler;
+		}
+
+		/* no collisions */
+		if(ptr == NULL)
+		{
+			scommand_seed = seed;
+			return 1;
 		}
 	}
+
+	return 0;
+}
+
+static struct scommand_handler *
+find_scommand(const char *command)
+{
+	struct scommand_handler *handler;
+
+	handler = scommand_table[hash_command(command, scommand_seed)];
+
+	if(handler != NULL && !strcasecmp(command, handler->cmd))
+		return handler;
+
+	return NULL;
+}
+
+static void
+handle_scommand_unknown(const char *command, const char *parv[], int parc)
+{
+	struct scommand_handler *handler;
+
+	if((handler = find_scommand(command)) == NULL)
+		return;
+
+	if(handler->flags & FLAGS_UNKNOWN)
+		handler->func(NULL, parv, parc);
 }
 
 static void
@@ -121,27 +177,15 @@ handle_scommand_client(struct client *client_p, const char *command,
 			const char *parv[], int parc)
 {
 	struct scommand_handler *handler;
-	scommand_func hook;
-	dlink_node *ptr;
-	dlink_node *hptr;
-	unsigned int hashv = hash_command(command);
-	
-	DLINK_FOREACH(ptr, scommand_table[hashv].head)
-	{
-		handler = ptr->data;
-		if(!strcasecmp(command, handler->cmd))
-		{
-			handler->func(client_p, parv, parc);
+	int i;
 
-			DLINK_FOREACH(hptr, handler->hooks.head)
-			{
-				hook = hptr->data;
-				(*hook)(client_p, parv, parc);
-			}
+	if((handler = find_scommand(command)) == NULL)
+		return;
 
-			break;
-		}
-	}
+	handler->func(client_p, parv, parc);
+
+	for(i = 0; i < handler->hook_count; i++)
+		(*handler->hooks[i])(client_p, parv, parc);
 }
 
 void
@@ -172,48 +216,64 @@ add_scommand_handler(struct scommand_handler *chandler)
 	if(chandler == NULL || EmptyString(chandler->cmd))
 		return;
 
-	hashv = hash_command(chandler->cmd);
-	dlink_add_alloc(chandler, &scommand_table[hashv]);
+	if(find_scommand(chandler->cmd) != NULL)
+	{
+		s_assert(0);
+		return;
+	}
+
+	dlink_add_alloc(chandler, &scommand_list);
+
+	hashv = hash_command(chandler->cmd, scommand_seed);
+
+	/* free slot with the current seed, no need to rehash */
+	if(scommand_table[hashv] == NULL)
+	{
+		scommand_table[hashv] = chandler;
+		return;
+	}
+
+	if(!rehash_scommand())
+		die(0, "Unable to build server command table");
 }
 
 void
 add_scommand_hook(scommand_func hook, const char *command)
 {
 	struct scommand_handler *handler;
-	dlink_node *ptr;
-	unsigned int hashv = hash_command(command);
 
-	DLINK_FOREACH(ptr, scommand_table[hashv].head)
+	if((handler = find_scommand(command)) == NULL ||
+	   handler->hook_count >= MAX_SCOMMAND_HOOKS)
 	{
-		handler = ptr->data;
-		if(!strcasecmp(command, handler->cmd))
-		{
-			dlink_add_alloc(hook, &handler->hooks);
-			return;
-		}
+		s_assert(0);
+		return;
 	}
 
-	s_assert(0);
+	handler->hooks[handler->hook_count++] = hook;
 }
 
 void
 del_scommand_hook(scommand_func hook, const char *command)
 {
 	struct scommand_handler *handler;
-	dlink_node *ptr;
-	unsigned int hashv = hash_command(command);
+	int i;
+
+	if((handler = find_scommand(command)) == NULL)
+	{
+		s_assert(0);
+		return;
+	}
 
-	DLINK_FOREACH(ptr, scommand_table[hashv].head)
+	for(i = 0; i < handler->hook_count; i++)
 	{
-		handler = ptr->data;
-		if(!strcasecmp(command, handler->cmd))
+		if(handler->hooks[i] == hook)
 		{
-			dlink_find_destroy(hook, &handler->hooks);
+			handler->hook_count--;
+			memmove(&handler->hooks[i], &handler->hooks[i+1],
+				(handler->hook_count - i) * sizeof(scommand_func));
 			return;
 		}
 	}
-
-	s_assert(0);
 }
 
 static void
@@ -383,6 +443,9 @@ c_pong(struct client *client_p, const char *parv[], int parc)
         if(parc < 1 || EmptyString(parv[0]) || !IsServer(client_p))
                 return;
 
+	/* finish with the burst before anything hooked on its end */
+	hook_flush_batches();
+
         if(!finished_bursting)
         {
                 mlog("Connection to server %s completed", server_p->name);
@@ -51,11 +51,15 @@
 #include "s_userserv.h"
 #include "watch.h"
 #include "balloc.h"
+#include "htable.h"
 
 dlink_list service_list;
 dlink_list ignore_list;
 
+static struct htable ignore_host_table;
+
 static int ignore_db_callback(int, const char **);
+static const char *ignore_host_key(void *);
 
 static void unmerge_service(struct client *service_p);
 
@@ -78,36 +82,314 @@ init_services(void)
 			(service_p->service->init)();
 	}
 
+	htable_init(&ignore_host_table, "Ignore Hosts", IGNORE_HOST_HASH_MIN,
+			ignore_host_key, irccmp);
 	rsdb_exec(ignore_db_callback, "SELECT hostname, oper, reason FROM ignore_hosts");
 }
 
 static int
 ignore_db_callback(int argc, const char **argv)
 {
-	struct service_ignore *ignore_p;
-
 	if(EmptyString(argv[0]) || EmptyString(argv[1]) || EmptyString(argv[2]))
 		return 0;
 
-	ignore_p = my_malloc(sizeof(struct service_ignore));
-	ignore_p->mask = my_strdup(argv[0]);
-	ignore_p->oper = my_strdup(argv[1]);
-	ignore_p->reason = my_strdup(argv[2]);
-
-	dlink_add(ignore_p, &ignore_p->ptr, &ignore_list);
+	add_ignore(argv[0], argv[1], argv[2]);
 	return 0;
 }
 
+/* The ignore index.
+ *
+ * Ignores are indexed on the host part of their mask, so a message only
+ * runs match() over the ignores that could apply to its sender:
+ *   - hosts without wildcards are kept in a hash of hosts
+ *   - hosts of *'s followed by text without wildcards are kept in a trie
+ *     of that text, reversed
+ *   - hosts of ip/len are kept in a binary trie for their family, and
+ *     match the clients ip, as they do in chanserv's UNBAN
+ *   - anything else is checked for every client
+ * The tries are rebuilt when next needed after the list changes.  Each
+ * client keeps whether they are ignored, which stands until the list,
+ * or their mask, changes.
+ */
+#define IGNORE_WILD	0
+#define IGNORE_HOST	1
+#define IGNORE_SUFFIX	2
+#define IGNORE_CIDR	3
+
+struct ignore_suffix
+{
+	int child;			/* first child */
+	int sibling;			/* next child of our parent */
+	unsigned char ch;
+	struct service_ignore *ignores;
+};
+
+struct ignore_cidr
+{
+	int child[2];			/* 0 is the v4 root, so never a child */
+	struct service_ignore *ignores;
+};
+
+static struct ignore_suffix *ignore_suffix_nodes;
+static int ignore_suffix_count;
+static int ignore_suffix_size;
+
+static struct ignore_cidr *ignore_cidr_nodes;
+static int ignore_cidr_count;
+static int ignore_cidr_size;
+
+static struct service_ignore *ignore_wild;
+
+static unsigned int ignore_serial = 1;
+static unsigned int ignore_index_serial;
+
+static const char *
+ignore_host_key(void *data)
+{
+	return ((struct service_ignore *) data)->host;
+}
+
+/* ignore_type()
+ *   works out how an ignore is indexed
+ *
+ * inputs	- mask, where to put the text it is indexed on
+ * outputs	- IGNORE_ type
+ */
 static int
-find_ignore(struct client *client_p)
+ignore_type(const char *mask, const char **host)
+{
+	unsigned char addr[16];
+	const char *p;
+	int bits;
+
+	/* a clients mask has a single @, which ours must line up with */
+	if((p = strchr(mask, '@')) == NULL || strchr(++p, '@') != NULL || *p == '\0')
+		return IGNORE_WILD;
+
+	*host = p;
+
+	if(strchr(p, '/') != NULL && parse_cidr(p, addr, &bits))
+		return IGNORE_CIDR;
+
+	while(*p == '*')
+		p++;
+
+	if(strpbrk(p, "*?") != NULL)
+		return IGNORE_WILD;
+
+	if(p == *host)
+		return IGNORE_HOST;
+
+	*host = p;
+	return IGNORE_SUFFIX;
+}
+
+static int
+ignore_suffix_add(int parent, unsigned char ch)
+{
+	int i;
+
+	for(i = ignore_suffix_nodes[parent].child; i; i = ignore_suffix_nodes[i].sibling)
+	{
+		if(ignore_suffix_nodes[i].ch == ch)
+			return i;
+	}
+
+	if(ignore_suffix_count == ignore_suffix_size)
+	{
+		ignore_suffix_size *= 2;
+		ignore_suffix_nodes = my_realloc(ignore_suffix_nodes,
+				sizeof(struct ignore_suffix) * ignore_suffix_size);
+	}
+
+	i = ignore_suffix_count++;
+	memset(&ignore_suffix_nodes[i], 0, sizeof(struct ignore_suffix));
+	ignore_suffix_nodes[i].ch = ch;
+	ignore_suffix_nodes[i].sibling = ignore_suffix_nodes[parent].child;
+	ignore_suffix_nodes[parent].child = i;
+
+	return i;
+}
+
+static int
+ignore_cidr_add(int parent, int bit)
+{
+	int i;
+
+	if((i = ignore_cidr_nodes[parent].child[bit]))
+		return i;
+
+	if(ignore_cidr_count == ignore_cidr_size)
+	{
+		ignore_cidr_size *= 2;
+		ignore_cidr_nodes = my_realloc(ignore_cidr_nodes,
+				sizeof(struct ignore_cidr) * ignore_cidr_size);
+	}
+
+	i = ignore_cidr_count++;
+	memset(&ignore_cidr_nodes[i], 0, sizeof(struct ignore_cidr));
+	ignore_cidr_nodes[parent].child[bit] = i;
+
+	return i;
+}
+
+/* ignore_index_build()
+ *   rebuilds the tries and the list of wildcard ignores.  Ignores by
+ *   host are kept in their hash as they come and go.
+ */
+static void
+ignore_index_build(void)
 {
 	struct service_ignore *ignore_p;
+	unsigned char addr[16];
+	const char *host;
+	const char *p;
 	dlink_node *ptr;
+	int node, bits, i;
+
+	if(ignore_suffix_nodes == NULL)
+	{
+		ignore_suffix_size = 64;
+		ignore_suffix_nodes = my_malloc(sizeof(struct ignore_suffix) * ignore_suffix_size);
+		ignore_cidr_size = 64;
+		ignore_cidr_nodes = my_malloc(sizeof(struct ignore_cidr) * ignore_cidr_size);
+	}
+
+	memset(ignore_suffix_nodes, 0, sizeof(struct ignore_suffix));
+	ignore_suffix_count = 1;
+
+	/* a root for each family */
+	memset(ignore_cidr_nodes, 0, sizeof(struct ignore_cidr) * 2);
+	ignore_cidr_count = 2;
+
+	ignore_wild = NULL;
 
 	DLINK_FOREACH(ptr, ignore_list.head)
 	{
 		ignore_p = ptr->data;
 
+		switch(ignore_type(ignore_p->mask, &host))
+		{
+			case IGNORE_HOST:
+				continue;
+
+			case IGNORE_SUFFIX:
+				node = 0;
+
+				for(p = host + strlen(host); p > host; )
+					node = ignore_suffix_add(node, ToLower(*--p));
+
+				ignore_p->next = ignore_suffix_nodes[node].ignores;
+				ignore_suffix_nodes[node].ignores = ignore_p;
+				break;
+
+			case IGNORE_CIDR:
+				node = (parse_cidr(host, addr, &bits) == 6) ? 1 : 0;
+
+				for(i = 0; i < bits; i++)
+					node = ignore_cidr_add(node, (addr[i / 8] >> (7 - i % 8)) & 1);
+
+				ignore_p->next = ignore_cidr_nodes[node].ignores;
+				ignore_cidr_nodes[node].ignores = ignore_p;
+				break;
+
+			default:
+				ignore_p->next = ignore_wild;
+				ignore_wild = ignore_p;
+				break;
+		}
+	}
+
+	ignore_index_serial = ignore_serial;
+}
+
+/* add_ignore()
+ *   adds an ignore to the list and its index
+ *
+ * inputs	- mask, oper who set it, reason
+ * outputs	- the ignore
+ */
+struct service_ignore *
+add_ignore(const char *mask, const char *oper, const char *reason)
+{
+	struct service_ignore *ignore_p;
+	struct service_ignore *host_p;
+	const char *host;
+
+	ignore_p = my_malloc(sizeof(struct service_ignore));
+	ignore_p->mask = my_strdup(mask);
+	ignore_p->oper = my_strdup(oper);
+	ignore_p->reason = my_strdup(reason);
+
+	dlink_add(ignore_p, &ignore_p->ptr, &ignore_list);
+
+	if(ignore_type(ignore_p->mask, &host) == IGNORE_HOST)
+	{
+		ignore_p->host = host;
+
+		/* the hash holds the first ignore on each host */
+		if((host_p = htable_find(&ignore_host_table, host)) != NULL)
+		{
+			ignore_p->next = host_p->next;
+			host_p->next = ignore_p;
+		}
+		else
+			htable_add(&ignore_host_table, ignore_p);
+	}
+
+	if(++ignore_serial == 0)
+		ignore_serial = 1;
+
+	return ignore_p;
+}
+
+/* del_ignore()
+ *   removes an ignore from the list and its index, and frees it
+ *
+ * inputs	- ignore
+ * outputs	-
+ */
+void
+del_ignore(struct service_ignore *ignore_p)
+{
+	struct service_ignore *host_p;
+
+	dlink_delete(&ignore_p->ptr, &ignore_list);
+
+	if(ignore_p->host != NULL)
+	{
+		host_p = htable_find(&ignore_host_table, ignore_p->host);
+
+		if(host_p == ignore_p)
+		{
+			htable_del(&ignore_host_table, ignore_p);
+
+			if(ignore_p->next != NULL)
+				htable_add(&ignore_host_table, ignore_p->next);
+		}
+		else
+		{
+			while(host_p->next != ignore_p)
+				host_p = host_p->next;
+
+			host_p->next = ignore_p->next;
+		}
+	}
+
+	if(++ignore_serial == 0)
+		ignore_serial = 1;
+
+	my_free(ignore_p->mask);
+	my_free(ignore_p->oper);
+	my_free(ignore_p->reason);
+	my_free(ignore_p);
+}
+
+static int
+ignore_match_list(struct service_ignore *ignore_p, struct client *client_p)
+{
+	for(; ignore_p != NULL; ignore_p = ignore_p->next)
+	{
 		if(match(ignore_p->mask, client_p->user->mask))
 			return 1;
 	}
@@ -115,6 +397,96 @@ find_ignore(struct client *client_p)
 	return 0;
 }
 
+/* ignore_match_cidr()
+ *   walks the trie for a clients ip family down their ip, checking the
+ *   ignores of each prefix passed
+ */
+static int
+ignore_match_cidr(struct client *client_p)
+{
+	struct service_ignore *ignore_p;
+	char ipmask[BUFSIZE];
+	unsigned char addr[16];
+	int family, node, bits, i;
+
+	if(client_p->user->ip == NULL ||
+	   (family = parse_ip(client_p->user->ip, addr)) == 0)
+		return 0;
+
+	snprintf(ipmask, sizeof(ipmask), "%s!%s@%s",
+		client_p->name, client_p->user->username, client_p->user->ip);
+
+	node = (family == 6) ? 1 : 0;
+	bits = (family == 6) ? 128 : 32;
+
+	for(i = 0; i < bits; i++)
+	{
+		if((node = ignore_cidr_nodes[node].child[(addr[i / 8] >> (7 - i % 8)) & 1]) == 0)
+			return 0;
+
+		for(ignore_p = ignore_cidr_nodes[node].ignores; ignore_p; ignore_p = ignore_p->next)
+		{
+			if(match_cidr(ignore_p->mask, ipmask))
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+ignore_match(struct client *client_p)
+{
+	const char *host = client_p->user->host;
+	const char *p;
+	int node = 0;
+	int i;
+
+	if(ignore_match_list(htable_find(&ignore_host_table, host), client_p))
+		return 1;
+
+	if(ignore_match_list(ignore_suffix_nodes[0].ignores, client_p))
+		return 1;
+
+	for(p = host + strlen(host); p > host; )
+	{
+		for(i = ignore_suffix_nodes[node].child; i; i = ignore_suffix_nodes[i].sibling)
+		{
+			if(ignore_suffix_nodes[i].ch == ToLower(p[-1]))
+				break;
+		}
+
+		if(i == 0)
+			break;
+
+		node = i;
+		p--;
+
+		if(ignore_match_list(ignore_suffix_nodes[node].ignores, client_p))
+			return 1;
+	}
+
+	if(ignore_match_cidr(client_p))
+		return 1;
+
+	return ignore_match_list(ignore_wild, client_p);
+}
+
+static int
+find_ignore(struct client *client_p)
+{
+	if(client_p->user->ignore_serial != ignore_serial)
+	{
+		if(ignore_index_serial != ignore_serial)
+			ignore_index_build();
+
+		client_p->user->ignored = ignore_match(client_p);
+		client_p->user->ignore_serial = ignore_serial;
+	}
+
+	return client_p->user->ignored;
+}
+
 typedef int (*bqcmp)(const void *, const void *);
 static int
 scmd_sort(struct service_command *one, struct service_command *two)
@@ -832,6 +1204,51 @@ handle_service_msg(struct client *service_p, struct client *client_p, char *text
 	handle_service(service_p, client_p, text, parc, (const char **) parv, 1);
 }
 
+/* oper_login_crypted()
+ *   finishes an OLOGIN once the password is hashed
+ *
+ * inputs	- client (NULL if they exited), hashed password, oper conf
+ *		  with a reference held for us
+ * outputs	-
+ */
+static void
+oper_login_crypted(struct client *client_p, const char *crpass, void *arg)
+{
+	struct conf_oper *oper_p = arg;
+
+	if(client_p == NULL)
+	{
+		deallocate_conf_oper(oper_p);
+		return;
+	}
+
+	if(client_p->user->oper)
+	{
+		sendto_server(":%s NOTICE %s :You are already logged in as an oper",
+				MYUID, UID(client_p));
+		deallocate_conf_oper(oper_p);
+		return;
+	}
+
+	/* removed by a rehash whilst we were hashing */
+	if(ConfDead(oper_p) || strcmp(crpass, oper_p->pass))
+	{
+		sendto_server(":%s NOTICE %s :Invalid password",
+				MYUID, UID(client_p));
+		deallocate_conf_oper(oper_p);
+		return;
+	}
+
+	sendto_server(":%s NOTICE %s :Oper login successful",
+			MYUID, UID(client_p));
+
+	/* keeps the reference we were given */
+	client_p->user->oper = oper_p;
+	dlink_add(client_p, &client_p->user->operptr, &oper_list);
+
+	watch_send(WATCH_AUTH, client_p, NULL, 1, "has logged in (irc)");
+}
+
 void
 handle_service(struct client *service_p, struct client *client_p, 
 		const char *command, int parc, const char *parv[], int msg)
@@ -917,7 +1334,6 @@ handle_service(struct client *service_p, struct client *client_p,
 	else if(!strcasecmp(command, "OPERLOGIN") || !strcasecmp(command, "OLOGIN"))
 	{
 		struct conf_oper *oper_p;
-		const char *crpass;
 
 		if(client_p->user->oper)
 		{
@@ -943,26 +1359,14 @@ handle_service(struct client *service_p, struct client *client_p,
 			return;
 		}
 
-		if(ConfOperEncrypted(oper_p))
-			crpass = crypt(parv[1], oper_p->pass);
-		else
-			crpass = parv[1];
-
-		if(strcmp(crpass, oper_p->pass))
-		{
-			sendto_server(":%s NOTICE %s :Invalid password",
-					MYUID, UID(client_p));
-			return;
-		}
-
-		sendto_server(":%s NOTICE %s :Oper login successful",
-				MYUID, UID(client_p));
-
-		client_p->user->oper = oper_p;
+		/* held until the login completes, in case of a rehash */
 		oper_p->refcount++;
-		dlink_add_alloc(client_p, &oper_list);
 
-		watch_send(WATCH_AUTH, client_p, NULL, 1, "has logged in (irc)");
+		if(ConfOperEncrypted(oper_p))
+			crypt_async(client_p, parv[1], oper_p->pass,
+					oper_login_crypted, oper_p);
+		else
+			oper_login_crypted(client_p, parv[1], oper_p);
 
 		return;
 	}
@@ -980,7 +1384,7 @@ handle_service(struct client *service_p, struct client *client_p,
 
 		deallocate_conf_oper(client_p->user->oper);
 		client_p->user->oper = NULL;
-		dlink_find_destroy(client_p, &oper_list);
+		dlink_delete(&client_p->user->operptr, &oper_list);
 
 		sendto_server(":%s NOTICE %s :Oper logout successful",
 				MYUID, UID(client_p));
@@ -1020,7 +1424,7 @@ handle_service(struct client *service_p, struct client *client_p,
 			else
 			{
 				client_p->user->user_reg->last_time = CURRENT_TIME;
-				client_p->user->user_reg->flags |= US_FLAGS_NEEDUPDATE;
+				mark_user_reg_update(client_p->user->user_reg);
 			}
 		}
 #endif
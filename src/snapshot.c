@@ -0,0 +1,428 @@
+/* src/snapshot.c
+ *   Contains code for writing and loading registry snapshots.
+ *
+ * Copyright (C) 2010 ircd-ratbox development team
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1.Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 2.Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * 3.The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id$
+ */
+#include "stdinc.h"
+#include "rserv.h"
+#include "rsdb.h"
+#include "hook.h"
+#include "io.h"
+#include "log.h"
+#include "intern.h"
+#include "snapshot.h"
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#define SNAPSHOT_MAGIC		"RSSNAP\0\0"
+#define SNAPSHOT_BYTEORDER	0x01020304
+
+/* sections and the string table start on this boundary, so records can
+ * be used straight out of the mapping
+ */
+#define SNAPSHOT_ALIGN		16
+#define SNAPSHOT_ALIGNED(x)	(((x) + SNAPSHOT_ALIGN - 1) & ~((unsigned long) SNAPSHOT_ALIGN - 1))
+
+/* snapshot_sync()
+ * commits any outstanding writes, then lets the registries dump
+ * themselves against the resulting database change counter.  Must be
+ * called after HOOK_DBSYNC, so the registries match what is on disk.
+ */
+void
+snapshot_sync(void)
+{
+	unsigned long counter;
+
+	rsdb_sync();
+
+	/* no way of telling whether a snapshot is current with this
+	 * backend, so there's no point writing one
+	 */
+	if(!rsdb_change_counter(&counter))
+		return;
+
+	hook_call(HOOK_DBSNAPSHOT, &counter, NULL);
+}
+
+static void
+snapshot_buf_add(struct snapshot_buf *buf, const void *data, unsigned long len)
+{
+	if(buf->len + len > buf->size)
+	{
+		while(buf->len + len > buf->size)
+			buf->size = buf->size ? buf->size * 2 : 4096;
+
+		buf->data = my_realloc(buf->data, buf->size);
+	}
+
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+struct snapshot *
+snapshot_create(const char *path, unsigned int version, unsigned long counter)
+{
+	struct snapshot *snap = my_malloc(sizeof(struct snapshot));
+
+	snap->path = my_strdup(path);
+	snap->version = version;
+	snap->counter = counter;
+
+	/* offset 0 is reserved for NULL */
+	snapshot_buf_add(&snap->strings, "", 1);
+
+	return snap;
+}
+
+unsigned int
+snapshot_string(struct snapshot *snap, const char *str)
+{
+	unsigned long offset;
+
+	if(str == NULL)
+		return 0;
+
+	offset = snap->strings.len;
+	snapshot_buf_add(&snap->strings, str, strlen(str) + 1);
+	return offset;
+}
+
+void
+snapshot_add(struct snapshot *snap, int section, const void *record,
+		unsigned int record_size)
+{
+	s_assert(section >= 0 && section < SNAPSHOT_MAX_SECTIONS);
+	s_assert(snap->record_size[section] == 0 ||
+		snap->record_size[section] == record_size);
+
+	snap->record_size[section] = record_size;
+	snap->count[section]++;
+	snapshot_buf_add(&snap->section[section], record, record_size);
+}
+
+static int
+snapshot_write(FILE *out, const void *data, unsigned long len, unsigned long *offset)
+{
+	static const char padding[SNAPSHOT_ALIGN];
+	unsigned long pad = SNAPSHOT_ALIGNED(*offset) - *offset;
+
+	if(pad && fwrite(padding, 1, pad, out) != pad)
+		return 0;
+
+	if(len && fwrite(data, 1, len, out) != len)
+		return 0;
+
+	*offset += pad + len;
+	return 1;
+}
+
+static void
+snapshot_free(struct snapshot *snap)
+{
+	int i;
+
+	for(i = 0; i < SNAPSHOT_MAX_SECTIONS; i++)
+		my_free(snap->section[i].data);
+
+	my_free(snap->strings.data);
+	my_free(snap->path);
+	my_free(snap);
+}
+
+/* snapshot_commit()
+ * writes the snapshot out and frees it.  The file is replaced
+ * atomically, so a failed write leaves the old one in place -- which
+ * will simply be ignored as out of date.
+ */
+int
+snapshot_commit(struct snapshot *snap)
+{
+	struct snapshot_header header;
+	char tmppath[PATH_MAX];
+	unsigned long offset;
+	FILE *out;
+	int i;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", snap->path);
+
+	if((out = fopen(tmppath, "w")) == NULL)
+	{
+		mlog("warning: unable to write snapshot %s: %s",
+			tmppath, strerror(errno));
+		snapshot_free(snap);
+		return 0;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = snap->version;
+	header.byteorder = SNAPSHOT_BYTEORDER;
+	header.counter = snap->counter;
+
+	offset = sizeof(header);
+
+	for(i = 0; i < SNAPSHOT_MAX_SECTIONS; i++)
+	{
+		offset = SNAPSHOT_ALIGNED(offset);
+		header.section[i].record_size = snap->record_size[i];
+		header.section[i].count = snap->count[i];
+		header.section[i].offset = offset;
+		offset += snap->section[i].len;
+	}
+
+	header.strings = SNAPSHOT_ALIGNED(offset);
+	header.strings_len = snap->strings.len;
+
+	offset = 0;
+
+	if(!snapshot_write(out, &header, sizeof(header), &offset))
+		goto error;
+
+	for(i = 0; i < SNAPSHOT_MAX_SECTIONS; i++)
+	{
+		if(!snapshot_write(out, snap->section[i].data,
+				snap->section[i].len, &offset))
+			goto error;
+	}
+
+	if(!snapshot_write(out, snap->strings.data, snap->strings.len, &offset))
+		goto error;
+
+	if(fflush(out) || fsync(fileno(out)))
+		goto error;
+
+	if(fclose(out))
+	{
+		out = NULL;
+		goto error;
+	}
+
+	if(rename(tmppath, snap->path))
+	{
+		out = NULL;
+		goto error;
+	}
+
+	snapshot_free(snap);
+	return 1;
+
+error:
+	mlog("warning: unable to write snapshot %s: %s",
+		tmppath, strerror(errno));
+
+	if(out != NULL)
+		fclose(out);
+
+	unlink(tmppath);
+	snapshot_free(snap);
+	return 0;
+}
+
+static int
+snapshot_valid(struct snapshot_map *map, unsigned int version, unsigned long counter)
+{
+	const struct snapshot_header *header = map->header;
+	const struct snapshot_section *section;
+	int i;
+
+	if(map->len < sizeof(struct snapshot_header) ||
+	   memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+	   header->version != version || header->byteorder != SNAPSHOT_BYTEORDER)
+	{
+		mlog("warning: Snapshot is from a different version, ignoring");
+		return 0;
+	}
+
+	if(header->counter != counter)
+		return 0;
+
+	for(i = 0; i < SNAPSHOT_MAX_SECTIONS; i++)
+	{
+		section = &header->section[i];
+
+		if(section->offset > map->len || section->offset % SNAPSHOT_ALIGN ||
+		   (section->record_size &&
+		    section->count > (map->len - section->offset) / section->record_size))
+			goto corrupt;
+	}
+
+	/* the table must open and close with a terminator, so no string
+	 * in it can run off the end
+	 */
+	if(header->strings > map->len || header->strings_len == 0 ||
+	   header->strings_len > map->len - header->strings ||
+	   map->base[header->strings] != '\0' ||
+	   map->base[header->strings + header->strings_len - 1] != '\0')
+		goto corrupt;
+
+	return 1;
+
+corrupt:
+	mlog("warning: Snapshot is corrupt, ignoring");
+	return 0;
+}
+
+/* snapshot_open()
+ * maps in the snapshot at path, if it's current with the database.
+ * Returns 0 when it isn't usable, in which case the caller should load
+ * from the database as normal.
+ */
+int
+snapshot_open(struct snapshot_map *map, const char *path, unsigned int version)
+{
+	struct stat st;
+	unsigned long counter;
+	int fd;
+
+	memset(map, 0, sizeof(struct snapshot_map));
+
+	if(!rsdb_change_counter(&counter))
+		return 0;
+
+	if((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+
+	if(fstat(fd, &st) || st.st_size <= 0)
+	{
+		close(fd);
+		return 0;
+	}
+
+	map->len = st.st_size;
+
+#ifdef HAVE_MMAP
+	map->base = mmap(NULL, map->len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if(map->base == MAP_FAILED)
+		map->base = NULL;
+	else
+		map->mapped = 1;
+#endif
+
+	if(map->base == NULL)
+	{
+		map->base = my_malloc(map->len);
+
+		if(read(fd, map->base, map->len) != (ssize_t) map->len)
+		{
+			mlog("warning: unable to read snapshot %s: %s",
+				path, strerror(errno));
+			close(fd);
+			snapshot_close(map);
+			return 0;
+		}
+	}
+
+	close(fd);
+
+	map->header = (const struct snapshot_header *) map->base;
+
+	if(!snapshot_valid(map, version, counter))
+	{
+		snapshot_close(map);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* snapshot_records()
+ * returns the records in a section, or NULL if they weren't written
+ * with the expected layout
+ */
+const void *
+snapshot_records(struct snapshot_map *map, int section,
+		unsigned int record_size, unsigned int *count)
+{
+	const struct snapshot_section *sect = &map->header->section[section];
+
+	*count = 0;
+
+	if(sect->count && sect->record_size != record_size)
+		return NULL;
+
+	*count = sect->count;
+	return map->base + sect->offset;
+}
+
+const char *
+snapshot_get_string(struct snapshot_map *map, unsigned int offset)
+{
+	if(offset == 0 || offset >= map->header->strings_len)
+		return NULL;
+
+	return map->base + map->header->strings + offset;
+}
+
+/* snapshot_strdup()
+ * copies a string out of the snapshot, empty strings come back as NULL
+ * to match the way they're loaded from the database
+ */
+char *
+snapshot_strdup(struct snapshot_map *map, unsigned int offset)
+{
+	const char *str = snapshot_get_string(map, offset);
+
+	if(EmptyString(str))
+		return NULL;
+
+	return my_strdup(str);
+}
+
+/* snapshot_intern()
+ * as snapshot_strdup(), for fields holding interned strings
+ */
+const char *
+snapshot_intern(struct snapshot_map *map, unsigned int offset)
+{
+	const char *str = snapshot_get_string(map, offset);
+
+	if(EmptyString(str))
+		return NULL;
+
+	return intern_string(str);
+}
+
+void
+snapshot_close(struct snapshot_map *map)
+{
+	if(map->base == NULL)
+		return;
+
+#ifdef HAVE_MMAP
+	if(map->mapped)
+		munmap(map->base, map->len);
+	else
+#endif
+		my_free(map->base);
+
+	memset(map, 0, sizeof(struct snapshot_map));
+}
@@ -35,6 +35,10 @@
 #include "rsdb.h"
 #include "balloc.h"
 
+#ifdef USE_THREADS
+#include <signal.h>
+#endif
+
 static BlockHeap *dlinknode_heap;
 
 void
@@ -59,6 +63,34 @@ my_sleep(unsigned int seconds, unsigned int microseconds)
 #endif
 }
 
+#ifdef USE_THREADS
+/* create_thread()
+ *   pthread_create() with every signal blocked in the new thread, so
+ *   our handlers -- and die() -- only ever run on the main thread
+ *
+ * inputs	- thread to fill in, function to run and its argument
+ * outputs	- 0 on success, else an error number
+ */
+int
+create_thread(pthread_t *thread, void *(*func)(void *), void *arg)
+{
+	sigset_t all, old;
+	int ret;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	ret = pthread_create(thread, NULL, func, arg);
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return ret;
+}
+#endif
+
+#ifdef RSERV_BENCH
+unsigned long bench_allocs;
+#endif
+
 /* my_calloc()
  *   wrapper for calloc() to detect out of memory
  */
@@ -67,6 +99,10 @@ my_calloc(size_t nmemb, size_t size)
 {
     void *p;
 
+#ifdef RSERV_BENCH
+    bench_allocs++;
+#endif
+
     p = calloc(nmemb, size);
 
     if(p == NULL)
@@ -75,6 +111,26 @@ my_calloc(size_t nmemb, size_t size)
     return p;
 }
 
+/* my_realloc()
+ *   wrapper for realloc() to detect out of memory
+ */
+void *
+my_realloc(void *ptr, size_t size)
+{
+    void *p;
+
+#ifdef RSERV_BENCH
+    bench_allocs++;
+#endif
+
+    p = realloc(ptr, size);
+
+    if(p == NULL)
+	    die(0, "out of memory");
+
+    return p;
+}
+
 /* my_free()
  *   wrapper for free() that checks what we're freeing exists
  */
@@ -93,6 +149,10 @@ my_strdup(const char *s)
 {
     char *n;
 
+#ifdef RSERV_BENCH
+    bench_allocs++;
+#endif
+
     n = strdup(s);
 
     if(n == NULL)
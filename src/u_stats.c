@@ -84,12 +84,27 @@ static void
 stats_uplink(struct lconn *conn_p)
 {
         if(server_p != NULL)
+        {
                 sendto_one(conn_p, "Currently connected to %s Idle: %ld "
                            "SendQ: %ld Connected: %s",
                            server_p->name,
                            (CURRENT_TIME - server_p->last_time), 
                            get_sendq(server_p),
                            get_duration(CURRENT_TIME - server_p->first_time));
+
+                sendto_one(conn_p, "Reads: %lu Lines: %lu (%.1f lines/read) "
+                           "IO: %s",
+                           server_p->recv_count, server_p->recv_lines,
+                           server_p->recv_count ?
+                           (float) server_p->recv_lines / server_p->recv_count : 0.0,
+                           io_backend->name);
+
+                if(server_p->cork_lines)
+                        sendto_one(conn_p, "Corked: %lu lines in %lu writes "
+                                   "(%lu writes saved)",
+                                   server_p->cork_lines, server_p->cork_flushes,
+                                   server_p->cork_lines - server_p->cork_flushes);
+        }
         else
                 sendto_one(conn_p, "Currently disconnected");
 }
@@ -48,10 +48,6 @@
 #include "watch.h"
 #include "c_init.h"
 
-#ifdef HAVE_CRYPT_H
-#include <crypt.h>
-#endif
-
 #define MAX_HELP_ROW 8
 
 static dlink_list ucommand_table[MAX_UCOMMAND_HASH];
@@ -247,11 +243,11 @@ u_login(struct client *unused, struct lconn *conn_p, const char *parv[], int par
         }
 
         if(ConfOperEncrypted(oper_p))
-                crpass = crypt(parv[1], oper_p->pass);
+                crpass = get_crypt(parv[1], oper_p->pass);
         else
                 crpass = parv[1];
 
-        if(strcmp(oper_p->pass, crpass))
+        if(crpass == NULL || strcmp(oper_p->pass, crpass))
         {
                 sendto_one(conn_p, "Invalid password");
                 return 0;
@@ -294,7 +290,7 @@ u_boot(struct client *unused, struct lconn *conn_p, const char *parv[], int parc
 
 			deallocate_conf_oper(target_p->user->oper);
 			target_p->user->oper = NULL;
-			dlink_destroy(ptr, &oper_list);
+			dlink_delete(ptr, &oper_list);
 
 			sendto_server(":%s NOTICE %s :Logged out by %s",
 					MYUID, UID(target_p), conn_p->name);
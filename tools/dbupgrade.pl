@@ -54,7 +54,10 @@ my %versionlist = (
 	"1.2.0rc1"	=> 6,
 	"1.2.0rc2"	=> 6,
 	"1.2.0"		=> 6,
-	"1.2.1"		=> 6
+	"1.2.1"		=> 6,
+	"1.2.2"		=> 6,
+	"1.2.3"		=> 6,
+	"1.2.4"		=> 6
 );
 
 my $version = $ARGV[0];
@@ -394,6 +397,25 @@ if($currentver < 6)
 	$upgraded = 1;
 }
 
+# room for sha crypt hashes, sqlite doesnt enforce a length
+if($currentver < 7 && $dbtype ne "sqlite")
+{
+	print "-- To version 1.2.4-cyco\n";
+
+	if($dbtype eq "mysql")
+	{
+		print "ALTER TABLE users MODIFY password VARCHAR(".$vals{"CRYPTLEN"}.") NOT NULL;\n";
+	}
+	elsif($dbtype eq "pgsql")
+	{
+		print "ALTER TABLE users ALTER COLUMN password TYPE VARCHAR(".$vals{"CRYPTLEN"}.");\n";
+	}
+
+	print "\n";
+
+	$upgraded = 1;
+}
+
 if($upgraded == 0)
 {
 	print "No database modification required.\n";
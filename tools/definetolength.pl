@@ -9,6 +9,7 @@
 my %lengths = (
 	"USERREGNAME_LEN" => 1,
 	"PASSWDLEN" => 1,
+	"CRYPTLEN" => 1,
 	"EMAILLEN" => 1,
 	"OPERNAMELEN" => 1,
 	"NICKLEN" => 1,